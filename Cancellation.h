@@ -0,0 +1,256 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <stdexcept>
+#include <condition_variable>
+
+namespace parallel
+{
+
+// Thrown by checkpoint() once the operation has been cancelled
+class OperationCancelledException :
+    public std::runtime_error
+{
+public:
+    OperationCancelledException() :
+        std::runtime_error("Operation cancelled")
+    {}
+};
+
+/**
+ * Flag telling a long running operation to stop. The operation polls it at its
+ * checkpoints, which makes checking cheap enough for inner loops.
+ */
+class CancellationToken
+{
+private:
+    std::atomic<bool> _cancelled;
+
+public:
+    CancellationToken() :
+        _cancelled(false)
+    {}
+
+    CancellationToken(const CancellationToken&) = delete;
+    CancellationToken& operator=(const CancellationToken&) = delete;
+
+    void cancel()
+    {
+        _cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    bool isCancelled() const
+    {
+        return _cancelled.load(std::memory_order_relaxed);
+    }
+};
+
+namespace detail
+{
+    // The token polled by checkpoint() on this thread, forEach passes it on to its workers
+    inline const CancellationToken*& currentToken()
+    {
+        thread_local const CancellationToken* token = nullptr;
+        return token;
+    }
+}
+
+// The token polled by checkpoint() on this thread, nullptr if there is none
+inline const CancellationToken* getCurrentToken()
+{
+    return detail::currentToken();
+}
+
+// Throws OperationCancelledException if the operation running on this thread has been cancelled
+inline void checkpoint()
+{
+    auto token = detail::currentToken();
+
+    if (token != nullptr && token->isCancelled())
+    {
+        throw OperationCancelledException();
+    }
+}
+
+// Variant for the body of inner loops, polling the token every 4096 iterations only
+inline void checkpoint(std::size_t iteration)
+{
+    if ((iteration & 4095) == 0)
+    {
+        checkpoint();
+    }
+}
+
+// Makes checkpoint() poll the given token on this thread (and the workers started from it)
+// for the lifetime of this object, restoring the previous token afterwards
+class CancellationScope
+{
+private:
+    const CancellationToken* _previous;
+
+public:
+    explicit CancellationScope(const CancellationToken& token) :
+        _previous(detail::currentToken())
+    {
+        detail::currentToken() = &token;
+    }
+
+    ~CancellationScope()
+    {
+        detail::currentToken() = _previous;
+    }
+
+    CancellationScope(const CancellationScope&) = delete;
+    CancellationScope& operator=(const CancellationScope&) = delete;
+};
+
+/**
+ * Cancels tokens whose time budget has run out. A single background thread sleeps until
+ * the nearest deadline, so the watched operations only need to poll their token.
+ */
+class Watchdog
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    std::mutex _lock;
+    std::condition_variable _changed;
+    std::multimap<Clock::time_point, CancellationToken*> _deadlines;
+    bool _stopping;
+    std::thread _thread;
+
+public:
+    Watchdog() :
+        _stopping(false)
+    {}
+
+    ~Watchdog()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            _stopping = true;
+        }
+
+        _changed.notify_all();
+
+        if (_thread.joinable())
+        {
+            _thread.join();
+        }
+    }
+
+    static Watchdog& getInstance()
+    {
+        static Watchdog instance;
+        return instance;
+    }
+
+    // Cancels the token once the given time has passed, unless unwatch() is called before
+    void watch(CancellationToken& token, Clock::duration budget)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+
+            _deadlines.emplace(Clock::now() + budget, &token);
+
+            if (!_thread.joinable())
+            {
+                _thread = std::thread([this]() { run(); });
+            }
+        }
+
+        _changed.notify_all();
+    }
+
+    void unwatch(CancellationToken& token)
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+
+        for (auto i = _deadlines.begin(); i != _deadlines.end(); ++i)
+        {
+            if (i->second == &token)
+            {
+                _deadlines.erase(i);
+                return;
+            }
+        }
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+
+        while (!_stopping)
+        {
+            if (_deadlines.empty())
+            {
+                _changed.wait(lock);
+                continue;
+            }
+
+            auto first = _deadlines.begin();
+
+            if (first->first <= Clock::now())
+            {
+                first->second->cancel();
+                _deadlines.erase(first);
+                continue;
+            }
+
+            _changed.wait_until(lock, first->first);
+        }
+    }
+};
+
+/**
+ * Time budget of an operation: cancels its token when the budget has run out and makes
+ * checkpoint() poll it on the current thread. A zero budget means unlimited time.
+ */
+class TimeBudget
+{
+private:
+    CancellationToken _token;
+    CancellationScope _scope;
+    bool _watched;
+
+public:
+    explicit TimeBudget(Watchdog::Clock::duration budget) :
+        _scope(_token),
+        _watched(budget > Watchdog::Clock::duration::zero())
+    {
+        if (_watched)
+        {
+            Watchdog::getInstance().watch(_token, budget);
+        }
+    }
+
+    ~TimeBudget()
+    {
+        if (_watched)
+        {
+            Watchdog::getInstance().unwatch(_token);
+        }
+    }
+
+    TimeBudget(const TimeBudget&) = delete;
+    TimeBudget& operator=(const TimeBudget&) = delete;
+
+    const CancellationToken& getToken() const
+    {
+        return _token;
+    }
+
+    bool isExceeded() const
+    {
+        return _token.isCancelled();
+    }
+};
+
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+#include "math/Hash.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+
+namespace math
+{
+
+/**
+ * Fingerprint of a piece of content, to be used as cache key. The content is split into
+ * chunks of a fixed size which are hashed with SHA-256 in parallel, the fingerprint is the
+ * SHA-256 of the content size and all chunk digests. The result only depends on the content,
+ * not on the number of threads, but it is not the same as the plain SHA-256 of the content.
+ */
+class ContentHash
+{
+public:
+    static constexpr std::size_t ChunkSize = 1 << 20;
+
+    static std::string ofData(const void* data, std::size_t size)
+    {
+        auto numChunks = (size + ChunkSize - 1) / ChunkSize;
+        std::vector<uint8_t> digests(numChunks * SHA256_BLOCK_SIZE);
+
+        parallel::forEach(numChunks, [&](std::size_t i)
+        {
+            auto offset = i * ChunkSize;
+
+            SHA256_CTX context;
+            sha256_init(&context);
+            sha256_update(&context, static_cast<const uint8_t*>(data) + offset, std::min(ChunkSize, size - offset));
+            sha256_final(&context, &digests[i * SHA256_BLOCK_SIZE]);
+        });
+
+        // Fixed-width sizes, the fingerprint must not depend on the platform
+        uint64_t sizes[2] = { size, ChunkSize };
+
+        Hash root;
+        root.addData(sizes, sizeof(sizes));
+        root.addData(digests.data(), digests.size());
+
+        return root;
+    }
+
+    // Hashes the file through a memory mapping, throws std::runtime_error if it cannot be read
+    static std::string ofFile(const std::filesystem::path& path)
+    {
+        stream::MappedFile file(path);
+        return ofData(file.data(), file.size());
+    }
+};
+
+/**
+ * Remembers the content hashes of files. As long as size and modification time of a file
+ * are unchanged, the stored hash is returned without reading the file again. The entries
+ * can be saved to a text file and loaded in the next run. Can be used from several threads.
+ */
+class ContentHashCache
+{
+private:
+    struct Entry
+    {
+        std::uintmax_t size;
+        int64_t modified;
+        std::string hash;
+    };
+
+    mutable std::mutex _lock;
+
+    // Absolute generic path => entry
+    std::map<std::string, Entry> _entries;
+
+    std::atomic<std::size_t> _numHashed;
+    std::atomic<std::size_t> _numReused;
+
+public:
+    ContentHashCache() :
+        _numHashed(0),
+        _numReused(0)
+    {}
+
+    // Number of files which had to be read and hashed
+    std::size_t getNumHashed() const
+    {
+        return _numHashed;
+    }
+
+    // Number of hashes returned from the cache since the file was unchanged
+    std::size_t getNumReused() const
+    {
+        return _numReused;
+    }
+
+    // Returns the content hash of the given file, throws std::runtime_error if it cannot be read
+    std::string get(const std::filesystem::path& path)
+    {
+        auto key = std::filesystem::absolute(path).generic_string();
+
+        // Take the stamp before reading, a file changing meanwhile will be hashed again next time
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        auto modified = static_cast<int64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+
+        if (ec)
+        {
+            throw std::runtime_error("Cannot access " + path.string() + ": " + ec.message());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+
+            auto existing = _entries.find(key);
+
+            if (existing != _entries.end() && existing->second.size == size && existing->second.modified == modified)
+            {
+                ++_numReused;
+                return existing->second.hash;
+            }
+        }
+
+        auto hash = ContentHash::ofFile(path);
+        ++_numHashed;
+
+        std::lock_guard<std::mutex> lock(_lock);
+        _entries[key] = Entry{ size, modified, hash };
+
+        return hash;
+    }
+
+    // Adds the entries stored in the given file, a missing file is not an error
+    void load(const std::filesystem::path& path)
+    {
+        std::ifstream stream(path);
+        std::string line;
+
+        std::lock_guard<std::mutex> lock(_lock);
+
+        // One entry per line: <hash> <size> <modification time> <path>
+        while (std::getline(stream, line))
+        {
+            std::istringstream fields(line);
+            Entry entry;
+
+            if (!(fields >> entry.hash >> entry.size >> entry.modified)) continue;
+
+            std::string filePath;
+            std::getline(fields >> std::ws, filePath);
+
+            if (!filePath.empty())
+            {
+                _entries[filePath] = entry;
+            }
+        }
+    }
+
+    void save(const std::filesystem::path& path) const
+    {
+        std::ofstream stream(path);
+
+        if (!stream.is_open())
+        {
+            throw std::runtime_error("Cannot open file for writing: " + path.string());
+        }
+
+        std::lock_guard<std::mutex> lock(_lock);
+
+        for (const auto& [filePath, entry] : _entries)
+        {
+            stream << entry.hash << ' ' << entry.size << ' ' << entry.modified << ' ' << filePath << '\n';
+        }
+    }
+};
+
+}
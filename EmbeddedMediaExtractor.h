@@ -0,0 +1,277 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <filesystem>
+#include "openfbx/ofbx.h"
+#include "ContentHash.h"
+#include "image/Image.h"
+#include "image/DdsWriter.h"
+#include "Parallel.h"
+#include "export/ExportStream.h"
+
+namespace model
+{
+
+/**
+ * Writes the media embedded in FBX files (Video content, usually texture images)
+ * to a target folder. Media are identified by the hash of their content, an image
+ * embedded in many FBX files is written only once and all of them will refer to
+ * the same file. One instance is meant to be shared across a whole batch, it can
+ * be used from several threads at once.
+ * With texture compression enabled, the PNG, JPEG and TGA images are decoded and written
+ * as DDS files with a full mip chain (BC1, or BC3 for images with transparency), so the
+ * engine can use them without decoding and compressing them at load time. Other media,
+ * and images which fail to decode, are written as they are.
+ */
+class EmbeddedMediaExtractor
+{
+public:
+	// The extracted file path for each piece of embedded content of a scene,
+	// keyed by the start of the content as returned by getEmbeddedData()
+	typedef std::map<const ofbx::u8*, std::string> MediaPaths;
+
+private:
+	std::filesystem::path _outputFolder;
+
+	std::mutex _lock;
+
+	// Content hash => extracted file path, available once the file has been written
+	std::map<std::string, std::shared_future<std::string>> _pathsByHash;
+
+	bool _compressTextures;
+
+	std::atomic<std::size_t> _numWritten;
+	std::atomic<std::size_t> _numUnchanged;
+	std::atomic<std::size_t> _numDuplicates;
+	std::atomic<std::size_t> _numCompressed;
+
+public:
+	EmbeddedMediaExtractor(const std::filesystem::path& outputFolder, bool compressTextures = false) :
+		_outputFolder(outputFolder),
+		_compressTextures(compressTextures),
+		_numWritten(0),
+		_numUnchanged(0),
+		_numDuplicates(0),
+		_numCompressed(0)
+	{}
+
+	// Number of media files written so far
+	std::size_t getNumWritten() const
+	{
+		return _numWritten;
+	}
+
+	// Number of media files left untouched since they already had the same content
+	std::size_t getNumUnchanged() const
+	{
+		return _numUnchanged;
+	}
+
+	// Number of embedded media which had been extracted before
+	std::size_t getNumDuplicates() const
+	{
+		return _numDuplicates;
+	}
+
+	// Number of media files written as compressed DDS textures
+	std::size_t getNumCompressed() const
+	{
+		return _numCompressed;
+	}
+
+	// Writes all embedded media of the given scene which haven't been seen before,
+	// and returns the paths of the extracted files for all of them. Images which fail
+	// to decode are written as they are instead of being compressed.
+	MediaPaths extract(const ofbx::IScene& scene)
+	{
+		struct PendingWrite
+		{
+			std::filesystem::path path;
+			ofbx::DataView content;
+			std::string contentHash;
+
+			// The image format to decode for compression, Unknown to write the content as is
+			image::Format format;
+
+			// The path to write the content to as it is, if it cannot be decoded
+			std::filesystem::path rawPath;
+
+			// Fulfilled with the written path, for all scenes embedding the same content
+			std::promise<std::string> result;
+			bool isDone = false;
+		};
+
+		// The paths of the scene's content, written by this call or by others
+		std::vector<std::pair<const ofbx::u8*, std::shared_future<std::string>>> contentPaths;
+		std::vector<PendingWrite> pendingWrites;
+
+		for (int i = 0; i < scene.getEmbeddedDataCount(); ++i)
+		{
+			auto content = GetContent(scene.getEmbeddedData(i));
+
+			if (content.begin == content.end) continue;
+
+			// Hashed in parallel chunks, embedded textures can be large
+			auto contentHash = math::ContentHash::ofData(content.begin, content.end - content.begin);
+
+			std::lock_guard<std::mutex> lock(_lock);
+
+			auto existing = _pathsByHash.find(contentHash);
+
+			if (existing != _pathsByHash.end())
+			{
+				contentPaths.emplace_back(scene.getEmbeddedData(i).begin, existing->second);
+				++_numDuplicates;
+				continue;
+			}
+
+			// Keep the original file name, the hash prefix makes it unique
+			std::filesystem::path originalName(ToString(scene.getEmbeddedFilename(i)));
+
+			auto format = _compressTextures ? image::getFormat(content.begin, content.end - content.begin, originalName.string()) :
+				image::Format::Unknown;
+
+			auto rawPath = _outputFolder / (originalName.stem().string() + "_" + contentHash.substr(0, 8) + originalName.extension().string());
+			auto path = format != image::Format::Unknown ? std::filesystem::path(rawPath).replace_extension(".dds") : rawPath;
+
+			auto& pending = pendingWrites.emplace_back();
+			pending.path = path;
+			pending.content = content;
+			pending.contentHash = contentHash;
+			pending.format = format;
+			pending.rawPath = rawPath;
+
+			// Published right away, so other scenes wait for this write instead of writing the content again
+			auto result = _pathsByHash.emplace(contentHash, pending.result.get_future().share()).first->second;
+			contentPaths.emplace_back(scene.getEmbeddedData(i).begin, result);
+		}
+
+		if (!pendingWrites.empty())
+		{
+			try
+			{
+				std::filesystem::create_directories(_outputFolder);
+
+				parallel::forEach(pendingWrites.size(), [&](std::size_t i)
+				{
+					auto& pending = pendingWrites[i];
+
+					auto path = write(pending.path, pending.rawPath, pending.content, pending.format);
+
+					pending.result.set_value(path.generic_string());
+					pending.isDone = true;
+				});
+			}
+			catch (...)
+			{
+				// Let the next scene embedding the same content try again, the scenes waiting for the
+				// unfinished writes get the error (or a broken promise) instead of a missing file
+				std::lock_guard<std::mutex> lock(_lock);
+
+				for (auto& pending : pendingWrites)
+				{
+					if (pending.isDone) continue;
+
+					_pathsByHash.erase(pending.contentHash);
+					pending.result.set_exception(std::current_exception());
+				}
+
+				throw;
+			}
+		}
+
+		// Wait for the content written by other scenes, only after the own writes are done,
+		// so two scenes waiting for each other's content can't block each other
+		MediaPaths paths;
+
+		for (const auto& [data, path] : contentPaths)
+		{
+			paths[data] = path.get();
+		}
+
+		return paths;
+	}
+
+private:
+	// Binary FBX properties of type R are prefixed with their 4 byte length
+	static ofbx::DataView GetContent(const ofbx::DataView& data)
+	{
+		ofbx::DataView content = data;
+
+		if (content.is_binary && content.end - content.begin >= 4)
+		{
+			content.begin += 4;
+		}
+
+		return content;
+	}
+
+	// Writes the content to the given path, compressed if the format is known. Content which fails
+	// to decode is written as it is to the raw path instead. Returns the path of the written file,
+	// an existing file with the same content is left untouched.
+	std::filesystem::path write(const std::filesystem::path& path, const std::filesystem::path& rawPath,
+		const ofbx::DataView& content, image::Format format)
+	{
+		auto size = static_cast<std::size_t>(content.end - content.begin);
+
+		if (format != image::Format::Unknown)
+		{
+			image::Image decoded;
+
+			try
+			{
+				decoded = image::decode(content.begin, size, format);
+			}
+			catch (const std::exception&)
+			{
+				format = image::Format::Unknown;
+			}
+
+			if (format != image::Format::Unknown)
+			{
+				// An error before close() discards the temporary file, leaving no truncated texture behind
+				stream::ExportStream output(path.parent_path().string(), path.filename().string(), std::ios::out | std::ios::binary, false);
+				image::writeDds(output.getStream(), decoded);
+
+				if (output.close())
+				{
+					++_numWritten;
+					++_numCompressed;
+				}
+				else
+				{
+					++_numUnchanged;
+				}
+
+				return path;
+			}
+		}
+
+		stream::ExportStream output(rawPath.parent_path().string(), rawPath.filename().string(), std::ios::out | std::ios::binary, false);
+		output.getStream().write(reinterpret_cast<const char*>(content.begin), size);
+
+		if (output.close())
+		{
+			++_numWritten;
+		}
+		else
+		{
+			++_numUnchanged;
+		}
+
+		return rawPath;
+	}
+
+	static std::string ToString(const ofbx::DataView& data)
+	{
+		return std::string(reinterpret_cast<const char*>(data.begin), data.end - data.begin);
+	}
+};
+
+}
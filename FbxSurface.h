@@ -1,5 +1,7 @@
 #pragma once
 
+#include <map>
+#include <string>
 #include <vector>
 #include <unordered_map>
 #include "export/ArbitraryMeshVertex.h"
@@ -8,15 +10,64 @@
 namespace model
 {
 
+// One entry of a weight map, referencing a vertex of the surface
+struct VertexWeight
+{
+	unsigned int vertex;
+	float weight;
+};
+
+// Sparse weight maps keyed by name (e.g. the bone name), storing only the influenced vertices
+typedef std::map<std::string, std::vector<VertexWeight>> VertexWeightMaps;
+
+// One entry of a morph map, moving a vertex of the surface by the given offset
+struct VertexOffset
+{
+	unsigned int vertex;
+	Vector3 offset;
+};
+
+// Sparse morph maps keyed by name (e.g. the blend shape name), storing only the moved vertices
+typedef std::map<std::string, std::vector<VertexOffset>> VertexOffsetMaps;
+
+// The vertices from firstVertex up to the next range are moved by the named motion track
+struct MotionTrackRange
+{
+	unsigned int firstVertex;
+	std::string track;
+};
+
 class FbxSurface
 {
 public:
 	std::vector<unsigned int> indices;
 	std::vector<ArbitraryMeshVertex> vertices;
-	std::string material;
+
+	// The material name as interned by the exporter's MaterialRegistry
+	unsigned int materialId = 0;
+
+	// Path to the texture image used by the material, if known
+	std::string texturePath;
+
+	// Vertex weights (skinning), sorted by vertex index
+	VertexWeightMaps weightMaps;
+
+	// Vertex offsets (blend shapes), sorted by vertex index
+	VertexOffsetMaps morphMaps;
+
+	// The animation track moving all vertices of the surface (for the point cache), empty if they are static
+	std::string motionTrack;
+
+	typedef std::unordered_map<ArbitraryMeshVertex, std::size_t, render::WeldVertexHash, render::WeldVertexEqual> VertexIndexMap;
 
 	// Hash index to share vertices with the same set of attributes
-	std::unordered_map<ArbitraryMeshVertex, std::size_t> vertexIndices;
+	VertexIndexMap vertexIndices;
+
+	// Use a different vertex epsilon for sharing vertices, needs to be called before adding any vertex
+	void setWeldEpsilon(double vertexEpsilon)
+	{
+		vertexIndices = VertexIndexMap(0, render::WeldVertexHash(vertexEpsilon), render::WeldVertexEqual(vertexEpsilon));
+	}
 
 	const std::vector<ArbitraryMeshVertex>& getVertexArray() const
 	{
@@ -28,12 +79,13 @@ public:
 		return indices;
 	}
 
-	const std::string& getActiveMaterial() const
+	unsigned int getMaterialId() const
 	{
-		return material;
+		return materialId;
 	}
 
-	void addVertex(const ArbitraryMeshVertex& vertex)
+	// Adds the vertex to the index buffer, returns the index of the (possibly shared) vertex
+	unsigned int addVertex(const ArbitraryMeshVertex& vertex)
 	{
 		// Try to look up an existing vertex or add a new index
 		auto emplaceResult = vertexIndices.try_emplace(vertex, vertices.size());
@@ -46,6 +98,8 @@ public:
 
 		// The emplaceResult now points to a valid index in the vertex array
 		indices.emplace_back(static_cast<unsigned int>(emplaceResult.first->second));
+
+		return indices.back();
 	}
 };
 
@@ -1,10 +1,130 @@
 #include <iostream>
+#include <sstream>
 #include <filesystem>
 #include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <fstream>
+#include <mutex>
+#include <chrono>
 #include "openfbx/ofbx.h"
 
 #include "export/Lwo2Exporter.h"
+#include "export/Lwo2Reader.h"
+#include "export/MeshCacheExporter.h"
+#include "export/CollisionProxyBuilder.h"
+#include "export/ExportStream.h"
 #include "FbxSurface.h"
+#include "EmbeddedMediaExtractor.h"
+#include "MaterialMerger.h"
+#include "IncrementalState.h"
+#include "NodeAnimation.h"
+#include "SkinPose.h"
+#include "StreamedGeometryReader.h"
+#include "Parallel.h"
+#include "StageProfiler.h"
+#include "Metrics.h"
+#include "math/Simd.h"
+
+// Defines how the FBX meshes are distributed across LWO layers
+enum class LayerMode
+{
+    Single,     // all meshes go into one layer
+    PerFile,    // one layer for each input file
+    PerMesh,    // one layer for each FBX mesh, keeping the mesh hierarchy
+};
+
+// The up axis convention of the FBX data
+enum class UpAxis
+{
+    Auto,       // as defined in the scene's global settings
+    Y,
+    Z,
+};
+
+// Where the convex collision proxies of the meshes are written to
+enum class CollisionMode
+{
+    None,
+    Layer,      // one additional layer per proxy in the LWO file
+    File,       // a separate <name>_cm.lwo file next to the LWO file
+};
+
+// The pose skinned meshes are exported in
+enum class SkinBake
+{
+    None,       // the control points as stored in the file
+    Rest,       // posed by the bone transforms without animation
+    Frame,      // posed by the animated bone transforms at a frame
+};
+
+struct ExportOptions
+{
+    LayerMode layerMode = LayerMode::Single;
+
+    UpAxis upAxis = UpAxis::Auto;
+
+    // Vertices closer than this (and with matching normals, UVs and colours) are welded
+    double weldEpsilon = render::VertexEpsilon;
+
+    // Extracts embedded textures if set, shared by all conversions
+    std::shared_ptr<model::EmbeddedMediaExtractor> mediaExtractor;
+
+    // Merges equivalent materials into one surface if set
+    std::shared_ptr<model::MaterialMerger> materialMerger;
+
+    // Skips the FBX files which are unchanged since the previous run if set
+    std::shared_ptr<model::IncrementalState> incremental;
+
+    // Wall time a file may take to convert, zero means unlimited. Files running out of time
+    // are converted again after all others, one at a time and with the retry budget.
+    std::chrono::duration<double> timeBudget{ 0 };
+    std::chrono::duration<double> retryTimeBudget{ 0 };
+
+    // Collects the stage timings and hardware counters of all converted files if set
+    std::shared_ptr<profiling::ProfileTotals> profile;
+
+    // Writes a binary mesh cache for the engine next to each LWO file, using the .mesh extension
+    bool writeMeshCache = false;
+
+    // Writes the animation of the meshes as MDD point cache next to each LWO file
+    bool writePointCache = false;
+
+    // The frames to write to the point cache, the scene's take or time span is used if not set
+    bool hasFrameRange = false;
+    model::NodeAnimation::FrameRange frameRange;
+
+    // Bakes the skinned meshes into the rest pose or the pose at skinBakeFrame
+    SkinBake skinBake = SkinBake::None;
+    int skinBakeFrame = 0;
+
+    // Builds a convex hull per connected component of the meshes, limited to the given number of vertices (0 = unlimited)
+    CollisionMode collisionMode = CollisionMode::None;
+    std::size_t collisionVertexBudget = 0;
+
+    // Converts the binary FBX files with the streaming reader, keeping only the mesh geometry
+    bool geometryOnly = false;
+};
+
+struct SceneDeleter
+{
+    void operator()(ofbx::IScene* scene) const
+    {
+        scene->destroy();
+    }
+};
+
+typedef std::unique_ptr<ofbx::IScene, SceneDeleter> ScenePtr;
+
+// JobProcessor handed to OpenFBX, distributing its jobs (e.g. geometry parsing) across threads
+void ProcessFbxJobs(ofbx::JobFunction fn, void*, void* data, ofbx::u32 size, ofbx::u32 count)
+{
+    parallel::forEach(count, [&](std::size_t i)
+    {
+        fn(static_cast<ofbx::u8*>(data) + i * size);
+    });
+}
 
 inline ArbitraryMeshVertex ConstructMeshVertex(const ofbx::Geometry& geometry, int index)
 {
@@ -21,221 +141,1975 @@ inline ArbitraryMeshVertex ConstructMeshVertex(const ofbx::Geometry& geometry, i
     );
 }
 
-void ExportFbxMesh(ofbx::IScene& scene, model::Lwo2Exporter& exporter)
+// Returns the transform converting the axis conventions of a scene with the given up axis to the ones of the LWO exporter
+Matrix4 GetAxisTransform(ofbx::UpVector sceneUpAxis, UpAxis upAxis)
 {
-    for (int meshIndex = 0; meshIndex < scene.getMeshCount(); ++meshIndex)
+    // "Objects in the FBX SDK are always created in the right handed, Y-Up axis system"
+    auto transform = Matrix4::getIdentity();
+
+    if (upAxis == UpAxis::Y || (upAxis == UpAxis::Auto && sceneUpAxis == ofbx::UpVector_AxisY))
     {
-        auto mesh = scene.getMesh(meshIndex);
-        auto geometry = mesh->getGeometry();
+        transform = transform.getPremultipliedBy(Matrix4::getRotationForEulerXYZDegrees(Vector3(90, 0, 0)));
+    }
 
-        std::cout << "Exporting FBX Mesh with " << geometry->getVertexCount() << " vertices\n";
+    return transform;
+}
 
-        std::vector<model::FbxSurface> surfacesByMaterial(mesh->getMaterialCount());
+Matrix4 GetAxisTransform(const ofbx::IScene& scene, UpAxis upAxis)
+{
+    return GetAxisTransform(scene.getGlobalSettings()->UpAxis, upAxis);
+}
 
-        if (mesh->getMaterialCount() == 0)
-        {
-            surfacesByMaterial.emplace_back().material = "Material"; // create at least one surface
-        }
+// Returns the transform moving the mesh's vertices into exporter space: the geometric transform
+// of the mesh, its node's rest transform (the one the point cache tracks are relative to) and the axis transform
+Matrix4 GetMeshTransform(const ofbx::Mesh& mesh, const Matrix4& axisTransform)
+{
+    return axisTransform.getMultipliedBy(model::NodeAnimation::GetRestTransform(mesh))
+        .getMultipliedBy(model::NodeAnimation::ToMatrix4(mesh.getGeometricMatrix()));
+}
 
-        // Assign the surface name for each material
-        for (int m = 0; m < mesh->getMaterialCount(); ++m)
-        {
-            auto material = mesh->getMaterial(m);
-            surfacesByMaterial[m].material = material->name;
-        }
+// Whether the meshes are placed by the transforms of their nodes. Only the layer modes need it, to match the
+// layer pivots, the single layer keeps the points in the space of their geometry as it always has.
+bool UsesNodeTransforms(const ExportOptions& options)
+{
+    return options.layerMode != LayerMode::Single;
+}
 
-        auto materials = geometry->getMaterials();
-        auto faceIndices = geometry->getFaceIndices();
+// The mesh origin in exporter space, used as layer pivot
+Vector3 GetMeshPivot(const ofbx::Mesh& mesh, const Matrix4& axisTransform)
+{
+    return axisTransform.getMultipliedBy(model::NodeAnimation::GetRestTransform(mesh)).transformPoint(Vector3(0, 0, 0));
+}
 
-        for (int i = 0; i < geometry->getIndexCount(); i += 3)
+// Returns the closest ancestor node of the given mesh which is a mesh itself, or nullptr
+const ofbx::Mesh* FindParentMesh(const ofbx::Mesh& mesh)
+{
+    for (auto parent = mesh.getParent(); parent != nullptr; parent = parent->getParent())
+    {
+        if (parent->getType() == ofbx::Object::Type::MESH)
         {
-            // Material index is assigned per triangle
-            auto polyIndex = i / 3;
-            auto materialIndex = materials ? materials[polyIndex] : 0; // put into first material by default
+            return static_cast<const ofbx::Mesh*>(parent);
+        }
+    }
 
-            // Reverse the poly indices to get the CCW order
-            auto indexA = (faceIndices[i+2] * -1) - 1; // last index is negative and 1-based
-            auto indexB = faceIndices[i+1];
-            auto indexC = faceIndices[i+0];
+    return nullptr;
+}
 
-            surfacesByMaterial[materialIndex].addVertex(ConstructMeshVertex(*geometry, indexA));
-            surfacesByMaterial[materialIndex].addVertex(ConstructMeshVertex(*geometry, indexB));
-            surfacesByMaterial[materialIndex].addVertex(ConstructMeshVertex(*geometry, indexC));
-        }
+// Returns the meshes of the given scene, sorted such that parent meshes come before their children
+std::vector<const ofbx::Mesh*> GetMeshesInHierarchyOrder(const ofbx::IScene& scene)
+{
+    std::vector<std::pair<int, const ofbx::Mesh*>> meshesByDepth;
 
-        // Apply the global transformation matrix
-        auto t = geometry->getGlobalTransform();
-#if 0
-        auto transform = Matrix4::byColumns(
-            t.m[0], t.m[1], t.m[2], t.m[3],
-            t.m[4], t.m[5], t.m[6], t.m[7],
-            t.m[8], t.m[9], t.m[10], t.m[11],
-            t.m[12], t.m[13], t.m[14], t.m[15]
-        );
-#endif
-        // "Objects in the FBX SDK are always created in the right handed, Y-Up axis system"
-        auto transform = Matrix4::getIdentity();
-        
-        if (scene.getGlobalSettings()->UpAxis == ofbx::UpVector_AxisY)
+    for (int meshIndex = 0; meshIndex < scene.getMeshCount(); ++meshIndex)
+    {
+        auto mesh = scene.getMesh(meshIndex);
+        int depth = 0;
+
+        for (auto parent = FindParentMesh(*mesh); parent != nullptr; parent = FindParentMesh(*parent))
         {
-            transform = transform.getPremultipliedBy(Matrix4::getRotationForEulerXYZDegrees(Vector3(90, 0, 0)));
+            ++depth;
         }
 
-        std::cout << "Generated " << surfacesByMaterial.size() << " triangulated surfaces\n";
+        meshesByDepth.emplace_back(depth, mesh);
+    }
 
-        for (const auto& surface : surfacesByMaterial)
-        {
-            std::cout << " - " << surface.material << std::endl;
-            exporter.addSurface(surface, transform);
-        }
+    std::stable_sort(meshesByDepth.begin(), meshesByDepth.end(), 
+        [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::vector<const ofbx::Mesh*> meshes;
+
+    for (const auto& pair : meshesByDepth)
+    {
+        meshes.push_back(pair.second);
     }
+
+    return meshes;
 }
 
-void ConvertFbxToLwo(const std::filesystem::path& inputPath, const std::filesystem::path& outputPath)
+// Where a geometry vertex ended up after welding: the surface and the vertex index within it
+struct WeldedVertex
 {
-    std::ifstream ifs(inputPath, std::ios::binary | std::ios::ate);
-    std::ifstream::pos_type pos = ifs.tellg();
+    int surface = -1;
+    unsigned int index = 0;
+};
 
-    std::vector<char> content(pos);
+// Name of the weight map of the given cluster, which is the name of the bone it's linked to
+std::string GetClusterName(const ofbx::Cluster& cluster)
+{
+    auto link = cluster.getLink();
+    return link != nullptr ? link->name : cluster.name;
+}
 
-    ifs.seekg(0, std::ios::beg);
-    ifs.read(content.data(), pos);
+// Keeps one entry per vertex, several geometry vertices can have been welded into the same one
+template<typename VertexEntry>
+void SortAndUniqueByVertex(std::vector<VertexEntry>& entries)
+{
+    std::stable_sort(entries.begin(), entries.end(),
+        [](const auto& a, const auto& b) { return a.vertex < b.vertex; });
 
-    auto scene = ofbx::load(reinterpret_cast<ofbx::u8*>(content.data()), 
-        static_cast<int>(content.size()), (ofbx::u64)ofbx::LoadFlags::TRIANGULATE);
+    entries.erase(std::unique(entries.begin(), entries.end(),
+        [](const auto& a, const auto& b) { return a.vertex == b.vertex; }), entries.end());
+}
 
-    if (!scene)
+// Moves the entries of each surface into the map of the given name, the first entry of a vertex wins
+template<typename VertexEntry, typename VertexMaps>
+void MergeIntoSurfaceMaps(const std::string& name, std::vector<std::vector<VertexEntry>>& entriesBySurface,
+    std::vector<model::FbxSurface>& surfaces, VertexMaps model::FbxSurface::* maps)
+{
+    for (std::size_t s = 0; s < surfaces.size(); ++s)
     {
-        std::cerr << ofbx::getError() << std::endl;
-        return;
+        auto& entries = entriesBySurface[s];
+
+        if (entries.empty()) continue;
+
+        auto& target = (surfaces[s].*maps)[name];
+
+        if (target.empty())
+        {
+            target = std::move(entries);
+            continue;
+        }
+
+        target.insert(target.end(), entries.begin(), entries.end());
+        SortAndUniqueByVertex(target);
     }
+}
 
-    try
+// Maps the skin cluster weights to the welded surface vertices, one weight map per bone
+void AddSkinWeights(const ofbx::Skin& skin, const std::vector<WeldedVertex>& weldedVertices, std::vector<model::FbxSurface>& surfaces)
+{
+    // Sparse weights of each cluster, split by surface
+    std::vector<std::vector<std::vector<model::VertexWeight>>> clusterWeights(skin.getClusterCount());
+
+    parallel::forEach(clusterWeights.size(), [&](std::size_t c)
     {
-        auto exporter = std::make_shared<model::Lwo2Exporter>();
+        auto cluster = skin.getCluster(static_cast<int>(c));
+        auto& weightsBySurface = clusterWeights[c];
 
-        ExportFbxMesh(*scene, *exporter);
+        weightsBySurface.resize(surfaces.size());
 
-        // Ensure the folders exist
-        std::filesystem::create_directories(outputPath.parent_path());
+        if (cluster->getIndicesCount() == 0) return;
 
-        std::cout << "Exporting LWO to " << outputPath.string() << std::endl;
-        exporter->exportToPath(outputPath.parent_path().string(), outputPath.filename().string());
+        auto indices = cluster->getIndices();
+        auto weights = cluster->getWeights();
 
-        scene->destroy();
-    }
-    catch (const std::exception&)
+        for (int i = 0; i < cluster->getIndicesCount(); ++i)
+        {
+            if (indices[i] < 0 || indices[i] >= static_cast<int>(weldedVertices.size()) || weights[i] == 0) continue;
+
+            const auto& welded = weldedVertices[indices[i]];
+
+            if (welded.surface == -1) continue; // not part of any triangle
+
+            weightsBySurface[welded.surface].push_back(model::VertexWeight{ welded.index, static_cast<float>(weights[i]) });
+        }
+
+        for (auto& weights : weightsBySurface)
+        {
+            SortAndUniqueByVertex(weights);
+        }
+    });
+
+    // Collect the results in cluster order, if several clusters link the same bone the first one wins
+    for (std::size_t c = 0; c < clusterWeights.size(); ++c)
     {
-        scene->destroy();
-        throw;
+        auto name = GetClusterName(*skin.getCluster(static_cast<int>(c)));
+        MergeIntoSurfaceMaps(name, clusterWeights[c], surfaces, &model::FbxSurface::weightMaps);
     }
 }
 
-namespace string
+// Maps the sparse blend shape deltas to the welded surface vertices, one morph map per shape
+void AddMorphMaps(const ofbx::BlendShape& blendShape, const std::vector<WeldedVertex>& weldedVertices, std::vector<model::FbxSurface>& surfaces)
 {
+    std::vector<const ofbx::Shape*> shapes;
 
-    std::string toLower(std::string s)
+    for (int c = 0; c < blendShape.getBlendShapeChannelCount(); ++c)
     {
-        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
-        return s;
+        auto channel = blendShape.getBlendShapeChannel(c);
+
+        for (int s = 0; s < channel->getShapeCount(); ++s)
+        {
+            shapes.push_back(channel->getShape(s));
+        }
+    }
+
+    // Sparse offsets of each shape, split by surface
+    std::vector<std::vector<std::vector<model::VertexOffset>>> shapeOffsets(shapes.size());
+
+    parallel::forEach(shapes.size(), [&](std::size_t i)
+    {
+        auto shape = shapes[i];
+        auto& offsetsBySurface = shapeOffsets[i];
+
+        offsetsBySurface.resize(surfaces.size());
+
+        auto indices = shape->getIndices();
+        auto deltas = shape->getDeltaVertices();
+
+        for (int d = 0; d < shape->getIndexCount(); ++d)
+        {
+            if (indices[d] < 0 || indices[d] >= static_cast<int>(weldedVertices.size())) continue;
+
+            const auto& welded = weldedVertices[indices[d]];
+            const auto& delta = deltas[d];
+
+            // Skip unused vertices and the ones not moved at all
+            if (welded.surface == -1 || (delta.x == 0 && delta.y == 0 && delta.z == 0)) continue;
+
+            offsetsBySurface[welded.surface].push_back(model::VertexOffset{ welded.index, Vector3(delta.x, delta.y, delta.z) });
+        }
+
+        for (auto& offsets : offsetsBySurface)
+        {
+            SortAndUniqueByVertex(offsets);
+        }
+    });
+
+    for (std::size_t i = 0; i < shapes.size(); ++i)
+    {
+        MergeIntoSurfaceMaps(shapes[i]->name, shapeOffsets[i], surfaces, &model::FbxSurface::morphMaps);
     }
+}
 
+// Name of the point cache motion track moving the vertices of the given mesh
+std::string GetMotionTrackName(const ofbx::Mesh& mesh)
+{
+    return std::to_string(mesh.id);
 }
 
-int main(int argc, char* argv[])
+// Samples the transforms of the animated meshes for the point cache, if it is enabled in the options.
+// The tracks move the exported vertices relative to the mesh's rest transform, in exporter space.
+model::PointAnimation BakePointAnimation(const ofbx::IScene& scene, const ExportOptions& options)
 {
-    if (argc == 1)
+    model::PointAnimation animation;
+
+    if (!options.writePointCache)
     {
-        std::cout << "Single File Usage: FbxToLwo <file1.fbx> <file2.fbx> <...>" << std::endl;
-        std::cout << "  Single specified FBX files will be converted to LWO, which will be placed right next to the FBX files." << std::endl;
-        std::cout << "  Example: FbxToLwo c:\\temp\\model.fbx c:\\temp\\model2.fbx" << std::endl;
-        std::cout << std::endl;
-        std::cout << std::endl;
-        std::cout << "Batch Folder Conversion Usage: FbxToLwo -input <path> -output <path>" << std::endl;
-        std::cout << "  Every FBX in the input folder and all its child folders will be converted to LWO, which will be placed" << std::endl;
-        std::cout << "  in the same relative path in the output folder." << std::endl;
-        std::cout << "  Example: FbxToLwo -input c:\\temp\fbx_files -output c:\\temp\\lwo_files" << std::endl;
-        return -1;
+        return animation;
     }
 
-    std::filesystem::path inputFolder;
-    std::filesystem::path outputFolder;
+    profiling::StageScope stage(profiling::Stage::Animate);
 
-    for (int i = 1; i < argc; ++i)
+    model::NodeAnimation nodeAnimation(scene, options.hasFrameRange ? options.frameRange : model::NodeAnimation::GetFrameRange(scene));
+    std::vector<const ofbx::Mesh*> animatedMeshes;
+
+    for (int meshIndex = 0; meshIndex < scene.getMeshCount(); ++meshIndex)
     {
-        if (string::toLower(argv[i]) == "-input")
+        if (nodeAnimation.isAnimated(*scene.getMesh(meshIndex)))
         {
-            if (argc <= i + 1)
-            {
-                std::cerr << "No input folder specified";
-                return -1;
-            }
-
-            inputFolder = argv[i + 1];
-            ++i;
+            animatedMeshes.push_back(scene.getMesh(meshIndex));
         }
-        else if (string::toLower(argv[i]) == "-output")
+    }
+
+    nodeAnimation.sample(std::vector<const ofbx::Object*>(animatedMeshes.begin(), animatedMeshes.end()));
+
+    auto axisTransform = GetAxisTransform(scene, options.upAxis);
+    auto inverseAxisTransform = axisTransform.getFullInverse();
+
+    animation.frameTimes = nodeAnimation.getTimes();
+
+    for (auto mesh : animatedMeshes)
+    {
+        auto inverseRestTransform = model::NodeAnimation::GetRestTransform(*mesh).getFullInverse();
+        auto& track = animation.tracks[GetMotionTrackName(*mesh)];
+
+        for (const auto& globalTransform : nodeAnimation.getGlobalTransforms(*mesh))
         {
-            if (argc <= i + 1)
-            {
-                std::cerr << "No output folder specified";
-                return -1;
-            }
+            // The motion relative to the rest pose, in the space the points are exported in
+            auto motion = UsesNodeTransforms(options) ? globalTransform.getMultipliedBy(inverseRestTransform) :
+                inverseRestTransform.getMultipliedBy(globalTransform);
 
-            outputFolder = argv[i + 1];
-            ++i;
+            track.push_back(axisTransform.getMultipliedBy(motion).getMultipliedBy(inverseAxisTransform));
         }
     }
 
-    if (inputFolder.empty() ^ outputFolder.empty())
+    return animation;
+}
+
+// The global transforms of the bones the skins of the given meshes are linked to, in the pose
+// the skins are baked into. Empty if skins are not baked.
+model::SkinPose::BoneTransforms GetSkinBoneTransforms(const ofbx::IScene& scene, const std::vector<const ofbx::Mesh*>& meshes,
+    const ExportOptions& options)
+{
+    model::SkinPose::BoneTransforms boneTransforms;
+
+    if (options.skinBake == SkinBake::None)
     {
-        std::cerr << "Both input and output folders must be specified" << std::endl;
-        return -1;
+        return boneTransforms;
     }
 
-    if (std::filesystem::is_directory(inputFolder) && !outputFolder.empty())
+    profiling::StageScope stage(profiling::Stage::Animate);
+
+    std::vector<const ofbx::Object*> bones;
+
+    for (auto mesh : meshes)
     {
-        std::cout << "Batch-converting the FBX files in directory " << inputFolder.string() << " to " << outputFolder.string() << std::endl;
+        auto skin = mesh->getGeometry()->getSkin();
 
-        for (auto i = std::filesystem::recursive_directory_iterator(inputFolder); i != std::filesystem::recursive_directory_iterator(); ++i)
+        for (int c = 0; skin != nullptr && c < skin->getClusterCount(); ++c)
         {
-            if (string::toLower(i->path().extension().string()) == ".fbx")
-            {
-                auto outputPath = outputFolder / std::filesystem::relative(i->path(), inputFolder);
-                outputPath.replace_extension("lwo");
+            auto link = skin->getCluster(c)->getLink();
 
-                std::cout << "Converting: " << i->path().string() << " => " << outputPath.string() << std::endl;
-
-                ConvertFbxToLwo(i->path(), outputPath);
+            if (link != nullptr && boneTransforms.emplace(link, model::NodeAnimation::GetRestTransform(*link)).second)
+            {
+                bones.push_back(link);
             }
         }
+    }
 
-        return 0;
+    if (options.skinBake == SkinBake::Frame)
+    {
+        model::NodeAnimation animation(scene, model::NodeAnimation::FrameRange{ options.skinBakeFrame, options.skinBakeFrame });
+        animation.sample(bones);
+
+        for (auto bone : bones)
+        {
+            boneTransforms[bone] = animation.getGlobalTransforms(*bone).front();
+        }
     }
 
-    for (int i = 1; i < argc; ++i)
+    return boneTransforms;
+}
+
+// Exports the given meshes of the scene, the scene is only read from.
+// The surfaces of meshes having a track in the animation are assigned to it.
+void ExportFbxMeshes(const ofbx::IScene& scene, const std::vector<const ofbx::Mesh*>& meshes,
+    const model::EmbeddedMediaExtractor::MediaPaths& mediaPaths, const model::PointAnimation& animation,
+    model::Lwo2Exporter& exporter, const ExportOptions& options, std::ostream& log)
+{
+    auto transform = GetAxisTransform(scene, options.upAxis);
+
+    // The points shared across the surfaces are welded with the same epsilon
+    exporter.setPointWeldEpsilon(options.weldEpsilon);
+
+    // Equivalent materials are merged before welding, so their polygons share vertices
+    auto materialNames = options.materialMerger ? options.materialMerger->resolve(meshes) : model::MaterialMerger::MaterialNames();
+
+    // The layer index of each exported mesh
+    std::map<const ofbx::Mesh*, int> meshLayers;
+
+    auto boneTransforms = GetSkinBoneTransforms(scene, meshes, options);
+
+    for (auto mesh : meshes)
     {
-        std::filesystem::path inputPath = argv[i];
+        profiling::StageScope weldStage(profiling::Stage::Weld);
 
-        try
+        auto geometry = mesh->getGeometry();
+
+        log << "Exporting FBX Mesh with " << geometry->getVertexCount() << " vertices\n";
+
+        if (options.layerMode == LayerMode::PerMesh)
+        {
+            // Put the mesh below the layer of its parent mesh, if there is any
+            auto parentLayer = meshLayers.find(FindParentMesh(*mesh));
+            auto parentIndex = parentLayer != meshLayers.end() ? parentLayer->second : -1;
+
+            meshLayers[mesh] = exporter.addLayer(mesh->name, GetMeshPivot(*mesh, transform), parentIndex);
+        }
+
+        // Material slots with the same (merged) name share a surface
+        std::vector<model::FbxSurface> surfaces;
+        std::vector<int> materialSurfaces(std::max(mesh->getMaterialCount(), 1));
+        std::unordered_map<unsigned int, int> surfacesById;
+
+        auto ensureSurface = [&](const std::string& materialName)
         {
-            if (!std::filesystem::exists(inputPath)) throw std::runtime_error("Path does not exist " + inputPath.string());
+            auto materialId = exporter.getMaterials().intern(materialName);
+            auto existing = surfacesById.emplace(materialId, static_cast<int>(surfaces.size()));
 
-            if (std::filesystem::is_regular_file(inputPath))
+            if (!existing.second)
             {
-                std::cout << "Trying to convert file " << inputPath.string() << std::endl;
+                return existing.first->second;
+            }
 
-                std::filesystem::path outputPath = inputPath;
-                outputPath.replace_extension("lwo");
+            auto& surface = surfaces.emplace_back();
+            surface.materialId = materialId;
 
-                ConvertFbxToLwo(inputPath, outputPath);
+            if (options.weldEpsilon != render::VertexEpsilon)
+            {
+                surface.setWeldEpsilon(options.weldEpsilon);
             }
+
+            return static_cast<int>(surfaces.size() - 1);
+        };
+
+        if (mesh->getMaterialCount() == 0)
+        {
+            materialSurfaces[0] = ensureSurface("Material"); // create at least one surface
         }
-        catch (const std::exception& ex)
+
+        // Assign the surface name for each material
+        for (int m = 0; m < mesh->getMaterialCount(); ++m)
         {
-            std::cerr << "Failed to handle file " << inputPath << ": " << ex.what() << std::endl;
+            auto material = mesh->getMaterial(m);
+            auto mergedName = materialNames.find(material);
+
+            materialSurfaces[m] = ensureSurface(mergedName != materialNames.end() ? mergedName->second : material->name);
+
+            // Reference the extracted image if the diffuse texture is embedded
+            auto texture = material->getTexture(ofbx::Texture::DIFFUSE);
+            auto mediaPath = texture != nullptr ? mediaPaths.find(texture->getEmbeddedData().begin) : mediaPaths.end();
+            auto& surface = surfaces[materialSurfaces[m]];
+
+            if (mediaPath != mediaPaths.end() && surface.texturePath.empty())
+            {
+                surface.texturePath = mediaPath->second;
+            }
         }
-    }
 
+        auto materials = geometry->getMaterials();
+        auto faceIndices = geometry->getFaceIndices();
+        auto skin = geometry->getSkin();
+        auto blendShape = geometry->getBlendShape();
+
+        // Skin weights and blend shapes are mapped through the welded vertices, only needed for deformed meshes
+        auto isDeformed = skin != nullptr || blendShape != nullptr;
+        std::vector<WeldedVertex> weldedVertices(isDeformed ? geometry->getVertexCount() : 0);
+
+        // Baking the skin poses every welded vertex, which needs the control point it has been created from
+        auto bakeSkin = skin != nullptr && options.skinBake != SkinBake::None;
+        std::vector<std::vector<int>> vertexControlPoints(bakeSkin ? surfaces.size() : 0);
+
+        auto addVertex = [&](int materialIndex, int index)
+        {
+            auto surfaceIndex = materialSurfaces[materialIndex];
+            auto weldedIndex = surfaces[surfaceIndex].addVertex(ConstructMeshVertex(*geometry, index));
+
+            if (isDeformed)
+            {
+                weldedVertices[index] = WeldedVertex{ surfaceIndex, weldedIndex };
+            }
+
+            if (bakeSkin && weldedIndex == vertexControlPoints[surfaceIndex].size())
+            {
+                vertexControlPoints[surfaceIndex].push_back(index);
+            }
+        };
+
+        for (int i = 0; i < geometry->getIndexCount(); i += 3)
+        {
+            // Material index is assigned per triangle
+            auto polyIndex = i / 3;
+            parallel::checkpoint(polyIndex);
+
+            auto materialIndex = materials ? materials[polyIndex] : 0; // put into first material by default
+
+            // Reverse the poly indices to get the CCW order
+            auto indexA = (faceIndices[i+2] * -1) - 1; // last index is negative and 1-based
+            auto indexB = faceIndices[i+1];
+            auto indexC = faceIndices[i+0];
+
+            addVertex(materialIndex, indexA);
+            addVertex(materialIndex, indexB);
+            addVertex(materialIndex, indexC);
+        }
+
+        metrics::add(metrics::getCounters().trianglesWelded, static_cast<uint64_t>(geometry->getIndexCount() / 3));
+
+        if (skin != nullptr)
+        {
+            AddSkinWeights(*skin, weldedVertices, surfaces);
+        }
+
+        if (blendShape != nullptr)
+        {
+            AddMorphMaps(*blendShape, weldedVertices, surfaces);
+        }
+
+        if (bakeSkin)
+        {
+            profiling::StageScope animateStage(profiling::Stage::Animate);
+
+            model::SkinPose pose(*skin, geometry->getVertexCount(), boneTransforms);
+
+            for (std::size_t s = 0; s < surfaces.size(); ++s)
+            {
+                pose.apply(vertexControlPoints[s], surfaces[s].vertices);
+            }
+
+            log << "Baked the skin into the " << (options.skinBake == SkinBake::Rest ? "rest pose" :
+                "pose at frame " + std::to_string(options.skinBakeFrame)) << "\n";
+        }
+
+        // Apply the global transformation matrix, the points end up in the same space as the layer pivots
+        auto meshTransform = UsesNodeTransforms(options) ? GetMeshTransform(*mesh, transform) : transform;
+
+        log << "Generated " << surfaces.size() << " triangulated surfaces\n";
+
+        if (animation.tracks.count(GetMotionTrackName(*mesh)) > 0)
+        {
+            for (auto& surface : surfaces)
+            {
+                surface.motionTrack = GetMotionTrackName(*mesh);
+            }
+        }
+
+        profiling::StageScope transformStage(profiling::Stage::Transform);
+
+        for (const auto& surface : surfaces)
+        {
+            log << " - " << exporter.getMaterials().getName(surface.materialId) << std::endl;
+            exporter.addSurface(surface, meshTransform);
+        }
+    }
+}
+
+// Extracts the embedded textures if requested, returns the paths of the extracted files
+model::EmbeddedMediaExtractor::MediaPaths ExtractMedia(const ofbx::IScene& scene, const ExportOptions& options)
+{
+    return options.mediaExtractor ? options.mediaExtractor->extract(scene) : model::EmbeddedMediaExtractor::MediaPaths();
+}
+
+void ExportFbxMesh(const ofbx::IScene& scene, const model::PointAnimation& animation, model::Lwo2Exporter& exporter,
+    const ExportOptions& options, std::ostream& log)
+{
+    std::vector<const ofbx::Mesh*> meshes;
+
+    if (options.layerMode == LayerMode::PerMesh)
+    {
+        // Parent layers need to be created before their children
+        meshes = GetMeshesInHierarchyOrder(scene);
+    }
+    else
+    {
+        for (int meshIndex = 0; meshIndex < scene.getMeshCount(); ++meshIndex)
+        {
+            meshes.push_back(scene.getMesh(meshIndex));
+        }
+    }
+
+    ExportFbxMeshes(scene, meshes, ExtractMedia(scene, options), animation, exporter, options, log);
+}
+
+// Starts the layer for the given input file, its pivot is the origin of the first mesh.
+// The meshes are exported in the same space, see GetMeshTransform.
+void AddFileLayer(model::Lwo2Exporter& exporter, const ofbx::IScene& scene, const std::filesystem::path& inputPath, const ExportOptions& options)
+{
+    auto pivot = scene.getMeshCount() > 0 ? GetMeshPivot(*scene.getMesh(0), GetAxisTransform(scene, options.upAxis)) : Vector3(0, 0, 0);
+
+    exporter.addLayer(inputPath.stem().string(), pivot);
+}
+
+bool IsLoadCancelled(void* token)
+{
+    return static_cast<const parallel::CancellationToken*>(token)->isCancelled();
+}
+
+using StageScopes = std::vector<std::unique_ptr<profiling::StageScope>>;
+
+// Maps the stages of the FBX loader to the profiler stages, opening and closing their scopes
+void OnLoadStage(void* scopes, ofbx::LoadStage stage, bool begin)
+{
+    auto& openScopes = *static_cast<StageScopes*>(scopes);
+
+    if (!begin)
+    {
+        openScopes.pop_back();
+        return;
+    }
+
+    openScopes.push_back(std::make_unique<profiling::StageScope>(
+        stage == ofbx::LoadStage::TOKENIZE ? profiling::Stage::Tokenize :
+        stage == ofbx::LoadStage::PARSE_OBJECTS ? profiling::Stage::Parse : profiling::Stage::Triangulate));
+}
+
+// Loads the given FBX file, returns an empty pointer if the file could not be parsed.
+// Throws OperationCancelledException if the time budget of the current thread runs out.
+ScenePtr LoadFbxScene(const std::filesystem::path& inputPath, std::ostream& errorLog)
+{
+    profiling::StageScope stage(profiling::Stage::Read);
+
+    std::ifstream ifs(inputPath, std::ios::binary | std::ios::ate);
+    std::ifstream::pos_type pos = ifs.tellg();
+
+    std::vector<char> content(pos);
+
+    ifs.seekg(0, std::ios::beg);
+    ifs.read(content.data(), pos);
+
+    metrics::add(metrics::getCounters().bytesRead, static_cast<uint64_t>(content.size()));
+
+    auto token = const_cast<parallel::CancellationToken*>(parallel::getCurrentToken());
+    StageScopes loadStages;
+
+    ScenePtr scene(ofbx::load(reinterpret_cast<ofbx::u8*>(content.data()), 
+        static_cast<int>(content.size()), (ofbx::u64)ofbx::LoadFlags::TRIANGULATE, ProcessFbxJobs, nullptr,
+        token != nullptr ? IsLoadCancelled : nullptr, token, OnLoadStage, &loadStages));
+
+    if (!scene)
+    {
+        parallel::checkpoint();
+        errorLog << ofbx::getError() << std::endl;
+    }
+
+    return scene;
+}
+
+// The material of the collision proxy surfaces
+const std::string CollisionMaterialName = "Collision";
+
+// Builds the collision proxies of the exporter's surfaces if enabled in the options. They are either
+// added to the exporter as layers, or written to <name>_cm.lwo next to the given output path.
+void AddCollisionProxies(model::Lwo2Exporter& exporter, const std::filesystem::path& outputPath, const ExportOptions& options, std::ostream& log)
+{
+    if (options.collisionMode == CollisionMode::None)
+    {
+        return;
+    }
+
+    std::vector<model::CollisionProxyBuilder::Hull> hulls;
+
+    {
+        profiling::StageScope stage(profiling::Stage::Collision);
+
+        std::vector<Vector3> positions;
+        model::IndexBuffer indices;
+        exporter.getTriangles(positions, indices);
+
+        hulls = model::CollisionProxyBuilder(options.weldEpsilon, options.collisionVertexBudget).build(positions, indices);
+    }
+
+    std::size_t numVertices = 0;
+
+    for (const auto& hull : hulls)
+    {
+        numVertices += hull.vertices.size();
+    }
+
+    log << "Built " << hulls.size() << " convex collision proxies with " << numVertices << " vertices\n";
+
+    if (options.collisionMode == CollisionMode::Layer)
+    {
+        model::CollisionProxyBuilder::AddHullLayers(hulls, CollisionMaterialName, exporter);
+        return;
+    }
+
+    auto collisionPath = std::filesystem::path(outputPath).replace_filename(outputPath.stem().string() + "_cm.lwo");
+    auto folder = std::filesystem::absolute(collisionPath).parent_path();
+
+    model::Lwo2Exporter collisionExporter;
+    collisionExporter.setPointWeldEpsilon(options.weldEpsilon);
+    model::CollisionProxyBuilder::AddHullLayers(hulls, CollisionMaterialName, collisionExporter);
+
+    log << "Exporting collision proxies to " << collisionPath.string() << std::endl;
+    collisionExporter.exportToPath(folder.string(), collisionPath.filename().string());
+}
+
+// Writes the LWO file, the point cache and the mesh cache if enabled in the options. The layers
+// are moved to the mesh cache exporter, the LWO exporter is empty afterwards.
+void WriteLwo(model::Lwo2Exporter& exporter, const model::PointAnimation& animation, const std::filesystem::path& outputPath,
+    const ExportOptions& options, std::ostream& log)
+{
+    auto folder = std::filesystem::absolute(outputPath).parent_path();
+    std::filesystem::create_directories(folder);
+
+    AddCollisionProxies(exporter, outputPath, options, log);
+
+    log << "Exporting LWO to " << outputPath.string() << std::endl;
+    exporter.exportToPath(folder.string(), outputPath.filename().string());
+
+    if (options.writePointCache && !animation.frameTimes.empty())
+    {
+        auto pointCachePath = std::filesystem::path(outputPath).replace_extension(".mdd");
+
+        log << "Exporting point cache with " << animation.frameTimes.size() << " frames to " << pointCachePath.string() << std::endl;
+        exporter.exportPointCache(folder.string(), pointCachePath.filename().string(), animation);
+    }
+
+    if (options.writeMeshCache)
+    {
+        auto cachePath = std::filesystem::path(outputPath).replace_extension(".mesh");
+
+        model::MeshCacheExporter cacheExporter(exporter.getMaterialRegistry());
+        cacheExporter.appendLayers(exporter);
+
+        log << "Exporting mesh cache to " << cachePath.string() << std::endl;
+        cacheExporter.exportToPath(folder.string(), cachePath.filename().string());
+    }
+}
+
+// Returns false if the FBX file could not be loaded
+bool ConvertFbxToLwo(const std::filesystem::path& inputPath, const std::filesystem::path& outputPath, const ExportOptions& options,
+    std::ostream& log, std::ostream& errorLog)
+{
+    auto scene = LoadFbxScene(inputPath, errorLog);
+
+    if (!scene)
+    {
+        return false;
+    }
+
+    // Each conversion interns its own materials
+    auto exporter = std::make_shared<model::Lwo2Exporter>();
+
+    if (options.layerMode == LayerMode::PerFile)
+    {
+        AddFileLayer(*exporter, *scene, inputPath, options);
+    }
+
+    auto animation = BakePointAnimation(*scene, options);
+
+    ExportFbxMesh(*scene, animation, *exporter, options, log);
+    WriteLwo(*exporter, animation, outputPath, options, log);
+
+    return true;
+}
+
+// Converts the mesh geometry of a binary FBX file without loading the whole file into memory. All geometries go into
+// a single surface of one layer, without normals, UVs, materials or animation. Throws std::runtime_error on read errors.
+bool ConvertFbxGeometryToLwo(const std::filesystem::path& inputPath, const std::filesystem::path& outputPath,
+    const ExportOptions& options, std::ostream& log)
+{
+    auto exporter = std::make_shared<model::Lwo2Exporter>();
+    exporter->setPointWeldEpsilon(options.weldEpsilon);
+
+    auto materialId = exporter->getMaterials().intern("Material");
+
+    {
+        profiling::StageScope stage(profiling::Stage::Read);
+
+        model::StreamedGeometryReader reader(materialId, options.weldEpsilon, [&](model::FbxSurface& surface)
+        {
+            log << "Streamed FBX Geometry with " << surface.getIndexArray().size() / 3 << " triangles\n";
+
+            // The global settings precede the objects, so the up axis is known by now
+            profiling::StageScope transformStage(profiling::Stage::Transform);
+            exporter->addSurface(surface, GetAxisTransform(reader.getUpAxis(), options.upAxis));
+        });
+
+        reader.readFromPath(inputPath);
+
+        metrics::add(metrics::getCounters().bytesRead, static_cast<uint64_t>(std::filesystem::file_size(inputPath)));
+        metrics::add(metrics::getCounters().trianglesWelded, static_cast<uint64_t>(reader.getNumTriangles()));
+
+        log << "Read " << reader.getNumGeometries() << " geometries with " << reader.getNumTriangles() << " triangles\n";
+    }
+
+    WriteLwo(*exporter, model::PointAnimation(), outputPath, options, log);
+
+    return true;
+}
+
+namespace string
+{
+
+    std::string toLower(std::string s)
+    {
+        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+        return s;
+    }
+
+}
+
+bool IsLwoFile(const std::filesystem::path& path)
+{
+    return string::toLower(path.extension().string()) == ".lwo";
+}
+
+// Re-processes an existing LWO file: its polygons are welded again and written like the converted FBX meshes.
+// The surfaces keep their SURF and CLIP chunks. The reader doesn't carry over everything (e.g. additional
+// UV maps), so a file is never replaced by its re-processed version, that goes to <name>_reprocessed.lwo instead.
+bool ConvertLwoToLwo(const std::filesystem::path& inputPath, std::filesystem::path outputPath, const ExportOptions& options,
+    std::ostream& log)
+{
+    std::error_code ec;
+
+    if (std::filesystem::equivalent(inputPath, outputPath, ec))
+    {
+        outputPath.replace_filename(outputPath.stem().string() + "_reprocessed.lwo");
+    }
+
+    auto exporter = std::make_shared<model::Lwo2Exporter>();
+    exporter->setPointWeldEpsilon(options.weldEpsilon);
+
+    {
+        model::Lwo2Reader reader(exporter->getMaterialRegistry(), options.weldEpsilon);
+        reader.readFromPath(inputPath);
+
+        exporter->setSourceSurfaces(reader.getSourceSurfaces());
+
+        for (const auto& skipped : reader.getSkippedContents())
+        {
+            log << "Not carried over: " << skipped << "\n";
+        }
+
+        metrics::add(metrics::getCounters().bytesRead, static_cast<uint64_t>(std::filesystem::file_size(inputPath)));
+        metrics::add(metrics::getCounters().trianglesWelded, static_cast<uint64_t>(reader.getTriangleCount()));
+
+        log << "Read " << reader.getLayers().size() << " layers with " << reader.getTriangleCount() << " triangles\n";
+
+        profiling::StageScope transformStage(profiling::Stage::Transform);
+        reader.addTo(*exporter);
+    }
+
+    // The LWO file doesn't carry any animation
+    WriteLwo(*exporter, model::PointAnimation(), outputPath, options, log);
+
+    return true;
+}
+
+// An FBX file to convert and the LWO file to write
+struct FileConversion
+{
+    std::filesystem::path inputPath;
+    std::filesystem::path outputPath;
+
+    // Printed before the log of the conversion
+    std::string message;
+};
+
+// Converts the given files, each of them on one NUMA node and within the time budget of the options.
+// Files running out of time are reported and converted again once all others are done.
+void ConvertFbxFilesToLwo(const std::vector<FileConversion>& conversions, const ExportOptions& options)
+{
+    std::mutex logLock;
+    std::vector<std::size_t> timedOut;
+
+    auto& counters = metrics::getCounters();
+
+    metrics::add(counters.filesQueued, static_cast<uint64_t>(conversions.size()));
+    metrics::add(counters.filesPending, static_cast<int64_t>(conversions.size()));
+
+    // Returns false if the time budget ran out, the logs are printed once the file is done
+    auto convert = [&](const FileConversion& conversion, std::chrono::duration<double> budget)
+    {
+        std::ostringstream log;
+        std::ostringstream errorLog;
+        bool finished = true;
+        bool converted = false;
+        bool skipped = false;
+
+        log << conversion.message << std::endl;
+
+        // Created first, so the counters include all threads started by the conversion
+        std::unique_ptr<profiling::StageProfiler> profiler;
+        std::unique_ptr<profiling::ProfilerScope> profilerScope;
+
+        if (options.profile)
+        {
+            profiler = std::make_unique<profiling::StageProfiler>();
+            profilerScope = std::make_unique<profiling::ProfilerScope>(*profiler);
+        }
+
+        try
+        {
+            parallel::TimeBudget timeBudget(std::chrono::duration_cast<parallel::Watchdog::Clock::duration>(budget));
+
+            // Re-processed LWO files may be written to another path than the output, they are always converted
+            std::string incrementalKey;
+
+            if (options.incremental && !IsLwoFile(conversion.inputPath))
+            {
+                incrementalKey = options.incremental->getKey(conversion.inputPath);
+                skipped = options.incremental->isUpToDate(incrementalKey, conversion.outputPath);
+            }
+
+            if (skipped)
+            {
+                log << "Unchanged since the previous run, skipped" << std::endl;
+            }
+            else
+            {
+                converted = IsLwoFile(conversion.inputPath) ?
+                    ConvertLwoToLwo(conversion.inputPath, conversion.outputPath, options, log) :
+                    options.geometryOnly ?
+                    ConvertFbxGeometryToLwo(conversion.inputPath, conversion.outputPath, options, log) :
+                    ConvertFbxToLwo(conversion.inputPath, conversion.outputPath, options, log, errorLog);
+
+                if (converted && !incrementalKey.empty())
+                {
+                    options.incremental->markConverted(incrementalKey, conversion.outputPath);
+                }
+            }
+        }
+        catch (const parallel::OperationCancelledException&)
+        {
+            errorLog << "Time budget of " << budget.count() << "s exceeded by " << conversion.inputPath.string() << std::endl;
+            metrics::add(counters.budgetsExceeded, uint64_t(1));
+            finished = false;
+        }
+        catch (const std::exception& ex)
+        {
+            errorLog << "Failed to handle file " << conversion.inputPath << ": " << ex.what() << std::endl;
+        }
+
+        if (profiler)
+        {
+            log << "Stage profile of " << conversion.inputPath.string() << ":" << std::endl;
+            profiling::ProfileTotals::Print(log, *profiler);
+            options.profile->add(*profiler);
+        }
+
+        if (finished && !skipped)
+        {
+            metrics::add(converted ? counters.filesConverted : counters.filesFailed, uint64_t(1));
+        }
+
+        std::lock_guard<std::mutex> lock(logLock);
+        std::cout << log.str() << std::flush;
+        std::cerr << errorLog.str() << std::flush;
+
+        return finished;
+    };
+
+    parallel::forEachOnNodes(conversions.size(), [&](std::size_t i)
+    {
+        metrics::add(counters.filesPending, int64_t(-1));
+        metrics::add(counters.filesRunning, int64_t(1));
+
+        auto finished = convert(conversions[i], options.timeBudget);
+
+        metrics::add(counters.filesRunning, int64_t(-1));
+
+        if (!finished)
+        {
+            metrics::add(counters.filesRetryPending, int64_t(1));
+
+            std::lock_guard<std::mutex> lock(logLock);
+            timedOut.push_back(i);
+        }
+    });
+
+    if (timedOut.empty()) return;
+
+    // The slow files get the whole machine, one after the other
+    std::sort(timedOut.begin(), timedOut.end());
+    std::size_t numFailed = 0;
+
+    std::cout << "Retrying " << timedOut.size() << " file(s) which exceeded the time budget" << std::endl;
+
+    for (auto i : timedOut)
+    {
+        metrics::add(counters.filesRetryPending, int64_t(-1));
+        metrics::add(counters.filesRunning, int64_t(1));
+
+        auto finished = convert(conversions[i], options.retryTimeBudget);
+
+        metrics::add(counters.filesRunning, int64_t(-1));
+
+        if (!finished)
+        {
+            metrics::add(counters.filesTimedOut, uint64_t(1));
+            ++numFailed;
+        }
+    }
+
+    std::cout << "Time budget: " << timedOut.size() << " file(s) retried, " << numFailed << " of them exceeded the retry budget" << std::endl;
+}
+
+// Converts all the given FBX files into a single LWO file, each file or mesh ending up in its own layer
+void MergeFbxFilesToLwo(const std::vector<std::filesystem::path>& inputPaths, const std::filesystem::path& outputPath, const ExportOptions& options)
+{
+    // The files share the registry of the merged output, their layers are moved without translating the materials
+    auto materials = std::make_shared<model::MaterialRegistry>();
+    std::vector<model::Lwo2Exporter> fileExporters(inputPaths.size(), model::Lwo2Exporter(materials));
+    std::vector<std::string> fileLogs(inputPaths.size());
+
+    // Load and weld the files in parallel, each one into its own exporter
+    parallel::forEach(inputPaths.size(), [&](std::size_t i)
+    {
+        std::ostringstream log;
+        log << "Loading " << inputPaths[i].string() << std::endl;
+
+        try
+        {
+            auto scene = LoadFbxScene(inputPaths[i], log);
+
+            if (scene)
+            {
+                if (options.layerMode != LayerMode::PerMesh)
+                {
+                    AddFileLayer(fileExporters[i], *scene, inputPaths[i], options);
+                }
+
+                ExportFbxMesh(*scene, model::PointAnimation(), fileExporters[i], options, log);
+            }
+        }
+        catch (const std::exception& ex)
+        {
+            log << "Failed to handle file " << inputPaths[i] << ": " << ex.what() << std::endl;
+        }
+
+        fileLogs[i] = log.str();
+    });
+
+    model::Lwo2Exporter exporter(materials);
+
+    for (std::size_t i = 0; i < inputPaths.size(); ++i)
+    {
+        std::cout << fileLogs[i];
+        exporter.appendLayers(fileExporters[i]);
+    }
+
+    WriteLwo(exporter, model::PointAnimation(), outputPath, options, std::cout);
+}
+
+// One output of an export job, with its own set of options
+struct ExportTarget
+{
+    std::filesystem::path outputPath;
+
+    // Write every mesh to its own file, named <output name>_<mesh name>.lwo
+    bool splitMeshes = false;
+
+    ExportOptions options;
+};
+
+// Any number of outputs generated from a single input file
+struct ExportJob
+{
+    std::filesystem::path inputPath;
+    std::vector<ExportTarget> targets;
+};
+
+// Splits the line at whitespace, double quotes group words containing spaces
+std::vector<std::string> SplitJobLine(const std::string& line)
+{
+    std::vector<std::string> tokens;
+    std::string token;
+    bool inQuotes = false;
+    bool hasToken = false;
+
+    for (char c : line)
+    {
+        if (c == '"')
+        {
+            inQuotes = !inQuotes;
+            hasToken = true;
+        }
+        else if (!inQuotes && std::isspace(static_cast<unsigned char>(c)))
+        {
+            if (hasToken) tokens.push_back(token);
+            token.clear();
+            hasToken = false;
+        }
+        else
+        {
+            token += c;
+            hasToken = true;
+        }
+    }
+
+    if (hasToken) tokens.push_back(token);
+
+    return tokens;
+}
+
+// Parses a frame range given as <first>:<last>
+bool ParseFrameRange(const std::string& value, model::NodeAnimation::FrameRange& range)
+{
+    auto separator = value.find(':');
+
+    if (separator == std::string::npos)
+    {
+        return false;
+    }
+
+    auto first = value.substr(0, separator);
+    auto last = value.substr(separator + 1);
+    char* firstEnd = nullptr;
+    char* lastEnd = nullptr;
+
+    range.first = static_cast<int>(std::strtol(first.c_str(), &firstEnd, 10));
+    range.last = static_cast<int>(std::strtol(last.c_str(), &lastEnd, 10));
+
+    return !first.empty() && !last.empty() && *firstEnd == '\0' && *lastEnd == '\0' && range.first <= range.last;
+}
+
+// Parses the pose to bake the skins into: rest, none or a frame number
+bool ParseSkinBake(const std::string& value, SkinBake& skinBake, int& frame)
+{
+    if (value == "rest" || value == "none")
+    {
+        skinBake = value == "rest" ? SkinBake::Rest : SkinBake::None;
+        return true;
+    }
+
+    char* end = nullptr;
+    frame = static_cast<int>(std::strtol(value.c_str(), &end, 10));
+    skinBake = SkinBake::Frame;
+
+    return !value.empty() && *end == '\0';
+}
+
+// Parses the number of vertices a collision proxy may have: 0 (unlimited) or at least 4
+bool ParseCollisionVertexBudget(const std::string& value, std::size_t& budget)
+{
+    char* end = nullptr;
+    auto number = std::strtol(value.c_str(), &end, 10);
+
+    budget = static_cast<std::size_t>(std::max(number, 0L));
+
+    return !value.empty() && *end == '\0' && (number == 0 || number >= 4);
+}
+
+// Reads a job description file. Relative paths are resolved against the folder of the job file,
+// the targets start with the given default options and override them with their own settings.
+ExportJob ReadExportJob(const std::filesystem::path& jobPath, const ExportOptions& defaults)
+{
+    std::ifstream stream(jobPath);
+
+    if (!stream)
+    {
+        throw std::runtime_error("Cannot open the job file");
+    }
+
+    auto basePath = std::filesystem::absolute(jobPath).parent_path();
+
+    ExportJob job;
+    std::string line;
+
+    for (int lineNumber = 1; std::getline(stream, line); ++lineNumber)
+    {
+        auto tokens = SplitJobLine(line);
+
+        if (tokens.empty() || tokens[0][0] == '#') continue;
+
+        auto lineError = [&](const std::string& message)
+        {
+            return std::runtime_error("Line " + std::to_string(lineNumber) + ": " + message);
+        };
+
+        auto keyword = string::toLower(tokens[0]);
+
+        if (keyword == "input" && tokens.size() == 2)
+        {
+            job.inputPath = basePath / tokens[1];
+            continue;
+        }
+
+        if (keyword != "output" || tokens.size() < 2)
+        {
+            throw lineError("expected input <file.fbx> or output <file.lwo> [options]");
+        }
+
+        auto& target = job.targets.emplace_back();
+        target.outputPath = basePath / tokens[1];
+        target.options = defaults;
+
+        for (std::size_t t = 2; t < tokens.size(); ++t)
+        {
+            auto separator = tokens[t].find('=');
+            auto key = string::toLower(tokens[t].substr(0, separator));
+            auto value = separator != std::string::npos ? string::toLower(tokens[t].substr(separator + 1)) : std::string();
+
+            if (key == "layers" && value == "single")
+            {
+                target.options.layerMode = LayerMode::Single;
+            }
+            else if (key == "layers" && value == "file")
+            {
+                target.options.layerMode = LayerMode::PerFile;
+            }
+            else if (key == "layers" && value == "mesh")
+            {
+                target.options.layerMode = LayerMode::PerMesh;
+            }
+            else if (key == "split" && value == "mesh")
+            {
+                target.splitMeshes = true;
+            }
+            else if (key == "axis" && (value == "auto" || value == "y" || value == "z"))
+            {
+                target.options.upAxis = value == "y" ? UpAxis::Y : value == "z" ? UpAxis::Z : UpAxis::Auto;
+            }
+            else if (key == "cache" && (value == "mesh" || value == "none"))
+            {
+                target.options.writeMeshCache = value == "mesh";
+            }
+            else if (key == "pointcache" && (value == "mdd" || value == "none"))
+            {
+                target.options.writePointCache = value == "mdd";
+            }
+            else if (key == "collision" && (value == "layer" || value == "file" || value == "none"))
+            {
+                target.options.collisionMode = value == "layer" ? CollisionMode::Layer : value == "file" ? CollisionMode::File : CollisionMode::None;
+            }
+            else if (key == "collisionvertices")
+            {
+                if (!ParseCollisionVertexBudget(value, target.options.collisionVertexBudget))
+                {
+                    throw lineError("invalid collision vertex budget " + value);
+                }
+            }
+            else if (key == "bakeskin")
+            {
+                if (!ParseSkinBake(value, target.options.skinBake, target.options.skinBakeFrame))
+                {
+                    throw lineError("invalid skin pose " + value);
+                }
+            }
+            else if (key == "frames")
+            {
+                if (!ParseFrameRange(value, target.options.frameRange))
+                {
+                    throw lineError("invalid frame range " + value);
+                }
+
+                target.options.hasFrameRange = true;
+            }
+            else if (key == "weld")
+            {
+                char* end = nullptr;
+                auto epsilon = std::strtod(value.c_str(), &end);
+
+                if (value.empty() || *end != '\0' || !(epsilon > 0))
+                {
+                    throw lineError("invalid weld epsilon " + value);
+                }
+
+                target.options.weldEpsilon = epsilon;
+            }
+            else
+            {
+                throw lineError("unknown target option " + tokens[t]);
+            }
+        }
+    }
+
+    if (job.inputPath.empty())
+    {
+        throw std::runtime_error("No input file specified");
+    }
+
+    if (job.targets.empty())
+    {
+        throw std::runtime_error("No output specified");
+    }
+
+    return job;
+}
+
+// Replaces the characters which are not safe to use in file names
+std::string GetSafeFileName(std::string name)
+{
+    std::replace_if(name.begin(), name.end(), [](unsigned char c)
+    {
+        return !std::isalnum(c) && c != '_' && c != '-' && c != '.';
+    }, '_');
+
+    return name;
+}
+
+// Writes each mesh of the scene to its own LWO file, named after the target and the mesh
+void ExportMeshesToSeparateFiles(const ofbx::IScene& scene, const ExportTarget& target, std::ostream& log)
+{
+    auto mediaPaths = ExtractMedia(scene, target.options);
+    auto animation = BakePointAnimation(scene, target.options);
+    std::set<std::string> usedNames;
+
+    for (int meshIndex = 0; meshIndex < scene.getMeshCount(); ++meshIndex)
+    {
+        auto mesh = scene.getMesh(meshIndex);
+        auto name = target.outputPath.stem().string() + "_" + GetSafeFileName(mesh->name);
+
+        // Meshes are not required to have unique names
+        auto uniqueName = name;
+
+        for (int n = 2; !usedNames.insert(string::toLower(uniqueName)).second; ++n)
+        {
+            uniqueName = name + "_" + std::to_string(n);
+        }
+
+        model::Lwo2Exporter exporter;
+        ExportFbxMeshes(scene, { mesh }, mediaPaths, animation, exporter, target.options, log);
+
+        WriteLwo(exporter, animation, target.outputPath.parent_path() / (uniqueName + ".lwo"), target.options, log);
+    }
+}
+
+// Loads the input file of the job once, all targets are then exported in parallel from the shared scene
+void RunExportJob(const ExportJob& job)
+{
+    std::cout << "Loading " << job.inputPath.string() << std::endl;
+
+    auto scene = LoadFbxScene(job.inputPath, std::cerr);
+
+    if (!scene)
+    {
+        return;
+    }
+
+    std::vector<std::string> targetLogs(job.targets.size());
+
+    parallel::forEach(job.targets.size(), [&](std::size_t i)
+    {
+        const auto& target = job.targets[i];
+        std::ostringstream log;
+
+        try
+        {
+            if (target.splitMeshes)
+            {
+                ExportMeshesToSeparateFiles(*scene, target, log);
+            }
+            else
+            {
+                model::Lwo2Exporter exporter;
+
+                if (target.options.layerMode == LayerMode::PerFile)
+                {
+                    AddFileLayer(exporter, *scene, job.inputPath, target.options);
+                }
+
+                auto animation = BakePointAnimation(*scene, target.options);
+
+                ExportFbxMesh(*scene, animation, exporter, target.options, log);
+                WriteLwo(exporter, animation, target.outputPath, target.options, log);
+            }
+        }
+        catch (const std::exception& ex)
+        {
+            log << "Failed to export " << target.outputPath.string() << ": " << ex.what() << std::endl;
+        }
+
+        targetLogs[i] = log.str();
+    });
+
+    for (const auto& log : targetLogs)
+    {
+        std::cout << log;
+    }
+}
+
+// Writes the state of the incremental conversion for the next run, if enabled
+void SaveIncrementalState(const ExportOptions& options)
+{
+    if (!options.incremental) return;
+
+    try
+    {
+        options.incremental->save();
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << "Failed to save the incremental state: " << ex.what() << std::endl;
+    }
+}
+
+void PrintSummary(const ExportOptions& options)
+{
+    std::cout << "Vector kernels: " << simd::getIsaName(simd::getActiveIsa()) << std::endl;
+
+    std::string fileTypes = "LWO";
+
+    if (options.writeMeshCache)
+    {
+        fileTypes += options.writePointCache ? ", mesh cache" : " and mesh cache";
+    }
+
+    if (options.writePointCache)
+    {
+        fileTypes += " and point cache";
+    }
+
+    std::cout << fileTypes << " files: " << stream::ExportStream::getNumWritten() << " written, " <<
+        stream::ExportStream::getNumUnchanged() << " unchanged files left untouched" << std::endl;
+
+    if (options.profile && options.profile->getNumProfiles() > 0)
+    {
+        std::cout << "Stage profile of " << options.profile->getNumProfiles() << " file(s):" << std::endl;
+        options.profile->print(std::cout);
+    }
+
+    if (options.incremental)
+    {
+        std::cout << "Incremental: " << options.incremental->getNumSkipped() << " unchanged files skipped, " <<
+            options.incremental->getNumHashed() << " files read to hash their content" << std::endl;
+    }
+
+    if (options.materialMerger)
+    {
+        std::cout << "Materials: " << options.materialMerger->getNumMerged() << " merged into equivalent ones" << std::endl;
+    }
+
+    if (!options.mediaExtractor) return;
+
+    std::cout << "Embedded textures: " << options.mediaExtractor->getNumWritten() << " written (" <<
+        options.mediaExtractor->getNumCompressed() << " compressed to DDS), " <<
+        options.mediaExtractor->getNumUnchanged() << " unchanged, " <<
+        options.mediaExtractor->getNumDuplicates() << " duplicates skipped" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 1)
+    {
+        std::cout << "Single File Usage: FbxToLwo <file1.fbx> <file2.fbx> <...>" << std::endl;
+        std::cout << "  Single specified FBX files will be converted to LWO, which will be placed right next to the FBX files." << std::endl;
+        std::cout << "  Example: FbxToLwo c:\\temp\\model.fbx c:\\temp\\model2.fbx" << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Batch Folder Conversion Usage: FbxToLwo -input <path> -output <path>" << std::endl;
+        std::cout << "  Every FBX in the input folder and all its child folders will be converted to LWO, which will be placed" << std::endl;
+        std::cout << "  in the same relative path in the output folder." << std::endl;
+        std::cout << "  Example: FbxToLwo -input c:\\temp\fbx_files -output c:\\temp\\lwo_files" << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "LWO Re-processing: FbxToLwo <file1.lwo> <...> or FbxToLwo -includeLwo -input <path> -output <path>" << std::endl;
+        std::cout << "  Existing LWO files are read, welded again and written like the converted FBX files, keeping their surfaces." << std::endl;
+        std::cout << "  Single LWO files are written to <name>_reprocessed.lwo, the original is never replaced. In batch mode" << std::endl;
+        std::cout << "  the LWO files of the input folder are only included on request." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Layer Options: -layers file|mesh" << std::endl;
+        std::cout << "  By default all meshes are put into a single layer. Use -layers mesh to create one layer per FBX mesh," << std::endl;
+        std::cout << "  child meshes will reference the layer of their parent mesh. -layers file puts each file into a layer." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Texture Options: -extractTextures <path> [-compressTextures]" << std::endl;
+        std::cout << "  Writes the textures embedded in the FBX files to the given folder and references them in the LWO surfaces." << std::endl;
+        std::cout << "  Textures embedded in several files are only written once. -compressTextures writes PNG, JPEG and TGA" << std::endl;
+        std::cout << "  textures as DDS files with mipmaps, BC1 compressed or BC3 if they have transparent pixels." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Mesh Cache Options: -meshCache" << std::endl;
+        std::cout << "  Writes a binary mesh cache (.mesh) next to each LWO file, holding the welded vertex and index buffers" << std::endl;
+        std::cout << "  of the surfaces in the layout the engine renders them from. It is loaded by mapping it, without parsing." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Point Cache Options: -mdd [-frames <first>:<last>]" << std::endl;
+        std::cout << "  Writes the animation of the meshes as MDD point cache (.mdd) next to each LWO file, moving the LWO points" << std::endl;
+        std::cout << "  along with their animated nodes. The frames of the scene's take are written, or the given frame range." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Skin Options: -bakeSkin rest|<frame>" << std::endl;
+        std::cout << "  Exports the skinned meshes posed by their bones instead of the raw control points, either in the pose" << std::endl;
+        std::cout << "  of the bones without animation or at the given frame. The skin weights are kept in the weight maps." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Collision Options: -collision layer|file [-collisionVertices <n>]" << std::endl;
+        std::cout << "  Builds a convex hull for each connected part of the meshes, for use as collision mesh. The hulls are added" << std::endl;
+        std::cout << "  to the LWO file as one layer each, or written to a separate <name>_cm.lwo file. -collisionVertices limits" << std::endl;
+        std::cout << "  the number of vertices of each hull, keeping the points farthest out (at least 4, 0 means unlimited)." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Material Options: -mergeMaterials [-materialNameRule <regex>]" << std::endl;
+        std::cout << "  Merges materials with equal colours, factors and textures whose names only differ in the parts matching" << std::endl;
+        std::cout << "  the name rule into one surface. The default rule ignores numeric suffixes like .001, use .* to merge" << std::endl;
+        std::cout << "  materials regardless of their names. The merged surface is named after the lowest of the names." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Time Budget Options: -timeBudget <seconds> [-retryTimeBudget <seconds>]" << std::endl;
+        std::cout << "  Stops converting a file once it took longer than the given time and converts the other files first." << std::endl;
+        std::cout << "  The files which ran out of time are converted again at the end, one at a time, with the retry budget" << std::endl;
+        std::cout << "  (four times the time budget by default, 0 means unlimited)." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Profiling Options: -profile" << std::endl;
+        std::cout << "  Prints the time, CPU cycles, instructions, last level cache misses and branch misses spent in each stage" << std::endl;
+        std::cout << "  of the conversion, per file and in total. The counters need perf events (Linux), else only the time is shown." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Metrics Options: [-metrics <file.prom>] [-status] [-metricsInterval <seconds>]" << std::endl;
+        std::cout << "  Publishes the progress counters (files done, queue depths, bytes read and written, triangles welded and" << std::endl;
+        std::cout << "  the stage latency histograms) every 10 seconds or the given interval while converting: -metrics writes" << std::endl;
+        std::cout << "  them to a file in the Prometheus text format, -status prints a status line." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Incremental Options: -incremental <state file>" << std::endl;
+        std::cout << "  Skips the files whose content and options are the same as in the previous run with the same state file," << std::endl;
+        std::cout << "  as long as their LWO file exists. Unchanged files are recognised by their size and modification time" << std::endl;
+        std::cout << "  without reading them. Works for single files and batch conversion." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Geometry Only Options: -geometryOnly" << std::endl;
+        std::cout << "  Converts binary FBX files with a streaming reader which never holds the whole file in memory, for files" << std::endl;
+        std::cout << "  too large to be loaded. Only the mesh geometry is converted, into a single surface without normals, UVs" << std::endl;
+        std::cout << "  and animation. Can't be combined with the layer, texture, material, point cache and skin options." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Instruction Set Options: -isa scalar|sse2|avx2|avx512" << std::endl;
+        std::cout << "  The vectorised kernels use the best instruction set of the CPU, this option forces a lower one." << std::endl;
+        std::cout << "  The output is the same with every instruction set." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Job Usage: FbxToLwo -job <job.txt> [-job <job2.txt> <...>]" << std::endl;
+        std::cout << "  Loads the input file named in the job file once and writes all of its outputs in parallel." << std::endl;
+        std::cout << "  Each line of a job file is either \"input <file.fbx>\" or \"output <file.lwo> [options]\", options being" << std::endl;
+        std::cout << "  layers=single|file|mesh, split=mesh (one file per mesh), weld=<vertex epsilon>, axis=auto|y|z" << std::endl;
+        std::cout << "  cache=mesh|none (write a mesh cache next to the output or not), pointcache=mdd|none, frames=<first>:<last>" << std::endl;
+        std::cout << "  bakeskin=rest|<frame>|none, collision=layer|file|none and collisionvertices=<n>." << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Merge Usage: FbxToLwo -merge <file.lwo> [-layers file|mesh] <file1.fbx> <file2.fbx> <...>" << std::endl;
+        std::cout << "         or: FbxToLwo -merge <file.lwo> [-layers file|mesh] -input <path>" << std::endl;
+        std::cout << "  All specified FBX files (or all FBX files in the input folder) are merged into a single LWO." << std::endl;
+        std::cout << "  Every input file is put into its own layer, use -layers mesh to create one layer per mesh instead." << std::endl;
+        std::cout << "  Example: FbxToLwo -merge c:\\temp\\set.lwo c:\\temp\\wall.fbx c:\\temp\\floor.fbx" << std::endl;
+        return -1;
+    }
+
+    std::filesystem::path inputFolder;
+    std::filesystem::path outputFolder;
+    std::filesystem::path mergeOutputPath;
+    std::vector<std::filesystem::path> inputFiles;
+    std::vector<std::filesystem::path> jobFiles;
+    ExportOptions options;
+    bool hasRetryTimeBudget = false;
+    std::filesystem::path metricsFile;
+    bool printStatus = false;
+    double metricsInterval = 10;
+    bool includeLwo = false;
+    std::filesystem::path textureFolder;
+    bool compressTextures = false;
+    std::filesystem::path incrementalFile;
+    std::set<int> inputArguments;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (string::toLower(argv[i]) == "-input")
+        {
+            if (argc <= i + 1)
+            {
+                std::cerr << "No input folder specified";
+                return -1;
+            }
+
+            inputFolder = argv[i + 1];
+            ++i;
+        }
+        else if (string::toLower(argv[i]) == "-output")
+        {
+            if (argc <= i + 1)
+            {
+                std::cerr << "No output folder specified";
+                return -1;
+            }
+
+            outputFolder = argv[i + 1];
+            ++i;
+        }
+        else if (string::toLower(argv[i]) == "-includelwo")
+        {
+            includeLwo = true;
+        }
+        else if (string::toLower(argv[i]) == "-merge")
+        {
+            if (argc <= i + 1)
+            {
+                std::cerr << "No merge output file specified";
+                return -1;
+            }
+
+            mergeOutputPath = argv[i + 1];
+            ++i;
+        }
+        else if (string::toLower(argv[i]) == "-layers")
+        {
+            auto mode = argc > i + 1 ? string::toLower(argv[i + 1]) : std::string();
+
+            if (mode == "file")
+            {
+                options.layerMode = LayerMode::PerFile;
+            }
+            else if (mode == "mesh")
+            {
+                options.layerMode = LayerMode::PerMesh;
+            }
+            else
+            {
+                std::cerr << "The -layers option expects either file or mesh" << std::endl;
+                return -1;
+            }
+
+            ++i;
+        }
+        else if (string::toLower(argv[i]) == "-job")
+        {
+            if (argc <= i + 1)
+            {
+                std::cerr << "No job file specified";
+                return -1;
+            }
+
+            jobFiles.emplace_back(argv[i + 1]);
+            ++i;
+        }
+        else if (string::toLower(argv[i]) == "-extracttextures")
+        {
+            if (argc <= i + 1)
+            {
+                std::cerr << "No texture output folder specified";
+                return -1;
+            }
+
+            textureFolder = argv[i + 1];
+            ++i;
+        }
+        else if (string::toLower(argv[i]) == "-compresstextures")
+        {
+            compressTextures = true;
+        }
+        else if (string::toLower(argv[i]) == "-mergematerials")
+        {
+            if (!options.materialMerger)
+            {
+                options.materialMerger = std::make_shared<model::MaterialMerger>();
+            }
+        }
+        else if (string::toLower(argv[i]) == "-materialnamerule")
+        {
+            if (argc <= i + 1)
+            {
+                std::cerr << "No material name rule specified";
+                return -1;
+            }
+
+            try
+            {
+                options.materialMerger = std::make_shared<model::MaterialMerger>(argv[i + 1]);
+            }
+            catch (const std::regex_error& ex)
+            {
+                std::cerr << "Invalid material name rule " << argv[i + 1] << ": " << ex.what() << std::endl;
+                return -1;
+            }
+
+            ++i;
+        }
+        else if (string::toLower(argv[i]) == "-timebudget" || string::toLower(argv[i]) == "-retrytimebudget")
+        {
+            double seconds = -1;
+
+            try
+            {
+                seconds = argc > i + 1 ? std::stod(argv[i + 1]) : -1;
+            }
+            catch (const std::exception&)
+            {}
+
+            if (seconds < 0)
+            {
+                std::cerr << "The " << argv[i] << " option expects a number of seconds" << std::endl;
+                return -1;
+            }
+
+            if (string::toLower(argv[i]) == "-timebudget")
+            {
+                options.timeBudget = std::chrono::duration<double>(seconds);
+            }
+            else
+            {
+                options.retryTimeBudget = std::chrono::duration<double>(seconds);
+                hasRetryTimeBudget = true;
+            }
+
+            ++i;
+        }
+        else if (string::toLower(argv[i]) == "-meshcache")
+        {
+            options.writeMeshCache = true;
+        }
+        else if (string::toLower(argv[i]) == "-mdd")
+        {
+            options.writePointCache = true;
+        }
+        else if (string::toLower(argv[i]) == "-collision")
+        {
+            auto mode = argc > i + 1 ? string::toLower(argv[i + 1]) : std::string();
+
+            if (mode == "layer")
+            {
+                options.collisionMode = CollisionMode::Layer;
+            }
+            else if (mode == "file")
+            {
+                options.collisionMode = CollisionMode::File;
+            }
+            else
+            {
+                std::cerr << "The -collision option expects either layer or file" << std::endl;
+                return -1;
+            }
+
+            ++i;
+        }
+        else if (string::toLower(argv[i]) == "-collisionvertices")
+        {
+            if (argc <= i + 1 || !ParseCollisionVertexBudget(argv[i + 1], options.collisionVertexBudget))
+            {
+                std::cerr << "The -collisionVertices option expects 0 (unlimited) or a number of at least 4" << std::endl;
+                return -1;
+            }
+
+            ++i;
+        }
+        else if (string::toLower(argv[i]) == "-bakeskin")
+        {
+            if (argc <= i + 1 || !ParseSkinBake(string::toLower(argv[i + 1]), options.skinBake, options.skinBakeFrame))
+            {
+                std::cerr << "The -bakeSkin option expects rest or a frame number" << std::endl;
+                return -1;
+            }
+
+            ++i;
+        }
+        else if (string::toLower(argv[i]) == "-frames")
+        {
+            if (argc <= i + 1 || !ParseFrameRange(argv[i + 1], options.frameRange))
+            {
+                std::cerr << "The -frames option expects a frame range like 0:100" << std::endl;
+                return -1;
+            }
+
+            options.hasFrameRange = true;
+            ++i;
+        }
+        else if (string::toLower(argv[i]) == "-profile")
+        {
+            options.profile = std::make_shared<profiling::ProfileTotals>();
+        }
+        else if (string::toLower(argv[i]) == "-metrics")
+        {
+            if (argc <= i + 1)
+            {
+                std::cerr << "The -metrics option expects the path of the metrics file" << std::endl;
+                return -1;
+            }
+
+            metricsFile = argv[++i];
+        }
+        else if (string::toLower(argv[i]) == "-status")
+        {
+            printStatus = true;
+        }
+        else if (string::toLower(argv[i]) == "-metricsinterval")
+        {
+            metricsInterval = 0;
+
+            try
+            {
+                metricsInterval = argc > i + 1 ? std::stod(argv[i + 1]) : 0;
+            }
+            catch (const std::exception&)
+            {}
+
+            if (metricsInterval <= 0)
+            {
+                std::cerr << "The -metricsInterval option expects a positive number of seconds" << std::endl;
+                return -1;
+            }
+
+            ++i;
+        }
+        else if (string::toLower(argv[i]) == "-incremental")
+        {
+            if (argc <= i + 1)
+            {
+                std::cerr << "The -incremental option expects the path of the state file" << std::endl;
+                return -1;
+            }
+
+            incrementalFile = argv[++i];
+        }
+        else if (string::toLower(argv[i]) == "-geometryonly")
+        {
+            options.geometryOnly = true;
+        }
+        else if (string::toLower(argv[i]) == "-isa")
+        {
+            simd::Isa isa;
+
+            if (argc <= i + 1 || !simd::parseIsa(argv[i + 1], isa))
+            {
+                std::cerr << "The -isa option expects one of scalar, sse2, avx2 or avx512" << std::endl;
+                return -1;
+            }
+
+            if (!simd::setActiveIsa(isa))
+            {
+                std::cerr << "This CPU doesn't support " << simd::getIsaName(isa) << ", the best supported set is " <<
+                    simd::getIsaName(simd::getSupportedIsa()) << std::endl;
+                return -1;
+            }
+
+            ++i;
+        }
+        else
+        {
+            inputFiles.emplace_back(argv[i]);
+            inputArguments.insert(i);
+        }
+    }
+
+    if (!textureFolder.empty())
+    {
+        options.mediaExtractor = std::make_shared<model::EmbeddedMediaExtractor>(textureFolder, compressTextures);
+    }
+    else if (compressTextures)
+    {
+        std::cerr << "The -compressTextures option needs the -extractTextures folder" << std::endl;
+        return -1;
+    }
+
+    if (options.geometryOnly && (!jobFiles.empty() || !mergeOutputPath.empty() || options.layerMode != LayerMode::Single ||
+        options.mediaExtractor || options.materialMerger || options.writePointCache || options.skinBake != SkinBake::None))
+    {
+        std::cerr << "The -geometryOnly option only works for single files and batch conversion, without layer, texture," << std::endl;
+        std::cerr << "material, point cache or skin options" << std::endl;
+        return -1;
+    }
+
+    if (!incrementalFile.empty())
+    {
+        if (!jobFiles.empty() || !mergeOutputPath.empty())
+        {
+            std::cerr << "The -incremental option only works for single files and batch conversion" << std::endl;
+            return -1;
+        }
+
+        // All arguments besides the input files and the state file go into the keys of the conversions,
+        // any change to them converts all files again
+        math::Hash optionsHash;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            if (string::toLower(argv[i]) == "-incremental")
+            {
+                ++i;
+            }
+            else if (inputArguments.count(i) == 0)
+            {
+                std::string argument(argv[i]);
+                optionsHash.addSizet(argument.size());
+                optionsHash.addString(argument);
+            }
+        }
+
+        options.incremental = std::make_shared<model::IncrementalState>(incrementalFile, optionsHash);
+    }
+
+    // Files exceeding the time budget get four times as long on their second attempt by default
+    if (!hasRetryTimeBudget)
+    {
+        options.retryTimeBudget = options.timeBudget * 4;
+    }
+
+    // Publishes the progress until main returns
+    std::unique_ptr<metrics::Publisher> metricsPublisher;
+
+    if (!metricsFile.empty() || printStatus)
+    {
+        metricsPublisher = std::make_unique<metrics::Publisher>(metricsFile, printStatus,
+            std::chrono::duration_cast<metrics::Publisher::Clock::duration>(std::chrono::duration<double>(metricsInterval)));
+    }
+
+    if (!jobFiles.empty())
+    {
+        for (const auto& jobFile : jobFiles)
+        {
+            try
+            {
+                RunExportJob(ReadExportJob(jobFile, options));
+            }
+            catch (const std::exception& ex)
+            {
+                std::cerr << "Failed to run job " << jobFile.string() << ": " << ex.what() << std::endl;
+            }
+        }
+
+        PrintSummary(options);
+        return 0;
+    }
+
+    if (!mergeOutputPath.empty())
+    {
+        if (!inputFolder.empty() && std::filesystem::is_directory(inputFolder))
+        {
+            for (auto i = std::filesystem::recursive_directory_iterator(inputFolder); i != std::filesystem::recursive_directory_iterator(); ++i)
+            {
+                if (string::toLower(i->path().extension().string()) == ".fbx")
+                {
+                    inputFiles.push_back(i->path());
+                }
+            }
+        }
+
+        if (inputFiles.empty())
+        {
+            std::cerr << "No input files to merge" << std::endl;
+            return -1;
+        }
+
+        if (options.writePointCache)
+        {
+            std::cerr << "The -mdd option can't be used when merging files" << std::endl;
+            return -1;
+        }
+
+        if (options.layerMode == LayerMode::Single)
+        {
+            options.layerMode = LayerMode::PerFile;
+        }
+
+        try
+        {
+            MergeFbxFilesToLwo(inputFiles, mergeOutputPath, options);
+        }
+        catch (const std::exception& ex)
+        {
+            std::cerr << "Failed to merge files into " << mergeOutputPath << ": " << ex.what() << std::endl;
+            return -1;
+        }
+
+        PrintSummary(options);
+        return 0;
+    }
+
+    if (inputFolder.empty() ^ outputFolder.empty())
+    {
+        std::cerr << "Both input and output folders must be specified" << std::endl;
+        return -1;
+    }
+
+    if (std::filesystem::is_directory(inputFolder) && !outputFolder.empty())
+    {
+        std::cout << "Batch-converting the FBX files in directory " << inputFolder.string() << " to " << outputFolder.string() << std::endl;
+
+        std::vector<FileConversion> conversions;
+
+        for (auto i = std::filesystem::recursive_directory_iterator(inputFolder); i != std::filesystem::recursive_directory_iterator(); ++i)
+        {
+            if (string::toLower(i->path().extension().string()) == ".fbx" || (includeLwo && IsLwoFile(i->path())))
+            {
+                auto outputPath = outputFolder / std::filesystem::relative(i->path(), inputFolder);
+                outputPath.replace_extension("lwo");
+
+                conversions.push_back(FileConversion{ i->path(), outputPath,
+                    "Converting: " + i->path().string() + " => " + outputPath.string() });
+            }
+        }
+
+        ConvertFbxFilesToLwo(conversions, options);
+        SaveIncrementalState(options);
+
+        PrintSummary(options);
+        return 0;
+    }
+
+    std::vector<FileConversion> conversions;
+
+    for (const auto& inputPath : inputFiles)
+    {
+        if (!std::filesystem::exists(inputPath))
+        {
+            std::cerr << "Failed to handle file " << inputPath << ": Path does not exist " << inputPath.string() << std::endl;
+            continue;
+        }
+
+        if (std::filesystem::is_regular_file(inputPath))
+        {
+            std::filesystem::path outputPath = inputPath;
+            outputPath.replace_extension("lwo");
+
+            conversions.push_back(FileConversion{ inputPath, outputPath, "Trying to convert file " + inputPath.string() });
+        }
+    }
+
+    ConvertFbxFilesToLwo(conversions, options);
+    SaveIncrementalState(options);
+
+    PrintSummary(options);
     return 0;
 }
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <filesystem>
+#include "ContentHash.h"
+
+namespace model
+{
+
+/**
+ * Remembers which input files have been converted with which options, so the next run can skip
+ * the files which didn't change since. Inputs are identified by their content hash, with the size
+ * and modification time check of the ContentHashCache in front, so unchanged files aren't even read.
+ * A conversion stays up to date as long as its output file exists. The state is kept in a text
+ * file, the hash cache next to it in <file>.hashes. Can be used from several threads at once.
+ */
+class IncrementalState
+{
+private:
+    std::filesystem::path _path;
+
+    // Fingerprint of everything besides the input content which affects the output
+    std::string _optionsHash;
+
+    math::ContentHashCache _hashes;
+
+    mutable std::mutex _lock;
+
+    // Absolute generic output path => key of the conversion which wrote it
+    std::map<std::string, std::string> _conversions;
+
+    std::atomic<std::size_t> _numSkipped;
+
+public:
+    // Loads the state saved by the previous run, a missing file is not an error
+    IncrementalState(const std::filesystem::path& path, const std::string& optionsHash) :
+        _path(path),
+        _optionsHash(optionsHash),
+        _numSkipped(0)
+    {
+        _hashes.load(GetHashesPath(path));
+
+        std::ifstream stream(path);
+        std::string line;
+
+        // One conversion per line: <key> <output path>
+        while (std::getline(stream, line))
+        {
+            std::istringstream fields(line);
+            std::string key;
+            std::string outputPath;
+
+            if (!(fields >> key)) continue;
+
+            std::getline(fields >> std::ws, outputPath);
+
+            if (!outputPath.empty())
+            {
+                _conversions[outputPath] = key;
+            }
+        }
+    }
+
+    // Number of conversions found to be up to date
+    std::size_t getNumSkipped() const
+    {
+        return _numSkipped;
+    }
+
+    // The number of input files which had to be read to get their content hash
+    std::size_t getNumHashed() const
+    {
+        return _hashes.getNumHashed();
+    }
+
+    // Returns the key of converting the given file with the current options,
+    // throws std::runtime_error if the file cannot be read
+    std::string getKey(const std::filesystem::path& inputPath)
+    {
+        math::Hash hash;
+        hash.addString(_hashes.get(inputPath));
+        hash.addString(_optionsHash);
+
+        return hash;
+    }
+
+    // True if the output file exists and has been written by a conversion with the same key,
+    // such conversions are counted as skipped
+    bool isUpToDate(const std::string& key, const std::filesystem::path& outputPath)
+    {
+        std::error_code ec;
+
+        if (!std::filesystem::exists(outputPath, ec))
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(_lock);
+
+        auto existing = _conversions.find(GetEntryName(outputPath));
+
+        if (existing == _conversions.end() || existing->second != key)
+        {
+            return false;
+        }
+
+        ++_numSkipped;
+        return true;
+    }
+
+    // Records the successful conversion with the given key
+    void markConverted(const std::string& key, const std::filesystem::path& outputPath)
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _conversions[GetEntryName(outputPath)] = key;
+    }
+
+    // Writes the state for the next run, throws std::runtime_error on failure
+    void save() const
+    {
+        _hashes.save(GetHashesPath(_path));
+
+        std::ofstream stream(_path);
+
+        if (!stream.is_open())
+        {
+            throw std::runtime_error("Cannot open file for writing: " + _path.string());
+        }
+
+        std::lock_guard<std::mutex> lock(_lock);
+
+        for (const auto& [outputPath, key] : _conversions)
+        {
+            stream << key << ' ' << outputPath << '\n';
+        }
+
+        if (!stream.flush())
+        {
+            throw std::runtime_error("Cannot write " + _path.string());
+        }
+    }
+
+private:
+    static std::string GetEntryName(const std::filesystem::path& outputPath)
+    {
+        return std::filesystem::absolute(outputPath).generic_string();
+    }
+
+    static std::filesystem::path GetHashesPath(const std::filesystem::path& path)
+    {
+        auto hashesPath = path;
+        hashesPath += ".hashes";
+
+        return hashesPath;
+    }
+};
+
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <stdexcept>
+#include <filesystem>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace stream
+{
+
+/**
+ * Maps a whole file read-only into memory. The pages are loaded by the OS on first
+ * access, so large files can be processed without reading them into a buffer first,
+ * and several threads can work on different ranges of the file at once.
+ */
+class MappedFile
+{
+private:
+    const unsigned char* _data = nullptr;
+    std::size_t _size = 0;
+
+#ifdef _WIN32
+    HANDLE _file = INVALID_HANDLE_VALUE;
+    HANDLE _mapping = nullptr;
+#endif
+
+public:
+    // Throws std::runtime_error if the file cannot be opened or mapped
+    explicit MappedFile(const std::filesystem::path& path)
+    {
+#ifdef _WIN32
+        _file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+        if (_file == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error("Cannot open file for reading: " + path.string());
+        }
+
+        LARGE_INTEGER size;
+
+        if (!GetFileSizeEx(_file, &size))
+        {
+            CloseHandle(_file);
+            throw std::runtime_error("Cannot determine the size of " + path.string());
+        }
+
+        _size = static_cast<std::size_t>(size.QuadPart);
+
+        // Empty files cannot be mapped
+        if (_size == 0) return;
+
+        _mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        _data = _mapping ? static_cast<const unsigned char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+
+        if (_data == nullptr)
+        {
+            if (_mapping) CloseHandle(_mapping);
+            CloseHandle(_file);
+            throw std::runtime_error("Cannot map file into memory: " + path.string());
+        }
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+
+        if (fd < 0)
+        {
+            throw std::runtime_error("Cannot open file for reading: " + path.string());
+        }
+
+        struct stat info;
+
+        if (fstat(fd, &info) != 0)
+        {
+            close(fd);
+            throw std::runtime_error("Cannot determine the size of " + path.string());
+        }
+
+        _size = static_cast<std::size_t>(info.st_size);
+
+        if (_size > 0)
+        {
+            void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (data == MAP_FAILED)
+            {
+                close(fd);
+                throw std::runtime_error("Cannot map file into memory: " + path.string());
+            }
+
+            _data = static_cast<const unsigned char*>(data);
+
+            // The file is mostly read from front to back
+            madvise(data, _size, MADV_SEQUENTIAL);
+        }
+
+        // The mapping stays valid after closing the descriptor
+        close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (_data) UnmapViewOfFile(_data);
+        if (_mapping) CloseHandle(_mapping);
+        if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+#else
+        if (_data) munmap(const_cast<unsigned char*>(_data), _size);
+#endif
+    }
+
+    const unsigned char* data() const
+    {
+        return _data;
+    }
+
+    std::size_t size() const
+    {
+        return _size;
+    }
+};
+
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <map>
+#include <regex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "openfbx/ofbx.h"
+#include "math/Hash.h"
+#include "ContentHash.h"
+
+namespace model
+{
+
+/**
+ * Finds materials which only differ in their name, like the Mat.001 and Mat.002 copies
+ * many DCC tools create, and assigns them a common name so their polygons end up in
+ * the same surface. Materials are equivalent if their colours, factors and textures are
+ * equal and their names are equal after removing the parts matching the name rule.
+ * The default rule strips numeric suffixes, a rule matching everything (.*) merges
+ * materials by their properties only. Can be used from several threads at once.
+ */
+class MaterialMerger
+{
+public:
+	// Material => the name it should be exported with
+	typedef std::map<const ofbx::Material*, std::string> MaterialNames;
+
+	static constexpr const char* const DefaultNameRule = R"(\.\d+$)";
+
+private:
+	std::regex _nameRule;
+
+	std::atomic<std::size_t> _numMerged;
+
+public:
+	// Throws std::regex_error if the rule is not a valid regular expression
+	MaterialMerger(const std::string& nameRule = DefaultNameRule) :
+		_nameRule(nameRule),
+		_numMerged(0)
+	{}
+
+	// Number of materials which have been merged into an equivalent one
+	std::size_t getNumMerged() const
+	{
+		return _numMerged;
+	}
+
+	// Returns the export name of every material used by the given meshes, equivalent
+	// materials share the lowest of their names
+	MaterialNames resolve(const std::vector<const ofbx::Mesh*>& meshes)
+	{
+		// Fingerprint => equivalent materials
+		std::map<std::string, std::vector<const ofbx::Material*>> groups;
+		MaterialNames names;
+
+		// Content hash of each embedded texture, the copies of a material usually share them
+		TextureHashes textureHashes;
+
+		for (auto mesh : meshes)
+		{
+			for (int m = 0; m < mesh->getMaterialCount(); ++m)
+			{
+				auto material = mesh->getMaterial(m);
+
+				if (names.emplace(material, material->name).second)
+				{
+					groups[GetFingerprint(*material, textureHashes)].push_back(material);
+				}
+			}
+		}
+
+		for (const auto& pair : groups)
+		{
+			const auto& group = pair.second;
+
+			auto lowest = std::min_element(group.begin(), group.end(), [](const ofbx::Material* a, const ofbx::Material* b)
+			{
+				return std::string(a->name) < std::string(b->name);
+			});
+
+			for (auto material : group)
+			{
+				names[material] = (*lowest)->name;
+			}
+
+			_numMerged += group.size() - 1;
+		}
+
+		return names;
+	}
+
+private:
+	// Start of the embedded content => its content hash
+	typedef std::map<const ofbx::u8*, std::string> TextureHashes;
+
+	std::string GetFingerprint(const ofbx::Material& material, TextureHashes& textureHashes) const
+	{
+		constexpr std::size_t SignificantDigits = 4;
+
+		math::Hash hash;
+
+		AddString(hash, std::regex_replace(std::string(material.name), _nameRule, ""));
+
+		for (const auto& color : { material.getDiffuseColor(), material.getSpecularColor(), material.getReflectionColor(),
+			material.getAmbientColor(), material.getEmissiveColor() })
+		{
+			hash.addVector3(Vector3(color.r, color.g, color.b), SignificantDigits);
+		}
+
+		for (auto factor : { material.getDiffuseFactor(), material.getSpecularFactor(), material.getReflectionFactor(),
+			material.getShininess(), material.getShininessExponent(), material.getAmbientFactor(), material.getBumpFactor(),
+			material.getEmissiveFactor() })
+		{
+			hash.addDouble(factor, SignificantDigits);
+		}
+
+		// Textures are compared by their file and their embedded content
+		for (int type = 0; type < ofbx::Texture::COUNT; ++type)
+		{
+			auto texture = material.getTexture(static_cast<ofbx::Texture::TextureType>(type));
+
+			if (texture == nullptr) continue;
+
+			hash.addSizet(type);
+			AddString(hash, ToString(texture->getFileName()));
+			AddString(hash, ToString(texture->getRelativeFileName()));
+
+			auto content = texture->getEmbeddedData();
+			auto contentHash = textureHashes.find(content.begin);
+
+			if (contentHash == textureHashes.end())
+			{
+				contentHash = textureHashes.emplace(content.begin, math::ContentHash::ofData(content.begin, content.end - content.begin)).first;
+			}
+
+			AddString(hash, contentHash->second);
+		}
+
+		return hash;
+	}
+
+	// Length-prefixed, so the boundaries between consecutive (possibly empty) strings can't shift
+	static void AddString(math::Hash& hash, const std::string& str)
+	{
+		hash.addSizet(str.size());
+		hash.addString(str);
+	}
+
+	static std::string ToString(const ofbx::DataView& data)
+	{
+		return std::string(reinterpret_cast<const char*>(data.begin), data.end - data.begin);
+	}
+};
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+namespace model
+{
+
+/**
+ * Interns material names into dense IDs (0, 1, 2, ...) in the order they are first seen.
+ * The surfaces carry the ID only, so the welding and export stages can use it as array
+ * index instead of comparing and looking up the names. One instance is shared by the
+ * exporters of a single conversion or merge, so the IDs stay as few as the materials of
+ * that output. It can be used from several threads at once.
+ */
+class MaterialRegistry
+{
+private:
+	mutable std::mutex _lock;
+
+	std::unordered_map<std::string, unsigned int> _ids;
+
+	// Names by ID, a deque keeps the references returned by getName() valid
+	std::deque<std::string> _names;
+
+public:
+	// Returns the ID of the given material name, assigning the next free ID to new names
+	unsigned int intern(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+
+		auto result = _ids.try_emplace(name, static_cast<unsigned int>(_names.size()));
+
+		if (result.second)
+		{
+			_names.push_back(name);
+		}
+
+		return result.first->second;
+	}
+
+	const std::string& getName(unsigned int id) const
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		return _names.at(id);
+	}
+
+	// Number of IDs assigned so far, all IDs are lower than this
+	std::size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		return _names.size();
+	}
+
+	// Sorts the given IDs by their material name, which is the order the exporters write them in
+	void sortByName(std::vector<unsigned int>& ids) const
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+
+		std::sort(ids.begin(), ids.end(), [&](unsigned int a, unsigned int b)
+		{
+			return _names[a] < _names[b];
+		});
+	}
+};
+
+}
@@ -0,0 +1,414 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <thread>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <filesystem>
+#include <condition_variable>
+#include "StageProfiler.h"
+
+namespace metrics
+{
+
+/**
+ * Latency histogram with fixed bucket bounds (in seconds). Observations only increment
+ * atomic counters, so any number of threads can record into it without locking.
+ */
+class Histogram
+{
+public:
+    static constexpr std::size_t NumBounds = 11;
+
+    static const std::array<double, NumBounds>& getBounds()
+    {
+        static const std::array<double, NumBounds> bounds = { 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60 };
+        return bounds;
+    }
+
+    // Non-cumulative bucket counts, the last bucket holds the values above all bounds
+    struct Snapshot
+    {
+        std::array<uint64_t, NumBounds + 1> buckets = {};
+        uint64_t count = 0;
+        double sum = 0;
+    };
+
+private:
+    std::array<std::atomic<uint64_t>, NumBounds + 1> _buckets;
+    std::atomic<uint64_t> _sumMicroseconds;
+
+public:
+    Histogram() :
+        _sumMicroseconds(0)
+    {
+        for (auto& bucket : _buckets)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void observe(double seconds)
+    {
+        const auto& bounds = getBounds();
+        std::size_t bucket = 0;
+
+        while (bucket < NumBounds && seconds > bounds[bucket])
+        {
+            ++bucket;
+        }
+
+        _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        _sumMicroseconds.fetch_add(static_cast<uint64_t>(std::max(seconds, 0.0) * 1e6), std::memory_order_relaxed);
+    }
+
+    Snapshot getSnapshot() const
+    {
+        Snapshot snapshot;
+
+        for (std::size_t b = 0; b < _buckets.size(); ++b)
+        {
+            snapshot.buckets[b] = _buckets[b].load(std::memory_order_relaxed);
+            snapshot.count += snapshot.buckets[b];
+        }
+
+        snapshot.sum = _sumMicroseconds.load(std::memory_order_relaxed) / 1e6;
+
+        return snapshot;
+    }
+};
+
+/**
+ * Progress counters of the running process. They are plain relaxed atomics updated from
+ * whatever thread does the work, the values are only read for reporting.
+ */
+struct Counters
+{
+    // File conversions, done = converted + failed + timedOut
+    std::atomic<uint64_t> filesQueued{ 0 };
+    std::atomic<uint64_t> filesConverted{ 0 };
+    std::atomic<uint64_t> filesFailed{ 0 };
+    std::atomic<uint64_t> filesTimedOut{ 0 };       // exceeded the retry budget as well
+    std::atomic<uint64_t> budgetsExceeded{ 0 };     // attempts stopped by the time budget
+
+    // Queue depths
+    std::atomic<int64_t> filesPending{ 0 };         // waiting for their first attempt
+    std::atomic<int64_t> filesRunning{ 0 };
+    std::atomic<int64_t> filesRetryPending{ 0 };    // waiting for the retry pass
+
+    std::atomic<uint64_t> bytesRead{ 0 };
+    std::atomic<uint64_t> bytesWritten{ 0 };
+    std::atomic<uint64_t> trianglesWelded{ 0 };
+
+    // Time spent in each stage, excluding the nested stages
+    std::array<Histogram, profiling::NumStages> stageSeconds;
+};
+
+inline Counters& getCounters()
+{
+    static Counters counters;
+    return counters;
+}
+
+template<typename T>
+inline void add(std::atomic<T>& counter, typename std::atomic<T>::value_type value)
+{
+    counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+// Copy of all counters at one point in time
+struct Snapshot
+{
+    std::chrono::steady_clock::time_point time;
+
+    uint64_t filesQueued = 0;
+    uint64_t filesConverted = 0;
+    uint64_t filesFailed = 0;
+    uint64_t filesTimedOut = 0;
+    uint64_t budgetsExceeded = 0;
+
+    int64_t filesPending = 0;
+    int64_t filesRunning = 0;
+    int64_t filesRetryPending = 0;
+
+    uint64_t bytesRead = 0;
+    uint64_t bytesWritten = 0;
+    uint64_t trianglesWelded = 0;
+
+    std::array<Histogram::Snapshot, profiling::NumStages> stageSeconds;
+
+    uint64_t getFilesDone() const
+    {
+        return filesConverted + filesFailed + filesTimedOut;
+    }
+
+    static Snapshot take()
+    {
+        const auto& counters = getCounters();
+        Snapshot snapshot;
+
+        snapshot.time = std::chrono::steady_clock::now();
+        snapshot.filesQueued = counters.filesQueued.load(std::memory_order_relaxed);
+        snapshot.filesConverted = counters.filesConverted.load(std::memory_order_relaxed);
+        snapshot.filesFailed = counters.filesFailed.load(std::memory_order_relaxed);
+        snapshot.filesTimedOut = counters.filesTimedOut.load(std::memory_order_relaxed);
+        snapshot.budgetsExceeded = counters.budgetsExceeded.load(std::memory_order_relaxed);
+        snapshot.filesPending = counters.filesPending.load(std::memory_order_relaxed);
+        snapshot.filesRunning = counters.filesRunning.load(std::memory_order_relaxed);
+        snapshot.filesRetryPending = counters.filesRetryPending.load(std::memory_order_relaxed);
+        snapshot.bytesRead = counters.bytesRead.load(std::memory_order_relaxed);
+        snapshot.bytesWritten = counters.bytesWritten.load(std::memory_order_relaxed);
+        snapshot.trianglesWelded = counters.trianglesWelded.load(std::memory_order_relaxed);
+
+        for (std::size_t s = 0; s < profiling::NumStages; ++s)
+        {
+            snapshot.stageSeconds[s] = counters.stageSeconds[s].getSnapshot();
+        }
+
+        return snapshot;
+    }
+};
+
+// Stage listener recording into the stage histograms
+inline void recordStage(profiling::Stage stage, double seconds)
+{
+    getCounters().stageSeconds[static_cast<std::size_t>(stage)].observe(seconds);
+}
+
+// Writes the snapshot in the Prometheus text exposition format
+inline void writePrometheus(std::ostream& stream, const Snapshot& snapshot)
+{
+    auto metric = [&](const char* name, const char* type, const char* help)
+    {
+        stream << "# HELP fbxtolwo_" << name << " " << help << "\n";
+        stream << "# TYPE fbxtolwo_" << name << " " << type << "\n";
+    };
+
+    metric("files_queued_total", "counter", "FBX files queued for conversion");
+    stream << "fbxtolwo_files_queued_total " << snapshot.filesQueued << "\n";
+
+    metric("files_done_total", "counter", "FBX files done, by result");
+    stream << "fbxtolwo_files_done_total{result=\"converted\"} " << snapshot.filesConverted << "\n";
+    stream << "fbxtolwo_files_done_total{result=\"failed\"} " << snapshot.filesFailed << "\n";
+    stream << "fbxtolwo_files_done_total{result=\"timed_out\"} " << snapshot.filesTimedOut << "\n";
+
+    metric("time_budgets_exceeded_total", "counter", "Conversion attempts stopped by the time budget");
+    stream << "fbxtolwo_time_budgets_exceeded_total " << snapshot.budgetsExceeded << "\n";
+
+    metric("queue_depth", "gauge", "FBX files waiting or being converted");
+    stream << "fbxtolwo_queue_depth{queue=\"pending\"} " << snapshot.filesPending << "\n";
+    stream << "fbxtolwo_queue_depth{queue=\"running\"} " << snapshot.filesRunning << "\n";
+    stream << "fbxtolwo_queue_depth{queue=\"retry\"} " << snapshot.filesRetryPending << "\n";
+
+    metric("read_bytes_total", "counter", "Bytes of FBX files read");
+    stream << "fbxtolwo_read_bytes_total " << snapshot.bytesRead << "\n";
+
+    metric("written_bytes_total", "counter", "Bytes of LWO files written");
+    stream << "fbxtolwo_written_bytes_total " << snapshot.bytesWritten << "\n";
+
+    metric("welded_triangles_total", "counter", "Triangles welded into surfaces");
+    stream << "fbxtolwo_welded_triangles_total " << snapshot.trianglesWelded << "\n";
+
+    metric("stage_duration_seconds", "histogram", "Time spent in each conversion stage, excluding nested stages");
+
+    for (std::size_t s = 0; s < profiling::NumStages; ++s)
+    {
+        const auto& histogram = snapshot.stageSeconds[s];
+        auto stage = profiling::getStageName(static_cast<profiling::Stage>(s));
+        uint64_t cumulative = 0;
+
+        for (std::size_t b = 0; b < Histogram::NumBounds; ++b)
+        {
+            cumulative += histogram.buckets[b];
+            stream << "fbxtolwo_stage_duration_seconds_bucket{stage=\"" << stage << "\",le=\"" <<
+                Histogram::getBounds()[b] << "\"} " << cumulative << "\n";
+        }
+
+        stream << "fbxtolwo_stage_duration_seconds_bucket{stage=\"" << stage << "\",le=\"+Inf\"} " << histogram.count << "\n";
+        stream << "fbxtolwo_stage_duration_seconds_sum{stage=\"" << stage << "\"} " << histogram.sum << "\n";
+        stream << "fbxtolwo_stage_duration_seconds_count{stage=\"" << stage << "\"} " << histogram.count << "\n";
+    }
+}
+
+namespace detail
+{
+    inline std::string formatBytes(double bytes)
+    {
+        static const char* const units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+        std::size_t unit = 0;
+
+        while (bytes >= 1024 && unit < 4)
+        {
+            bytes /= 1024;
+            ++unit;
+        }
+
+        std::ostringstream stream;
+        stream << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << bytes << " " << units[unit];
+        return stream.str();
+    }
+
+    inline std::string formatCount(double count)
+    {
+        static const char* const suffixes[] = { "", "k", "M", "G" };
+        std::size_t suffix = 0;
+
+        while (count >= 1000 && suffix < 3)
+        {
+            count /= 1000;
+            ++suffix;
+        }
+
+        std::ostringstream stream;
+        stream << std::fixed << std::setprecision(suffix == 0 ? 0 : 1) << count << suffixes[suffix];
+        return stream.str();
+    }
+}
+
+// One line summary of the snapshot, the rates are measured since the previous snapshot
+inline std::string formatStatusLine(const Snapshot& snapshot, const Snapshot& previous)
+{
+    auto seconds = std::chrono::duration<double>(snapshot.time - previous.time).count();
+    auto rate = [&](uint64_t value, uint64_t previousValue)
+    {
+        return seconds > 0 ? (value - previousValue) / seconds : 0.0;
+    };
+
+    std::ostringstream line;
+
+    line << "Status: " << snapshot.getFilesDone() << "/" << snapshot.filesQueued << " files";
+
+    if (snapshot.filesFailed > 0 || snapshot.filesTimedOut > 0)
+    {
+        line << " (" << snapshot.filesFailed << " failed, " << snapshot.filesTimedOut << " timed out)";
+    }
+
+    line << ", queue " << snapshot.filesPending << " pending/" << snapshot.filesRunning << " running/" <<
+        snapshot.filesRetryPending << " retry" <<
+        " | read " << detail::formatBytes(static_cast<double>(snapshot.bytesRead)) <<
+        " (" << detail::formatBytes(rate(snapshot.bytesRead, previous.bytesRead)) << "/s)" <<
+        ", written " << detail::formatBytes(static_cast<double>(snapshot.bytesWritten)) <<
+        " (" << detail::formatBytes(rate(snapshot.bytesWritten, previous.bytesWritten)) << "/s)" <<
+        ", " << detail::formatCount(static_cast<double>(snapshot.trianglesWelded)) << " triangles" <<
+        " (" << detail::formatCount(rate(snapshot.trianglesWelded, previous.trianglesWelded)) << "/s)";
+
+    return line.str();
+}
+
+/**
+ * Publishes the counters periodically from a background thread: to a file in the Prometheus
+ * text format (e.g. for the node_exporter textfile collector) and/or as status line on the
+ * error stream. The file is replaced atomically, so a scraper never sees a partial one.
+ * Destroying the publisher stops the thread and publishes the final values.
+ */
+class Publisher
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    std::filesystem::path _textFile;
+    bool _statusLine;
+    Clock::duration _interval;
+
+    std::mutex _lock;
+    std::condition_variable _changed;
+    bool _stopping;
+    bool _reportedError;
+    Snapshot _previous;
+    std::thread _thread;
+
+public:
+    // An empty path disables the file
+    Publisher(const std::filesystem::path& textFile, bool statusLine, Clock::duration interval) :
+        _textFile(textFile),
+        _statusLine(statusLine),
+        _interval(interval),
+        _stopping(false),
+        _reportedError(false),
+        _previous(Snapshot::take())
+    {
+        profiling::setStageListener(recordStage);
+
+        _thread = std::thread([this]() { run(); });
+    }
+
+    ~Publisher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            _stopping = true;
+        }
+
+        _changed.notify_all();
+        _thread.join();
+
+        publish();
+    }
+
+    Publisher(const Publisher&) = delete;
+    Publisher& operator=(const Publisher&) = delete;
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+
+        while (!_stopping)
+        {
+            if (_changed.wait_for(lock, _interval, [this]() { return _stopping; })) break;
+
+            lock.unlock();
+            publish();
+            lock.lock();
+        }
+    }
+
+    void publish()
+    {
+        auto snapshot = Snapshot::take();
+
+        if (!_textFile.empty())
+        {
+            writeTextFile(snapshot);
+        }
+
+        if (_statusLine)
+        {
+            std::cerr << (formatStatusLine(snapshot, _previous) + "\n") << std::flush;
+        }
+
+        _previous = snapshot;
+    }
+
+    void writeTextFile(const Snapshot& snapshot)
+    {
+        auto tempFile = _textFile;
+        tempFile += ".tmp";
+
+        {
+            std::ofstream stream(tempFile, std::ios::out | std::ios::trunc);
+            writePrometheus(stream, snapshot);
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tempFile, _textFile, ec);
+
+        // Keep converting if the file cannot be written, but say so once
+        if (ec && !_reportedError)
+        {
+            std::cerr << "Cannot write the metrics file " << _textFile.string() << ": " << ec.message() << std::endl;
+            _reportedError = true;
+        }
+    }
+};
+
+}
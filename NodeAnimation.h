@@ -0,0 +1,275 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "openfbx/ofbx.h"
+#include "math/Matrix4.h"
+#include "Parallel.h"
+
+namespace model
+{
+
+/**
+ * Evaluates the node transforms of a scene's animation at a range of frames. The curves of
+ * every node are sampled in a single pass over their keys, then the global transforms of
+ * all frames are composed in parallel. The first layer of the first animation stack is
+ * used, nodes without curves keep their static transform.
+ */
+class NodeAnimation
+{
+public:
+	// Frame numbers at the scene's frame rate, both ends included
+	struct FrameRange
+	{
+		int first = 0;
+		int last = 0;
+	};
+
+private:
+	const ofbx::AnimationLayer* _layer;
+
+	// The time of each frame in seconds
+	std::vector<double> _times;
+
+	// Node => its global transform at each frame
+	std::map<const ofbx::Object*, std::vector<Matrix4>> _globalTransforms;
+
+public:
+	NodeAnimation(const ofbx::IScene& scene, const FrameRange& frames) :
+		_layer(nullptr)
+	{
+		if (scene.getAnimationStackCount() > 0)
+		{
+			_layer = scene.getAnimationStack(0)->getLayer(0);
+		}
+
+		auto frameRate = GetFrameRate(scene);
+
+		for (int frame = frames.first; frame <= frames.last; ++frame)
+		{
+			_times.push_back(frame / frameRate);
+		}
+	}
+
+	// The frames per second the scene's time mode defines
+	static double GetFrameRate(const ofbx::IScene& scene)
+	{
+		// The default time mode of the FBX SDK is 30 frames per second
+		auto frameRate = scene.getGlobalSettings()->TimeMode == ofbx::FrameRate_DEFAULT ? 30.0 : scene.getSceneFrameRate();
+
+		return frameRate > 0 ? frameRate : 30.0;
+	}
+
+	// The frames of the first animation stack's take. Without a take, the scene's time span
+	// is used, and if that is empty too the range of the animation keys.
+	static FrameRange GetFrameRange(const ofbx::IScene& scene)
+	{
+		double start = scene.getGlobalSettings()->TimeSpanStart;
+		double stop = scene.getGlobalSettings()->TimeSpanStop;
+
+		const ofbx::AnimationLayer* layer = nullptr;
+
+		if (scene.getAnimationStackCount() > 0)
+		{
+			auto stack = scene.getAnimationStack(0);
+			auto take = scene.getTakeInfo(stack->name);
+
+			if (take != nullptr)
+			{
+				start = take->local_time_from;
+				stop = take->local_time_to;
+			}
+
+			layer = stack->getLayer(0);
+		}
+
+		if (stop <= start && layer != nullptr)
+		{
+			GetKeyTimeRange(*layer, start, stop);
+		}
+
+		auto frameRate = GetFrameRate(scene);
+
+		FrameRange range;
+		range.first = static_cast<int>(std::lround(start * frameRate));
+		range.last = std::max(static_cast<int>(std::lround(stop * frameRate)), range.first);
+
+		return range;
+	}
+
+	const std::vector<double>& getTimes() const
+	{
+		return _times;
+	}
+
+	// True if the node or any of its parents has animation curves for its transform
+	bool isAnimated(const ofbx::Object& node) const
+	{
+		if (_layer == nullptr) return false;
+
+		for (auto current = &node; current != nullptr; current = current->getParent())
+		{
+			if (_layer->getCurveNode(*current, "Lcl Translation") != nullptr ||
+				_layer->getCurveNode(*current, "Lcl Rotation") != nullptr ||
+				_layer->getCurveNode(*current, "Lcl Scaling") != nullptr)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Samples the global transforms of the given nodes and their parents at all frames,
+	// nodes which have been sampled before are skipped
+	void sample(const std::vector<const ofbx::Object*>& nodes)
+	{
+		// The nodes to sample, parents before their children
+		std::vector<const ofbx::Object*> order;
+		std::set<const ofbx::Object*> added;
+
+		for (auto node : nodes)
+		{
+			addWithParents(node, order, added);
+		}
+
+		if (order.empty()) return;
+
+		// The local transforms don't depend on each other
+		std::vector<std::vector<Matrix4>> localTransforms(order.size());
+
+		parallel::forEach(order.size(), [&](std::size_t i)
+		{
+			localTransforms[i] = sampleLocalTransforms(*order[i]);
+		});
+
+		// Allocate the results up front, the frames are composed in parallel
+		std::vector<std::vector<Matrix4>*> globals(order.size());
+		std::vector<const std::vector<Matrix4>*> parentGlobals(order.size(), nullptr);
+
+		for (std::size_t i = 0; i < order.size(); ++i)
+		{
+			globals[i] = &_globalTransforms[order[i]];
+			globals[i]->resize(_times.size());
+		}
+
+		for (std::size_t i = 0; i < order.size(); ++i)
+		{
+			if (auto parent = order[i]->getParent())
+			{
+				parentGlobals[i] = &_globalTransforms.at(parent);
+			}
+		}
+
+		parallel::forEach(_times.size(), [&](std::size_t frame)
+		{
+			for (std::size_t i = 0; i < order.size(); ++i)
+			{
+				(*globals[i])[frame] = parentGlobals[i] != nullptr ?
+					(*parentGlobals[i])[frame].getMultipliedBy(localTransforms[i][frame]) : localTransforms[i][frame];
+			}
+		});
+	}
+
+	// The global transform of a sampled node at each frame
+	const std::vector<Matrix4>& getGlobalTransforms(const ofbx::Object& node) const
+	{
+		return _globalTransforms.at(&node);
+	}
+
+	// The global transform of the node from its static properties, composed like the animated ones
+	static Matrix4 GetRestTransform(const ofbx::Object& node)
+	{
+		auto local = ToMatrix4(node.getLocalTransform());
+		auto parent = node.getParent();
+
+		return parent != nullptr ? GetRestTransform(*parent).getMultipliedBy(local) : local;
+	}
+
+	static Matrix4 ToMatrix4(const ofbx::Matrix& m)
+	{
+		return Matrix4::byColumns(
+			m.m[0], m.m[1], m.m[2], m.m[3],
+			m.m[4], m.m[5], m.m[6], m.m[7],
+			m.m[8], m.m[9], m.m[10], m.m[11],
+			m.m[12], m.m[13], m.m[14], m.m[15]);
+	}
+
+private:
+	void addWithParents(const ofbx::Object* node, std::vector<const ofbx::Object*>& order, std::set<const ofbx::Object*>& added) const
+	{
+		if (_globalTransforms.count(node) > 0 || !added.insert(node).second) return;
+
+		if (auto parent = node->getParent())
+		{
+			addWithParents(parent, order, added);
+		}
+
+		order.push_back(node);
+	}
+
+	std::vector<Matrix4> sampleLocalTransforms(const ofbx::Object& node) const
+	{
+		std::vector<ofbx::Vec3> translations(_times.size(), node.getLocalTranslation());
+		std::vector<ofbx::Vec3> rotations(_times.size(), node.getLocalRotation());
+		std::vector<ofbx::Vec3> scalings(_times.size(), node.getLocalScaling());
+
+		bool isAnimated = sampleCurves(node, "Lcl Translation", translations);
+		isAnimated |= sampleCurves(node, "Lcl Rotation", rotations);
+		isAnimated |= sampleCurves(node, "Lcl Scaling", scalings);
+
+		if (!isAnimated)
+		{
+			return std::vector<Matrix4>(_times.size(), ToMatrix4(node.getLocalTransform()));
+		}
+
+		std::vector<Matrix4> transforms;
+		transforms.reserve(_times.size());
+
+		for (std::size_t frame = 0; frame < _times.size(); ++frame)
+		{
+			transforms.push_back(ToMatrix4(node.evalLocal(translations[frame], rotations[frame], scalings[frame])));
+		}
+
+		return transforms;
+	}
+
+	// Overwrites the values with the ones of the property's curves, returns false if it is not animated
+	bool sampleCurves(const ofbx::Object& node, const char* property, std::vector<ofbx::Vec3>& values) const
+	{
+		auto curveNode = _layer != nullptr ? _layer->getCurveNode(node, property) : nullptr;
+
+		if (curveNode == nullptr) return false;
+
+		curveNode->getNodeLocalTransforms(_times.data(), static_cast<int>(_times.size()), values.data());
+		return true;
+	}
+
+	// Sets start and stop to the first and last key of the layer's curves, if it has any
+	static void GetKeyTimeRange(const ofbx::AnimationLayer& layer, double& start, double& stop)
+	{
+		bool hasKeys = false;
+
+		for (int i = 0; layer.getCurveNode(i) != nullptr; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				auto curve = layer.getCurveNode(i)->getCurve(c);
+
+				if (curve == nullptr || curve->getKeyCount() == 0) continue;
+
+				auto first = ofbx::fbxTimeToSeconds(curve->getKeyTime()[0]);
+				auto last = ofbx::fbxTimeToSeconds(curve->getKeyTime()[curve->getKeyCount() - 1]);
+
+				start = hasKeys ? std::min(start, first) : first;
+				stop = hasKeys ? std::max(stop, last) : last;
+				hasKeys = true;
+			}
+		}
+	}
+};
+
+}
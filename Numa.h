@@ -0,0 +1,197 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+namespace parallel
+{
+
+/**
+ * NUMA topology of the machine and pinning of threads to nodes. Memory is placed on
+ * the node of the thread touching it first (the default policy of Linux and Windows),
+ * so a thread pinned to a node before it allocates and fills its buffers gets them
+ * from local memory. Only CPUs the process is allowed to run on are considered, nodes
+ * without such CPUs are left out. On machines with a single node nothing is pinned.
+ */
+namespace numa
+{
+
+struct Node
+{
+    unsigned int id;
+    std::vector<unsigned int> cpus;
+
+#ifdef _WIN32
+    GROUP_AFFINITY affinity;
+#endif
+};
+
+namespace detail
+{
+#ifndef _WIN32
+    // Parses a kernel CPU list like "0-3,8-11"
+    inline std::vector<unsigned int> parseCpuList(const std::string& list)
+    {
+        std::vector<unsigned int> cpus;
+        std::size_t pos = 0;
+
+        while (pos < list.size())
+        {
+            auto end = list.find(',', pos);
+            auto range = list.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+            auto dash = range.find('-');
+
+            try
+            {
+                auto first = std::stoul(range);
+                auto last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+
+                for (auto cpu = first; cpu <= last; ++cpu)
+                {
+                    cpus.push_back(static_cast<unsigned int>(cpu));
+                }
+            }
+            catch (const std::exception&)
+            {} // skip empty or malformed ranges
+
+            if (end == std::string::npos) break;
+            pos = end + 1;
+        }
+
+        return cpus;
+    }
+#endif
+
+    inline std::vector<Node> detectNodes()
+    {
+        std::vector<Node> nodes;
+
+#ifdef _WIN32
+        ULONG highestNode = 0;
+
+        if (!GetNumaHighestNodeNumber(&highestNode)) return nodes;
+
+        for (ULONG id = 0; id <= highestNode; ++id)
+        {
+            Node node{ static_cast<unsigned int>(id), {}, {} };
+
+            if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(id), &node.affinity)) continue;
+
+            for (unsigned int bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit)
+            {
+                if (node.affinity.Mask & (static_cast<KAFFINITY>(1) << bit))
+                {
+                    node.cpus.push_back(node.affinity.Group * static_cast<unsigned int>(sizeof(KAFFINITY) * 8) + bit);
+                }
+            }
+
+            if (!node.cpus.empty())
+            {
+                nodes.push_back(node);
+            }
+        }
+#else
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return nodes;
+
+        std::error_code ec;
+
+        for (std::filesystem::directory_iterator i("/sys/devices/system/node", ec), end; !ec && i != end; i.increment(ec))
+        {
+            auto name = i->path().filename().string();
+
+            if (name.size() <= 4 || name.compare(0, 4, "node") != 0 ||
+                name.find_first_not_of("0123456789", 4) != std::string::npos) continue;
+
+            std::ifstream cpuList(i->path() / "cpulist");
+            std::string list;
+            std::getline(cpuList, list);
+
+            Node node{ static_cast<unsigned int>(std::stoul(name.substr(4))), {} };
+
+            for (auto cpu : parseCpuList(list))
+            {
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                {
+                    node.cpus.push_back(cpu);
+                }
+            }
+
+            if (!node.cpus.empty())
+            {
+                nodes.push_back(node);
+            }
+        }
+#endif
+
+        std::sort(nodes.begin(), nodes.end(), [](const Node& a, const Node& b) { return a.id < b.id; });
+
+        return nodes;
+    }
+}
+
+// The nodes with usable CPUs, detected on first use. Empty if the topology is unknown.
+inline const std::vector<Node>& getNodes()
+{
+    static const std::vector<Node> nodes = detail::detectNodes();
+    return nodes;
+}
+
+// The number of nodes work can be spread across, 1 on machines without NUMA
+inline std::size_t getNodeCount()
+{
+    return std::max<std::size_t>(getNodes().size(), 1);
+}
+
+// Index (into getNodes()) of the node the current thread has been bound to, -1 if not bound
+inline int& currentNode()
+{
+    thread_local int node = -1;
+    return node;
+}
+
+// Restricts the current thread to the CPUs of the given node (an index into getNodes()).
+// Returns false and leaves the thread unbound if the node doesn't exist or the OS refuses.
+inline bool bindCurrentThread(std::size_t index)
+{
+    const auto& nodes = getNodes();
+
+    if (index >= nodes.size()) return false;
+
+#ifdef _WIN32
+    GROUP_AFFINITY affinity = nodes[index].affinity;
+
+    if (!SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr)) return false;
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (auto cpu : nodes[index].cpus)
+    {
+        CPU_SET(cpu, &set);
+    }
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) return false;
+#endif
+
+    currentNode() = static_cast<int>(index);
+    return true;
+}
+
+}
+
+}
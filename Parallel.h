@@ -0,0 +1,200 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <algorithm>
+#include "Numa.h"
+#include "Cancellation.h"
+
+namespace parallel
+{
+
+namespace detail
+{
+    // Set on threads spawned by forEach, nested calls will then run sequentially
+    // instead of multiplying the number of threads
+    inline bool& isWorkerThread()
+    {
+        thread_local bool isWorker = false;
+        return isWorker;
+    }
+
+    inline std::atomic<unsigned int>& workerCount()
+    {
+        static std::atomic<unsigned int> count(0);
+        return count;
+    }
+}
+
+// Overrides the number of threads used by forEach (0 = use the hardware concurrency)
+inline void setWorkerCount(unsigned int count)
+{
+    detail::workerCount() = count;
+}
+
+// The number of threads forEach is going to use, including the calling one.
+// On a thread bound to a NUMA node this is the node's share of the threads.
+inline unsigned int getWorkerCount()
+{
+    auto count = detail::workerCount().load();
+    auto node = numa::currentNode();
+
+    if (node >= 0)
+    {
+        return count == 0 ? static_cast<unsigned int>(numa::getNodes()[node].cpus.size()) :
+            std::max(count / static_cast<unsigned int>(numa::getNodeCount()), 1u);
+    }
+
+    if (count == 0)
+    {
+        count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    return count;
+}
+
+namespace detail
+{
+    // Invokes func(index) for every index in [0..count) on the given number of threads,
+    // each of them calling prepare(threadNum) before starting on the indices. The calling
+    // thread takes part as the last thread if useCallingThread is set, without prepare().
+    // Rethrows the first exception after all threads have finished.
+    template<typename Func, typename Prepare>
+    void runThreads(std::size_t threadCount, bool useCallingThread, std::size_t count, const Func& func, const Prepare& prepare)
+    {
+        std::atomic<std::size_t> nextIndex(0);
+        std::atomic<bool> failed(false);
+        std::exception_ptr firstException;
+        std::atomic_flag exceptionLock = ATOMIC_FLAG_INIT;
+
+        auto worker = [&]()
+        {
+            for (auto i = nextIndex++; i < count && !failed; i = nextIndex++)
+            {
+                try
+                {
+                    func(i);
+                }
+                catch (...)
+                {
+                    if (!exceptionLock.test_and_set())
+                    {
+                        firstException = std::current_exception();
+                    }
+                    failed = true;
+                }
+            }
+        };
+
+        auto spawnCount = useCallingThread ? threadCount - 1 : threadCount;
+
+        std::vector<std::thread> threads;
+        threads.reserve(spawnCount);
+
+        for (std::size_t t = 0; t < spawnCount; ++t)
+        {
+            threads.emplace_back([&, t]()
+            {
+                prepare(t);
+                worker();
+            });
+        }
+
+        if (useCallingThread)
+        {
+            // Let the calling thread do its share, restoring its state afterwards
+            auto wasWorker = isWorkerThread();
+            isWorkerThread() = true;
+            worker();
+            isWorkerThread() = wasWorker;
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        if (firstException)
+        {
+            std::rethrow_exception(firstException);
+        }
+    }
+}
+
+/**
+ * Invokes func(index) for every index in the range [0..count), distributing the
+ * calls across worker threads. The calling thread takes part in the work and the
+ * function returns when all indices have been processed. If any invocation throws,
+ * the remaining indices are skipped and the first exception is re-thrown here.
+ * The workers poll the same cancellation token as the calling thread in checkpoint().
+ */
+template<typename Func>
+void forEach(std::size_t count, const Func& func)
+{
+    auto threadCount = std::min<std::size_t>(getWorkerCount(), count);
+
+    if (threadCount <= 1 || detail::isWorkerThread())
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            func(i);
+        }
+        return;
+    }
+
+    // Threads spawned from a thread bound to a NUMA node stay on that node, otherwise they
+    // are spread across the nodes. An invocation runs on a single thread either way.
+    auto node = numa::currentNode();
+    auto nodeCount = numa::getNodeCount();
+    auto token = detail::currentToken();
+
+    detail::runThreads(threadCount, true, count, func, [node, nodeCount, token](std::size_t thread)
+    {
+        detail::isWorkerThread() = true;
+        detail::currentToken() = token;
+
+        if (node >= 0)
+        {
+            numa::bindCurrentThread(node);
+        }
+        else if (nodeCount > 1)
+        {
+            numa::bindCurrentThread(thread % nodeCount);
+        }
+    });
+}
+
+/**
+ * Like forEach, but meant for independent jobs like converting a set of files: each job
+ * runs entirely on one NUMA node, on a thread bound to that node, so the memory it
+ * allocates is local to it. Nested forEach calls use the threads of the same node.
+ * On machines with a single node the jobs run one after the other on the calling thread,
+ * each of them using all the threads for its nested forEach calls.
+ */
+template<typename Func>
+void forEachOnNodes(std::size_t count, const Func& func)
+{
+    auto nodeCount = std::min(numa::getNodeCount(), count);
+
+    if (nodeCount <= 1 || detail::isWorkerThread() || numa::currentNode() >= 0)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            func(i);
+        }
+        return;
+    }
+
+    // One job thread per node, these are no worker threads so nested calls can go parallel
+    auto token = detail::currentToken();
+
+    detail::runThreads(nodeCount, false, count, func, [token](std::size_t node)
+    {
+        numa::bindCurrentThread(node);
+        detail::currentToken() = token;
+    });
+}
+
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <algorithm>
+#include "openfbx/ofbx.h"
+#include "math/Matrix4.h"
+#include "math/Simd.h"
+#include "export/ArbitraryMeshVertex.h"
+#include "NodeAnimation.h"
+#include "Parallel.h"
+
+namespace model
+{
+
+/**
+ * Bakes a skinned geometry into a pose of its bones using linear blend skinning. Each control
+ * point keeps its 4 strongest cluster weights, normalised to add up to 1. The vertices stay in
+ * the geometry's space: at the pose the skin has been bound in, they don't move at all.
+ */
+class SkinPose
+{
+public:
+	// The global transform of each bone in the pose to bake
+	typedef std::map<const ofbx::Object*, Matrix4> BoneTransforms;
+
+private:
+	static_assert(sizeof(Matrix4) == 16 * sizeof(double), "The skinning kernel expects Matrix4 to be 16 doubles");
+
+	// One matrix per cluster moving the vertices from the bind pose to the baked one,
+	// followed by the identity for control points without any weights
+	std::vector<Matrix4> _matrices;
+
+	// The influences of each control point of the geometry
+	std::vector<simd::SkinInfluences> _influences;
+
+public:
+	// Clusters linked to a bone missing in the transforms don't move their control points
+	SkinPose(const ofbx::Skin& skin, int numControlPoints, const BoneTransforms& boneTransforms)
+	{
+		// The weights of each control point in the order of the clusters
+		std::vector<std::vector<std::pair<uint16_t, float>>> weights(numControlPoints);
+
+		for (int c = 0; c < skin.getClusterCount(); ++c)
+		{
+			auto cluster = skin.getCluster(c);
+			auto bone = boneTransforms.find(cluster->getLink());
+
+			if (bone == boneTransforms.end() || _matrices.size() >= 0xFFFF) continue;
+
+			// Transform is the geometry's global transform and TransformLink the bone's one when binding
+			auto bindTransform = NodeAnimation::ToMatrix4(cluster->getTransformMatrix());
+			auto boneBindTransform = NodeAnimation::ToMatrix4(cluster->getTransformLinkMatrix());
+
+			auto clusterIndex = static_cast<uint16_t>(_matrices.size());
+
+			_matrices.push_back(bindTransform.getFullInverse().getMultipliedBy(bone->second)
+				.getMultipliedBy(boneBindTransform.getFullInverse()).getMultipliedBy(bindTransform));
+
+			auto indices = cluster->getIndices();
+			auto clusterWeights = cluster->getWeights();
+
+			for (int i = 0; i < cluster->getIndicesCount(); ++i)
+			{
+				if (indices[i] < 0 || indices[i] >= numControlPoints || !(clusterWeights[i] > 0)) continue;
+
+				weights[indices[i]].emplace_back(clusterIndex, static_cast<float>(clusterWeights[i]));
+			}
+		}
+
+		auto identityIndex = static_cast<uint16_t>(_matrices.size());
+		_matrices.push_back(Matrix4::getIdentity());
+
+		_influences.resize(numControlPoints);
+
+		parallel::forEach(weights.size(), [&](std::size_t p)
+		{
+			_influences[p] = GetStrongestInfluences(weights[p], identityIndex);
+		});
+	}
+
+	// Poses the vertices, each of them created from the given control point of the geometry
+	void apply(const std::vector<int>& controlPoints, std::vector<ArbitraryMeshVertex>& vertices) const
+	{
+		static_assert(sizeof(ArbitraryMeshVertex) % sizeof(double) == 0, "Vertex stride must be a multiple of double");
+		constexpr std::size_t Stride = sizeof(ArbitraryMeshVertex) / sizeof(double);
+		constexpr std::size_t BlockSize = 4096;
+
+		// The influences of the vertices in one compact array, read sequentially by the kernel
+		std::vector<simd::SkinInfluences> influences(vertices.size());
+
+		for (std::size_t v = 0; v < vertices.size(); ++v)
+		{
+			influences[v] = _influences[controlPoints[v]];
+		}
+
+		parallel::forEach((vertices.size() + BlockSize - 1) / BlockSize, [&](std::size_t block)
+		{
+			auto start = block * BlockSize;
+			auto count = std::min(BlockSize, vertices.size() - start);
+			auto first = vertices.data() + start;
+
+			simd::skinVertices(_matrices.front(), influences.data() + start, first->vertex, first->normal, Stride, count);
+
+			for (std::size_t v = 0; v < count; ++v)
+			{
+				first[v].normal = first[v].normal.getNormalised();
+			}
+		});
+	}
+
+private:
+	// Picks the 4 largest weights, the first cluster wins on equal weights. Control points
+	// without weights are assigned to the identity matrix.
+	static simd::SkinInfluences GetStrongestInfluences(std::vector<std::pair<uint16_t, float>>& weights, uint16_t identityIndex)
+	{
+		simd::SkinInfluences influences = { { identityIndex, identityIndex, identityIndex, identityIndex }, { 1, 0, 0, 0 } };
+
+		std::stable_sort(weights.begin(), weights.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+		auto count = std::min<std::size_t>(weights.size(), 4);
+		float sum = 0;
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			sum += weights[i].second;
+		}
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			influences.bones[i] = weights[i].first;
+			influences.weights[i] = weights[i].second / sum;
+		}
+
+		return influences;
+	}
+};
+
+}
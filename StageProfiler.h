@@ -0,0 +1,490 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+namespace profiling
+{
+
+// The major stages of a conversion, in the order they usually run
+enum class Stage
+{
+    Read,           // reading the FBX file into memory
+    Tokenize,       // splitting the FBX content into elements
+    Parse,          // creating the scene objects
+    Triangulate,    // triangulating and splatting the geometry attributes
+    Animate,        // sampling the animated node transforms and posing the skins
+    Weld,           // welding the triangle vertices into surfaces
+    Transform,      // transforming the surfaces into the LWO coordinate system
+    Collision,      // building the convex collision proxies
+    Encode,         // building the LWO chunks
+    Write,          // writing the chunks to the output file
+    Count,
+};
+
+inline const char* getStageName(Stage stage)
+{
+    static const char* const names[] = { "read", "tokenize", "parse", "triangulate", "animate", "weld", "transform", "collision", "encode", "write" };
+    return names[static_cast<std::size_t>(stage)];
+}
+
+// The hardware events counted for each stage
+enum class Counter
+{
+    Cycles,
+    Instructions,
+    CacheMisses,    // last level cache misses
+    BranchMisses,
+    Count,
+};
+
+constexpr std::size_t NumStages = static_cast<std::size_t>(Stage::Count);
+constexpr std::size_t NumCounters = static_cast<std::size_t>(Counter::Count);
+
+// Wall time and counter values of one stage
+struct Sample
+{
+    double seconds = 0;
+    std::array<uint64_t, NumCounters> counters = {};
+
+    Sample& operator+=(const Sample& other)
+    {
+        seconds += other.seconds;
+
+        for (std::size_t c = 0; c < NumCounters; ++c)
+        {
+            counters[c] += other.counters[c];
+        }
+
+        return *this;
+    }
+};
+
+/**
+ * Hardware performance counters of the calling thread and all threads it starts later on,
+ * using perf_event_open on Linux. Each counter is opened separately, so a CPU or VM lacking
+ * some of the events still provides the others. Where no counter can be opened (other
+ * platforms, missing permissions, no PMU) isAvailable() is false and all values stay 0.
+ */
+class HardwareCounters
+{
+private:
+    std::array<int, NumCounters> _fds;
+
+public:
+    HardwareCounters()
+    {
+        _fds.fill(-1);
+
+#ifdef __linux__
+        static const uint64_t events[NumCounters] =
+        {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+
+        for (std::size_t c = 0; c < NumCounters; ++c)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = events[c];
+            attr.exclude_kernel = 1; // allowed with the default perf_event_paranoid setting
+            attr.exclude_hv = 1;
+            attr.inherit = 1; // include the worker threads, their counts are added when they exit
+
+            _fds[c] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    ~HardwareCounters()
+    {
+#ifdef __linux__
+        for (auto fd : _fds)
+        {
+            if (fd >= 0) close(fd);
+        }
+#endif
+    }
+
+    HardwareCounters(const HardwareCounters&) = delete;
+    HardwareCounters& operator=(const HardwareCounters&) = delete;
+
+    bool isAvailable() const
+    {
+        for (auto fd : _fds)
+        {
+            if (fd >= 0) return true;
+        }
+
+        return false;
+    }
+
+    bool isAvailable(Counter counter) const
+    {
+        return _fds[static_cast<std::size_t>(counter)] >= 0;
+    }
+
+    // The current counter values, 0 for the unavailable ones
+    std::array<uint64_t, NumCounters> read() const
+    {
+        std::array<uint64_t, NumCounters> values = {};
+
+#ifdef __linux__
+        for (std::size_t c = 0; c < NumCounters; ++c)
+        {
+            if (_fds[c] < 0 || ::read(_fds[c], &values[c], sizeof(values[c])) != sizeof(values[c]))
+            {
+                values[c] = 0;
+            }
+        }
+#endif
+
+        return values;
+    }
+};
+
+/**
+ * Collects wall time and hardware counters per stage of a single conversion. The stages
+ * are delimited on the thread which created the profiler, the work done by its worker
+ * threads is included since forEach joins them before returning. Stages can be nested,
+ * time spent in an inner stage is only charged to the inner one.
+ */
+class StageProfiler
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    HardwareCounters _counters;
+
+    std::array<Sample, NumStages> _samples;
+    std::vector<Stage> _stack;
+
+    Clock::time_point _lastTime;
+    std::array<uint64_t, NumCounters> _lastCounters;
+
+public:
+    StageProfiler() :
+        _lastTime(Clock::now()),
+        _lastCounters(_counters.read())
+    {}
+
+    void begin(Stage stage)
+    {
+        charge();
+        _stack.push_back(stage);
+    }
+
+    void end()
+    {
+        charge();
+
+        if (!_stack.empty())
+        {
+            _stack.pop_back();
+        }
+    }
+
+    const Sample& getSample(Stage stage) const
+    {
+        return _samples[static_cast<std::size_t>(stage)];
+    }
+
+    const HardwareCounters& getCounters() const
+    {
+        return _counters;
+    }
+
+private:
+    // Adds everything since the last begin or end to the innermost stage
+    void charge()
+    {
+        auto now = Clock::now();
+        auto counters = _counters.read();
+
+        if (!_stack.empty())
+        {
+            auto& sample = _samples[static_cast<std::size_t>(_stack.back())];
+
+            sample.seconds += std::chrono::duration<double>(now - _lastTime).count();
+
+            for (std::size_t c = 0; c < NumCounters; ++c)
+            {
+                sample.counters[c] += counters[c] - _lastCounters[c];
+            }
+        }
+
+        _lastTime = now;
+        _lastCounters = counters;
+    }
+};
+
+/**
+ * Sums up the stage samples of several conversions, can be used from several threads.
+ */
+class ProfileTotals
+{
+private:
+    mutable std::mutex _lock;
+    std::array<Sample, NumStages> _samples;
+    std::array<bool, NumCounters> _available = {};
+    std::size_t _numProfiles = 0;
+
+public:
+    void add(const StageProfiler& profiler)
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+
+        for (std::size_t s = 0; s < NumStages; ++s)
+        {
+            _samples[s] += profiler.getSample(static_cast<Stage>(s));
+        }
+
+        for (std::size_t c = 0; c < NumCounters; ++c)
+        {
+            _available[c] = _available[c] || profiler.getCounters().isAvailable(static_cast<Counter>(c));
+        }
+
+        ++_numProfiles;
+    }
+
+    std::size_t getNumProfiles() const
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        return _numProfiles;
+    }
+
+    void print(std::ostream& stream) const
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        Print(stream, _samples, _available);
+    }
+
+    // Writes the samples of the profiler as table, one line per stage
+    static void Print(std::ostream& stream, const StageProfiler& profiler)
+    {
+        std::array<Sample, NumStages> samples;
+        std::array<bool, NumCounters> available;
+
+        for (std::size_t s = 0; s < NumStages; ++s)
+        {
+            samples[s] = profiler.getSample(static_cast<Stage>(s));
+        }
+
+        for (std::size_t c = 0; c < NumCounters; ++c)
+        {
+            available[c] = profiler.getCounters().isAvailable(static_cast<Counter>(c));
+        }
+
+        Print(stream, samples, available);
+    }
+
+private:
+    static void Print(std::ostream& stream, const std::array<Sample, NumStages>& samples, const std::array<bool, NumCounters>& available)
+    {
+        auto hasCounters = std::find(available.begin(), available.end(), true) != available.end();
+        auto flags = stream.flags();
+
+        stream << "  " << std::left << std::setw(12) << "stage" << std::right << std::setw(10) << "ms";
+
+        if (hasCounters)
+        {
+            stream << std::setw(16) << "cycles" << std::setw(16) << "instructions" << std::setw(7) << "IPC" <<
+                std::setw(14) << "LLC misses" << std::setw(14) << "branch misses";
+        }
+        else
+        {
+            stream << "  (hardware counters unavailable, timing only)";
+        }
+
+        stream << std::endl;
+
+        for (std::size_t s = 0; s < NumStages; ++s)
+        {
+            const auto& sample = samples[s];
+
+            stream << "  " << std::left << std::setw(12) << getStageName(static_cast<Stage>(s)) << std::right <<
+                std::setw(10) << std::fixed << std::setprecision(1) << sample.seconds * 1000;
+
+            if (hasCounters)
+            {
+                auto value = [&](Counter counter, int width)
+                {
+                    auto c = static_cast<std::size_t>(counter);
+
+                    if (available[c])
+                    {
+                        stream << std::setw(width) << sample.counters[c];
+                    }
+                    else
+                    {
+                        stream << std::setw(width) << "-";
+                    }
+                };
+
+                value(Counter::Cycles, 16);
+                value(Counter::Instructions, 16);
+
+                auto cycles = sample.counters[static_cast<std::size_t>(Counter::Cycles)];
+                auto instructions = sample.counters[static_cast<std::size_t>(Counter::Instructions)];
+
+                if (cycles > 0 && instructions > 0)
+                {
+                    stream << std::setw(7) << std::setprecision(2) << static_cast<double>(instructions) / cycles;
+                }
+                else
+                {
+                    stream << std::setw(7) << "-";
+                }
+
+                value(Counter::CacheMisses, 14);
+                value(Counter::BranchMisses, 14);
+            }
+
+            stream << std::endl;
+        }
+
+        stream.flags(flags);
+    }
+};
+
+namespace detail
+{
+    // The profiler of the conversion running on this thread
+    inline StageProfiler*& currentProfiler()
+    {
+        thread_local StageProfiler* profiler = nullptr;
+        return profiler;
+    }
+}
+
+// The profiler StageScope records into on this thread, nullptr if there is none
+inline StageProfiler* getCurrentProfiler()
+{
+    return detail::currentProfiler();
+}
+
+// Makes StageScope record into the given profiler on this thread for the lifetime of this object
+class ProfilerScope
+{
+private:
+    StageProfiler* _previous;
+
+public:
+    explicit ProfilerScope(StageProfiler& profiler) :
+        _previous(detail::currentProfiler())
+    {
+        detail::currentProfiler() = &profiler;
+    }
+
+    ~ProfilerScope()
+    {
+        detail::currentProfiler() = _previous;
+    }
+
+    ProfilerScope(const ProfilerScope&) = delete;
+    ProfilerScope& operator=(const ProfilerScope&) = delete;
+};
+
+// Receives the time spent in each completed StageScope, excluding its nested stages.
+// Called on the thread which ran the stage, which can be any thread.
+using StageListener = void(*)(Stage stage, double seconds);
+
+class StageScope;
+
+namespace detail
+{
+    inline std::atomic<StageListener>& stageListener()
+    {
+        static std::atomic<StageListener> listener(nullptr);
+        return listener;
+    }
+
+    // The innermost StageScope timed for the listener on this thread
+    inline StageScope*& currentScope()
+    {
+        thread_local StageScope* scope = nullptr;
+        return scope;
+    }
+}
+
+// Installs the listener for all stages starting from now on, nullptr removes it
+inline void setStageListener(StageListener listener)
+{
+    detail::stageListener().store(listener, std::memory_order_relaxed);
+}
+
+// Charges the time and events until its destruction to the given stage. Does nothing
+// if no profiler is active on the thread (like on worker threads or without profiling)
+// and no stage listener is installed.
+class StageScope
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    Stage _stage;
+    StageProfiler* _profiler;
+    StageListener _listener;
+
+    StageScope* _parent;
+    Clock::time_point _start;
+    Clock::duration _nested;
+
+public:
+    explicit StageScope(Stage stage) :
+        _stage(stage),
+        _profiler(detail::currentProfiler()),
+        _listener(detail::stageListener().load(std::memory_order_relaxed)),
+        _parent(nullptr),
+        _nested(Clock::duration::zero())
+    {
+        if (_profiler) _profiler->begin(stage);
+
+        if (_listener)
+        {
+            _parent = detail::currentScope();
+            detail::currentScope() = this;
+            _start = Clock::now();
+        }
+    }
+
+    ~StageScope()
+    {
+        if (_profiler) _profiler->end();
+
+        if (_listener)
+        {
+            auto duration = Clock::now() - _start;
+
+            detail::currentScope() = _parent;
+
+            if (_parent)
+            {
+                _parent->_nested += duration;
+            }
+
+            _listener(_stage, std::chrono::duration<double>(duration - _nested).count());
+        }
+    }
+
+    StageScope(const StageScope&) = delete;
+    StageScope& operator=(const StageScope&) = delete;
+};
+
+}
@@ -0,0 +1,352 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#include <functional>
+#include <filesystem>
+#include "openfbx/ofbx.h"
+#include "openfbx/ofbx_stream.h"
+#include "FbxSurface.h"
+#include "Parallel.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace model
+{
+
+/**
+ * Reads the mesh geometries of a binary FBX through the streaming reader, without loading the
+ * file or building its element tree. Only the control points and the polygons are decoded, the
+ * polygons are triangulated as fans like ofbx::load does. Everything else (normals, UVs, materials,
+ * deformers, the node hierarchy) is skipped. Each geometry is passed to the handler as one surface
+ * as soon as its record ends, so besides the stream buffers only the geometry being read is held
+ * in memory. The vertices stay in the space of their geometry, like in the single layer conversion.
+ */
+class StreamedGeometryReader :
+	public ofbx::StreamVisitor
+{
+public:
+	// Receives the surface of each geometry, it may be moved from
+	typedef std::function<void(FbxSurface&)> SurfaceHandler;
+
+private:
+	enum class ArrayTarget
+	{
+		None,
+		Points,
+		Polygons,
+		String,
+	};
+
+	unsigned int _materialId;
+	double _weldEpsilon;
+	SurfaceHandler _handler;
+
+	// The names of the records enclosing the current event, only the visited ones are entered
+	std::vector<std::string> _records;
+
+	ArrayTarget _arrayTarget = ArrayTarget::None;
+	char _arrayType = 0;
+
+	// The string property being read and the number of strings read in the current record
+	std::string _string;
+	int _numStrings = 0;
+
+	// The first string of the current Properties70 entry, i.e. its name
+	std::string _propertyName;
+
+	ofbx::UpVector _upAxis = ofbx::UpVector_AxisX;
+
+	// Set once the class of the current geometry turned out to be "Mesh" (and not e.g. "Shape")
+	bool _isMesh = false;
+
+	// The control point coordinates of the current geometry, 3 per point
+	std::vector<double> _coordinates;
+
+	// The triangulated control point indices of the current geometry, in counter-clockwise order
+	std::vector<int> _triangles;
+
+	// The fan triangulation state of the polygon being read
+	int _polygonSize = 0;
+	int _polygonFirst = 0;
+	int _polygonPrevious = 0;
+
+	std::size_t _numGeometries = 0;
+	std::size_t _numTriangles = 0;
+
+public:
+	StreamedGeometryReader(unsigned int materialId, double weldEpsilon, const SurfaceHandler& handler) :
+		_materialId(materialId),
+		_weldEpsilon(weldEpsilon),
+		_handler(handler)
+	{}
+
+	// Reads the binary FBX file, throws std::runtime_error if it cannot be opened or read.
+	// Text FBX files are not supported by the streaming reader.
+	void readFromPath(const std::filesystem::path& path)
+	{
+#ifdef _WIN32
+		FileDescriptor file{ _wopen(path.c_str(), _O_RDONLY | _O_BINARY) };
+#else
+		FileDescriptor file{ open(path.c_str(), O_RDONLY) };
+#endif
+
+		if (file.fd < 0)
+		{
+			throw std::runtime_error("Cannot open file for reading: " + path.string());
+		}
+
+		ofbx::FileDescriptorSource source(file.fd);
+
+		if (!ofbx::readStream(source, *this))
+		{
+			throw std::runtime_error(ofbx::getStreamError());
+		}
+	}
+
+	// The up axis of the scene's global settings, they are stored in front of the geometries
+	ofbx::UpVector getUpAxis() const
+	{
+		return _upAxis;
+	}
+
+	// Number of geometries passed to the handler
+	std::size_t getNumGeometries() const
+	{
+		return _numGeometries;
+	}
+
+	// Number of triangles in all geometries passed to the handler
+	std::size_t getNumTriangles() const
+	{
+		return _numTriangles;
+	}
+
+	bool beginRecord(const char* id, int idLength, int depth) override
+	{
+		std::string name(id, idLength);
+		auto parent = depth > 0 ? _records.back() : std::string();
+
+		auto isVisited =
+			(depth == 0 && (name == "GlobalSettings" || name == "Objects")) ||
+			(depth == 1 && parent == "GlobalSettings" && name == "Properties70") ||
+			(depth == 1 && parent == "Objects" && name == "Geometry") ||
+			(depth == 2 && parent == "Properties70" && name == "P") ||
+			(depth == 2 && parent == "Geometry" && _isMesh && (name == "Vertices" || name == "PolygonVertexIndex"));
+
+		if (!isVisited)
+		{
+			return false;
+		}
+
+		_numStrings = 0;
+
+		if (name == "Geometry")
+		{
+			_isMesh = false;
+		}
+		else if (name == "P")
+		{
+			_propertyName.clear();
+		}
+
+		_records.push_back(name);
+		return true;
+	}
+
+	void endRecord(int) override
+	{
+		if (_records.back() == "Geometry" && _isMesh)
+		{
+			finishGeometry();
+		}
+
+		_records.pop_back();
+	}
+
+	void property(char type, const ofbx::u8* value) override
+	{
+		if (type == 'I' && _records.back() == "P" && _propertyName == "UpAxis")
+		{
+			int32_t axis;
+			std::memcpy(&axis, value, sizeof(axis));
+
+			_upAxis = static_cast<ofbx::UpVector>(axis);
+		}
+	}
+
+	bool beginArray(char type, ofbx::u32, ofbx::u32) override
+	{
+		const auto& record = _records.back();
+
+		if (type == 'S' && (record == "Geometry" || record == "P"))
+		{
+			_arrayTarget = ArrayTarget::String;
+			_string.clear();
+		}
+		else if ((type == 'd' || type == 'f') && record == "Vertices")
+		{
+			_arrayTarget = ArrayTarget::Points;
+		}
+		else if (type == 'i' && record == "PolygonVertexIndex")
+		{
+			_arrayTarget = ArrayTarget::Polygons;
+			_polygonSize = 0;
+		}
+		else
+		{
+			return false;
+		}
+
+		_arrayType = type;
+		return true;
+	}
+
+	void arrayData(const ofbx::u8* data, ofbx::u32 count) override
+	{
+		parallel::checkpoint();
+
+		switch (_arrayTarget)
+		{
+		case ArrayTarget::Points:
+			for (ofbx::u32 i = 0; i < count; ++i)
+			{
+				_coordinates.push_back(_arrayType == 'd' ? ReadValue<double>(data, i) : ReadValue<float>(data, i));
+			}
+			break;
+
+		case ArrayTarget::Polygons:
+			for (ofbx::u32 i = 0; i < count; ++i)
+			{
+				addPolygonIndex(ReadValue<int32_t>(data, i));
+			}
+			break;
+
+		case ArrayTarget::String:
+			_string.append(reinterpret_cast<const char*>(data), count);
+			break;
+
+		case ArrayTarget::None:
+			break;
+		}
+	}
+
+	void endArray() override
+	{
+		if (_arrayTarget == ArrayTarget::String)
+		{
+			++_numStrings;
+
+			// Geometry: ID, "<name>\0\1Geometry", "<class>"; P: "<name>", "<type>", ...
+			if (_records.back() == "Geometry" && _numStrings == 2)
+			{
+				_isMesh = _string == "Mesh";
+			}
+			else if (_records.back() == "P" && _numStrings == 1)
+			{
+				_propertyName = _string;
+			}
+		}
+
+		_arrayTarget = ArrayTarget::None;
+	}
+
+private:
+	// Closes the file when the reading is done or an exception is passed through
+	struct FileDescriptor
+	{
+		int fd;
+
+		~FileDescriptor()
+		{
+#ifdef _WIN32
+			if (fd >= 0) _close(fd);
+#else
+			if (fd >= 0) close(fd);
+#endif
+		}
+	};
+
+	template<typename T>
+	static T ReadValue(const ofbx::u8* data, ofbx::u32 index)
+	{
+		T value;
+		std::memcpy(&value, data + index * sizeof(T), sizeof(T));
+
+		return value;
+	}
+
+	// The last index of a polygon is stored as its bitwise complement
+	void addPolygonIndex(int32_t value)
+	{
+		auto index = value < 0 ? ~value : value;
+
+		if (_polygonSize == 0)
+		{
+			_polygonFirst = index;
+		}
+		else if (_polygonSize >= 2)
+		{
+			// Reverse the fan triangle to get the CCW order
+			_triangles.push_back(index);
+			_triangles.push_back(_polygonPrevious);
+			_triangles.push_back(_polygonFirst);
+		}
+
+		_polygonPrevious = index;
+		_polygonSize = value < 0 ? 0 : _polygonSize + 1;
+	}
+
+	// Welds the triangles of the current geometry into a surface and passes it to the handler
+	void finishGeometry()
+	{
+		auto numPoints = _coordinates.size() / 3;
+
+		if (!_triangles.empty())
+		{
+			FbxSurface surface;
+			surface.materialId = _materialId;
+
+			if (_weldEpsilon != render::VertexEpsilon)
+			{
+				surface.setWeldEpsilon(_weldEpsilon);
+			}
+
+			for (std::size_t i = 0; i < _triangles.size(); ++i)
+			{
+				parallel::checkpoint(i);
+
+				auto index = static_cast<std::size_t>(_triangles[i]);
+
+				if (index >= numPoints)
+				{
+					throw std::runtime_error("Polygon vertex index out of range");
+				}
+
+				// Without normals, UVs and colours the vertices are welded by their position only
+				surface.addVertex(ArbitraryMeshVertex(
+					Vertex3f(_coordinates[index * 3], _coordinates[index * 3 + 1], _coordinates[index * 3 + 2]),
+					Normal3f(1, 0, 0), TexCoord2f(0, 0), Vector3(1, 1, 1)));
+			}
+
+			_numTriangles += _triangles.size() / 3;
+			++_numGeometries;
+
+			_handler(surface);
+		}
+
+		// Release the memory, the next geometry may be much smaller
+		_coordinates = std::vector<double>();
+		_triangles = std::vector<int>();
+	}
+};
+
+}
@@ -0,0 +1,652 @@
+#include "CollisionProxyBuilder.h"
+
+#include <cmath>
+#include <queue>
+#include <atomic>
+#include <limits>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_map>
+#include "VertexHashing.h"
+#include "../Parallel.h"
+
+namespace model
+{
+
+namespace
+{
+	// Triangles and points are handed to the threads in blocks of this size
+	constexpr std::size_t BlockSize = 16384;
+
+	// Disjoint sets of points which can be merged from several threads at once. Roots are
+	// always linked below the smaller root, so every set ends up with its smallest point as
+	// root and the result doesn't depend on the order of the merges.
+	class ConcurrentUnionFind
+	{
+	private:
+		std::vector<std::atomic<uint32_t>> _parents;
+
+	public:
+		explicit ConcurrentUnionFind(std::size_t count) :
+			_parents(count)
+		{
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				_parents[i].store(static_cast<uint32_t>(i), std::memory_order_relaxed);
+			}
+		}
+
+		uint32_t find(uint32_t x)
+		{
+			for (;;)
+			{
+				auto parent = _parents[x].load();
+
+				if (parent == x) return x;
+
+				// Path halving, another thread may have done it already
+				auto grandParent = _parents[parent].load();
+
+				if (grandParent != parent)
+				{
+					_parents[x].compare_exchange_weak(parent, grandParent);
+				}
+
+				x = grandParent;
+			}
+		}
+
+		void unite(uint32_t a, uint32_t b)
+		{
+			for (;;)
+			{
+				a = find(a);
+				b = find(b);
+
+				if (a == b) return;
+
+				if (a < b) std::swap(a, b);
+
+				// Fails if another thread linked a in the meantime, then try again with the new roots
+				auto expected = a;
+
+				if (_parents[a].compare_exchange_strong(expected, b)) return;
+			}
+		}
+	};
+
+	uint64_t getEdgeKey(unsigned int from, unsigned int to)
+	{
+		return static_cast<uint64_t>(from) << 32 | to;
+	}
+
+	// Quickhull over a set of points, following Barber, Dobkin and Huhdanpaa: each face owns the
+	// points outside of it, the farthest of them is added next and replaces all faces it can see.
+	class QuickHull
+	{
+	private:
+		struct Face
+		{
+			unsigned int v[3];
+			Vector3 normal;
+			double offset = 0;
+
+			std::vector<unsigned int> outside;
+			unsigned int farthest = 0;
+			double farthestDistance = 0;
+
+			bool deleted = false;
+		};
+
+		const std::vector<Vector3>& _points;
+		double _epsilon;
+
+		std::vector<Face> _faces;
+
+		// The face on the left of each directed edge
+		std::unordered_map<uint64_t, std::size_t> _edges;
+
+		// The number of live faces using each point, and the number of points used at all
+		std::vector<unsigned int> _vertexFaces;
+		std::size_t _numVertices = 0;
+
+	public:
+		explicit QuickHull(const std::vector<Vector3>& points) :
+			_points(points),
+			_vertexFaces(points.size(), 0)
+		{
+			double scale = 0;
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				double maxAbs = 0;
+
+				for (const auto& point : points)
+				{
+					maxAbs = std::max(maxAbs, std::fabs(point[axis]));
+				}
+
+				scale += maxAbs;
+			}
+
+			// Distances below the rounding error of the plane equations count as on the plane
+			_epsilon = 3 * std::numeric_limits<double>::epsilon() * scale;
+		}
+
+		// Returns false if the points are flat, no hull is built then
+		bool build(std::size_t vertexBudget)
+		{
+			if (!createSimplex())
+			{
+				return false;
+			}
+
+			auto compare = [](const std::pair<double, std::size_t>& a, const std::pair<double, std::size_t>& b)
+			{
+				// The farthest point first, on equal distances the oldest face
+				return a.first < b.first || (a.first == b.first && a.second > b.second);
+			};
+
+			std::priority_queue<std::pair<double, std::size_t>, std::vector<std::pair<double, std::size_t>>, decltype(compare)> queue(compare);
+
+			for (std::size_t f = 0; f < _faces.size(); ++f)
+			{
+				if (!_faces[f].outside.empty())
+				{
+					queue.emplace(_faces[f].farthestDistance, f);
+				}
+			}
+
+			for (std::size_t iteration = 0; !queue.empty(); ++iteration)
+			{
+				parallel::checkpoint(iteration);
+
+				if (vertexBudget != 0 && _numVertices >= vertexBudget) break;
+
+				auto faceIndex = queue.top().second;
+				queue.pop();
+
+				if (_faces[faceIndex].deleted) continue;
+
+				for (auto newFace : addPoint(faceIndex))
+				{
+					if (!_faces[newFace].outside.empty())
+					{
+						queue.emplace(_faces[newFace].farthestDistance, newFace);
+					}
+				}
+			}
+
+			return true;
+		}
+
+		CollisionProxyBuilder::Hull getHull() const
+		{
+			CollisionProxyBuilder::Hull hull;
+			std::vector<unsigned int> hullIndices(_points.size(), 0);
+
+			for (std::size_t p = 0; p < _points.size(); ++p)
+			{
+				if (_vertexFaces[p] > 0)
+				{
+					hullIndices[p] = static_cast<unsigned int>(hull.vertices.size());
+					hull.vertices.push_back(_points[p]);
+				}
+			}
+
+			for (const auto& face : _faces)
+			{
+				if (face.deleted) continue;
+
+				hull.indices.insert(hull.indices.end(), { hullIndices[face.v[0]], hullIndices[face.v[1]], hullIndices[face.v[2]] });
+			}
+
+			return hull;
+		}
+
+	private:
+		double getDistance(const Face& face, unsigned int point) const
+		{
+			return face.normal.dot(_points[point]) - face.offset;
+		}
+
+		// Builds the tetrahedron of the extreme points, returns false if the points are flat
+		bool createSimplex()
+		{
+			if (_points.size() < 4)
+			{
+				return false;
+			}
+
+			// The two extreme points along the axis with the largest extent
+			unsigned int v0 = 0, v1 = 0;
+			double largestExtent = -1;
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				unsigned int min = 0, max = 0;
+
+				for (unsigned int p = 1; p < _points.size(); ++p)
+				{
+					if (_points[p][axis] < _points[min][axis]) min = p;
+					if (_points[p][axis] > _points[max][axis]) max = p;
+				}
+
+				if (_points[max][axis] - _points[min][axis] > largestExtent)
+				{
+					largestExtent = _points[max][axis] - _points[min][axis];
+					v0 = min;
+					v1 = max;
+				}
+			}
+
+			if (largestExtent <= _epsilon)
+			{
+				return false;
+			}
+
+			// The point farthest from their line
+			auto direction = _points[v1] - _points[v0];
+			unsigned int v2 = v0;
+			double largestArea = 0;
+
+			for (unsigned int p = 0; p < _points.size(); ++p)
+			{
+				auto cross = direction.crossProduct(_points[p] - _points[v0]);
+				auto area = cross.dot(cross);
+
+				if (area > largestArea)
+				{
+					largestArea = area;
+					v2 = p;
+				}
+			}
+
+			if (std::sqrt(largestArea) / largestExtent <= _epsilon)
+			{
+				return false;
+			}
+
+			// The point farthest from their plane
+			auto normal = direction.crossProduct(_points[v2] - _points[v0]);
+			normal = normal / std::sqrt(normal.dot(normal));
+
+			unsigned int v3 = v0;
+			double largestDistance = 0;
+
+			for (unsigned int p = 0; p < _points.size(); ++p)
+			{
+				auto distance = std::fabs(normal.dot(_points[p] - _points[v0]));
+
+				if (distance > largestDistance)
+				{
+					largestDistance = distance;
+					v3 = p;
+				}
+			}
+
+			if (largestDistance <= _epsilon)
+			{
+				return false;
+			}
+
+			// The base is wound such that the apex lies behind it
+			if (normal.dot(_points[v3] - _points[v0]) > 0)
+			{
+				std::swap(v1, v2);
+			}
+
+			addFace(v0, v1, v2);
+			addFace(v1, v0, v3);
+			addFace(v2, v1, v3);
+			addFace(v0, v2, v3);
+
+			for (unsigned int p = 0; p < _points.size(); ++p)
+			{
+				if (p == v0 || p == v1 || p == v2 || p == v3) continue;
+
+				assignToFace(p, 0, _faces.size());
+			}
+
+			return true;
+		}
+
+		std::size_t addFace(unsigned int a, unsigned int b, unsigned int c)
+		{
+			Face& face = _faces.emplace_back();
+			face.v[0] = a;
+			face.v[1] = b;
+			face.v[2] = c;
+
+			auto normal = (_points[b] - _points[a]).crossProduct(_points[c] - _points[a]);
+			auto length = std::sqrt(normal.dot(normal));
+
+			// A sliver face keeps a zero normal, no point is ever outside of it
+			face.normal = length > 0 ? normal / length : Vector3(0, 0, 0);
+			face.offset = face.normal.dot(_points[a]);
+
+			auto faceIndex = _faces.size() - 1;
+
+			for (int i = 0; i < 3; ++i)
+			{
+				_edges[getEdgeKey(face.v[i], face.v[(i + 1) % 3])] = faceIndex;
+
+				if (_vertexFaces[face.v[i]]++ == 0)
+				{
+					++_numVertices;
+				}
+			}
+
+			return faceIndex;
+		}
+
+		void deleteFace(std::size_t faceIndex)
+		{
+			Face& face = _faces[faceIndex];
+			face.deleted = true;
+
+			for (int i = 0; i < 3; ++i)
+			{
+				auto edge = _edges.find(getEdgeKey(face.v[i], face.v[(i + 1) % 3]));
+
+				if (edge != _edges.end() && edge->second == faceIndex)
+				{
+					_edges.erase(edge);
+				}
+
+				if (--_vertexFaces[face.v[i]] == 0)
+				{
+					--_numVertices;
+				}
+			}
+		}
+
+		// Puts the point into the outside set of the first face in the range it is outside of,
+		// points not outside of any of them are inside the hull
+		void assignToFace(unsigned int point, std::size_t firstFace, std::size_t endFace)
+		{
+			for (auto f = firstFace; f < endFace; ++f)
+			{
+				Face& face = _faces[f];
+				auto distance = getDistance(face, point);
+
+				if (distance > _epsilon)
+				{
+					if (face.outside.empty() || distance > face.farthestDistance)
+					{
+						face.farthest = point;
+						face.farthestDistance = distance;
+					}
+
+					face.outside.push_back(point);
+					return;
+				}
+			}
+		}
+
+		// Adds the farthest outside point of the face to the hull, returns the new faces
+		std::vector<std::size_t> addPoint(std::size_t faceIndex)
+		{
+			auto eye = _faces[faceIndex].farthest;
+
+			// Collect the faces the point can see, starting at the given one, and the horizon
+			// edges between them and the others, wound like in the visible faces
+			std::vector<std::size_t> visible = { faceIndex };
+			std::vector<std::pair<unsigned int, unsigned int>> horizon;
+			std::vector<bool> isVisited(_faces.size(), false);
+
+			isVisited[faceIndex] = true;
+
+			for (std::size_t i = 0; i < visible.size(); ++i)
+			{
+				const Face& face = _faces[visible[i]];
+
+				for (int e = 0; e < 3; ++e)
+				{
+					auto a = face.v[e], b = face.v[(e + 1) % 3];
+					auto neighbour = _edges.find(getEdgeKey(b, a));
+
+					if (neighbour == _edges.end())
+					{
+						throw std::runtime_error("Convex hull is not closed");
+					}
+
+					if (isVisited[neighbour->second])
+					{
+						continue;
+					}
+
+					if (getDistance(_faces[neighbour->second], eye) > _epsilon)
+					{
+						isVisited[neighbour->second] = true;
+						visible.push_back(neighbour->second);
+					}
+					else
+					{
+						horizon.emplace_back(a, b);
+					}
+				}
+			}
+
+			// The points of the visible faces need to be assigned to the new faces
+			std::vector<unsigned int> orphans;
+
+			for (auto f : visible)
+			{
+				orphans.insert(orphans.end(), _faces[f].outside.begin(), _faces[f].outside.end());
+				_faces[f].outside.clear();
+				_faces[f].outside.shrink_to_fit();
+
+				deleteFace(f);
+			}
+
+			auto firstNewFace = _faces.size();
+			std::vector<std::size_t> newFaces;
+
+			for (const auto& edge : horizon)
+			{
+				newFaces.push_back(addFace(edge.first, edge.second, eye));
+			}
+
+			for (auto point : orphans)
+			{
+				if (point != eye)
+				{
+					assignToFace(point, firstNewFace, _faces.size());
+				}
+			}
+
+			return newFaces;
+		}
+	};
+
+	// A box around the points, flat sides are padded to a hundredth of the largest extent
+	std::vector<Vector3> getPaddedBoxCorners(const std::vector<Vector3>& points, double minThickness)
+	{
+		Vector3 min = points.front(), max = points.front();
+
+		for (const auto& point : points)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				min[axis] = std::min(min[axis], point[axis]);
+				max[axis] = std::max(max[axis], point[axis]);
+			}
+		}
+
+		auto largestExtent = std::max({ max.x() - min.x(), max.y() - min.y(), max.z() - min.z() });
+		auto thickness = std::max(largestExtent / 100, minThickness);
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			auto padding = (thickness - (max[axis] - min[axis])) / 2;
+
+			if (padding > 0)
+			{
+				min[axis] -= padding;
+				max[axis] += padding;
+			}
+		}
+
+		std::vector<Vector3> corners;
+
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			corners.emplace_back(corner & 1 ? max.x() : min.x(), corner & 2 ? max.y() : min.y(), corner & 4 ? max.z() : min.z());
+		}
+
+		return corners;
+	}
+}
+
+CollisionProxyBuilder::CollisionProxyBuilder(double weldEpsilon, std::size_t vertexBudget) :
+	_weldEpsilon(weldEpsilon),
+	_vertexBudget(vertexBudget)
+{
+	if (_vertexBudget != 0 && _vertexBudget < 4)
+	{
+		throw std::invalid_argument("A convex hull needs at least 4 vertices");
+	}
+}
+
+std::vector<CollisionProxyBuilder::Hull> CollisionProxyBuilder::build(const std::vector<Vector3>& positions, const IndexBuffer& indices) const
+{
+	// Weld the positions into points, ignoring all other vertex attributes
+	auto cellScale = render::WeldVertexHash(_weldEpsilon).cellScale;
+
+	auto hash = [&](std::size_t v) { return math::hashVector3InCells(positions[v], cellScale); };
+	auto equal = [&](std::size_t a, std::size_t b) { return math::isNear(positions[a], positions[b], _weldEpsilon); };
+
+	std::unordered_map<std::size_t, uint32_t, decltype(hash), decltype(equal)> pointIndices(positions.size(), hash, equal);
+	std::vector<uint32_t> vertexPoints(positions.size());
+	std::vector<std::size_t> pointVertices;
+
+	for (std::size_t v = 0; v < positions.size(); ++v)
+	{
+		parallel::checkpoint(v);
+
+		auto result = pointIndices.emplace(v, static_cast<uint32_t>(pointVertices.size()));
+
+		if (result.second)
+		{
+			pointVertices.push_back(v);
+		}
+
+		vertexPoints[v] = result.first->second;
+	}
+
+	// Merge the points of each triangle
+	ConcurrentUnionFind components(pointVertices.size());
+	auto numTriangles = indices.size() / 3;
+
+	parallel::forEach((numTriangles + BlockSize - 1) / BlockSize, [&](std::size_t block)
+	{
+		parallel::checkpoint();
+
+		auto end = std::min((block + 1) * BlockSize, numTriangles);
+
+		for (auto t = block * BlockSize; t < end; ++t)
+		{
+			auto a = vertexPoints[indices[t * 3]];
+
+			components.unite(a, vertexPoints[indices[t * 3 + 1]]);
+			components.unite(a, vertexPoints[indices[t * 3 + 2]]);
+		}
+	});
+
+	std::vector<uint32_t> roots(pointVertices.size());
+
+	parallel::forEach((roots.size() + BlockSize - 1) / BlockSize, [&](std::size_t block)
+	{
+		auto end = std::min((block + 1) * BlockSize, roots.size());
+
+		for (auto p = block * BlockSize; p < end; ++p)
+		{
+			roots[p] = components.find(static_cast<uint32_t>(p));
+		}
+	});
+
+	// The roots are the smallest point of their component, which numbers the components in point order
+	std::vector<uint32_t> componentIndices(roots.size());
+	std::vector<std::vector<Vector3>> componentPoints;
+
+	for (std::size_t p = 0; p < roots.size(); ++p)
+	{
+		if (roots[p] == p)
+		{
+			componentIndices[p] = static_cast<uint32_t>(componentPoints.size());
+			componentPoints.emplace_back();
+		}
+
+		componentPoints[componentIndices[roots[p]]].push_back(positions[pointVertices[p]]);
+	}
+
+	std::vector<Hull> hulls(componentPoints.size());
+
+	parallel::forEach(componentPoints.size(), [&](std::size_t c)
+	{
+		QuickHull hull(componentPoints[c]);
+
+		if (hull.build(_vertexBudget))
+		{
+			hulls[c] = hull.getHull();
+			return;
+		}
+
+		// Flat components get a thin box
+		auto corners = getPaddedBoxCorners(componentPoints[c], _weldEpsilon);
+		QuickHull box(corners);
+
+		box.build(_vertexBudget);
+		hulls[c] = box.getHull();
+	});
+
+	return hulls;
+}
+
+void CollisionProxyBuilder::AddHullLayers(const std::vector<Hull>& hulls, const std::string& materialName, ModelExporterBase& exporter)
+{
+	auto materialId = exporter.getMaterials().intern(materialName);
+
+	for (std::size_t h = 0; h < hulls.size(); ++h)
+	{
+		const Hull& hull = hulls[h];
+
+		exporter.addLayer("Collision_" + std::to_string(h), Vector3(0, 0, 0));
+
+		// The normals are averaged over the faces, so the hull's vertices stay shared in the LWO file
+		std::vector<Vector3> normals(hull.vertices.size(), Vector3(0, 0, 0));
+
+		for (std::size_t i = 0; i + 2 < hull.indices.size(); i += 3)
+		{
+			const auto& a = hull.vertices[hull.indices[i]];
+			auto faceNormal = (hull.vertices[hull.indices[i + 1]] - a).crossProduct(hull.vertices[hull.indices[i + 2]] - a);
+
+			for (std::size_t corner = i; corner < i + 3; ++corner)
+			{
+				normals[hull.indices[corner]] += faceNormal;
+			}
+		}
+
+		FbxSurface surface;
+		surface.materialId = materialId;
+
+		for (std::size_t v = 0; v < hull.vertices.size(); ++v)
+		{
+			auto length = std::sqrt(normals[v].dot(normals[v]));
+
+			surface.vertices.emplace_back(Vertex3f(hull.vertices[v]), Normal3f(length > 0 ? normals[v] / length : Vector3(0, 0, 1)),
+				TexCoord2f(0, 0), Vector3(1, 1, 1));
+		}
+
+		// addSurface expects clockwise triangles
+		for (std::size_t i = 0; i + 2 < hull.indices.size(); i += 3)
+		{
+			surface.indices.insert(surface.indices.end(), { hull.indices[i + 2], hull.indices[i + 1], hull.indices[i] });
+		}
+
+		exporter.addSurface(surface, Matrix4::getIdentity());
+	}
+}
+
+}
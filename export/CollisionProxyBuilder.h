@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "ModelExporterBase.h"
+
+namespace model
+{
+
+/**
+ * Builds convex collision proxies for a mesh: the vertices are welded by position, the
+ * triangles are split into connected components using a concurrent union-find, and each
+ * component gets its convex hull (quickhull). Hulls can be limited to a vertex budget, the
+ * points farthest out are added first, so the limited hull is the best fit quickhull finds
+ * with that many vertices. Flat components get a thin box instead.
+ *
+ * All loops poll the cancellation token of the calling thread, so the proxies count
+ * towards the time budget of the conversion.
+ */
+class CollisionProxyBuilder
+{
+public:
+	// A convex hull, its triangles wound counter-clockwise seen from outside
+	struct Hull
+	{
+		std::vector<Vector3> vertices;
+		IndexBuffer indices;
+	};
+
+private:
+	double _weldEpsilon;
+	std::size_t _vertexBudget;
+
+public:
+	// A vertex budget of 0 means unlimited, other budgets need to be at least 4
+	CollisionProxyBuilder(double weldEpsilon, std::size_t vertexBudget);
+
+	// Returns one hull per connected component of the triangles, ordered by their first position
+	std::vector<Hull> build(const std::vector<Vector3>& positions, const IndexBuffer& indices) const;
+
+	// Adds each hull as a layer of its own named Collision_<n>, using the given material
+	static void AddHullLayers(const std::vector<Hull>& hulls, const std::string& materialName, ModelExporterBase& exporter);
+};
+
+}
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <atomic>
 #include <string>
+#include <vector>
+#include <cstring>
 #include <fstream>
+#include <algorithm>
 #include <stdexcept>
 #include <filesystem>
+#include "../Metrics.h"
 
 namespace stream
 {
@@ -14,6 +19,8 @@ namespace stream
  * to a temporary file for writing first. On calling close(), the temporary stream 
  * will be finalised and the temporary file will be moved over to the target file,
  * which in turn will be renamed to .bak first.
+ * If the target file already has the exact same content, it is left untouched
+ * (keeping its modification time) and the temporary file is discarded.
  */
 class ExportStream
 {
@@ -23,6 +30,9 @@ private:
     std::string _outputDirectory;
     std::string _filename;
 
+    // Whether close() adds the file to the written/unchanged counts
+    bool _isCounted;
+
 public:
     // Output stream mode
     enum class Mode
@@ -35,9 +45,10 @@ public:
         ExportStream(outputDirectory, filename, mode == Mode::Binary ? std::ios::out | std::ios::binary : std::ios::out)
     {}
 
-    ExportStream(const std::string& outputDirectory, const std::string& filename, std::ios::openmode mode) :
+    ExportStream(const std::string& outputDirectory, const std::string& filename, std::ios::openmode mode, bool isCounted = true) :
         _outputDirectory(outputDirectory),
-        _filename(filename)
+        _filename(filename),
+        _isCounted(isCounted)
     {
         std::filesystem::path targetPath = _outputDirectory;
 
@@ -57,22 +68,71 @@ public:
         }
     }
 
+    // An export aborted before close() (e.g. by an exception) leaves the target file alone
+    ~ExportStream()
+    {
+        if (_tempStream.is_open())
+        {
+            _tempStream.close();
+
+            std::error_code ec;
+            std::filesystem::remove(_tempFile, ec);
+        }
+    }
+
+    // Number of files created or replaced by close() so far
+    static std::size_t getNumWritten()
+    {
+        return numWritten();
+    }
+
+    // Number of files left untouched by close() since their content was up to date
+    static std::size_t getNumUnchanged()
+    {
+        return numUnchanged();
+    }
+
     // Returns the stream for writing the export data
     std::ofstream& getStream()
     {
         return _tempStream;
     }
 
-    void close()
+    // Returns true if the target file has been written, false if it was left untouched
+    bool close()
     {
+        auto size = _tempStream.tellp();
         _tempStream.close();
 
+        // The stream doesn't throw, a full disk or an I/O error only shows in its state
+        if (_tempStream.fail())
+        {
+            std::error_code ec;
+            std::filesystem::remove(_tempFile, ec);
+
+            throw std::runtime_error("Could not write the temporary file: " + _tempFile.string());
+        }
+
+        if (size > 0)
+        {
+            metrics::add(metrics::getCounters().bytesWritten, static_cast<uint64_t>(size));
+        }
+
         // The full OS path to the output file
         std::filesystem::path targetPath = _outputDirectory;
         targetPath /= _filename;
 
         if (std::filesystem::exists(targetPath))
         {
+            if (hasSameContent(_tempFile, targetPath))
+            {
+                std::error_code ec;
+                std::filesystem::remove(_tempFile, ec);
+
+                if (_isCounted) ++numUnchanged();
+                return false;
+            }
+
             try
             {
                 // Move the old target file to .bak (overwriting any existing .bak file)
@@ -92,6 +152,56 @@ public:
         {
             throw std::runtime_error("Could not rename the temporary file: " + _tempFile.string());
         }
+
+        if (_isCounted) ++numWritten();
+        return true;
+    }
+
+private:
+    static std::atomic<std::size_t>& numWritten()
+    {
+        static std::atomic<std::size_t> count(0);
+        return count;
+    }
+
+    static std::atomic<std::size_t>& numUnchanged()
+    {
+        static std::atomic<std::size_t> count(0);
+        return count;
+    }
+
+    // Compares the sizes first, then the contents chunk by chunk until the first difference
+    static bool hasSameContent(const std::filesystem::path& first, const std::filesystem::path& second)
+    {
+        constexpr std::size_t ChunkSize = 1 << 16;
+
+        std::error_code ec;
+        auto size = std::filesystem::file_size(first, ec);
+
+        if (ec || size != std::filesystem::file_size(second, ec) || ec)
+        {
+            return false;
+        }
+
+        std::ifstream firstStream(first, std::ios::binary);
+        std::ifstream secondStream(second, std::ios::binary);
+
+        std::vector<char> firstChunk(ChunkSize);
+        std::vector<char> secondChunk(ChunkSize);
+
+        for (std::uintmax_t offset = 0; offset < size; offset += ChunkSize)
+        {
+            auto length = static_cast<std::streamsize>(std::min<std::uintmax_t>(ChunkSize, size - offset));
+
+            // Just write the file if it cannot be read
+            if (!firstStream.read(firstChunk.data(), length) || !secondStream.read(secondChunk.data(), length) ||
+                std::memcmp(firstChunk.data(), secondChunk.data(), static_cast<std::size_t>(length)) != 0)
+            {
+                return false;
+            }
+        }
+
+        return true;
     }
 };
 
@@ -1,11 +1,16 @@
 #include "Lwo2Exporter.h"
 
+#include <map>
 #include <vector>
-#include "../math/AABB.h"
+#include <algorithm>
+#include <unordered_map>
+#include "../math/Simd.h"
 #include "StreamUtils.h"
 #include "ExportStream.h"
 
 #include "Lwo2Chunk.h"
+#include "../Parallel.h"
+#include "../StageProfiler.h"
 
 // Namespace extension containing some LWO-specific data export functions
 namespace stream
@@ -60,6 +65,198 @@ void writeString(std::ostream& stream, const std::string& str)
 namespace model
 {
 
+namespace
+{
+	const std::string UVMapName = "UVMap";
+	const std::string VertexColourMapName = "VertexColourMap";
+}
+
+std::vector<const Lwo2Exporter::Surface*> Lwo2Exporter::getSurfacesInTagOrder(const Layer& layer, const TagIndices& tagIndices)
+{
+	std::vector<const Surface*> surfaces;
+
+	for (const Surface& surface : layer.surfaces)
+	{
+		surfaces.push_back(&surface);
+	}
+
+	std::sort(surfaces.begin(), surfaces.end(), [&](const Surface* a, const Surface* b)
+	{
+		return tagIndices[a->materialId] < tagIndices[b->materialId];
+	});
+
+	return surfaces;
+}
+
+Lwo2Exporter::PointTable Lwo2Exporter::buildPointTable(const std::vector<const Surface*>& surfaces, double weldEpsilon)
+{
+	PointTable table;
+
+	for (const Surface* surface : surfaces)
+	{
+		for (const ArbitraryMeshVertex& vertex : surface->vertices)
+		{
+			table.vertices.push_back(&vertex);
+		}
+	}
+
+	// The weights and offsets of each vertex as (map number, value) pairs, in map name order
+	typedef std::vector<std::pair<std::size_t, Vector3>> Deformation;
+	std::vector<Deformation> deformations;
+
+	std::map<std::string, std::size_t> weightMapNumbers;
+	std::map<std::string, std::size_t> morphMapNumbers;
+	std::size_t vertexIdxStart = 0;
+
+	for (const Surface* surface : surfaces)
+	{
+		for (const auto& weights : surface->weightMaps)
+		{
+			auto mapNumber = weightMapNumbers.emplace(weights.first, weightMapNumbers.size()).first->second;
+			deformations.resize(table.vertices.size());
+
+			for (const VertexWeight& weight : weights.second)
+			{
+				deformations[vertexIdxStart + weight.vertex].emplace_back(mapNumber, Vector3(weight.weight, 0, 0));
+			}
+		}
+
+		for (const auto& offsets : surface->morphMaps)
+		{
+			// Morph maps are numbered after the weight maps
+			auto mapNumber = morphMapNumbers.emplace(offsets.first, morphMapNumbers.size()).first->second + (1 << 16);
+			deformations.resize(table.vertices.size());
+
+			for (const VertexOffset& offset : offsets.second)
+			{
+				deformations[vertexIdxStart + offset.vertex].emplace_back(mapNumber, offset.offset);
+			}
+		}
+
+		vertexIdxStart += surface->vertices.size();
+	}
+
+	// Number the motion tracks, the static vertices get the empty track 0
+	bool isAnimated = std::any_of(surfaces.begin(), surfaces.end(), [](const Surface* surface) { return !surface->motionTracks.empty(); });
+
+	if (isAnimated)
+	{
+		std::map<std::string, std::size_t> trackNumbers = { { std::string(), 0 } };
+		table.trackNames.emplace_back();
+		table.vertexTracks.resize(table.vertices.size(), 0);
+
+		vertexIdxStart = 0;
+
+		for (const Surface* surface : surfaces)
+		{
+			for (std::size_t r = 0; r < surface->motionTracks.size(); ++r)
+			{
+				const auto& range = surface->motionTracks[r];
+				auto result = trackNumbers.emplace(range.track, table.trackNames.size());
+
+				if (result.second)
+				{
+					table.trackNames.push_back(range.track);
+				}
+
+				auto end = r + 1 < surface->motionTracks.size() ? surface->motionTracks[r + 1].firstVertex : surface->vertices.size();
+
+				std::fill(table.vertexTracks.begin() + vertexIdxStart + range.firstVertex,
+					table.vertexTracks.begin() + vertexIdxStart + end, result.first->second);
+			}
+
+			vertexIdxStart += surface->vertices.size();
+		}
+	}
+
+	auto cellScale = render::WeldVertexHash(weldEpsilon).cellScale;
+
+	auto hash = [&](std::size_t v)
+	{
+		return math::hashVector3InCells(table.vertices[v]->vertex, cellScale);
+	};
+
+	auto equal = [&](std::size_t a, std::size_t b)
+	{
+		const ArbitraryMeshVertex& first = *table.vertices[a];
+		const ArbitraryMeshVertex& second = *table.vertices[b];
+
+		return math::isNear(first.vertex, second.vertex, weldEpsilon) &&
+			first.normal.dot(second.normal) > (1.0 - render::NormalEpsilon) &&
+			(deformations.empty() || deformations[a] == deformations[b]) &&
+			(table.vertexTracks.empty() || table.vertexTracks[a] == table.vertexTracks[b]);
+	};
+
+	std::unordered_map<std::size_t, std::size_t, decltype(hash), decltype(equal)> points(table.vertices.size(), hash, equal);
+
+	table.vertexPoints.reserve(table.vertices.size());
+
+	for (std::size_t v = 0; v < table.vertices.size(); ++v)
+	{
+		parallel::checkpoint(v);
+
+		auto result = points.emplace(v, table.pointVertices.size());
+
+		if (result.second)
+		{
+			table.pointVertices.push_back(v);
+		}
+
+		table.vertexPoints.push_back(result.first->second);
+	}
+
+	return table;
+}
+
+Lwo2Exporter::TagIndices Lwo2Exporter::getTagIndices(std::vector<unsigned int>& tagMaterials) const
+{
+	std::vector<bool> materialIsUsed(_materials->size(), false);
+
+	for (const Layer& layer : _layers)
+	{
+		for (const Surface& surface : layer.surfaces)
+		{
+			if (!materialIsUsed[surface.materialId])
+			{
+				materialIsUsed[surface.materialId] = true;
+				tagMaterials.push_back(surface.materialId);
+			}
+		}
+	}
+
+	// The tags are sorted by material name
+	_materials->sortByName(tagMaterials);
+
+	TagIndices tagIndices(_materials->size(), 0);
+
+	for (std::size_t tagNum = 0; tagNum < tagMaterials.size(); ++tagNum)
+	{
+		tagIndices[tagMaterials[tagNum]] = tagNum;
+	}
+
+	return tagIndices;
+}
+
+void Lwo2Exporter::setPointWeldEpsilon(double epsilon)
+{
+	_pointWeldEpsilon = epsilon;
+}
+
+void Lwo2Exporter::setSourceSurfaces(const SourceSurfaces& sourceSurfaces)
+{
+	_sourceSurfaces = sourceSurfaces;
+}
+
+const std::string& Lwo2Exporter::getUVMapName() const
+{
+	return _sourceSurfaces.uvMapName.empty() ? UVMapName : _sourceSurfaces.uvMapName;
+}
+
+const std::string& Lwo2Exporter::getColourMapName() const
+{
+	return _sourceSurfaces.colourMapName.empty() ? VertexColourMapName : _sourceSurfaces.colourMapName;
+}
+
 const std::string& Lwo2Exporter::getDisplayName() const
 {
 	static std::string _extension("Lightwave Object File");
@@ -74,6 +271,8 @@ const std::string& Lwo2Exporter::getExtension() const
 
 void Lwo2Exporter::exportToPath(const std::string& outputPath, const std::string& filename)
 {
+    profiling::StageScope stage(profiling::Stage::Write);
+
     // Open the stream to the output file
     stream::ExportStream output(outputPath, filename, stream::ExportStream::Mode::Binary);
 
@@ -82,8 +281,136 @@ void Lwo2Exporter::exportToPath(const std::string& outputPath, const std::string
     output.close();
 }
 
+void Lwo2Exporter::exportPointCache(const std::string& outputPath, const std::string& filename, const PointAnimation& animation)
+{
+    profiling::StageScope stage(profiling::Stage::Write);
+
+    stream::ExportStream output(outputPath, filename, stream::ExportStream::Mode::Binary);
+
+    exportPointCacheToStream(output.getStream(), animation);
+
+    output.close();
+}
+
+void Lwo2Exporter::exportPointCacheToStream(std::ostream& stream, const PointAnimation& animation)
+{
+	profiling::StageScope stage(profiling::Stage::Encode);
+
+	std::vector<unsigned int> tagMaterials;
+	auto tagIndices = getTagIndices(tagMaterials);
+
+	// Weld the points exactly like encodeLayer does, to get the same point numbers
+	std::vector<PointTable> layerPoints(_layers.size());
+
+	parallel::forEach(_layers.size(), [&](std::size_t layerNum)
+	{
+		layerPoints[layerNum] = buildPointTable(getSurfacesInTagOrder(_layers[layerNum], tagIndices), _pointWeldEpsilon);
+	});
+
+	// The rest positions of the points of all layers, and the points moved by each track
+	std::vector<Vector3> restPositions;
+	std::map<std::string, std::vector<std::size_t>> trackPoints;
+
+	for (const PointTable& points : layerPoints)
+	{
+		for (std::size_t pointNum = 0; pointNum < points.pointVertices.size(); ++pointNum)
+		{
+			auto vertexIndex = points.pointVertices[pointNum];
+
+			// Vertices without a known track stay in place
+			if (!points.vertexTracks.empty() && points.vertexTracks[vertexIndex] != 0)
+			{
+				const auto& track = points.trackNames[points.vertexTracks[vertexIndex]];
+
+				if (animation.tracks.count(track) > 0)
+				{
+					trackPoints[track].push_back(restPositions.size());
+				}
+			}
+
+			restPositions.push_back(points.vertices[vertexIndex]->vertex);
+		}
+	}
+
+	auto numFrames = animation.frameTimes.size();
+
+	for (const auto& pair : trackPoints)
+	{
+		if (animation.tracks.at(pair.first).size() != numFrames)
+		{
+			throw std::runtime_error("Motion track " + pair.first + " doesn't have a transform for every frame");
+		}
+	}
+
+	// MDD header: numFrames[I4], numPoints[I4], time[F4] # numFrames
+	stream::writeBigEndian<uint32_t>(stream, static_cast<uint32_t>(numFrames));
+	stream::writeBigEndian<uint32_t>(stream, static_cast<uint32_t>(restPositions.size()));
+
+	for (auto time : animation.frameTimes)
+	{
+		stream::writeBigEndian<float>(stream, static_cast<float>(time));
+	}
+
+	// The static points are the same in every frame, swap Y and Z like for PNTS
+	std::vector<float> restValues;
+	restValues.reserve(restPositions.size() * 3);
+
+	for (const Vector3& position : restPositions)
+	{
+		restValues.push_back(static_cast<float>(position.x()));
+		restValues.push_back(static_cast<float>(position.z()));
+		restValues.push_back(static_cast<float>(position.y()));
+	}
+
+	// Frames are encoded in parallel, in batches keeping the buffered data below 64 MB
+	auto frameSize = restValues.size() * sizeof(float);
+	auto batchSize = std::max<std::size_t>(1, (64 << 20) / std::max<std::size_t>(frameSize, 1));
+
+	std::vector<char> encoded;
+
+	for (std::size_t batchStart = 0; batchStart < numFrames; batchStart += batchSize)
+	{
+		auto batchFrames = std::min(batchSize, numFrames - batchStart);
+		encoded.resize(batchFrames * frameSize);
+
+		parallel::forEach(batchFrames, [&](std::size_t batchFrame)
+		{
+			auto frame = batchStart + batchFrame;
+			std::vector<float> values(restValues);
+			std::vector<Vector3> moved;
+
+			for (const auto& pair : trackPoints)
+			{
+				moved.clear();
+
+				for (auto pointNum : pair.second)
+				{
+					moved.push_back(restPositions[pointNum]);
+				}
+
+				constexpr std::size_t Stride = sizeof(Vector3) / sizeof(double);
+				simd::transformPoints(animation.tracks.at(pair.first)[frame], moved.front(), Stride, moved.size());
+
+				for (std::size_t i = 0; i < moved.size(); ++i)
+				{
+					auto value = values.data() + pair.second[i] * 3;
+					value[0] = static_cast<float>(moved[i].x());
+					value[1] = static_cast<float>(moved[i].z());
+					value[2] = static_cast<float>(moved[i].y());
+				}
+			}
+
+			simd::storeBigEndian(values.data(), values.size(), encoded.data() + batchFrame * frameSize);
+		});
+
+		stream.write(encoded.data(), encoded.size());
+	}
+}
+
 void Lwo2Exporter::exportToStream(std::ostream& stream)
 {
+	profiling::StageScope stage(profiling::Stage::Encode);
+
 	// The encompassing FORM chunk
 	Lwo2Chunk fileChunk("FORM", Lwo2Chunk::Type::Chunk);
 
@@ -94,13 +421,17 @@ void Lwo2Exporter::exportToStream(std::ostream& stream)
 
 	// TAGS
 	Lwo2Chunk::Ptr tags = fileChunk.addChunk("TAGS");
-	
+
+	// Materials used in more than one layer share the same tag and SURF chunk
+	std::vector<unsigned int> tagMaterials;
+	auto tagIndices = getTagIndices(tagMaterials);
+
 	// Export all material names as tags
-	if (!_surfaces.empty())
+	if (!tagMaterials.empty())
 	{
-		for (const Surfaces::value_type& pair : _surfaces)
+		for (auto materialId : tagMaterials)
 		{
-			stream::writeString(tags->stream, pair.second.materialName);
+			stream::writeString(tags->stream, _materials->getName(materialId));
 		}
 	}
 	else
@@ -108,113 +439,92 @@ void Lwo2Exporter::exportToStream(std::ostream& stream)
 		stream::writeString(tags->stream, "");
 	}
 
-	// Create a single layer for the geometry
-	Lwo2Chunk::Ptr layr = fileChunk.addChunk("LAYR");
-
-	// LAYR{ number[U2], flags[U2], pivot[VEC12], name[S0], parent[U2] ? }
-
-	stream::writeBigEndian<uint16_t>(layr->stream, 0); // number[U2]
-	stream::writeBigEndian<uint16_t>(layr->stream, 0); // flags[U2]
-
-	// pivot[VEC12]
-	stream::writeBigEndian<float>(layr->stream, 0);
-	stream::writeBigEndian<float>(layr->stream, 0);
-	stream::writeBigEndian<float>(layr->stream, 0);
+	// Export at least one (empty) layer
+	ensureLayer();
 
-	stream::writeString(layr->stream, ""); // name[S0]
-	// no parent index
+	// The layers don't depend on each other, encode them in parallel
+	std::vector<std::vector<Lwo2Chunk::Ptr>> layerChunks(_layers.size());
 
-	// Create the chunks for PNTS, POLS, PTAG, VMAP
-	Lwo2Chunk::Ptr pnts = fileChunk.addChunk("PNTS");
-	Lwo2Chunk::Ptr bbox = fileChunk.addChunk("BBOX");
-	Lwo2Chunk::Ptr pols = fileChunk.addChunk("POLS");
-	Lwo2Chunk::Ptr ptag = fileChunk.addChunk("PTAG");
-	Lwo2Chunk::Ptr vmap = fileChunk.addChunk("VMAP");
-	Lwo2Chunk::Ptr colourVmap = fileChunk.addChunk("VMAP");
+	parallel::forEach(_layers.size(), [&](std::size_t layerNum)
+	{
+		layerChunks[layerNum] = encodeLayer(layerNum, _layers[layerNum], tagIndices);
+	});
 
-	// We only ever export FACE polygons
-	pols->stream.write("FACE", 4);
-	ptag->stream.write("SURF", 4); // we tag the surfaces
+	for (const std::vector<Lwo2Chunk::Ptr>& chunks : layerChunks)
+	{
+		fileChunk.subChunks.insert(fileChunk.subChunks.end(), chunks.begin(), chunks.end());
+	}
 
-	// Texture UV Coordinates go into one VMAP
-	// VMAP { type[ID4], dimension[U2], name[S0], ...) }
-	vmap->stream.write("TXUV", 4);		// "TXUV"
-	stream::writeBigEndian<uint16_t>(vmap->stream, 2); // dimension (2 vector components)
-	
-	std::string uvmapName = "UVMap";
-	stream::writeString(vmap->stream, uvmapName);
+	// The CLIP chunks of the source file keep their indices, the generated ones are numbered after them
+	uint32_t lastSourceClip = 0;
 
-	// Vertex Colours go into another VMAP
-	// VMAP { type[ID4], dimension[U2], name[S0], ...) }
-	colourVmap->stream.write("RGBA", 4); // type [ID4] == "RGBA"
-	stream::writeBigEndian<uint16_t>(colourVmap->stream, 4); // dimension (4 colour components)
+	for (const std::string& source : _sourceSurfaces.clips)
+	{
+		Lwo2Chunk::Ptr clip = fileChunk.addChunk("CLIP");
+		clip->stream.write(source.data(), source.size());
 
-	std::string vertColourMapName = "VertexColourMap";
-	stream::writeString(colourVmap->stream, vertColourMapName); // map name [S0]
+		if (source.size() >= 4)
+		{
+			auto index = static_cast<uint32_t>(static_cast<unsigned char>(source[0])) << 24 |
+				static_cast<uint32_t>(static_cast<unsigned char>(source[1])) << 16 |
+				static_cast<uint32_t>(static_cast<unsigned char>(source[2])) << 8 |
+				static_cast<uint32_t>(static_cast<unsigned char>(source[3]));
 
-	std::size_t vertexIdxStart = 0;
-	std::size_t polyNum = 0; // poly index is used across all surfaces
+			lastSourceClip = std::max(lastSourceClip, index);
+		}
+	}
 
-	AABB bounds;
+	// Every distinct texture image gets a CLIP chunk, referenced by the surfaces using it
+	std::vector<const std::string*> tagTextures(tagMaterials.size(), nullptr);
+	std::map<std::string, uint32_t> clipIndices;
 
-	// Write all surface data
-	std::size_t surfNum = 0;
-	for (Surfaces::value_type& pair : _surfaces)
+	for (const Layer& layer : _layers)
 	{
-		Surface& surface = pair.second;
-
-		for (std::size_t v = 0; v < surface.vertices.size(); ++v)
+		for (const Surface* surface : getSurfacesInTagOrder(layer, tagIndices))
 		{
-			const ArbitraryMeshVertex& vertex = surface.vertices[v];
-			std::size_t vertNum = vertexIdxStart + v;
-
-			// "The LightWave coordinate system is left-handed, with +X to the right or east, +Y upward, and +Z forward or north."
-			stream::writeBigEndian<float>(pnts->stream, static_cast<float>(vertex.vertex.x()));
-			stream::writeBigEndian<float>(pnts->stream, static_cast<float>(vertex.vertex.z()));
-			stream::writeBigEndian<float>(pnts->stream, static_cast<float>(vertex.vertex.y()));
-
-			// Write the UV map data (invert the T axis)
-			stream::writeVariableIndex(vmap->stream, vertNum);
-			stream::writeBigEndian<float>(vmap->stream, static_cast<float>(vertex.texcoord.x()));
-			stream::writeBigEndian<float>(vmap->stream, 1.0f - static_cast<float>(vertex.texcoord.y()));
-
-			// Write the vertex colour data
-			stream::writeVariableIndex(colourVmap->stream, vertNum);
-			stream::writeBigEndian<float>(colourVmap->stream, static_cast<float>(vertex.colour.x()));
-			stream::writeBigEndian<float>(colourVmap->stream, static_cast<float>(vertex.colour.y()));
-			stream::writeBigEndian<float>(colourVmap->stream, static_cast<float>(vertex.colour.z()));
-			stream::writeBigEndian<float>(colourVmap->stream, 1.0f);
-
-			// Accumulate the BBOX
-			bounds.includePoint(vertex.vertex);
+			// Source SURF chunks refer to the source CLIP chunks
+			if (surface->texturePath.empty() || _sourceSurfaces.surfaces.count(_materials->getName(surface->materialId)) > 0) continue;
+
+			auto& tagTexture = tagTextures[tagIndices[surface->materialId]];
+
+			if (tagTexture == nullptr)
+			{
+				tagTexture = &surface->texturePath;
+			}
+
+			if (clipIndices.count(surface->texturePath) == 0)
+			{
+				// CLIP indices are 1-based
+				auto clipIndex = static_cast<uint32_t>(lastSourceClip + clipIndices.size() + 1);
+				clipIndices.emplace(surface->texturePath, clipIndex);
+
+				// CLIP { index[U4], attributes[SUB-CHUNK] * }
+				Lwo2Chunk::Ptr clip = fileChunk.addChunk("CLIP");
+				stream::writeBigEndian<uint32_t>(clip->stream, clipIndex);
+
+				// STIL { name[FNAM0] }
+				Lwo2Chunk::Ptr stil = clip->addSubChunk("STIL");
+				stream::writeString(stil->stream, surface->texturePath);
+			}
 		}
+	}
 
-		int16_t numVerts = 3; // we export triangles
-
-		// LWO2 sez: "When writing POLS, the vertex list for each polygon should begin 
-		// at a convex vertex and proceed clockwise as seen from the visible side of the polygon"
-		// DarkRadiant uses CCW windings, so reverse the index ordering
-
-		for (std::size_t i = 0; i + 2 < surface.indices.size(); i += 3)
-		{
-			stream::writeBigEndian<uint16_t>(pols->stream, numVerts); // [U2]
+	// Write the SURF chunks, one for each tag
+	for (std::size_t tagNum = 0; tagNum < tagMaterials.size(); ++tagNum)
+	{
+		const std::string& materialName = _materials->getName(tagMaterials[tagNum]);
 
-			// The three vertices defining this polygon (reverse indices to produce LWO2 windings)
-			stream::writeVariableIndex(pols->stream, vertexIdxStart + surface.indices[i+2]); // [VX]
-			stream::writeVariableIndex(pols->stream, vertexIdxStart + surface.indices[i+1]); // [VX]
-			stream::writeVariableIndex(pols->stream, vertexIdxStart + surface.indices[i+0]); // [VX]
+		Lwo2Chunk::Ptr surf = fileChunk.addChunk("SURF");
 
-			// The surface mapping in the PTAG
-			stream::writeVariableIndex(ptag->stream, polyNum); // [VX]
-			stream::writeBigEndian<uint16_t>(ptag->stream, static_cast<uint16_t>(surfNum)); // [U2]
+		auto source = _sourceSurfaces.surfaces.find(materialName);
 
-			++polyNum;
+		if (source != _sourceSurfaces.surfaces.end())
+		{
+			surf->stream.write(source->second.data(), source->second.size());
+			continue;
 		}
 
-		// Write the SURF chunk for the surface
-		Lwo2Chunk::Ptr surf = fileChunk.addChunk("SURF");
-
-		stream::writeString(surf->stream, surface.materialName);
+		stream::writeString(surf->stream, materialName);
 		stream::writeString(surf->stream, ""); // empty parent name
 
 		// Define the base surface colour as <1.0, 1.0, 1.0>
@@ -229,8 +539,8 @@ void Lwo2Exporter::exportToStream(std::ostream& stream)
 		Lwo2Chunk::Ptr vcol = surf->addSubChunk("VCOL");
 		stream::writeBigEndian<float>(vcol->stream, 1.0f); // intensity [F4]
 		stream::writeVariableIndex(vcol->stream, 0); // [VX]
-		vcol->stream.write("RGBA", 4); // vmap-type [ID4]
-		stream::writeString(vcol->stream, vertColourMapName); // name [S0]
+		vcol->stream.write(_sourceSurfaces.colourMapHasAlpha ? "RGBA" : "RGB ", 4); // vmap-type [ID4]
+		stream::writeString(vcol->stream, getColourMapName()); // name [S0]
 
 		// Smoothing angle
 		Lwo2Chunk::Ptr sman = surf->addSubChunk("SMAN");
@@ -243,7 +553,7 @@ void Lwo2Exporter::exportToStream(std::ostream& stream)
 		Lwo2Chunk::Ptr imap = blok->addSubChunk("IMAP");
 		{
 			// Use the same name as the surface as ordinal string
-			stream::writeString(imap->stream, surface.materialName);
+			stream::writeString(imap->stream, materialName);
 
 			Lwo2Chunk::Ptr imapChan = imap->addSubChunk("CHAN");
 			imapChan->stream.write("COLR", 4);
@@ -270,29 +580,334 @@ void Lwo2Exporter::exportToStream(std::ostream& stream)
 		Lwo2Chunk::Ptr blokAxis = blok->addSubChunk("AXIS");
 		stream::writeBigEndian<uint16_t>(blokAxis->stream, 2); // Z axis
 
+		// IMAG, reference the CLIP of the texture image
+		if (tagTextures[tagNum] != nullptr)
+		{
+			Lwo2Chunk::Ptr blokImag = blok->addSubChunk("IMAG");
+			stream::writeVariableIndex(blokImag->stream, clipIndices.at(*tagTextures[tagNum]));
+		}
+
 		// VMAP 
 		Lwo2Chunk::Ptr blokVmap = blok->addSubChunk("VMAP");
-		stream::writeString(blokVmap->stream, uvmapName);
+		stream::writeString(blokVmap->stream, getUVMapName());
+	}
+
+	profiling::StageScope writeStage(profiling::Stage::Write);
+	fileChunk.writeToStream(stream);
+}
+
+std::vector<Lwo2Chunk::Ptr> Lwo2Exporter::encodeLayer(std::size_t layerNum, const Layer& layer, const TagIndices& tagIndices)
+{
+	Lwo2Chunk::Ptr layr = std::make_shared<Lwo2Chunk>("LAYR", Lwo2Chunk::Type::Chunk);
+
+	// LAYR{ number[U2], flags[U2], pivot[VEC12], name[S0], parent[U2] ? }
+
+	stream::writeBigEndian<uint16_t>(layr->stream, static_cast<uint16_t>(layerNum)); // number[U2]
+	stream::writeBigEndian<uint16_t>(layr->stream, 0); // flags[U2]
+
+	// pivot[VEC12], swap Y and Z like for the points below
+	stream::writeBigEndian<float>(layr->stream, static_cast<float>(layer.pivot.x()));
+	stream::writeBigEndian<float>(layr->stream, static_cast<float>(layer.pivot.z()));
+	stream::writeBigEndian<float>(layr->stream, static_cast<float>(layer.pivot.y()));
 
-		// Reposition the vertex index
-		vertexIdxStart += surface.vertices.size();
+	stream::writeString(layr->stream, layer.name); // name[S0]
 
-		++surfNum;
+	// parent[U2] is optional, top-level layers don't write it
+	if (layer.parentIndex != -1)
+	{
+		stream::writeBigEndian<uint16_t>(layr->stream, static_cast<uint16_t>(layer.parentIndex));
 	}
 
-	// Write the bounds now that we know all the points
-	Vector3 min = bounds.origin - bounds.extents;
-	Vector3 max = bounds.origin + bounds.extents;
+	// Surfaces are written in tag order, like the SURF chunks
+	auto surfaces = getSurfacesInTagOrder(layer, tagIndices);
+	auto points = buildPointTable(surfaces, _pointWeldEpsilon);
 
-	stream::writeBigEndian<float>(bbox->stream, static_cast<float>(min.x()));
-	stream::writeBigEndian<float>(bbox->stream, static_cast<float>(min.y()));
-	stream::writeBigEndian<float>(bbox->stream, static_cast<float>(min.z()));
+	// Create the chunks for PNTS, POLS, PTAG, VMAP
+	Lwo2Chunk::Ptr pnts = std::make_shared<Lwo2Chunk>("PNTS", Lwo2Chunk::Type::Chunk);
+	Lwo2Chunk::Ptr bbox = std::make_shared<Lwo2Chunk>("BBOX", Lwo2Chunk::Type::Chunk);
+	Lwo2Chunk::Ptr pols = std::make_shared<Lwo2Chunk>("POLS", Lwo2Chunk::Type::Chunk);
+	Lwo2Chunk::Ptr ptag = std::make_shared<Lwo2Chunk>("PTAG", Lwo2Chunk::Type::Chunk);
+	Lwo2Chunk::Ptr vmap = std::make_shared<Lwo2Chunk>("VMAP", Lwo2Chunk::Type::Chunk);
+	Lwo2Chunk::Ptr colourVmap = std::make_shared<Lwo2Chunk>("VMAP", Lwo2Chunk::Type::Chunk);
+	Lwo2Chunk::Ptr vmad = std::make_shared<Lwo2Chunk>("VMAD", Lwo2Chunk::Type::Chunk);
+	Lwo2Chunk::Ptr colourVmad = std::make_shared<Lwo2Chunk>("VMAD", Lwo2Chunk::Type::Chunk);
 
-	stream::writeBigEndian<float>(bbox->stream, static_cast<float>(max.x()));
-	stream::writeBigEndian<float>(bbox->stream, static_cast<float>(max.y()));
-	stream::writeBigEndian<float>(bbox->stream, static_cast<float>(max.z()));
+	// We only ever export FACE polygons
+	pols->stream.write("FACE", 4);
+	ptag->stream.write("SURF", 4); // we tag the surfaces
 
-	fileChunk.writeToStream(stream);
+	// Texture UV Coordinates go into one VMAP
+	// VMAP { type[ID4], dimension[U2], name[S0], ...) }
+	vmap->stream.write("TXUV", 4);		// "TXUV"
+	stream::writeBigEndian<uint16_t>(vmap->stream, 2); // dimension (2 vector components)
+	stream::writeString(vmap->stream, getUVMapName());
+
+	// Vertex Colours go into another VMAP
+	// VMAP { type[ID4], dimension[U2], name[S0], ...) }
+	// The alpha is only omitted to match the RGB map of a re-processed file
+	auto colourHasAlpha = _sourceSurfaces.colourMapHasAlpha;
+
+	colourVmap->stream.write(colourHasAlpha ? "RGBA" : "RGB ", 4); // type [ID4]
+	stream::writeBigEndian<uint16_t>(colourVmap->stream, colourHasAlpha ? 4 : 3); // dimension (colour components)
+	stream::writeString(colourVmap->stream, getColourMapName()); // map name [S0]
+
+	// Polygon corners whose texcoords or colours differ from their point's values
+	// VMAD { type[ID4], dimension[U2], name[S0], ( vert[VX], poly[VX], value[F4] # dimension )* }
+	vmad->stream.write("TXUV", 4);
+	stream::writeBigEndian<uint16_t>(vmad->stream, 2);
+	stream::writeString(vmad->stream, getUVMapName());
+
+	colourVmad->stream.write(colourHasAlpha ? "RGBA" : "RGB ", 4);
+	stream::writeBigEndian<uint16_t>(colourVmad->stream, colourHasAlpha ? 4 : 3);
+	stream::writeString(colourVmad->stream, getColourMapName());
+
+	bool hasVmad = false;
+	bool hasColourVmad = false;
+
+	// Each named weight map of the layer's surfaces gets its own weight VMAP
+	std::map<std::string, Lwo2Chunk::Ptr> weightVmaps;
+
+	for (const Surface* surface : surfaces)
+	{
+		for (const VertexWeightMaps::value_type& weights : surface->weightMaps)
+		{
+			if (weightVmaps.count(weights.first) > 0) continue;
+
+			// VMAP { type[ID4], dimension[U2], name[S0], ...) }
+			Lwo2Chunk::Ptr weightVmap = std::make_shared<Lwo2Chunk>("VMAP", Lwo2Chunk::Type::Chunk);
+			weightVmap->stream.write("WGHT", 4); // type [ID4] == "WGHT"
+			stream::writeBigEndian<uint16_t>(weightVmap->stream, 1); // dimension (1 weight)
+			stream::writeString(weightVmap->stream, weights.first); // map name [S0]
+
+			weightVmaps.emplace(weights.first, weightVmap);
+		}
+	}
+
+	// Same for the morph maps, these store relative offsets
+	std::map<std::string, Lwo2Chunk::Ptr> morphVmaps;
+
+	for (const Surface* surface : surfaces)
+	{
+		for (const VertexOffsetMaps::value_type& offsets : surface->morphMaps)
+		{
+			if (morphVmaps.count(offsets.first) > 0) continue;
+
+			// VMAP { type[ID4], dimension[U2], name[S0], ...) }
+			Lwo2Chunk::Ptr morphVmap = std::make_shared<Lwo2Chunk>("VMAP", Lwo2Chunk::Type::Chunk);
+			morphVmap->stream.write("MORF", 4); // type [ID4] == "MORF"
+			stream::writeBigEndian<uint16_t>(morphVmap->stream, 3); // dimension (3 vector components)
+			stream::writeString(morphVmap->stream, offsets.first); // map name [S0]
+
+			morphVmaps.emplace(offsets.first, morphVmap);
+		}
+	}
+
+	// The point data, the polygon data and the vertex maps go into different chunks, encode them in parallel
+	parallel::forEach(weightVmaps.empty() && morphVmaps.empty() ? 2 : 3, [&](std::size_t task)
+	{
+		if (task == 0)
+		{
+			std::vector<float> positions;
+			positions.reserve(points.pointVertices.size() * 3);
+
+			// The points are written all at once, in the order they have been created
+			for (std::size_t pointNum = 0; pointNum < points.pointVertices.size(); ++pointNum)
+			{
+				parallel::checkpoint(pointNum);
+
+				const ArbitraryMeshVertex& vertex = *points.vertices[points.pointVertices[pointNum]];
+
+				// "The LightWave coordinate system is left-handed, with +X to the right or east, +Y upward, and +Z forward or north."
+				positions.push_back(static_cast<float>(vertex.vertex.x()));
+				positions.push_back(static_cast<float>(vertex.vertex.z()));
+				positions.push_back(static_cast<float>(vertex.vertex.y()));
+
+				// Write the UV map data (invert the T axis)
+				stream::writeVariableIndex(vmap->stream, pointNum);
+				stream::writeBigEndian<float>(vmap->stream, static_cast<float>(vertex.texcoord.x()));
+				stream::writeBigEndian<float>(vmap->stream, 1.0f - static_cast<float>(vertex.texcoord.y()));
+
+				// Write the vertex colour data
+				stream::writeVariableIndex(colourVmap->stream, pointNum);
+				stream::writeBigEndian<float>(colourVmap->stream, static_cast<float>(vertex.colour.x()));
+				stream::writeBigEndian<float>(colourVmap->stream, static_cast<float>(vertex.colour.y()));
+				stream::writeBigEndian<float>(colourVmap->stream, static_cast<float>(vertex.colour.z()));
+
+				if (colourHasAlpha)
+				{
+					stream::writeBigEndian<float>(colourVmap->stream, 1.0f);
+				}
+			}
+
+			// Byte-swap the whole PNTS payload in one go
+			std::vector<char> encoded(positions.size() * sizeof(float));
+			simd::storeBigEndian(positions.data(), positions.size(), encoded.data());
+			pnts->stream.write(encoded.data(), encoded.size());
+
+			// Write the bounds now that we know all the points
+			double bounds[6] = { 1, 1, 1, -1, -1, -1 }; // what an empty AABB used to yield
+
+			if (!points.pointVertices.empty())
+			{
+				// The vertices aren't contiguous, gather the positions first
+				std::vector<Vector3> pointPositions;
+				pointPositions.reserve(points.pointVertices.size());
+
+				for (auto vertexIndex : points.pointVertices)
+				{
+					pointPositions.push_back(points.vertices[vertexIndex]->vertex);
+				}
+
+				constexpr std::size_t Stride = sizeof(Vector3) / sizeof(double);
+				simd::getBounds(pointPositions.front(), Stride, pointPositions.size(), bounds, bounds + 3);
+			}
+
+			float boundsValues[6];
+			std::transform(bounds, bounds + 6, boundsValues, [](double value) { return static_cast<float>(value); });
+
+			char encodedBounds[sizeof(boundsValues)];
+			simd::storeBigEndian(boundsValues, 6, encodedBounds);
+			bbox->stream.write(encodedBounds, sizeof(encodedBounds));
+
+			return;
+		}
+
+		std::size_t vertexIdxStart = 0;
+		std::size_t polyNum = 0; // poly index is used across all surfaces
+
+		for (const Surface* surfacePtr : surfaces)
+		{
+			const Surface& surface = *surfacePtr;
+
+			parallel::checkpoint();
+
+			if (task == 1)
+			{
+				int16_t numVerts = 3; // we export triangles
+				auto surfNum = tagIndices[surface.materialId];
+
+				// LWO2 sez: "When writing POLS, the vertex list for each polygon should begin 
+				// at a convex vertex and proceed clockwise as seen from the visible side of the polygon"
+				// DarkRadiant uses CCW windings, so reverse the index ordering
+
+				for (std::size_t i = 0; i + 2 < surface.indices.size(); i += 3)
+				{
+					parallel::checkpoint(polyNum);
+
+					stream::writeBigEndian<uint16_t>(pols->stream, numVerts); // [U2]
+
+					// The three vertices defining this polygon (reverse indices to produce LWO2 windings)
+					for (std::size_t corner = i + 3; corner-- > i;)
+					{
+						std::size_t vertNum = vertexIdxStart + surface.indices[corner];
+						std::size_t pointNum = points.vertexPoints[vertNum];
+
+						stream::writeVariableIndex(pols->stream, pointNum); // [VX]
+
+						if (points.pointVertices[pointNum] == vertNum) continue;
+
+						const ArbitraryMeshVertex& vertex = *points.vertices[vertNum];
+						const ArbitraryMeshVertex& pointVertex = *points.vertices[points.pointVertices[pointNum]];
+
+						if (!math::isNear(vertex.texcoord, pointVertex.texcoord, render::TexCoordEpsilon))
+						{
+							stream::writeVariableIndex(vmad->stream, pointNum);
+							stream::writeVariableIndex(vmad->stream, polyNum);
+							stream::writeBigEndian<float>(vmad->stream, static_cast<float>(vertex.texcoord.x()));
+							stream::writeBigEndian<float>(vmad->stream, 1.0f - static_cast<float>(vertex.texcoord.y()));
+							hasVmad = true;
+						}
+
+						if (!math::isNear(vertex.colour, pointVertex.colour, render::VertexEpsilon))
+						{
+							stream::writeVariableIndex(colourVmad->stream, pointNum);
+							stream::writeVariableIndex(colourVmad->stream, polyNum);
+							stream::writeBigEndian<float>(colourVmad->stream, static_cast<float>(vertex.colour.x()));
+							stream::writeBigEndian<float>(colourVmad->stream, static_cast<float>(vertex.colour.y()));
+							stream::writeBigEndian<float>(colourVmad->stream, static_cast<float>(vertex.colour.z()));
+
+							if (colourHasAlpha)
+							{
+								stream::writeBigEndian<float>(colourVmad->stream, 1.0f);
+							}
+							hasColourVmad = true;
+						}
+					}
+
+					// The surface mapping in the PTAG
+					stream::writeVariableIndex(ptag->stream, polyNum); // [VX]
+					stream::writeBigEndian<uint16_t>(ptag->stream, static_cast<uint16_t>(surfNum)); // [U2]
+
+					++polyNum;
+				}
+			}
+			else
+			{
+				// Only the influenced vertices are listed in the weight maps. Vertices sharing
+				// a point have the same weights and offsets, write them for the first one only.
+				for (const VertexWeightMaps::value_type& weights : surface.weightMaps)
+				{
+					auto& weightVmap = weightVmaps.at(weights.first);
+
+					for (const VertexWeight& weight : weights.second)
+					{
+						std::size_t pointNum = points.vertexPoints[vertexIdxStart + weight.vertex];
+
+						if (points.pointVertices[pointNum] != vertexIdxStart + weight.vertex) continue;
+
+						stream::writeVariableIndex(weightVmap->stream, pointNum); // [VX]
+						stream::writeBigEndian<float>(weightVmap->stream, weight.weight); // [F4]
+					}
+				}
+
+				// Only the moved vertices are listed in the morph maps, swap Y and Z like for the points
+				for (const VertexOffsetMaps::value_type& offsets : surface.morphMaps)
+				{
+					auto& morphVmap = morphVmaps.at(offsets.first);
+
+					for (const VertexOffset& offset : offsets.second)
+					{
+						std::size_t pointNum = points.vertexPoints[vertexIdxStart + offset.vertex];
+
+						if (points.pointVertices[pointNum] != vertexIdxStart + offset.vertex) continue;
+
+						stream::writeVariableIndex(morphVmap->stream, pointNum); // [VX]
+						stream::writeBigEndian<float>(morphVmap->stream, static_cast<float>(offset.offset.x()));
+						stream::writeBigEndian<float>(morphVmap->stream, static_cast<float>(offset.offset.z()));
+						stream::writeBigEndian<float>(morphVmap->stream, static_cast<float>(offset.offset.y()));
+					}
+				}
+			}
+
+			// Reposition the vertex index
+			vertexIdxStart += surface.vertices.size();
+		}
+
+	});
+
+	std::vector<Lwo2Chunk::Ptr> chunks{ layr, pnts, bbox, pols, ptag, vmap, colourVmap };
+
+	if (hasVmad)
+	{
+		chunks.push_back(vmad);
+	}
+
+	if (hasColourVmad)
+	{
+		chunks.push_back(colourVmad);
+	}
+
+	for (const auto& pair : weightVmaps)
+	{
+		chunks.push_back(pair.second);
+	}
+
+	for (const auto& pair : morphVmaps)
+	{
+		chunks.push_back(pair.second);
+	}
+
+	return chunks;
 }
 
 }
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <map>
 #include "ModelExporterBase.h"
+#include "PointAnimation.h"
+#include "Lwo2Chunk.h"
+#include "VertexHashing.h"
 
 namespace model
 {
@@ -9,6 +13,32 @@ class Lwo2Exporter :
 	public ModelExporterBase
 {
 public:
+	// The surface properties of a re-processed LWO file
+	struct SourceSurfaces
+	{
+		// Surface name => contents of its SURF chunk, written unchanged instead of the generated one
+		std::map<std::string, std::string> surfaces;
+
+		// The contents of the CLIP chunks, each starting with its index
+		std::vector<std::string> clips;
+
+		// The names of the UV and vertex colour maps the surfaces refer to, empty for the default names
+		std::string uvMapName;
+		std::string colourMapName;
+
+		// The vertex colour map is written as RGB map without alpha if false
+		bool colourMapHasAlpha = true;
+	};
+
+private:
+	// Vertices of a layer closer than this are written as one point
+	double _pointWeldEpsilon = render::VertexEpsilon;
+
+	SourceSurfaces _sourceSurfaces;
+
+public:
+	using ModelExporterBase::ModelExporterBase;
+
 	const std::string& getDisplayName() const;
 
 	// Returns the uppercase file extension this exporter is suitable for
@@ -16,9 +46,64 @@ public:
 
     void exportToPath(const std::string& outputPath, const std::string& filename);
 
+	// Sets the distance within which the vertices of a layer are merged into one point,
+	// should match the epsilon the surfaces have been welded with
+	void setPointWeldEpsilon(double epsilon);
+
+	// Keeps the surface properties of a re-processed LWO file: its SURF and CLIP chunks are
+	// written unchanged, surfaces without SURF chunk get the generated one
+	void setSourceSurfaces(const SourceSurfaces& sourceSurfaces);
+
+	// Writes the animation of the points as LightWave MDD point cache, to be used with the
+	// LWO file written by exportToPath. The points of all layers are stored in the order of
+	// the LWO file, vertices without a motion track of the animation stay in place.
+	void exportPointCache(const std::string& outputPath, const std::string& filename, const PointAnimation& animation);
+
 private:
 	// Export the model file to the given stream
 	void exportToStream(std::ostream& stream);
+
+	void exportPointCacheToStream(std::ostream& stream, const PointAnimation& animation);
+
+	// The names of the written UV and vertex colour maps
+	const std::string& getUVMapName() const;
+	const std::string& getColourMapName() const;
+
+	// Maps each material ID to its index in the TAGS chunk
+	typedef std::vector<std::size_t> TagIndices;
+
+	// The tag index of the materials used by the layers, the tags are sorted by material name.
+	// The used materials are returned in tag order.
+	TagIndices getTagIndices(std::vector<unsigned int>& tagMaterials) const;
+
+	// The surfaces of the layer, sorted by their tag index
+	static std::vector<const Surface*> getSurfacesInTagOrder(const Layer& layer, const TagIndices& tagIndices);
+
+	// The vertices of all surfaces of a layer are written as shared points where possible.
+	// Vertices can share a point if they have the same position and normal (within the weld
+	// epsilons) and the same weights and morph offsets. Their texcoords and colours may differ,
+	// the values not matching the point's VMAP entries are written to discontinuous VMADs.
+	struct PointTable
+	{
+		// All vertices of the layer, numbered across the surfaces
+		std::vector<const ArbitraryMeshVertex*> vertices;
+
+		// The point of each vertex
+		std::vector<std::size_t> vertexPoints;
+
+		// The vertex each point has been created from, this defines the values in the VMAPs
+		std::vector<std::size_t> pointVertices;
+
+		// The motion track of each vertex as index into trackNames, empty if no vertex is animated.
+		// Vertices of different tracks don't share points.
+		std::vector<std::size_t> vertexTracks;
+		std::vector<std::string> trackNames;
+	};
+
+	static PointTable buildPointTable(const std::vector<const Surface*>& surfaces, double weldEpsilon);
+
+	// Generates the LAYR chunk and all the geometry chunks following it
+	std::vector<Lwo2Chunk::Ptr> encodeLayer(std::size_t layerNum, const Layer& layer, const TagIndices& tagIndices);
 };
 
 }
@@ -0,0 +1,940 @@
+#include "Lwo2Reader.h"
+
+#include <map>
+#include <set>
+#include <cmath>
+#include <limits>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include "../MappedFile.h"
+#include "../math/Simd.h"
+#include "../Parallel.h"
+#include "../StageProfiler.h"
+
+namespace model
+{
+
+namespace
+{
+	constexpr uint32_t makeId(const char(&id)[5])
+	{
+		return static_cast<uint32_t>(static_cast<unsigned char>(id[0])) << 24 |
+			static_cast<uint32_t>(static_cast<unsigned char>(id[1])) << 16 |
+			static_cast<uint32_t>(static_cast<unsigned char>(id[2])) << 8 |
+			static_cast<uint32_t>(static_cast<unsigned char>(id[3]));
+	}
+
+	constexpr uint32_t NoTag = std::numeric_limits<uint32_t>::max();
+
+	const float Missing = std::numeric_limits<float>::quiet_NaN();
+
+	// Decodes the big endian LWO2 data types right from memory
+	class Cursor
+	{
+	private:
+		const unsigned char* _pos;
+		const unsigned char* _end;
+
+	public:
+		Cursor(const unsigned char* begin, const unsigned char* end) :
+			_pos(begin),
+			_end(end)
+		{}
+
+		bool atEnd() const
+		{
+			return _pos >= _end;
+		}
+
+		std::size_t remaining() const
+		{
+			return static_cast<std::size_t>(_end - _pos);
+		}
+
+		const unsigned char* position() const
+		{
+			return _pos;
+		}
+
+		void require(std::size_t bytes) const
+		{
+			if (remaining() < bytes)
+			{
+				throw std::runtime_error("Unexpected end of LWO2 data");
+			}
+		}
+
+		void skip(std::size_t bytes)
+		{
+			require(bytes);
+			_pos += bytes;
+		}
+
+		// Returns a cursor over the next bytes and moves past them
+		Cursor take(std::size_t bytes)
+		{
+			require(bytes);
+
+			Cursor range(_pos, _pos + bytes);
+			_pos += bytes;
+
+			return range;
+		}
+
+		uint16_t readU2()
+		{
+			require(2);
+
+			auto value = static_cast<uint16_t>(_pos[0] << 8 | _pos[1]);
+			_pos += 2;
+
+			return value;
+		}
+
+		uint32_t readU4()
+		{
+			require(4);
+
+			auto value = static_cast<uint32_t>(_pos[0]) << 24 | static_cast<uint32_t>(_pos[1]) << 16 |
+				static_cast<uint32_t>(_pos[2]) << 8 | static_cast<uint32_t>(_pos[3]);
+			_pos += 4;
+
+			return value;
+		}
+
+		float readF4()
+		{
+			auto bits = readU4();
+
+			float value;
+			std::memcpy(&value, &bits, sizeof(value));
+
+			return value;
+		}
+
+		// VX is 2 bytes, or 4 bytes with the first one set to 0xFF for values of 0xFF00 and above
+		uint32_t readVX()
+		{
+			require(1);
+
+			return _pos[0] == 0xFF ? readU4() & 0x00FFFFFF : readU2();
+		}
+
+		// S0 is null terminated and padded to an even length
+		std::string readS0()
+		{
+			auto terminator = static_cast<const unsigned char*>(std::memchr(_pos, 0, remaining()));
+
+			if (terminator == nullptr)
+			{
+				throw std::runtime_error("Unterminated string in LWO2 data");
+			}
+
+			std::string value(reinterpret_cast<const char*>(_pos), terminator - _pos);
+			_pos += std::min((value.size() + 2) & ~static_cast<std::size_t>(1), remaining());
+
+			return value;
+		}
+
+		// Swaps Y and Z, LightWave's coordinate system is left-handed and Y is up
+		Vector3 readVec12()
+		{
+			float x = readF4(), y = readF4(), z = readF4();
+			return Vector3(x, z, y);
+		}
+
+		// Reads the header of a (sub-)chunk, returns its contents and moves past the padding
+		Cursor readChunk(uint32_t& id, bool isSubChunk)
+		{
+			id = readU4();
+
+			std::size_t size = isSubChunk ? readU2() : readU4();
+			auto contents = take(size);
+
+			if ((size & 1) != 0 && !atEnd())
+			{
+				skip(1);
+			}
+
+			return contents;
+		}
+	};
+
+	struct Face
+	{
+		uint32_t firstCorner;
+		uint32_t numCorners;
+
+		// Index into the TAGS, NoTag if the face hasn't been tagged
+		uint32_t tag;
+	};
+
+	// The raw geometry of a layer, as it is stored in the file
+	struct LayerData
+	{
+		std::string name;
+		Vector3 pivot;
+		int number = 0;
+		int parentNumber = -1;
+
+		// Three floats per point, in LightWave coordinates
+		std::vector<float> points;
+
+		std::vector<Face> faces;
+
+		// The point of each polygon corner
+		std::vector<uint32_t> corners;
+
+		// The faces of the most recent POLS chunk, the polygon indices of PTAG and VMAD refer to these
+		std::size_t polsStart = 0;
+		bool polsAreFaces = false;
+
+		// Point values of the first UV map and the first colour map
+		std::string uvMapName;
+		std::string colourMapName;
+		uint32_t colourMapType = 0;
+		std::vector<float> uvs;
+		std::vector<float> colours;
+
+		// Point normals, empty if there is no normal map
+		std::vector<float> normals;
+
+		// Corner values from the VMADs, Missing where the point value applies
+		std::vector<float> cornerUvs;
+		std::vector<float> cornerColours;
+		std::vector<float> cornerNormals;
+
+		// Sparse weight and morph maps as (point, value) pairs, the offsets in LightWave coordinates
+		std::map<std::string, std::vector<std::pair<uint32_t, float>>> weightMaps;
+		std::map<std::string, std::vector<std::pair<uint32_t, Vector3>>> morphMaps;
+
+		// Descriptions of the contents which are not read, like additional UV maps
+		std::set<std::string> skipped;
+
+		std::size_t getNumPoints() const
+		{
+			return points.size() / 3;
+		}
+
+		Vector3 getPoint(uint32_t point) const
+		{
+			return Vector3(points[point * 3], points[point * 3 + 2], points[point * 3 + 1]);
+		}
+
+		// The corner of the given polygon of the recent POLS chunk using the point, -1 if there is none
+		int64_t findCorner(uint32_t poly, uint32_t point) const
+		{
+			if (!polsAreFaces || polsStart + poly >= faces.size()) return -1;
+
+			const auto& face = faces[polsStart + poly];
+
+			for (auto corner = face.firstCorner; corner < face.firstCorner + face.numCorners; ++corner)
+			{
+				if (corners[corner] == point) return corner;
+			}
+
+			return -1;
+		}
+	};
+
+	std::string getIdName(uint32_t id)
+	{
+		return std::string{ static_cast<char>(id >> 24), static_cast<char>(id >> 16), static_cast<char>(id >> 8), static_cast<char>(id) };
+	}
+
+	// The properties of a SURF chunk the reader is interested in
+	struct SurfaceInfo
+	{
+		// The CLIP of the colour texture, 0 if there is none
+		uint32_t clip = 0;
+	};
+
+	void readPoints(Cursor contents, LayerData& layer)
+	{
+		auto count = contents.remaining() / 12;
+		auto first = layer.points.size();
+
+		layer.points.resize(first + count * 3);
+		simd::loadBigEndian(reinterpret_cast<const char*>(contents.position()), count * 3, layer.points.data() + first);
+
+		layer.uvs.resize(layer.getNumPoints() * 2, 0.0f);
+		layer.colours.resize(layer.getNumPoints() * 3, 1.0f);
+
+		if (!layer.normals.empty())
+		{
+			layer.normals.resize(layer.getNumPoints() * 3, Missing);
+		}
+	}
+
+	void readPolygons(Cursor contents, LayerData& layer)
+	{
+		layer.polsStart = layer.faces.size();
+		auto type = contents.readU4();
+		layer.polsAreFaces = type == makeId("FACE");
+
+		// Patches, curves, bones etc. are skipped
+		if (!layer.polsAreFaces)
+		{
+			layer.skipped.insert(getIdName(type) + " polygons");
+			return;
+		}
+
+		auto numPoints = layer.getNumPoints();
+
+		while (!contents.atEnd())
+		{
+			parallel::checkpoint(layer.faces.size());
+
+			// The upper 6 bits are flags
+			uint32_t numCorners = contents.readU2() & 0x03FF;
+
+			layer.faces.push_back(Face{ static_cast<uint32_t>(layer.corners.size()), numCorners, NoTag });
+
+			for (uint32_t c = 0; c < numCorners; ++c)
+			{
+				auto point = contents.readVX();
+
+				if (point >= numPoints)
+				{
+					throw std::runtime_error("Polygon references point " + std::to_string(point) + " of " + std::to_string(numPoints));
+				}
+
+				layer.corners.push_back(point);
+			}
+		}
+	}
+
+	void readPolygonTags(Cursor contents, LayerData& layer)
+	{
+		if (contents.readU4() != makeId("SURF") || !layer.polsAreFaces) return;
+
+		while (!contents.atEnd())
+		{
+			auto poly = contents.readVX();
+			auto tag = contents.readU2();
+
+			if (layer.polsStart + poly < layer.faces.size())
+			{
+				layer.faces[layer.polsStart + poly].tag = tag;
+			}
+		}
+	}
+
+	// Copies the values of a map entry into the array of the point or corner, creating the array if needed
+	void storeValues(Cursor& contents, std::size_t dimension, std::vector<float>& values, std::size_t size,
+		std::size_t index, float defaultValue, std::size_t usedDimension)
+	{
+		if (values.empty())
+		{
+			values.resize(size * usedDimension, defaultValue);
+		}
+
+		for (std::size_t d = 0; d < dimension; ++d)
+		{
+			auto value = contents.readF4();
+
+			if (d < usedDimension && index < size)
+			{
+				values[index * usedDimension + d] = value;
+			}
+		}
+	}
+
+	void readVertexMap(Cursor contents, LayerData& layer, bool isDiscontinuous)
+	{
+		auto type = contents.readU4();
+		std::size_t dimension = contents.readU2();
+		auto name = contents.readS0();
+
+		auto numPoints = layer.getNumPoints();
+
+		// The values of the first UV and colour map are used, the normals of any normal map
+		std::vector<float>* values = nullptr;
+		std::size_t usedDimension = 0;
+
+		if (type == makeId("TXUV") && dimension >= 2 && (layer.uvMapName.empty() || layer.uvMapName == name))
+		{
+			layer.uvMapName = name;
+			values = isDiscontinuous ? &layer.cornerUvs : &layer.uvs;
+			usedDimension = 2;
+		}
+		else if ((type == makeId("RGB ") || type == makeId("RGBA")) && dimension >= 3 &&
+			(layer.colourMapName.empty() || layer.colourMapName == name))
+		{
+			layer.colourMapName = name;
+			layer.colourMapType = type;
+			values = isDiscontinuous ? &layer.cornerColours : &layer.colours;
+			usedDimension = 3;
+		}
+		else if (type == makeId("NORM") && dimension >= 3)
+		{
+			values = isDiscontinuous ? &layer.cornerNormals : &layer.normals;
+			usedDimension = 3;
+		}
+
+		if (values != nullptr)
+		{
+			auto size = isDiscontinuous ? layer.corners.size() : numPoints;
+
+			while (!contents.atEnd())
+			{
+				auto point = contents.readVX();
+				auto index = isDiscontinuous ? layer.findCorner(contents.readVX(), point) : point;
+
+				storeValues(contents, dimension, *values, size, index < 0 ? size : static_cast<std::size_t>(index),
+					Missing, usedDimension);
+			}
+
+			return;
+		}
+
+		// Weights and morphs are per point, other maps like additional UV maps or selection sets are not read
+		if (isDiscontinuous || !((type == makeId("WGHT") && dimension >= 1) ||
+			((type == makeId("MORF") || type == makeId("SPOT")) && dimension == 3)))
+		{
+			layer.skipped.insert(getIdName(type) + " map " + name);
+			return;
+		}
+
+		if (type == makeId("WGHT") && dimension >= 1)
+		{
+			auto& weights = layer.weightMaps[name];
+
+			while (!contents.atEnd())
+			{
+				auto point = contents.readVX();
+				auto weight = contents.readF4();
+				contents.skip((dimension - 1) * 4);
+
+				if (point < numPoints)
+				{
+					weights.emplace_back(point, weight);
+				}
+			}
+		}
+		else if ((type == makeId("MORF") || type == makeId("SPOT")) && dimension == 3)
+		{
+			auto& offsets = layer.morphMaps[name];
+
+			while (!contents.atEnd())
+			{
+				auto point = contents.readVX();
+				auto value = contents.readVec12();
+
+				if (point < numPoints)
+				{
+					// Absolute morph targets are stored as offsets as well
+					offsets.emplace_back(point, type == makeId("SPOT") ? value - layer.getPoint(point) : value);
+				}
+			}
+		}
+	}
+
+	void readLayer(Cursor contents, LayerData& layer)
+	{
+		layer.number = contents.readU2();
+		contents.readU2(); // flags
+		layer.pivot = contents.readVec12();
+		layer.name = contents.readS0();
+
+		// The parent is optional
+		if (contents.remaining() >= 2)
+		{
+			auto parent = contents.readU2();
+			layer.parentNumber = parent == 0xFFFF ? -1 : parent;
+		}
+	}
+
+	SurfaceInfo readSurface(Cursor contents, std::string& name)
+	{
+		SurfaceInfo info;
+
+		name = contents.readS0();
+		contents.readS0(); // source
+
+		while (!contents.atEnd())
+		{
+			uint32_t id;
+			auto subChunk = contents.readChunk(id, true);
+
+			if (id == makeId("BLOK") && info.clip == 0)
+			{
+				// The first enabled image block on the colour channel defines the texture
+				uint32_t headerId;
+				auto header = subChunk.readChunk(headerId, true);
+
+				if (headerId != makeId("IMAP")) continue;
+
+				header.readS0(); // ordinal
+				bool isColour = false;
+				bool isEnabled = true;
+
+				while (!header.atEnd())
+				{
+					uint32_t attributeId;
+					auto attribute = header.readChunk(attributeId, true);
+
+					if (attributeId == makeId("CHAN"))
+					{
+						isColour = attribute.readU4() == makeId("COLR");
+					}
+					else if (attributeId == makeId("ENAB"))
+					{
+						isEnabled = attribute.readU2() != 0;
+					}
+				}
+
+				if (!isColour || !isEnabled) continue;
+
+				while (!subChunk.atEnd())
+				{
+					uint32_t attributeId;
+					auto attribute = subChunk.readChunk(attributeId, true);
+
+					if (attributeId == makeId("IMAG"))
+					{
+						info.clip = attribute.readVX();
+					}
+				}
+			}
+		}
+
+		return info;
+	}
+
+	// Newell's method, works for non-planar polygons too. LWO2 polygons are clockwise
+	// as seen from the front, with the flipped Y and Z axes that makes them counter-clockwise.
+	Vector3 getFaceNormal(const LayerData& layer, const Face& face)
+	{
+		Vector3 normal(0, 0, 0);
+
+		for (uint32_t c = 0; c < face.numCorners; ++c)
+		{
+			auto current = layer.getPoint(layer.corners[face.firstCorner + c]);
+			auto next = layer.getPoint(layer.corners[face.firstCorner + (c + 1) % face.numCorners]);
+
+			normal += Vector3(
+				(current.y() - next.y()) * (current.z() + next.z()),
+				(current.z() - next.z()) * (current.x() + next.x()),
+				(current.x() - next.x()) * (current.y() + next.y()));
+		}
+
+		auto length = std::sqrt(normal.dot(normal));
+
+		// The winding is reversed by the Y/Z swap
+		return length > 0 ? normal / -length : normal;
+	}
+
+	// VMAD arrays only cover the corners which existed when they were read
+	bool hasValue(const std::vector<float>& values, std::size_t index, std::size_t dimension)
+	{
+		return index * dimension < values.size() && !std::isnan(values[index * dimension]);
+	}
+
+	Vector3 getVector(const std::vector<float>& values, std::size_t index)
+	{
+		return Vector3(values[index * 3], values[index * 3 + 1], values[index * 3 + 2]);
+	}
+
+	// Adds the weights and offsets of the points to the surface vertices created from them
+	void addDeformations(const LayerData& data, FbxSurface& surface, const std::vector<uint32_t>& vertexPoints)
+	{
+		if (data.weightMaps.empty() && data.morphMaps.empty()) return;
+
+		// The vertices of each point, sorted by point
+		std::vector<std::pair<uint32_t, unsigned int>> pointVertices;
+		pointVertices.reserve(vertexPoints.size());
+
+		for (std::size_t v = 0; v < vertexPoints.size(); ++v)
+		{
+			pointVertices.emplace_back(vertexPoints[v], static_cast<unsigned int>(v));
+		}
+
+		std::sort(pointVertices.begin(), pointVertices.end());
+
+		auto forEachVertex = [&](uint32_t point, const auto& func)
+		{
+			auto range = std::equal_range(pointVertices.begin(), pointVertices.end(), std::make_pair(point, 0u),
+				[](const auto& a, const auto& b) { return a.first < b.first; });
+
+			for (auto i = range.first; i != range.second; ++i)
+			{
+				func(i->second);
+			}
+		};
+
+		for (const auto& pair : data.weightMaps)
+		{
+			std::vector<VertexWeight> weights;
+
+			for (const auto& entry : pair.second)
+			{
+				forEachVertex(entry.first, [&](unsigned int vertex) { weights.push_back(VertexWeight{ vertex, entry.second }); });
+			}
+
+			if (weights.empty()) continue;
+
+			std::sort(weights.begin(), weights.end(), [](const VertexWeight& a, const VertexWeight& b) { return a.vertex < b.vertex; });
+			surface.weightMaps[pair.first] = std::move(weights);
+		}
+
+		for (const auto& pair : data.morphMaps)
+		{
+			std::vector<VertexOffset> offsets;
+
+			for (const auto& entry : pair.second)
+			{
+				forEachVertex(entry.first, [&](unsigned int vertex) { offsets.push_back(VertexOffset{ vertex, entry.second }); });
+			}
+
+			if (offsets.empty()) continue;
+
+			std::sort(offsets.begin(), offsets.end(), [](const VertexOffset& a, const VertexOffset& b) { return a.vertex < b.vertex; });
+			surface.morphMaps[pair.first] = std::move(offsets);
+		}
+	}
+
+	// Triangulates and welds the faces of the layer into one surface per tag
+	std::vector<FbxSurface> buildSurfaces(const LayerData& data, const std::vector<unsigned int>& tagMaterials,
+		const std::vector<SurfaceInfo>& tagSurfaces, const std::map<uint32_t, std::string>& clips,
+		unsigned int defaultMaterial, double weldEpsilon)
+	{
+		std::vector<Vector3> faceNormals(data.faces.size());
+		std::vector<Vector3> pointNormals(data.getNumPoints(), Vector3(0, 0, 0));
+
+		for (std::size_t f = 0; f < data.faces.size(); ++f)
+		{
+			const auto& face = data.faces[f];
+
+			if (face.numCorners < 3) continue;
+
+			faceNormals[f] = getFaceNormal(data, face);
+
+			for (auto corner = face.firstCorner; corner < face.firstCorner + face.numCorners; ++corner)
+			{
+				pointNormals[data.corners[corner]] += faceNormals[f];
+			}
+		}
+
+		std::vector<FbxSurface> surfaces;
+		std::vector<std::vector<uint32_t>> surfaceVertexPoints;
+		std::map<uint32_t, std::size_t> tagSurfaceIndices;
+
+		std::vector<ArbitraryMeshVertex> faceVertices;
+
+		for (std::size_t f = 0; f < data.faces.size(); ++f)
+		{
+			parallel::checkpoint(f);
+
+			const auto& face = data.faces[f];
+
+			if (face.numCorners < 3) continue;
+
+			auto tag = face.tag < tagMaterials.size() ? face.tag : NoTag;
+			auto existing = tagSurfaceIndices.emplace(tag, surfaces.size());
+
+			if (existing.second)
+			{
+				auto& surface = surfaces.emplace_back();
+
+				surface.materialId = tag != NoTag ? tagMaterials[tag] : defaultMaterial;
+
+				if (weldEpsilon != render::VertexEpsilon)
+				{
+					surface.setWeldEpsilon(weldEpsilon);
+				}
+
+				auto clip = tag != NoTag ? clips.find(tagSurfaces[tag].clip) : clips.end();
+
+				if (clip != clips.end())
+				{
+					surface.texturePath = clip->second;
+				}
+
+				surfaceVertexPoints.emplace_back();
+			}
+
+			auto& surface = surfaces[existing.first->second];
+			auto& vertexPoints = surfaceVertexPoints[existing.first->second];
+
+			faceVertices.clear();
+
+			for (auto corner = face.firstCorner; corner < face.firstCorner + face.numCorners; ++corner)
+			{
+				auto point = data.corners[corner];
+				auto& vertex = faceVertices.emplace_back();
+
+				vertex.vertex = data.getPoint(point);
+
+				// UVs are stored with an inverted T axis
+				auto uv = hasValue(data.cornerUvs, corner, 2) ? &data.cornerUvs[corner * 2] : &data.uvs[point * 2];
+				vertex.texcoord = TexCoord2f(uv[0], 1.0f - uv[1]);
+
+				vertex.colour = hasValue(data.cornerColours, corner, 3) ? getVector(data.cornerColours, corner) :
+					getVector(data.colours, point);
+
+				if (hasValue(data.cornerNormals, corner, 3) || hasValue(data.normals, point, 3))
+				{
+					auto normal = hasValue(data.cornerNormals, corner, 3) ? getVector(data.cornerNormals, corner) :
+						getVector(data.normals, point);
+
+					vertex.normal = Normal3f(normal.x(), normal.z(), normal.y());
+					continue;
+				}
+
+				// The file doesn't store normals, but the exporter splits points where the normals differ.
+				// Giving all corners of a point the same normal keeps the points together when written again.
+				const auto& normal = pointNormals[point];
+				auto length = std::sqrt(normal.dot(normal));
+
+				vertex.normal = length > 0 ? normal / length : faceNormals[f];
+			}
+
+			// Polygons start at a convex corner, a fan covers them
+			for (std::size_t c = 1; c + 1 < faceVertices.size(); ++c)
+			{
+				for (auto corner : { std::size_t(0), c, c + 1 })
+				{
+					auto numVertices = surface.vertices.size();
+
+					surface.addVertex(faceVertices[corner]);
+
+					if (surface.vertices.size() > numVertices)
+					{
+						vertexPoints.push_back(data.corners[face.firstCorner + corner]);
+					}
+				}
+			}
+		}
+
+		for (std::size_t s = 0; s < surfaces.size(); ++s)
+		{
+			addDeformations(data, surfaces[s], surfaceVertexPoints[s]);
+		}
+
+		return surfaces;
+	}
+}
+
+Lwo2Reader::Lwo2Reader(const std::shared_ptr<MaterialRegistry>& materials, double weldEpsilon) :
+	_materials(materials),
+	_weldEpsilon(weldEpsilon)
+{}
+
+void Lwo2Reader::readFromPath(const std::filesystem::path& path)
+{
+	stream::MappedFile file(path);
+
+	try
+	{
+		read(file.data(), file.size());
+	}
+	catch (const std::runtime_error& ex)
+	{
+		throw std::runtime_error(path.string() + ": " + ex.what());
+	}
+}
+
+void Lwo2Reader::read(const unsigned char* data, std::size_t size)
+{
+	std::vector<LayerData> layers;
+	std::vector<std::string> tags;
+	std::map<std::string, SurfaceInfo> surfaceInfos;
+	std::map<uint32_t, std::string> clips;
+
+	_sourceSurfaces = Lwo2Exporter::SourceSurfaces();
+	_skippedContents.clear();
+
+	{
+		profiling::StageScope stage(profiling::Stage::Read);
+
+		Cursor file(data, data + size);
+
+		uint32_t formId;
+		auto form = file.readChunk(formId, false);
+
+		if (formId != makeId("FORM") || form.readU4() != makeId("LWO2"))
+		{
+			throw std::runtime_error("Not an LWO2 file");
+		}
+
+		// Geometry before the first LAYR chunk goes into a default layer
+		auto currentLayer = [&]() -> LayerData&
+		{
+			if (layers.empty())
+			{
+				layers.emplace_back();
+			}
+
+			return layers.back();
+		};
+
+		while (!form.atEnd())
+		{
+			parallel::checkpoint();
+
+			uint32_t id;
+			auto contents = form.readChunk(id, false);
+
+			switch (id)
+			{
+			case makeId("LAYR"):
+				readLayer(contents, layers.emplace_back());
+				break;
+			case makeId("PNTS"):
+				readPoints(contents, currentLayer());
+				break;
+			case makeId("POLS"):
+				readPolygons(contents, currentLayer());
+				break;
+			case makeId("PTAG"):
+				readPolygonTags(contents, currentLayer());
+				break;
+			case makeId("VMAP"):
+			case makeId("VMAD"):
+				readVertexMap(contents, currentLayer(), id == makeId("VMAD"));
+				break;
+			case makeId("TAGS"):
+				while (!contents.atEnd())
+				{
+					tags.push_back(contents.readS0());
+				}
+				break;
+			case makeId("SURF"):
+			{
+				std::string raw(reinterpret_cast<const char*>(contents.position()), contents.remaining());
+				std::string name;
+				auto info = readSurface(contents, name);
+
+				if (surfaceInfos.emplace(name, info).second)
+				{
+					_sourceSurfaces.surfaces.emplace(name, std::move(raw));
+				}
+				break;
+			}
+			case makeId("CLIP"):
+			{
+				_sourceSurfaces.clips.emplace_back(reinterpret_cast<const char*>(contents.position()), contents.remaining());
+
+				auto index = contents.readU4();
+
+				while (!contents.atEnd())
+				{
+					uint32_t subId;
+					auto subChunk = contents.readChunk(subId, true);
+
+					if (subId == makeId("STIL"))
+					{
+						clips[index] = subChunk.readS0();
+					}
+				}
+				break;
+			}
+			default:
+				break; // BBOX, DESC, ICON etc. are not needed
+			}
+		}
+	}
+
+	// The surfaces refer to the maps by name, the exporter writes the maps it keeps under the first names of the file
+	for (const auto& layer : layers)
+	{
+		if (_sourceSurfaces.uvMapName.empty()) _sourceSurfaces.uvMapName = layer.uvMapName;
+		if (_sourceSurfaces.colourMapName.empty() && !layer.colourMapName.empty())
+		{
+			_sourceSurfaces.colourMapName = layer.colourMapName;
+			_sourceSurfaces.colourMapHasAlpha = layer.colourMapType == makeId("RGBA");
+		}
+
+		_skippedContents.insert(layer.skipped.begin(), layer.skipped.end());
+	}
+
+	profiling::StageScope stage(profiling::Stage::Weld);
+
+	// Untagged polygons use LightWave's default surface
+	std::vector<unsigned int> tagMaterials;
+	std::vector<SurfaceInfo> tagSurfaces;
+
+	for (const auto& tag : tags)
+	{
+		tagMaterials.push_back(_materials->intern(tag));
+
+		auto info = surfaceInfos.find(tag);
+		tagSurfaces.push_back(info != surfaceInfos.end() ? info->second : SurfaceInfo());
+	}
+
+	auto defaultMaterial = _materials->intern("Default");
+
+	_layers.clear();
+	_layers.resize(layers.size());
+
+	// The layers don't depend on each other, weld them in parallel
+	parallel::forEach(layers.size(), [&](std::size_t l)
+	{
+		auto& layer = _layers[l];
+
+		layer.name = layers[l].name;
+		layer.pivot = layers[l].pivot;
+		layer.surfaces = buildSurfaces(layers[l], tagMaterials, tagSurfaces, clips, defaultMaterial, _weldEpsilon);
+
+		for (std::size_t parent = 0; parent < layers.size() && layers[l].parentNumber != -1; ++parent)
+		{
+			if (layers[parent].number == layers[l].parentNumber && parent != l)
+			{
+				layer.parentIndex = static_cast<int>(parent);
+				break;
+			}
+		}
+	});
+}
+
+const std::vector<Lwo2Reader::Layer>& Lwo2Reader::getLayers() const
+{
+	return _layers;
+}
+
+const Lwo2Exporter::SourceSurfaces& Lwo2Reader::getSourceSurfaces() const
+{
+	return _sourceSurfaces;
+}
+
+const std::set<std::string>& Lwo2Reader::getSkippedContents() const
+{
+	return _skippedContents;
+}
+
+std::size_t Lwo2Reader::getTriangleCount() const
+{
+	std::size_t count = 0;
+
+	for (const auto& layer : _layers)
+	{
+		for (const auto& surface : layer.surfaces)
+		{
+			count += surface.indices.size() / 3;
+		}
+	}
+
+	return count;
+}
+
+void Lwo2Reader::addTo(ModelExporterBase& exporter) const
+{
+	// Parent indices are shifted past the layers the exporter already has
+	auto firstLayer = static_cast<int>(exporter.getLayerCount());
+
+	for (const auto& layer : _layers)
+	{
+		exporter.addLayer(layer.name, layer.pivot, layer.parentIndex != -1 ? layer.parentIndex + firstLayer : -1);
+
+		for (const auto& surface : layer.surfaces)
+		{
+			if (surface.indices.size() < 3) continue;
+
+			exporter.addSurface(surface, Matrix4::getIdentity());
+		}
+	}
+}
+
+}
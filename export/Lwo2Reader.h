@@ -0,0 +1,81 @@
+#pragma once
+
+#include <set>
+#include <memory>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include "Lwo2Exporter.h"
+#include "VertexHashing.h"
+
+namespace model
+{
+
+/**
+ * Reads LWO2 files into welded FbxSurfaces, so existing models can be re-processed by
+ * the same pipeline as the FBX meshes: the surfaces are added to an exporter which
+ * writes them out again.
+ *
+ * The file is memory mapped and the chunks are decoded right from the mapped pages,
+ * there are no per-value stream reads. Supported are the layers (LAYR) with their
+ * points (PNTS), FACE polygons (POLS) and surface tags (PTAG), the first UV map, the
+ * first vertex colour map, vertex normals, weight maps and morph maps (VMAP/VMAD), and
+ * the colour textures of the surfaces (TAGS, SURF, CLIP). Polygons with more than three
+ * corners are triangulated as fans. Without vertex normals each point gets the average
+ * normal of its polygons, so the points stay shared when the surfaces are written again.
+ *
+ * The SURF and CLIP chunks are kept as they are, to be written unchanged by the exporter.
+ * Everything else the reader doesn't support, like additional UV maps or patches, is
+ * listed in the skipped contents.
+ */
+class Lwo2Reader
+{
+public:
+	struct Layer
+	{
+		std::string name;
+		Vector3 pivot;
+
+		// Index of the parent layer, -1 if this is a top-level layer
+		int parentIndex = -1;
+
+		// One surface per tag used by the layer's polygons
+		std::vector<FbxSurface> surfaces;
+	};
+
+private:
+	std::shared_ptr<MaterialRegistry> _materials;
+	double _weldEpsilon;
+
+	std::vector<Layer> _layers;
+
+	Lwo2Exporter::SourceSurfaces _sourceSurfaces;
+	std::set<std::string> _skippedContents;
+
+public:
+	// The surface names are interned in the given registry
+	explicit Lwo2Reader(const std::shared_ptr<MaterialRegistry>& materials, double weldEpsilon = render::VertexEpsilon);
+
+	// Reads the given file, replacing the layers read before.
+	// Throws std::runtime_error if the file cannot be read or is not a valid LWO2 file.
+	void readFromPath(const std::filesystem::path& path);
+
+	// Reads the LWO2 file contents from memory
+	void read(const unsigned char* data, std::size_t size);
+
+	const std::vector<Layer>& getLayers() const;
+
+	// The surface properties of the file, to be passed to Lwo2Exporter::setSourceSurfaces
+	const Lwo2Exporter::SourceSurfaces& getSourceSurfaces() const;
+
+	// Descriptions of the contents which are not carried over, e.g. "TXUV map Detail" or "PTCH polygons"
+	const std::set<std::string>& getSkippedContents() const;
+
+	// The number of triangles in all layers
+	std::size_t getTriangleCount() const;
+
+	// Adds the layers and their surfaces to the exporter, which must use the same material registry
+	void addTo(ModelExporterBase& exporter) const;
+};
+
+}
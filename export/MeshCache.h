@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+/**
+ * Binary mesh cache, written next to the LWO files for the engine. It stores the
+ * welded surfaces exactly as the renderer consumes them, so loading one takes a
+ * single mmap and no parsing or re-welding: all values are little endian, every
+ * section starts at a multiple of 64 bytes and is a plain array of the structs below.
+ *
+ * Layout: MeshCacheHeader, then the sections it points to (layers, surfaces, vertices,
+ * indices, strings). The vertices and indices of all surfaces share one buffer each,
+ * the indices are absolute (not relative to the surface's first vertex) and describe
+ * counter-clockwise triangles. Positions and normals are in the exporter's coordinate
+ * system, which is the LWO one with Y and Z swapped back.
+ */
+namespace model
+{
+
+namespace meshcache
+{
+	constexpr char Magic[8] = { 'M', 'E', 'S', 'H', 'B', 'I', 'N', '\0' };
+
+	// Increased with every incompatible change of the format
+	constexpr uint32_t Version = 1;
+
+	// Written as native uint32, reads back differently on machines of the other byte order
+	constexpr uint32_t ByteOrderMark = 0x01020304;
+
+	constexpr std::size_t Alignment = 64;
+
+	// Marks an absent string
+	constexpr uint32_t NoString = 0xFFFFFFFF;
+}
+
+struct MeshCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint64_t fileSize;
+
+	uint32_t numLayers;
+	uint32_t numSurfaces;
+	uint64_t numVertices;
+	uint64_t numIndices;
+
+	// Sizes of MeshCacheVertex and of an index, for loaders to verify
+	uint32_t vertexStride;
+	uint32_t indexSize;
+
+	// Byte offsets of the sections from the start of the file
+	uint64_t layersOffset;
+	uint64_t surfacesOffset;
+	uint64_t verticesOffset;
+	uint64_t indicesOffset;
+	uint64_t stringsOffset;
+	uint64_t stringsSize;
+
+	// Bounds of all vertices, min > max if there are none
+	float boundsMin[3];
+	float boundsMax[3];
+};
+
+struct MeshCacheLayer
+{
+	// Offset of the null-terminated name in the string section
+	uint32_t nameOffset;
+
+	// Index of the parent layer, -1 for top-level layers
+	int32_t parentIndex;
+
+	// The surfaces of the layer are consecutive
+	uint32_t firstSurface;
+	uint32_t numSurfaces;
+
+	float pivot[3];
+	float boundsMin[3];
+	float boundsMax[3];
+
+	uint32_t reserved[3];
+};
+
+struct MeshCacheSurface
+{
+	uint32_t materialOffset;
+	uint32_t texturePathOffset;     // NoString if the surface has no texture
+
+	// The range of the shared vertex buffer used by this surface
+	uint32_t firstVertex;
+	uint32_t numVertices;
+
+	// The range of the shared index buffer, numIndices / 3 triangles
+	uint32_t firstIndex;
+	uint32_t numIndices;
+
+	float boundsMin[3];
+	float boundsMax[3];
+
+	uint32_t layerIndex;
+	uint32_t reserved[3];
+};
+
+struct MeshCacheVertex
+{
+	float position[3];
+	float normal[3];
+	float texcoord[2];
+	float colour[4];
+};
+
+static_assert(sizeof(MeshCacheHeader) == 128, "MeshCacheHeader must not contain padding");
+static_assert(sizeof(MeshCacheLayer) == 64, "MeshCacheLayer must fill one cache line");
+static_assert(sizeof(MeshCacheSurface) == 64, "MeshCacheSurface must fill one cache line");
+static_assert(sizeof(MeshCacheVertex) == 48, "MeshCacheVertex must not contain padding");
+
+/**
+ * Typed access to a mesh cache in memory, e.g. a mapped file. Only the header and
+ * the section bounds are checked, the arrays are used in place.
+ */
+class MeshCacheView
+{
+private:
+	const unsigned char* _data = nullptr;
+	const MeshCacheHeader* _header = nullptr;
+
+public:
+	MeshCacheView() = default;
+
+	// Returns false if the data isn't a mesh cache of this version and byte order, or is truncated.
+	// The data needs to be aligned to at least 8 bytes, which mapped files always are.
+	bool open(const void* data, std::size_t size)
+	{
+		_data = nullptr;
+		_header = nullptr;
+
+		if (data == nullptr || size < sizeof(MeshCacheHeader)) return false;
+
+		auto header = static_cast<const MeshCacheHeader*>(data);
+
+		if (std::memcmp(header->magic, meshcache::Magic, sizeof(header->magic)) != 0 ||
+			header->version != meshcache::Version || header->byteOrder != meshcache::ByteOrderMark ||
+			header->vertexStride != sizeof(MeshCacheVertex) || header->indexSize != sizeof(uint32_t) ||
+			header->fileSize > size)
+		{
+			return false;
+		}
+
+		auto fits = [&](uint64_t offset, uint64_t count, uint64_t elementSize)
+		{
+			return offset % meshcache::Alignment == 0 && offset <= header->fileSize &&
+				count <= (header->fileSize - offset) / elementSize;
+		};
+
+		if (!fits(header->layersOffset, header->numLayers, sizeof(MeshCacheLayer)) ||
+			!fits(header->surfacesOffset, header->numSurfaces, sizeof(MeshCacheSurface)) ||
+			!fits(header->verticesOffset, header->numVertices, sizeof(MeshCacheVertex)) ||
+			!fits(header->indicesOffset, header->numIndices, sizeof(uint32_t)) ||
+			!fits(header->stringsOffset, header->stringsSize, 1))
+		{
+			return false;
+		}
+
+		_data = static_cast<const unsigned char*>(data);
+		_header = header;
+
+		return true;
+	}
+
+	const MeshCacheHeader& getHeader() const
+	{
+		return *_header;
+	}
+
+	const MeshCacheLayer* getLayers() const
+	{
+		return reinterpret_cast<const MeshCacheLayer*>(_data + _header->layersOffset);
+	}
+
+	const MeshCacheSurface* getSurfaces() const
+	{
+		return reinterpret_cast<const MeshCacheSurface*>(_data + _header->surfacesOffset);
+	}
+
+	const MeshCacheVertex* getVertices() const
+	{
+		return reinterpret_cast<const MeshCacheVertex*>(_data + _header->verticesOffset);
+	}
+
+	const uint32_t* getIndices() const
+	{
+		return reinterpret_cast<const uint32_t*>(_data + _header->indicesOffset);
+	}
+
+	// The string at the given offset of the string section, nullptr for NoString
+	const char* getString(uint32_t offset) const
+	{
+		if (offset == meshcache::NoString || offset >= _header->stringsSize) return nullptr;
+
+		return reinterpret_cast<const char*>(_data + _header->stringsOffset + offset);
+	}
+};
+
+}
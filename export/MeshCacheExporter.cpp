@@ -0,0 +1,283 @@
+#include "MeshCacheExporter.h"
+
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include "../math/Simd.h"
+#include "ExportStream.h"
+
+#include "../Parallel.h"
+#include "../StageProfiler.h"
+
+// The sections are written as they are laid out in memory
+#ifdef __BIG_ENDIAN__
+#error "The mesh cache exporter requires a little endian platform"
+#endif
+
+namespace model
+{
+
+namespace
+{
+	std::size_t align(std::size_t offset)
+	{
+		return (offset + meshcache::Alignment - 1) & ~(meshcache::Alignment - 1);
+	}
+
+	void writePadding(std::ostream& stream, std::size_t& offset)
+	{
+		static const char zeros[meshcache::Alignment] = {};
+
+		auto aligned = align(offset);
+		stream.write(zeros, static_cast<std::streamsize>(aligned - offset));
+		offset = aligned;
+	}
+
+	template<typename T>
+	void writeSection(std::ostream& stream, const std::vector<T>& elements, std::size_t& offset)
+	{
+		writePadding(stream, offset);
+
+		stream.write(reinterpret_cast<const char*>(elements.data()), static_cast<std::streamsize>(elements.size() * sizeof(T)));
+		offset += elements.size() * sizeof(T);
+	}
+
+	// Sets min > max, the state of an empty set of points
+	void clearBounds(float* min, float* max)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			min[i] = std::numeric_limits<float>::max();
+			max[i] = -std::numeric_limits<float>::max();
+		}
+	}
+
+	void includeBounds(float* min, float* max, const float* otherMin, const float* otherMax)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			min[i] = std::min(min[i], otherMin[i]);
+			max[i] = std::max(max[i], otherMax[i]);
+		}
+	}
+}
+
+const std::string& MeshCacheExporter::getExtension() const
+{
+	static std::string _extension("MESH");
+	return _extension;
+}
+
+void MeshCacheExporter::exportToPath(const std::string& outputPath, const std::string& filename)
+{
+	profiling::StageScope stage(profiling::Stage::Write);
+
+	stream::ExportStream output(outputPath, filename, stream::ExportStream::Mode::Binary);
+
+	exportToStream(output.getStream());
+
+	output.close();
+}
+
+MeshCacheExporter::Sections MeshCacheExporter::encode() const
+{
+	Sections sections;
+
+	// The strings are stored once, the offsets are reused for each surface using them
+	std::unordered_map<std::string, uint32_t> stringOffsets;
+
+	auto addString = [&](const std::string& str)
+	{
+		auto result = stringOffsets.emplace(str, static_cast<uint32_t>(sections.strings.size()));
+
+		if (result.second)
+		{
+			sections.strings.append(str.c_str(), str.size() + 1);
+		}
+
+		return result.first->second;
+	};
+
+	// Surfaces referring to the exporter's data, in the order of the surface records
+	std::vector<const Surface*> surfaces;
+
+	std::size_t numVertices = 0;
+	std::size_t numIndices = 0;
+
+	for (std::size_t l = 0; l < _layers.size(); ++l)
+	{
+		const Layer& layer = _layers[l];
+		MeshCacheLayer& record = sections.layers.emplace_back();
+
+		record = MeshCacheLayer();
+		record.nameOffset = addString(layer.name);
+		record.parentIndex = layer.parentIndex;
+		record.firstSurface = static_cast<uint32_t>(sections.surfaces.size());
+
+		for (int i = 0; i < 3; ++i)
+		{
+			record.pivot[i] = static_cast<float>(layer.pivot[i]);
+		}
+
+		for (const Surface& surface : layer.surfaces)
+		{
+			if (surface.indices.empty()) continue;
+
+			MeshCacheSurface& surfaceRecord = sections.surfaces.emplace_back();
+
+			surfaceRecord = MeshCacheSurface();
+			surfaceRecord.materialOffset = addString(_materials->getName(surface.materialId));
+			surfaceRecord.texturePathOffset = surface.texturePath.empty() ? meshcache::NoString : addString(surface.texturePath);
+			surfaceRecord.firstVertex = static_cast<uint32_t>(numVertices);
+			surfaceRecord.numVertices = static_cast<uint32_t>(surface.vertices.size());
+			surfaceRecord.firstIndex = static_cast<uint32_t>(numIndices);
+			surfaceRecord.numIndices = static_cast<uint32_t>(surface.indices.size());
+			surfaceRecord.layerIndex = static_cast<uint32_t>(l);
+
+			numVertices += surface.vertices.size();
+			numIndices += surface.indices.size();
+
+			surfaces.push_back(&surface);
+		}
+
+		record.numSurfaces = static_cast<uint32_t>(sections.surfaces.size()) - record.firstSurface;
+	}
+
+	// The indices are 32 bit and absolute, so are the surface ranges
+	if (numVertices > std::numeric_limits<uint32_t>::max() || numIndices > std::numeric_limits<uint32_t>::max())
+	{
+		throw std::runtime_error("The model is too large for the mesh cache format.");
+	}
+
+	sections.vertices.resize(numVertices);
+	sections.indices.resize(numIndices);
+
+	static_assert(sizeof(ArbitraryMeshVertex) % sizeof(double) == 0, "Vertex stride must be a multiple of double");
+	constexpr std::size_t Stride = sizeof(ArbitraryMeshVertex) / sizeof(double);
+
+	// Each surface converts its own range of the shared buffers
+	parallel::forEach(surfaces.size(), [&](std::size_t s)
+	{
+		const Surface& surface = *surfaces[s];
+		MeshCacheSurface& record = sections.surfaces[s];
+
+		MeshCacheVertex* vertices = sections.vertices.data() + record.firstVertex;
+
+		for (std::size_t v = 0; v < surface.vertices.size(); ++v)
+		{
+			const ArbitraryMeshVertex& vertex = surface.vertices[v];
+			MeshCacheVertex& converted = vertices[v];
+
+			for (int i = 0; i < 3; ++i)
+			{
+				converted.position[i] = static_cast<float>(vertex.vertex[i]);
+				converted.normal[i] = static_cast<float>(vertex.normal[i]);
+				converted.colour[i] = static_cast<float>(vertex.colour[i]);
+			}
+
+			converted.texcoord[0] = static_cast<float>(vertex.texcoord.x());
+			converted.texcoord[1] = static_cast<float>(vertex.texcoord.y());
+			converted.colour[3] = 1.0f;
+		}
+
+		uint32_t* indices = sections.indices.data() + record.firstIndex;
+
+		for (std::size_t i = 0; i < surface.indices.size(); ++i)
+		{
+			indices[i] = static_cast<uint32_t>(surface.indices[i]) + record.firstVertex;
+		}
+
+		clearBounds(record.boundsMin, record.boundsMax);
+
+		double min[3], max[3];
+
+		if (!surface.vertices.empty())
+		{
+			simd::getBounds(surface.vertices.front().vertex, Stride, surface.vertices.size(), min, max);
+
+			for (int i = 0; i < 3; ++i)
+			{
+				record.boundsMin[i] = static_cast<float>(min[i]);
+				record.boundsMax[i] = static_cast<float>(max[i]);
+			}
+		}
+	});
+
+	MeshCacheHeader& header = sections.header;
+
+	header = MeshCacheHeader();
+	std::copy(std::begin(meshcache::Magic), std::end(meshcache::Magic), header.magic);
+	header.version = meshcache::Version;
+	header.byteOrder = meshcache::ByteOrderMark;
+	header.numLayers = static_cast<uint32_t>(sections.layers.size());
+	header.numSurfaces = static_cast<uint32_t>(sections.surfaces.size());
+	header.numVertices = numVertices;
+	header.numIndices = numIndices;
+	header.vertexStride = sizeof(MeshCacheVertex);
+	header.indexSize = sizeof(uint32_t);
+
+	clearBounds(header.boundsMin, header.boundsMax);
+
+	for (MeshCacheLayer& layer : sections.layers)
+	{
+		clearBounds(layer.boundsMin, layer.boundsMax);
+
+		for (uint32_t s = layer.firstSurface; s < layer.firstSurface + layer.numSurfaces; ++s)
+		{
+			includeBounds(layer.boundsMin, layer.boundsMax, sections.surfaces[s].boundsMin, sections.surfaces[s].boundsMax);
+		}
+
+		includeBounds(header.boundsMin, header.boundsMax, layer.boundsMin, layer.boundsMax);
+	}
+
+	// The sections follow the header in the order of its offsets
+	std::size_t offset = sizeof(MeshCacheHeader);
+
+	header.layersOffset = offset = align(offset);
+	offset += sections.layers.size() * sizeof(MeshCacheLayer);
+
+	header.surfacesOffset = offset = align(offset);
+	offset += sections.surfaces.size() * sizeof(MeshCacheSurface);
+
+	header.verticesOffset = offset = align(offset);
+	offset += sections.vertices.size() * sizeof(MeshCacheVertex);
+
+	header.indicesOffset = offset = align(offset);
+	offset += sections.indices.size() * sizeof(uint32_t);
+
+	header.stringsOffset = offset = align(offset);
+	header.stringsSize = sections.strings.size();
+
+	header.fileSize = align(offset + sections.strings.size());
+
+	return sections;
+}
+
+void MeshCacheExporter::exportToStream(std::ostream& stream)
+{
+	Sections sections;
+
+	{
+		profiling::StageScope stage(profiling::Stage::Encode);
+		sections = encode();
+	}
+
+	stream.write(reinterpret_cast<const char*>(&sections.header), sizeof(MeshCacheHeader));
+
+	std::size_t offset = sizeof(MeshCacheHeader);
+
+	writeSection(stream, sections.layers, offset);
+	writeSection(stream, sections.surfaces, offset);
+	writeSection(stream, sections.vertices, offset);
+	writeSection(stream, sections.indices, offset);
+
+	writePadding(stream, offset);
+	stream.write(sections.strings.data(), static_cast<std::streamsize>(sections.strings.size()));
+	offset += sections.strings.size();
+
+	// Pad the file as well, so it can be concatenated or mapped in one piece
+	writePadding(stream, offset);
+}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include "ModelExporterBase.h"
+#include "MeshCache.h"
+
+namespace model
+{
+
+/**
+ * Writes the surfaces into the binary mesh cache format defined in MeshCache.h, which
+ * the engine maps and uses without parsing. Every layer and surface is written in the
+ * order it has been added, empty surfaces are skipped. Weight and morph maps are not
+ * part of the cache, they are only written to the LWO file.
+ */
+class MeshCacheExporter :
+	public ModelExporterBase
+{
+public:
+	using ModelExporterBase::ModelExporterBase;
+
+	// Returns the uppercase file extension this exporter is suitable for
+	const std::string& getExtension() const;
+
+	void exportToPath(const std::string& outputPath, const std::string& filename);
+
+private:
+	// The file contents, all sections are already aligned
+	struct Sections
+	{
+		MeshCacheHeader header;
+		std::vector<MeshCacheLayer> layers;
+		std::vector<MeshCacheSurface> surfaces;
+		std::vector<MeshCacheVertex> vertices;
+		std::vector<uint32_t> indices;
+		std::string strings;
+	};
+
+	Sections encode() const;
+
+	void exportToStream(std::ostream& stream);
+};
+
+}
@@ -2,11 +2,15 @@
 
 #include <fstream>
 #include <map>
+#include <memory>
 #include <vector>
+#include <unordered_map>
 #include "../math/Matrix4.h"
+#include "../math/Simd.h"
 
 #include "ArbitraryMeshVertex.h"
 #include "../FbxSurface.h"
+#include "../MaterialRegistry.h"
 
 namespace model
 {
@@ -26,22 +30,156 @@ class ModelExporterBase
 protected:
 	struct Surface
 	{
-		std::string materialName;
+		// The ID of the material name in the exporter's registry
+		unsigned int materialId = 0;
+
+		// The image to reference in the surface's texture block (optional)
+		std::string texturePath;
 
 		// The vertices of this surface
 		std::vector<ArbitraryMeshVertex> vertices;
 
 		// The indices connecting the vertices to triangles
 		IndexBuffer indices;
+
+		// Named vertex weights, e.g. skin weights per bone
+		VertexWeightMaps weightMaps;
+
+		// Named vertex offsets, e.g. one morph map per blend shape
+		VertexOffsetMaps morphMaps;
+
+		// The motion tracks of the vertices in ascending vertex order, empty if none is animated
+		std::vector<MotionTrackRange> motionTracks;
 	};
 
-	typedef std::map<std::string, Surface> Surfaces;
-	Surfaces _surfaces;
+	typedef std::vector<Surface> Surfaces;
+
+	// Each layer carries its own set of surfaces and a pivot point
+	struct Layer
+	{
+		std::string name;
+		Vector3 pivot;
+
+		// Index of the parent layer, -1 if this is a top-level layer
+		int parentIndex = -1;
+
+		Surfaces surfaces;
+
+		// The index into surfaces for each material ID the layer uses, sparse since layers only
+		// use a few of the materials in the registry
+		std::unordered_map<unsigned int, int> surfaceIndices;
+	};
+
+	typedef std::vector<Layer> Layers;
+	Layers _layers;
+
+	std::shared_ptr<MaterialRegistry> _materials;
 
 public:
+	ModelExporterBase() :
+		_materials(std::make_shared<MaterialRegistry>())
+	{}
+
+	// Exporters sharing the registry can exchange layers without translating the material IDs
+	explicit ModelExporterBase(const std::shared_ptr<MaterialRegistry>& materials) :
+		_materials(materials)
+	{}
+
+	// The registry the material IDs of the added surfaces refer to
+	MaterialRegistry& getMaterials()
+	{
+		return *_materials;
+	}
+
+	// For exporters which are to share the registry with this one
+	const std::shared_ptr<MaterialRegistry>& getMaterialRegistry() const
+	{
+		return _materials;
+	}
+
+	// Starts a new layer, all surfaces added after this call will end up in it.
+	// Surfaces added before the first call to addLayer go into an unnamed layer.
+	// Returns the index of the new layer, which can be used as parent index for subsequent layers.
+	int addLayer(const std::string& name, const Vector3& pivot, int parentIndex = -1)
+	{
+		Layer& layer = _layers.emplace_back();
+
+		layer.name = name;
+		layer.pivot = pivot;
+		layer.parentIndex = parentIndex;
+
+		return static_cast<int>(_layers.size() - 1);
+	}
+
+	std::size_t getLayerCount() const
+	{
+		return _layers.size();
+	}
+
+	// Collects the positions and triangles of all layers' surfaces, the indices refer to the positions
+	void getTriangles(std::vector<Vector3>& positions, IndexBuffer& indices) const
+	{
+		for (const Layer& layer : _layers)
+		{
+			for (const Surface& surface : layer.surfaces)
+			{
+				auto indexStart = static_cast<unsigned int>(positions.size());
+
+				for (const ArbitraryMeshVertex& vertex : surface.vertices)
+				{
+					positions.push_back(vertex.vertex);
+				}
+
+				for (auto index : surface.indices)
+				{
+					indices.push_back(index + indexStart);
+				}
+			}
+		}
+	}
+
+	// Moves all layers of the given exporter to the end of this exporter's layer list
+	void appendLayers(ModelExporterBase& other)
+	{
+		auto indexOffset = static_cast<int>(_layers.size());
+
+		for (Layer& layer : other._layers)
+		{
+			Layer& appended = _layers.emplace_back(std::move(layer));
+
+			// Parent indices are shifted along with the layers
+			if (appended.parentIndex != -1)
+			{
+				appended.parentIndex += indexOffset;
+			}
+
+			// Material IDs are only valid within their registry
+			if (other._materials != _materials)
+			{
+				appended.surfaceIndices.clear();
+
+				for (std::size_t s = 0; s < appended.surfaces.size(); ++s)
+				{
+					auto materialId = _materials->intern(other._materials->getName(appended.surfaces[s].materialId));
+
+					appended.surfaces[s].materialId = materialId;
+					getSurfaceIndex(appended, materialId) = static_cast<int>(s);
+				}
+			}
+		}
+
+		other._layers.clear();
+	}
+
+	// The material ID of the incoming surface needs to be interned in getMaterials()
 	void addSurface(const FbxSurface& incoming, const Matrix4& localToWorld)
 	{
-		Surface& surface = ensureSurface(incoming.getActiveMaterial());
+		Surface& surface = ensureSurface(incoming.getMaterialId());
+
+		if (surface.texturePath.empty())
+		{
+			surface.texturePath = incoming.texturePath;
+		}
 
 		Matrix4 invTranspTransform = localToWorld.getFullInverse().getTransposed();
 
@@ -58,17 +196,54 @@ public:
 			return;
 		}
 
-		// Transform vertices before inserting them
-		for (const auto& meshVertex : vertices)
+		// Copy the incoming vertices, then transform them in place using the vectorised kernels
+		surface.vertices.insert(surface.vertices.end(), vertices.begin(), vertices.end());
+
+		static_assert(sizeof(ArbitraryMeshVertex) % sizeof(double) == 0, "Vertex stride must be a multiple of double");
+		constexpr std::size_t Stride = sizeof(ArbitraryMeshVertex) / sizeof(double);
+
+		ArbitraryMeshVertex* inserted = surface.vertices.data() + indexStart;
+
+		// Transform the normal using the inverse transpose
+		simd::transformPoints(localToWorld, inserted->vertex, Stride, vertices.size());
+		simd::transformPoints(invTranspTransform, inserted->normal, Stride, vertices.size());
+
+		for (std::size_t i = 0; i < vertices.size(); ++i)
 		{
-			// Copy-construct based on the incoming meshVertex, transform the vertex.
-			// Transform the normal using the inverse transpose
 			// We discard the tangent and bitangent vectors here, none of the exporters is using them.
-			surface.vertices.emplace_back(
-				localToWorld.transformPoint(meshVertex.vertex),
-				invTranspTransform.transformPoint(meshVertex.normal).getNormalised(),
-				meshVertex.texcoord,
-				meshVertex.colour);
+			inserted[i].normal = inserted[i].normal.getNormalised();
+			inserted[i].tangent = Normal3f(0, 0, 0);
+			inserted[i].bitangent = Normal3f(0, 0, 0);
+		}
+
+		// Weights are referring to the incoming vertices, offset them along with the indices
+		for (const auto& pair : incoming.weightMaps)
+		{
+			auto& weights = surface.weightMaps[pair.first];
+			weights.reserve(weights.size() + pair.second.size());
+
+			for (const auto& weight : pair.second)
+			{
+				weights.push_back(VertexWeight{ weight.vertex + indexStart, weight.weight });
+			}
+		}
+
+		// Offsets are directions, they are not affected by the translation part
+		for (const auto& pair : incoming.morphMaps)
+		{
+			auto& offsets = surface.morphMaps[pair.first];
+			offsets.reserve(offsets.size() + pair.second.size());
+
+			for (const auto& offset : pair.second)
+			{
+				offsets.push_back(VertexOffset{ offset.vertex + indexStart, localToWorld.transformDirection(offset.offset) });
+			}
+		}
+
+		// Static vertices following animated ones need a range of their own
+		if (!incoming.motionTrack.empty() || !surface.motionTracks.empty())
+		{
+			surface.motionTracks.push_back(MotionTrackRange{ indexStart, incoming.motionTrack });
 		}
 
 		surface.indices.reserve(surface.indices.size() + indices.size());
@@ -85,7 +260,7 @@ public:
 
 	void addPolygons(const std::string& materialName, const std::vector<ModelPolygon>& polys)
 	{
-		Surface& surface = ensureSurface(materialName);
+		Surface& surface = ensureSurface(_materials->intern(materialName));
 
 		for (const ModelPolygon& poly : polys)
 		{
@@ -109,18 +284,36 @@ public:
 		}
 	}
 
+protected:
+	Layer& ensureLayer()
+	{
+		if (_layers.empty())
+		{
+			_layers.emplace_back();
+		}
+
+		return _layers.back();
+	}
+
 private:
-	Surface& ensureSurface(const std::string& materialName)
+	// Returns -1 if the layer doesn't use the material yet
+	static int& getSurfaceIndex(Layer& layer, unsigned int materialId)
+	{
+		return layer.surfaceIndices.try_emplace(materialId, -1).first->second;
+	}
+
+	Surface& ensureSurface(unsigned int materialId)
 	{
-		Surfaces::iterator surf = _surfaces.find(materialName);
+		Layer& layer = ensureLayer();
+		int& surfaceIndex = getSurfaceIndex(layer, materialId);
 
-		if (surf == _surfaces.end())
+		if (surfaceIndex == -1)
 		{
-			surf = _surfaces.insert(std::make_pair(materialName, Surface())).first;
-			surf->second.materialName = materialName;
+			surfaceIndex = static_cast<int>(layer.surfaces.size());
+			layer.surfaces.emplace_back().materialId = materialId;
 		}
 
-		return surf->second;
+		return layer.surfaces[surfaceIndex];
 	}
 };
 
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "../math/Matrix4.h"
+
+namespace model
+{
+
+// The frames of a point cache. Each motion track has one transform per frame, moving the
+// vertices referring to the track from their exported position to the one at that frame.
+struct PointAnimation
+{
+	// The time of each frame in seconds
+	std::vector<double> frameTimes;
+
+	// Track name => its transform at each frame, in the exporter's coordinate system
+	std::map<std::string, std::vector<Matrix4>> tracks;
+};
+
+}
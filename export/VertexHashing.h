@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include "../math/Vector3.h"
 #include "ArbitraryMeshVertex.h"
 #include "../math/Hash.h"
@@ -73,3 +74,48 @@ struct std::equal_to<ArbitraryMeshVertex>
             math::isNear(a.colour, b.colour, render::VertexEpsilon);
     }
 };
+
+namespace render
+{
+
+// Hash and equality functors for welding vertices with a custom vertex epsilon instead
+// of the fixed VertexEpsilon. The default-constructed functors behave exactly like the
+// std::hash<> and std::equal_to<> specialisations above.
+struct WeldVertexHash
+{
+    // The inverse of the hash cell size
+    double cellScale = math::detail::RoundingFactor(std::hash<Vector3>::SignificantVertexDigits);
+
+    WeldVertexHash() = default;
+
+    // The hash cells are as large as the epsilon, down to 8 significant digits
+    explicit WeldVertexHash(double vertexEpsilon) :
+        cellScale(std::min(1.0 / vertexEpsilon, math::detail::RoundingFactor(8)))
+    {}
+
+    size_t operator()(const ArbitraryMeshVertex& v) const
+    {
+        return math::hashVector3InCells(v.vertex, cellScale);
+    }
+};
+
+struct WeldVertexEqual
+{
+    double vertexEpsilon = VertexEpsilon;
+
+    WeldVertexEqual() = default;
+
+    explicit WeldVertexEqual(double vertexEpsilon_) :
+        vertexEpsilon(vertexEpsilon_)
+    {}
+
+    bool operator()(const ArbitraryMeshVertex& a, const ArbitraryMeshVertex& b) const
+    {
+        return math::isNear(a.vertex, b.vertex, vertexEpsilon) &&
+            a.normal.dot(b.normal) > (1.0 - NormalEpsilon) &&
+            math::isNear(a.texcoord, b.texcoord, TexCoordEpsilon) &&
+            math::isNear(a.colour, b.colour, VertexEpsilon);
+    }
+};
+
+}
@@ -0,0 +1,270 @@
+#include "DdsWriter.h"
+
+#include <cmath>
+#include <algorithm>
+#include "../math/Simd.h"
+#include "../export/StreamUtils.h"
+#include "../Parallel.h"
+
+namespace image
+{
+
+namespace
+{
+	// Conversions between 8 bit sRGB and linear values
+	struct GammaTables
+	{
+		static constexpr int LinearSteps = 4096;
+
+		float toLinear[256];
+		uint8_t toSrgb[LinearSteps];
+
+		GammaTables()
+		{
+			for (int i = 0; i < 256; ++i)
+			{
+				double value = i / 255.0;
+				toLinear[i] = static_cast<float>(value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4));
+			}
+
+			for (int i = 0; i < LinearSteps; ++i)
+			{
+				double value = i / double(LinearSteps - 1);
+				double srgb = value <= 0.0031308 ? value * 12.92 : 1.055 * std::pow(value, 1 / 2.4) - 0.055;
+
+				toSrgb[i] = static_cast<uint8_t>(std::lround(srgb * 255));
+			}
+		}
+
+		static const GammaTables& get()
+		{
+			static const GammaTables tables;
+			return tables;
+		}
+	};
+
+	std::size_t getBlockSize(BlockFormat format)
+	{
+		return format == BlockFormat::BC1 ? 8 : 16;
+	}
+
+	// DDS header flags and the FourCC codes
+	constexpr uint32_t DDSD_CAPS = 0x1;
+	constexpr uint32_t DDSD_HEIGHT = 0x2;
+	constexpr uint32_t DDSD_WIDTH = 0x4;
+	constexpr uint32_t DDSD_PIXELFORMAT = 0x1000;
+	constexpr uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+	constexpr uint32_t DDSD_LINEARSIZE = 0x80000;
+	constexpr uint32_t DDPF_FOURCC = 0x4;
+	constexpr uint32_t DDSCAPS_COMPLEX = 0x8;
+	constexpr uint32_t DDSCAPS_TEXTURE = 0x1000;
+	constexpr uint32_t DDSCAPS_MIPMAP = 0x400000;
+
+	constexpr uint32_t makeFourCC(char a, char b, char c, char d)
+	{
+		return static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) | (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
+	}
+
+	void writeHeader(std::ostream& stream, const Image& image, std::size_t numLevels, BlockFormat format)
+	{
+		auto blocksX = (image.width + 3) / 4;
+		auto blocksY = (image.height + 3) / 4;
+
+		stream.write("DDS ", 4);
+
+		stream::writeLittleEndian<uint32_t>(stream, 124); // size of the header
+		stream::writeLittleEndian<uint32_t>(stream, DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE);
+		stream::writeLittleEndian<uint32_t>(stream, static_cast<uint32_t>(image.height));
+		stream::writeLittleEndian<uint32_t>(stream, static_cast<uint32_t>(image.width));
+		stream::writeLittleEndian<uint32_t>(stream, static_cast<uint32_t>(blocksX * blocksY * getBlockSize(format))); // size of the top level
+		stream::writeLittleEndian<uint32_t>(stream, 0); // depth
+		stream::writeLittleEndian<uint32_t>(stream, static_cast<uint32_t>(numLevels));
+
+		for (int i = 0; i < 11; ++i)
+		{
+			stream::writeLittleEndian<uint32_t>(stream, 0); // reserved
+		}
+
+		// Pixel format
+		stream::writeLittleEndian<uint32_t>(stream, 32);
+		stream::writeLittleEndian<uint32_t>(stream, DDPF_FOURCC);
+		stream::writeLittleEndian<uint32_t>(stream, format == BlockFormat::BC1 ? makeFourCC('D', 'X', 'T', '1') : makeFourCC('D', 'X', 'T', '5'));
+
+		for (int i = 0; i < 5; ++i)
+		{
+			stream::writeLittleEndian<uint32_t>(stream, 0); // bit count and masks
+		}
+
+		stream::writeLittleEndian<uint32_t>(stream, DDSCAPS_TEXTURE | (numLevels > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0));
+
+		for (int i = 0; i < 4; ++i)
+		{
+			stream::writeLittleEndian<uint32_t>(stream, 0); // caps 2 to 4, reserved
+		}
+	}
+
+	// Copies the image to a size divisible by 4, repeating the last row and column
+	Image padToBlocks(const Image& image)
+	{
+		Image padded((image.width + 3) / 4 * 4, (image.height + 3) / 4 * 4);
+
+		for (std::size_t y = 0; y < padded.height; ++y)
+		{
+			for (std::size_t x = 0; x < padded.width; ++x)
+			{
+				std::copy_n(image.getPixel(std::min(x, image.width - 1), std::min(y, image.height - 1)), 4, padded.getPixel(x, y));
+			}
+		}
+
+		return padded;
+	}
+
+	// Compresses the given block rows of an image whose size is divisible by 4
+	void compressRows(const Image& image, BlockFormat format, std::size_t firstRow, std::size_t numRows, uint8_t* dest)
+	{
+		auto blocksX = image.width / 4;
+		auto rowSize = blocksX * getBlockSize(format);
+
+		for (std::size_t row = firstRow; row < firstRow + numRows; ++row)
+		{
+			const uint8_t* source = image.getPixel(0, row * 4);
+			uint8_t* target = dest + (row - firstRow) * rowSize;
+
+			if (format == BlockFormat::BC1)
+			{
+				simd::compressBC1(source, image.width * 4, blocksX, target);
+			}
+			else
+			{
+				simd::compressBC3(source, image.width * 4, blocksX, target);
+			}
+		}
+	}
+}
+
+Image downsample(const Image& image)
+{
+	const auto& gamma = GammaTables::get();
+
+	Image result(std::max<std::size_t>(image.width / 2, 1), std::max<std::size_t>(image.height / 2, 1));
+
+	parallel::forEach(result.height, [&](std::size_t y)
+	{
+		std::size_t y0 = std::min(y * 2, image.height - 1), y1 = std::min(y * 2 + 1, image.height - 1);
+
+		for (std::size_t x = 0; x < result.width; ++x)
+		{
+			std::size_t x0 = std::min(x * 2, image.width - 1), x1 = std::min(x * 2 + 1, image.width - 1);
+
+			const uint8_t* samples[4] = { image.getPixel(x0, y0), image.getPixel(x1, y0), image.getPixel(x0, y1), image.getPixel(x1, y1) };
+			uint8_t* pixel = result.getPixel(x, y);
+
+			for (int c = 0; c < 3; ++c)
+			{
+				float linear = (gamma.toLinear[samples[0][c]] + gamma.toLinear[samples[1][c]] +
+					gamma.toLinear[samples[2][c]] + gamma.toLinear[samples[3][c]]) * 0.25f;
+
+				pixel[c] = gamma.toSrgb[std::lround(linear * (GammaTables::LinearSteps - 1))];
+			}
+
+			pixel[3] = static_cast<uint8_t>((samples[0][3] + samples[1][3] + samples[2][3] + samples[3][3] + 2) / 4);
+		}
+	});
+
+	return result;
+}
+
+std::vector<uint8_t> compress(const Image& image, BlockFormat format)
+{
+	std::vector<uint8_t> blocks((image.width + 3) / 4 * ((image.height + 3) / 4) * getBlockSize(format));
+
+	if (image.width % 4 != 0 || image.height % 4 != 0)
+	{
+		Image padded = padToBlocks(image);
+		compressRows(padded, format, 0, padded.height / 4, blocks.data());
+	}
+	else
+	{
+		compressRows(image, format, 0, image.height / 4, blocks.data());
+	}
+
+	return blocks;
+}
+
+void writeDds(std::ostream& stream, const Image& image)
+{
+	auto format = image.hasAlpha() ? BlockFormat::BC3 : BlockFormat::BC1;
+
+	// The smaller levels, padded to whole blocks
+	std::vector<Image> levels;
+
+	for (const Image* level = &image; level->width > 1 || level->height > 1; level = &levels.back())
+	{
+		levels.push_back(downsample(*level));
+	}
+
+	Image paddedTop;
+
+	if (image.width % 4 != 0 || image.height % 4 != 0)
+	{
+		paddedTop = padToBlocks(image);
+	}
+
+	for (auto& level : levels)
+	{
+		if (level.width % 4 != 0 || level.height % 4 != 0)
+		{
+			level = padToBlocks(level);
+		}
+	}
+
+	std::vector<const Image*> chain = { paddedTop.width > 0 ? &paddedTop : &image };
+
+	for (const auto& level : levels)
+	{
+		chain.push_back(&level);
+	}
+
+	// All block rows of all levels make up the work items, in the order they are written.
+	// Rows are grouped into chunks of a similar number of blocks to balance the threads.
+	struct Chunk
+	{
+		const Image* level;
+		std::size_t firstRow;
+		std::size_t numRows;
+		std::size_t offset;
+	};
+
+	constexpr std::size_t BlocksPerChunk = 4096;
+
+	std::vector<Chunk> chunks;
+	std::size_t size = 0;
+
+	for (const Image* level : chain)
+	{
+		auto blocksX = level->width / 4;
+		auto blockRows = level->height / 4;
+		auto rowsPerChunk = std::max<std::size_t>(BlocksPerChunk / blocksX, 1);
+
+		for (std::size_t row = 0; row < blockRows; row += rowsPerChunk)
+		{
+			auto numRows = std::min(rowsPerChunk, blockRows - row);
+
+			chunks.push_back(Chunk{ level, row, numRows, size });
+			size += numRows * blocksX * getBlockSize(format);
+		}
+	}
+
+	std::vector<uint8_t> data(size);
+
+	parallel::forEach(chunks.size(), [&](std::size_t i)
+	{
+		const auto& chunk = chunks[i];
+		compressRows(*chunk.level, format, chunk.firstRow, chunk.numRows, data.data() + chunk.offset);
+	});
+
+	writeHeader(stream, image, chain.size(), format);
+	stream.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+}
+
+}
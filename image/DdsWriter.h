@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include <ostream>
+#include "Image.h"
+
+namespace image
+{
+
+enum class BlockFormat
+{
+	BC1,    // DXT1, opaque colours
+	BC3,    // DXT5, colours and interpolated alpha
+};
+
+// The next smaller mip level: half the size (at least 1 pixel), each pixel the average of the
+// 2x2 pixels it covers. The colours are averaged in linear space, not in sRGB.
+Image downsample(const Image& image);
+
+// Compresses the image into 4x4 pixel blocks in row order. Sizes which are not a multiple of 4
+// are padded by repeating the last row and column.
+std::vector<uint8_t> compress(const Image& image, BlockFormat format);
+
+// Writes the image and its mip chain down to 1x1 as DDS file, compressed to BC3 if it has
+// any transparent pixels and to BC1 otherwise. The levels are compressed in parallel.
+void writeDds(std::ostream& stream, const Image& image);
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace image
+{
+
+// Images larger than this in either direction are rejected instead of decoded
+constexpr std::size_t MaxDimension = 32768;
+
+// An image with 8 bit RGBA pixels, the rows are stored from top to bottom without padding
+struct Image
+{
+	std::size_t width = 0;
+	std::size_t height = 0;
+
+	std::vector<uint8_t> pixels;
+
+	Image() = default;
+
+	Image(std::size_t width_, std::size_t height_) :
+		width(width_),
+		height(height_),
+		pixels(width_ * height_ * 4)
+	{}
+
+	uint8_t* getPixel(std::size_t x, std::size_t y)
+	{
+		return pixels.data() + (y * width + x) * 4;
+	}
+
+	const uint8_t* getPixel(std::size_t x, std::size_t y) const
+	{
+		return pixels.data() + (y * width + x) * 4;
+	}
+
+	// True if any pixel is not fully opaque
+	bool hasAlpha() const
+	{
+		for (std::size_t i = 3; i < pixels.size(); i += 4)
+		{
+			if (pixels[i] != 255) return true;
+		}
+
+		return false;
+	}
+};
+
+enum class Format
+{
+	Unknown,
+	Png,
+	Jpeg,
+	Tga,
+};
+
+// Identifies the encodings which can be decoded: PNG and JPEG by their signature, TGA (which has
+// none) by the file name and the header. Returns Unknown for other formats and the unsupported
+// variants, like progressive JPEGs.
+Format getFormat(const unsigned char* data, std::size_t size, const std::string& filename);
+
+// Decodes the image, throws std::runtime_error if it is corrupt or not supported
+Image decode(const unsigned char* data, std::size_t size, Format format);
+
+// PNG of any colour type and bit depth, interlaced or not
+Image decodePng(const unsigned char* data, std::size_t size);
+
+// Baseline (sequential Huffman) JPEG with one or three components
+Image decodeJpeg(const unsigned char* data, std::size_t size);
+
+// Uncompressed or run-length encoded TGA with grey, colour-mapped or true colour pixels
+Image decodeTga(const unsigned char* data, std::size_t size);
+
+// False if the data isn't a JPEG or uses a frame type decodeJpeg can't handle
+bool isBaselineJpeg(const unsigned char* data, std::size_t size);
+
+}
@@ -0,0 +1,325 @@
+#include "Image.h"
+
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+namespace image
+{
+
+namespace
+{
+	std::runtime_error error(const std::string& message)
+	{
+		return std::runtime_error("Invalid TGA: " + message);
+	}
+
+	uint16_t readU16LittleEndian(const unsigned char* data)
+	{
+		return static_cast<uint16_t>(data[0] | (data[1] << 8));
+	}
+
+	struct TgaHeader
+	{
+		std::size_t idLength;
+		int colourMapType;
+		int imageType;
+		std::size_t colourMapFirst;
+		std::size_t colourMapLength;
+		int colourMapDepth;
+		std::size_t width;
+		std::size_t height;
+		int pixelDepth;
+		int descriptor;
+
+		static constexpr std::size_t Size = 18;
+
+		explicit TgaHeader(const unsigned char* data) :
+			idLength(data[0]),
+			colourMapType(data[1]),
+			imageType(data[2]),
+			colourMapFirst(readU16LittleEndian(data + 3)),
+			colourMapLength(readU16LittleEndian(data + 5)),
+			colourMapDepth(data[7]),
+			width(readU16LittleEndian(data + 12)),
+			height(readU16LittleEndian(data + 14)),
+			pixelDepth(data[16]),
+			descriptor(data[17])
+		{}
+
+		bool isColourMapped() const
+		{
+			return (imageType & 7) == 1;
+		}
+
+		bool isGrey() const
+		{
+			return (imageType & 7) == 3;
+		}
+
+		bool isRunLengthEncoded() const
+		{
+			return imageType & 8;
+		}
+
+		bool isValid() const
+		{
+			if (imageType != 1 && imageType != 2 && imageType != 3 && imageType != 9 && imageType != 10 && imageType != 11)
+			{
+				return false;
+			}
+
+			if (width == 0 || height == 0 || width > MaxDimension || height > MaxDimension || colourMapType > 1)
+			{
+				return false;
+			}
+
+			// The colour map is decoded even if the image type doesn't use it, so it needs a valid depth in any case
+			if (colourMapType == 1 && colourMapDepth != 15 && colourMapDepth != 16 && colourMapDepth != 24 && colourMapDepth != 32)
+			{
+				return false;
+			}
+
+			if (isColourMapped())
+			{
+				return colourMapType == 1 && (pixelDepth == 8 || pixelDepth == 16);
+			}
+
+			if (isGrey())
+			{
+				return pixelDepth == 8 || pixelDepth == 16;
+			}
+
+			return pixelDepth == 15 || pixelDepth == 16 || pixelDepth == 24 || pixelDepth == 32;
+		}
+	};
+
+	// Decodes a colour of the given depth (BGR order, 16 bit colours as A1R5G5B5) to RGBA
+	void decodeColour(const unsigned char* data, int depth, bool hasAlpha, uint8_t* rgba)
+	{
+		switch (depth)
+		{
+		case 15:
+		case 16:
+		{
+			auto value = readU16LittleEndian(data);
+
+			rgba[0] = static_cast<uint8_t>(((value >> 10) & 31) * 255 / 31);
+			rgba[1] = static_cast<uint8_t>(((value >> 5) & 31) * 255 / 31);
+			rgba[2] = static_cast<uint8_t>((value & 31) * 255 / 31);
+			rgba[3] = depth == 16 && hasAlpha && !(value & 0x8000) ? 0 : 255;
+			break;
+		}
+		default:
+			rgba[0] = data[2];
+			rgba[1] = data[1];
+			rgba[2] = data[0];
+			rgba[3] = depth == 32 && hasAlpha ? data[3] : 255;
+			break;
+		}
+	}
+
+	bool hasExtension(const std::string& filename, const char* extension)
+	{
+		auto length = std::strlen(extension);
+
+		if (filename.size() < length) return false;
+
+		for (std::size_t i = 0; i < length; ++i)
+		{
+			if (std::tolower(static_cast<unsigned char>(filename[filename.size() - length + i])) != extension[i]) return false;
+		}
+
+		return true;
+	}
+}
+
+Image decodeTga(const unsigned char* data, std::size_t size)
+{
+	if (size < TgaHeader::Size)
+	{
+		throw error("header missing");
+	}
+
+	TgaHeader header(data);
+
+	if (!header.isValid())
+	{
+		throw error("unsupported image type or pixel depth");
+	}
+
+	// The number of attribute bits, colours without them are opaque
+	bool hasAlpha = (header.descriptor & 15) > 0;
+
+	std::size_t offset = TgaHeader::Size + header.idLength;
+
+	// The colour map, decoded to RGBA
+	std::vector<uint8_t> colourMap;
+
+	if (header.colourMapType == 1)
+	{
+		std::size_t entrySize = (header.colourMapDepth + 7) / 8;
+
+		if (size < offset || (size - offset) / entrySize < header.colourMapLength)
+		{
+			throw error("colour map exceeds the file");
+		}
+
+		colourMap.resize(header.colourMapLength * 4);
+
+		for (std::size_t i = 0; i < header.colourMapLength; ++i)
+		{
+			decodeColour(data + offset + i * entrySize, header.colourMapDepth, hasAlpha, colourMap.data() + i * 4);
+		}
+
+		offset += header.colourMapLength * entrySize;
+	}
+
+	std::size_t pixelSize = (header.pixelDepth + 7) / 8;
+
+	auto decodePixel = [&](const unsigned char* source, uint8_t* rgba)
+	{
+		if (header.isColourMapped())
+		{
+			std::size_t index = pixelSize == 1 ? source[0] : readU16LittleEndian(source);
+
+			if (index < header.colourMapFirst || index - header.colourMapFirst >= header.colourMapLength)
+			{
+				throw error("colour index out of range");
+			}
+
+			std::memcpy(rgba, colourMap.data() + (index - header.colourMapFirst) * 4, 4);
+		}
+		else if (header.isGrey())
+		{
+			rgba[0] = rgba[1] = rgba[2] = source[0];
+			rgba[3] = pixelSize == 2 && hasAlpha ? source[1] : 255;
+		}
+		else
+		{
+			decodeColour(source, header.pixelDepth, hasAlpha, rgba);
+		}
+	};
+
+	// The pixels in file order, flipped into place below
+	Image image(header.width, header.height);
+
+	std::size_t numPixels = header.width * header.height;
+	std::size_t pixel = 0;
+
+	auto fileEnd = data + size;
+	auto source = data + std::min(offset, size);
+
+	auto requireBytes = [&](std::size_t count)
+	{
+		if (static_cast<std::size_t>(fileEnd - source) < count)
+		{
+			throw error("unexpected end of file");
+		}
+	};
+
+	while (pixel < numPixels)
+	{
+		if (!header.isRunLengthEncoded())
+		{
+			requireBytes(pixelSize);
+			decodePixel(source, image.pixels.data() + pixel * 4);
+
+			source += pixelSize;
+			++pixel;
+			continue;
+		}
+
+		// A packet repeats one pixel or contains up to 128 raw pixels
+		requireBytes(1);
+
+		auto packet = *source++;
+		std::size_t count = std::min<std::size_t>((packet & 0x7F) + 1, numPixels - pixel);
+
+		if (packet & 0x80)
+		{
+			requireBytes(pixelSize);
+
+			uint8_t rgba[4];
+			decodePixel(source, rgba);
+			source += pixelSize;
+
+			for (std::size_t i = 0; i < count; ++i, ++pixel)
+			{
+				std::memcpy(image.pixels.data() + pixel * 4, rgba, 4);
+			}
+		}
+		else
+		{
+			requireBytes(count * pixelSize);
+
+			for (std::size_t i = 0; i < count; ++i, ++pixel, source += pixelSize)
+			{
+				decodePixel(source, image.pixels.data() + pixel * 4);
+			}
+		}
+	}
+
+	// The rows are stored bottom-up unless bit 5 of the descriptor is set, bit 4 mirrors the columns
+	bool flipRows = !(header.descriptor & 0x20);
+	bool flipColumns = (header.descriptor & 0x10) != 0;
+
+	if (flipRows)
+	{
+		std::size_t rowSize = header.width * 4;
+
+		for (std::size_t y = 0; y < header.height / 2; ++y)
+		{
+			std::swap_ranges(image.getPixel(0, y), image.getPixel(0, y) + rowSize, image.getPixel(0, header.height - 1 - y));
+		}
+	}
+
+	if (flipColumns)
+	{
+		for (std::size_t y = 0; y < header.height; ++y)
+		{
+			for (std::size_t x = 0; x < header.width / 2; ++x)
+			{
+				std::swap_ranges(image.getPixel(x, y), image.getPixel(x, y) + 4, image.getPixel(header.width - 1 - x, y));
+			}
+		}
+	}
+
+	return image;
+}
+
+Format getFormat(const unsigned char* data, std::size_t size, const std::string& filename)
+{
+	static const unsigned char PngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+	if (size >= 8 && std::memcmp(data, PngSignature, 8) == 0)
+	{
+		return Format::Png;
+	}
+
+	if (size >= 2 && data[0] == 0xFF && data[1] == 0xD8)
+	{
+		return isBaselineJpeg(data, size) ? Format::Jpeg : Format::Unknown;
+	}
+
+	if (hasExtension(filename, ".tga") && size >= TgaHeader::Size && TgaHeader(data).isValid())
+	{
+		return Format::Tga;
+	}
+
+	return Format::Unknown;
+}
+
+Image decode(const unsigned char* data, std::size_t size, Format format)
+{
+	switch (format)
+	{
+	case Format::Png: return decodePng(data, size);
+	case Format::Jpeg: return decodeJpeg(data, size);
+	case Format::Tga: return decodeTga(data, size);
+	default: throw std::runtime_error("Unsupported image format");
+	}
+}
+
+}
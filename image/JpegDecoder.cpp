@@ -0,0 +1,765 @@
+#include "Image.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+namespace image
+{
+
+namespace
+{
+	// The natural position of the coefficients in zigzag order
+	const uint8_t ZigZag[64] =
+	{
+		0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+		12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+		35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+		58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+	};
+
+	std::runtime_error error(const std::string& message)
+	{
+		return std::runtime_error("Invalid JPEG: " + message);
+	}
+
+	uint16_t readU16(const unsigned char* data)
+	{
+		return static_cast<uint16_t>((data[0] << 8) | data[1]);
+	}
+
+	// A canonical Huffman table, codes of up to 8 bits are decoded with a single lookup
+	struct HuffmanTable
+	{
+		static constexpr int LookupBits = 8;
+
+		// Per code length: the largest code (-1 if there is none) and the index of the first value
+		int maxCode[17] = {};
+		int valueOffset[17] = {};
+
+		uint8_t values[256] = {};
+
+		// Code length (0 for longer codes) and value per 8 bit prefix
+		uint8_t lookupLength[1 << LookupBits] = {};
+		uint8_t lookupValue[1 << LookupBits] = {};
+
+		bool isDefined = false;
+
+		void build(const uint8_t* counts, const uint8_t* symbols, std::size_t numSymbols)
+		{
+			std::memcpy(values, symbols, numSymbols);
+			std::memset(lookupLength, 0, sizeof(lookupLength));
+
+			int code = 0;
+			int index = 0;
+
+			for (int length = 1; length <= 16; ++length)
+			{
+				valueOffset[length] = index - code;
+
+				// More codes than the length allows come from corrupt tables, they would overrun the lookup
+				if (code + counts[length - 1] > (1 << length))
+				{
+					throw error("Huffman table has too many codes");
+				}
+
+				for (int i = 0; i < counts[length - 1]; ++i, ++code, ++index)
+				{
+					if (length <= LookupBits)
+					{
+						int shift = LookupBits - length;
+
+						for (int fill = 0; fill < (1 << shift); ++fill)
+						{
+							lookupLength[(code << shift) | fill] = static_cast<uint8_t>(length);
+							lookupValue[(code << shift) | fill] = symbols[index];
+						}
+					}
+				}
+
+				maxCode[length] = counts[length - 1] > 0 ? code - 1 : -1;
+				code <<= 1;
+			}
+
+			isDefined = true;
+		}
+	};
+
+	// Reads the entropy-coded data of a scan, removing the stuffed zero bytes. Stops at the
+	// next marker and returns zero bits from then on.
+	class BitReader
+	{
+	private:
+		const unsigned char* _pos;
+		const unsigned char* _end;
+
+		uint32_t _buffer = 0;
+		int _numBits = 0;
+		bool _atMarker = false;
+
+	public:
+		BitReader(const unsigned char* begin, const unsigned char* end) :
+			_pos(begin),
+			_end(end)
+		{}
+
+		const unsigned char* getPosition() const
+		{
+			return _pos;
+		}
+
+		uint32_t peek(int count)
+		{
+			fill();
+			return _buffer >> (32 - count);
+		}
+
+		void skip(int count)
+		{
+			_buffer <<= count;
+			_numBits -= count;
+		}
+
+		int getBits(int count)
+		{
+			auto bits = peek(count);
+			skip(count);
+			return static_cast<int>(bits);
+		}
+
+		// Reads a coefficient difference of the given size and extends its sign
+		int receiveExtend(int size)
+		{
+			if (size == 0) return 0;
+
+			int value = getBits(size);
+
+			return value < (1 << (size - 1)) ? value - (1 << size) + 1 : value;
+		}
+
+		int decode(const HuffmanTable& table)
+		{
+			auto prefix = peek(HuffmanTable::LookupBits);
+			auto length = table.lookupLength[prefix];
+
+			if (length > 0)
+			{
+				skip(length);
+				return table.lookupValue[prefix];
+			}
+
+			int code = static_cast<int>(peek(16));
+
+			for (int length = HuffmanTable::LookupBits + 1; length <= 16; ++length)
+			{
+				int lengthCode = code >> (16 - length);
+
+				if (lengthCode <= table.maxCode[length])
+				{
+					skip(length);
+					return table.values[(table.valueOffset[length] + lengthCode) & 0xFF];
+				}
+			}
+
+			throw error("invalid Huffman code");
+		}
+
+		// Skips the RSTn marker ending a restart interval and resets the bit buffer
+		void restart()
+		{
+			_buffer = 0;
+			_numBits = 0;
+			_atMarker = false;
+
+			if (_end - _pos >= 2 && _pos[0] == 0xFF && _pos[1] >= 0xD0 && _pos[1] <= 0xD7)
+			{
+				_pos += 2;
+			}
+		}
+
+	private:
+		void fill()
+		{
+			while (_numBits <= 24)
+			{
+				uint32_t byte = 0;
+
+				if (!_atMarker && _pos < _end)
+				{
+					byte = *_pos++;
+
+					if (byte == 0xFF)
+					{
+						if (_pos < _end && *_pos == 0x00)
+						{
+							++_pos;
+						}
+						else
+						{
+							// Leave the marker for the caller
+							--_pos;
+							_atMarker = true;
+							byte = 0;
+						}
+					}
+				}
+
+				_buffer |= byte << (24 - _numBits);
+				_numBits += 8;
+			}
+		}
+	};
+
+	struct Component
+	{
+		int id = 0;
+		int h = 1;
+		int v = 1;
+		int quantTable = 0;
+
+		int dcTable = 0;
+		int acTable = 0;
+		int dcPrediction = 0;
+
+		// The samples of the component, covering all MCUs
+		std::size_t planeWidth = 0;
+		std::size_t planeHeight = 0;
+		std::vector<uint8_t> plane;
+	};
+
+	// The basis functions of the inverse DCT: cosines[x * 8 + u] = C(u) / 2 * cos((2x + 1) * u * pi / 16)
+	struct Cosines
+	{
+		float values[64];
+
+		Cosines()
+		{
+			const double pi = 3.14159265358979323846;
+
+			for (int x = 0; x < 8; ++x)
+			{
+				for (int u = 0; u < 8; ++u)
+				{
+					double scale = u == 0 ? std::sqrt(0.5) : 1.0;
+					values[x * 8 + u] = static_cast<float>(scale / 2 * std::cos((2 * x + 1) * u * pi / 16));
+				}
+			}
+		}
+	};
+
+	// Transforms the dequantised coefficients (in natural order) into 8x8 samples
+	void inverseDct(const int* coefficients, uint8_t* dest, std::size_t pitch)
+	{
+		static const Cosines cosines;
+
+		float rows[64];
+
+		// Rows first, then the columns of the row results
+		for (int y = 0; y < 8; ++y)
+		{
+			for (int x = 0; x < 8; ++x)
+			{
+				float sum = 0;
+
+				for (int u = 0; u < 8; ++u)
+				{
+					sum += cosines.values[x * 8 + u] * coefficients[y * 8 + u];
+				}
+
+				rows[y * 8 + x] = sum;
+			}
+		}
+
+		for (int x = 0; x < 8; ++x)
+		{
+			for (int y = 0; y < 8; ++y)
+			{
+				float sum = 0;
+
+				for (int v = 0; v < 8; ++v)
+				{
+					sum += cosines.values[y * 8 + v] * rows[v * 8 + x];
+				}
+
+				int sample = static_cast<int>(std::lround(sum + 128));
+				dest[y * pitch + x] = static_cast<uint8_t>(std::clamp(sample, 0, 255));
+			}
+		}
+	}
+
+	class Decoder
+	{
+	private:
+		const unsigned char* _data;
+		std::size_t _size;
+
+		uint16_t _quantTables[4][64] = {};
+		HuffmanTable _dcTables[4];
+		HuffmanTable _acTables[4];
+
+		std::vector<Component> _components;
+		std::size_t _width = 0;
+		std::size_t _height = 0;
+		int _maxH = 1;
+		int _maxV = 1;
+		std::size_t _mcusX = 0;
+		std::size_t _mcusY = 0;
+
+		int _restartInterval = 0;
+
+		// Set by an Adobe APP14 segment, 0 means the components are RGB instead of YCbCr
+		int _adobeTransform = -1;
+
+	public:
+		Decoder(const unsigned char* data, std::size_t size) :
+			_data(data),
+			_size(size)
+		{}
+
+		Image decode()
+		{
+			if (_size < 4 || _data[0] != 0xFF || _data[1] != 0xD8)
+			{
+				throw error("start of image missing");
+			}
+
+			std::size_t offset = 2;
+
+			while (true)
+			{
+				// Markers may be preceded by any number of fill bytes
+				while (offset < _size && _data[offset] == 0xFF && offset + 1 < _size && _data[offset + 1] == 0xFF)
+				{
+					++offset;
+				}
+
+				if (_size - offset < 2 || _data[offset] != 0xFF)
+				{
+					throw error("marker expected");
+				}
+
+				int marker = _data[offset + 1];
+				offset += 2;
+
+				if (marker == 0xD9) break; // EOI
+
+				if (_size - offset < 2)
+				{
+					throw error("unexpected end of file");
+				}
+
+				std::size_t length = readU16(_data + offset);
+
+				if (length < 2 || length > _size - offset)
+				{
+					throw error("segment exceeds the file");
+				}
+
+				const unsigned char* segment = _data + offset + 2;
+				std::size_t segmentSize = length - 2;
+
+				offset += length;
+
+				switch (marker)
+				{
+				case 0xC0: case 0xC1:
+					readFrame(segment, segmentSize);
+					break;
+				case 0xC4:
+					readHuffmanTables(segment, segmentSize);
+					break;
+				case 0xDB:
+					readQuantTables(segment, segmentSize);
+					break;
+				case 0xDD:
+					if (segmentSize < 2) throw error("restart interval too short");
+					_restartInterval = readU16(segment);
+					break;
+				case 0xEE:
+					if (segmentSize >= 12 && std::memcmp(segment, "Adobe", 5) == 0)
+					{
+						_adobeTransform = segment[11];
+					}
+					break;
+				case 0xDA:
+					offset = readScan(segment, segmentSize, _data + offset);
+					break;
+				default:
+					if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+					{
+						throw error("only baseline JPEGs are supported");
+					}
+					break; // APPn, COM and others are skipped
+				}
+
+				if (marker == 0xDA && offset >= _size) break; // missing EOI
+			}
+
+			if (_components.empty())
+			{
+				throw error("frame header missing");
+			}
+
+			return convert();
+		}
+
+	private:
+		void readFrame(const unsigned char* segment, std::size_t size)
+		{
+			if (size < 6 || segment[0] != 8)
+			{
+				throw error("only 8 bit samples are supported");
+			}
+
+			_height = readU16(segment + 1);
+			_width = readU16(segment + 3);
+
+			std::size_t numComponents = segment[5];
+
+			if (_width == 0 || _height == 0 || _width > MaxDimension || _height > MaxDimension)
+			{
+				throw error("unsupported image size");
+			}
+
+			if ((numComponents != 1 && numComponents != 3) || size < 6 + numComponents * 3)
+			{
+				throw error("only grey and three component images are supported");
+			}
+
+			_components.resize(numComponents);
+
+			for (std::size_t c = 0; c < numComponents; ++c)
+			{
+				auto& component = _components[c];
+				const unsigned char* spec = segment + 6 + c * 3;
+
+				component.id = spec[0];
+				component.h = spec[1] >> 4;
+				component.v = spec[1] & 15;
+				component.quantTable = spec[2] & 3;
+
+				if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4)
+				{
+					throw error("invalid sampling factors");
+				}
+
+				_maxH = std::max(_maxH, component.h);
+				_maxV = std::max(_maxV, component.v);
+			}
+
+			_mcusX = (_width + _maxH * 8 - 1) / (_maxH * 8);
+			_mcusY = (_height + _maxV * 8 - 1) / (_maxV * 8);
+
+			for (auto& component : _components)
+			{
+				component.planeWidth = _mcusX * component.h * 8;
+				component.planeHeight = _mcusY * component.v * 8;
+				component.plane.assign(component.planeWidth * component.planeHeight, 0);
+			}
+		}
+
+		void readHuffmanTables(const unsigned char* segment, std::size_t size)
+		{
+			std::size_t offset = 0;
+
+			while (offset < size)
+			{
+				if (size - offset < 17) throw error("Huffman table too short");
+
+				int tableClass = segment[offset] >> 4;
+				int index = segment[offset] & 3;
+				const uint8_t* counts = segment + offset + 1;
+
+				std::size_t numSymbols = 0;
+
+				for (int i = 0; i < 16; ++i)
+				{
+					numSymbols += counts[i];
+				}
+
+				if (numSymbols > 256 || size - offset - 17 < numSymbols) throw error("Huffman table too short");
+
+				auto& table = tableClass == 0 ? _dcTables[index] : _acTables[index];
+				table.build(counts, segment + offset + 17, numSymbols);
+
+				offset += 17 + numSymbols;
+			}
+		}
+
+		void readQuantTables(const unsigned char* segment, std::size_t size)
+		{
+			std::size_t offset = 0;
+
+			while (offset < size)
+			{
+				int precision = segment[offset] >> 4;
+				int index = segment[offset] & 3;
+				std::size_t tableSize = precision == 0 ? 64 : 128;
+
+				if (size - offset - 1 < tableSize) throw error("quantisation table too short");
+
+				// Stored in zigzag order, like the coefficients are decoded
+				for (int k = 0; k < 64; ++k)
+				{
+					_quantTables[index][k] = precision == 0 ? segment[offset + 1 + k] : readU16(segment + offset + 1 + k * 2);
+				}
+
+				offset += 1 + tableSize;
+			}
+		}
+
+		// Decodes the entropy-coded data following the scan header, returns the offset after it
+		std::size_t readScan(const unsigned char* segment, std::size_t size, const unsigned char* entropyData)
+		{
+			if (_components.empty())
+			{
+				throw error("scan before the frame header");
+			}
+
+			std::size_t numScanComponents = size > 0 ? segment[0] : 0;
+
+			if (numScanComponents < 1 || numScanComponents > _components.size() || size < 1 + numScanComponents * 2 + 3)
+			{
+				throw error("invalid scan header");
+			}
+
+			std::vector<Component*> scanComponents;
+
+			for (std::size_t s = 0; s < numScanComponents; ++s)
+			{
+				int id = segment[1 + s * 2];
+				int tables = segment[2 + s * 2];
+
+				auto found = std::find_if(_components.begin(), _components.end(), [&](const Component& c) { return c.id == id; });
+
+				if (found == _components.end()) throw error("scan of an unknown component");
+
+				found->dcTable = tables >> 4 & 3;
+				found->acTable = tables & 3;
+				found->dcPrediction = 0;
+
+				if (!_dcTables[found->dcTable].isDefined || !_acTables[found->acTable].isDefined)
+				{
+					throw error("Huffman table missing");
+				}
+
+				scanComponents.push_back(&*found);
+			}
+
+			BitReader reader(entropyData, _data + _size);
+			int coefficients[64];
+
+			auto decodeBlock = [&](Component& component, std::size_t blockX, std::size_t blockY)
+			{
+				std::fill(std::begin(coefficients), std::end(coefficients), 0);
+
+				const uint16_t* quant = _quantTables[component.quantTable];
+
+				// Baseline coefficients have at most 11 bits (DC differences) or 10 bits (AC values),
+				// larger sizes only come from corrupt tables and would overflow the bit reader
+				int dcSize = reader.decode(_dcTables[component.dcTable]);
+
+				if (dcSize > 11) throw error("DC difference size out of range");
+
+				component.dcPrediction += reader.receiveExtend(dcSize);
+
+				if (component.dcPrediction < -2047 || component.dcPrediction > 2047) throw error("DC coefficient out of range");
+
+				coefficients[0] = component.dcPrediction * quant[0];
+
+				const auto& acTable = _acTables[component.acTable];
+
+				for (int k = 1; k < 64;)
+				{
+					int symbol = reader.decode(acTable);
+					int run = symbol >> 4;
+					int bits = symbol & 15;
+
+					if (bits == 0)
+					{
+						if (run != 15) break; // end of block
+
+						k += 16;
+						continue;
+					}
+
+					k += run;
+
+					if (k > 63) throw error("coefficient index out of range");
+					if (bits > 10) throw error("AC coefficient size out of range");
+
+					coefficients[ZigZag[k]] = reader.receiveExtend(bits) * quant[k];
+					++k;
+				}
+
+				inverseDct(coefficients, component.plane.data() + blockY * 8 * component.planeWidth + blockX * 8, component.planeWidth);
+			};
+
+			// A single component is not interleaved, each MCU is one of its blocks
+			bool interleaved = scanComponents.size() > 1;
+
+			std::size_t blocksX = _mcusX, blocksY = _mcusY;
+
+			if (!interleaved)
+			{
+				const auto& component = *scanComponents.front();
+
+				blocksX = ((_width * component.h + _maxH - 1) / _maxH + 7) / 8;
+				blocksY = ((_height * component.v + _maxV - 1) / _maxV + 7) / 8;
+			}
+
+			std::size_t numMcus = blocksX * blocksY;
+
+			for (std::size_t mcu = 0; mcu < numMcus; ++mcu)
+			{
+				if (_restartInterval > 0 && mcu > 0 && mcu % _restartInterval == 0)
+				{
+					reader.restart();
+
+					for (auto component : scanComponents)
+					{
+						component->dcPrediction = 0;
+					}
+				}
+
+				std::size_t mcuX = mcu % blocksX;
+				std::size_t mcuY = mcu / blocksX;
+
+				if (!interleaved)
+				{
+					decodeBlock(*scanComponents.front(), mcuX, mcuY);
+					continue;
+				}
+
+				for (auto component : scanComponents)
+				{
+					for (int y = 0; y < component->v; ++y)
+					{
+						for (int x = 0; x < component->h; ++x)
+						{
+							decodeBlock(*component, mcuX * component->h + x, mcuY * component->v + y);
+						}
+					}
+				}
+			}
+
+			// Continue at the marker following the entropy-coded data
+			const unsigned char* pos = reader.getPosition();
+			const unsigned char* end = _data + _size;
+
+			while (pos + 1 < end && !(pos[0] == 0xFF && pos[1] != 0x00 && (pos[1] < 0xD0 || pos[1] > 0xD7)))
+			{
+				++pos;
+			}
+
+			return pos + 1 < end ? static_cast<std::size_t>(pos - _data) : _size;
+		}
+
+		// Upsamples the components (by replicating their samples) and converts them to RGBA
+		Image convert() const
+		{
+			Image image(_width, _height);
+
+			bool isRgb = _components.size() == 3 && (_adobeTransform == 0 ||
+				(_components[0].id == 'R' && _components[1].id == 'G' && _components[2].id == 'B'));
+
+			for (std::size_t y = 0; y < _height; ++y)
+			{
+				for (std::size_t x = 0; x < _width; ++x)
+				{
+					int samples[3];
+
+					for (std::size_t c = 0; c < _components.size(); ++c)
+					{
+						const auto& component = _components[c];
+
+						std::size_t sx = x * component.h / _maxH;
+						std::size_t sy = y * component.v / _maxV;
+
+						samples[c] = component.plane[sy * component.planeWidth + sx];
+					}
+
+					uint8_t* pixel = image.getPixel(x, y);
+					pixel[3] = 255;
+
+					if (_components.size() == 1)
+					{
+						pixel[0] = pixel[1] = pixel[2] = static_cast<uint8_t>(samples[0]);
+					}
+					else if (isRgb)
+					{
+						pixel[0] = static_cast<uint8_t>(samples[0]);
+						pixel[1] = static_cast<uint8_t>(samples[1]);
+						pixel[2] = static_cast<uint8_t>(samples[2]);
+					}
+					else
+					{
+						// JFIF YCbCr
+						float luma = static_cast<float>(samples[0]);
+						float cb = samples[1] - 128.0f;
+						float cr = samples[2] - 128.0f;
+
+						pixel[0] = toByte(luma + 1.402f * cr);
+						pixel[1] = toByte(luma - 0.344136f * cb - 0.714136f * cr);
+						pixel[2] = toByte(luma + 1.772f * cb);
+					}
+				}
+			}
+
+			return image;
+		}
+
+		static uint8_t toByte(float value)
+		{
+			return static_cast<uint8_t>(std::clamp(static_cast<int>(std::lround(value)), 0, 255));
+		}
+	};
+}
+
+bool isBaselineJpeg(const unsigned char* data, std::size_t size)
+{
+	if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+
+	// Walk the segments up to the frame header
+	std::size_t offset = 2;
+
+	while (size - offset >= 4 && data[offset] == 0xFF)
+	{
+		int marker = data[offset + 1];
+
+		if (marker == 0xFF)
+		{
+			++offset;
+			continue;
+		}
+
+		std::size_t length = readU16(data + offset + 2);
+
+		if (marker == 0xC0 || marker == 0xC1)
+		{
+			// 8 bit samples, one or three components
+			return length >= 8 && size - offset >= 10 && data[offset + 4] == 8 &&
+				(data[offset + 9] == 1 || data[offset + 9] == 3);
+		}
+
+		if ((marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) || marker == 0xDA)
+		{
+			return false;
+		}
+
+		offset += 2 + length;
+
+		if (offset > size) return false;
+	}
+
+	return false;
+}
+
+Image decodeJpeg(const unsigned char* data, std::size_t size)
+{
+	Decoder decoder(data, size);
+	return decoder.decode();
+}
+
+}
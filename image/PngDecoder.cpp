@@ -0,0 +1,357 @@
+#include "Image.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+#include "../openfbx/miniz.h"
+
+namespace image
+{
+
+namespace
+{
+	const unsigned char Signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+	enum ColourType
+	{
+		Grey = 0,
+		Rgb = 2,
+		Palette = 3,
+		GreyAlpha = 4,
+		Rgba = 6,
+	};
+
+	// The first pixel and the pixel spacing of each Adam7 pass
+	struct Pass
+	{
+		std::size_t x, y, dx, dy;
+	};
+
+	const Pass Adam7Passes[7] = { { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 }, { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 } };
+
+	uint32_t readU32(const unsigned char* data)
+	{
+		return (static_cast<uint32_t>(data[0]) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+	}
+
+	uint16_t readU16(const unsigned char* data)
+	{
+		return static_cast<uint16_t>((data[0] << 8) | data[1]);
+	}
+
+	std::runtime_error error(const std::string& message)
+	{
+		return std::runtime_error("Invalid PNG: " + message);
+	}
+
+	struct Header
+	{
+		std::size_t width = 0;
+		std::size_t height = 0;
+		int bitDepth = 0;
+		int colourType = 0;
+		bool interlaced = false;
+
+		int getChannels() const
+		{
+			switch (colourType)
+			{
+			case Grey: return 1;
+			case Rgb: return 3;
+			case Palette: return 1;
+			case GreyAlpha: return 2;
+			default: return 4;
+			}
+		}
+
+		std::size_t getRowBytes(std::size_t pixels) const
+		{
+			return (pixels * getChannels() * bitDepth + 7) / 8;
+		}
+	};
+
+	unsigned char paeth(int a, int b, int c)
+	{
+		int p = a + b - c;
+		int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+
+		return static_cast<unsigned char>(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+	}
+
+	// Reverses the filter of a scanline in place, previous is nullptr for the first line
+	void unfilter(int filter, unsigned char* line, const unsigned char* previous, std::size_t length, std::size_t bytesPerPixel)
+	{
+		for (std::size_t i = 0; i < length; ++i)
+		{
+			int left = i >= bytesPerPixel ? line[i - bytesPerPixel] : 0;
+			int up = previous ? previous[i] : 0;
+			int upLeft = previous && i >= bytesPerPixel ? previous[i - bytesPerPixel] : 0;
+
+			switch (filter)
+			{
+			case 0: break;
+			case 1: line[i] = static_cast<unsigned char>(line[i] + left); break;
+			case 2: line[i] = static_cast<unsigned char>(line[i] + up); break;
+			case 3: line[i] = static_cast<unsigned char>(line[i] + ((left + up) >> 1)); break;
+			case 4: line[i] = static_cast<unsigned char>(line[i] + paeth(left, up, upLeft)); break;
+			default: throw error("unknown filter type");
+			}
+		}
+	}
+}
+
+Image decodePng(const unsigned char* data, std::size_t size)
+{
+	if (size < 8 || std::memcmp(data, Signature, 8) != 0)
+	{
+		throw error("signature missing");
+	}
+
+	Header header;
+	std::vector<unsigned char> compressed;
+
+	unsigned char palette[256][4];
+	std::size_t paletteSize = 0;
+
+	for (auto& entry : palette)
+	{
+		entry[0] = entry[1] = entry[2] = 0;
+		entry[3] = 255;
+	}
+
+	// The transparent colour of grey and RGB images, in the sample bit depth
+	bool hasColourKey = false;
+	uint16_t colourKey[3] = { 0, 0, 0 };
+
+	std::size_t offset = 8;
+	bool hasEnd = false;
+
+	while (!hasEnd)
+	{
+		if (size - offset < 12)
+		{
+			throw error("unexpected end of file");
+		}
+
+		auto length = readU32(data + offset);
+		const unsigned char* type = data + offset + 4;
+		const unsigned char* chunk = data + offset + 8;
+
+		if (length > size - offset - 12)
+		{
+			throw error("chunk exceeds the file");
+		}
+
+		if (std::memcmp(type, "IHDR", 4) == 0)
+		{
+			if (length < 13) throw error("header too short");
+
+			header.width = readU32(chunk);
+			header.height = readU32(chunk + 4);
+			header.bitDepth = chunk[8];
+			header.colourType = chunk[9];
+			header.interlaced = chunk[12] == 1;
+
+			if (header.width == 0 || header.height == 0 || header.width > MaxDimension || header.height > MaxDimension)
+			{
+				throw error("unsupported image size");
+			}
+
+			bool valid;
+
+			switch (header.colourType)
+			{
+			case Grey: valid = header.bitDepth == 1 || header.bitDepth == 2 || header.bitDepth == 4 || header.bitDepth == 8 || header.bitDepth == 16; break;
+			case Palette: valid = header.bitDepth == 1 || header.bitDepth == 2 || header.bitDepth == 4 || header.bitDepth == 8; break;
+			case Rgb: case GreyAlpha: case Rgba: valid = header.bitDepth == 8 || header.bitDepth == 16; break;
+			default: valid = false; break;
+			}
+
+			if (!valid || chunk[10] != 0 || chunk[11] != 0 || chunk[12] > 1)
+			{
+				throw error("unsupported colour type, bit depth or compression");
+			}
+		}
+		else if (std::memcmp(type, "PLTE", 4) == 0)
+		{
+			paletteSize = std::min<std::size_t>(length / 3, 256);
+
+			for (std::size_t i = 0; i < paletteSize; ++i)
+			{
+				std::memcpy(palette[i], chunk + i * 3, 3);
+			}
+		}
+		else if (std::memcmp(type, "tRNS", 4) == 0)
+		{
+			if (header.colourType == Palette)
+			{
+				for (std::size_t i = 0; i < length && i < 256; ++i)
+				{
+					palette[i][3] = chunk[i];
+				}
+			}
+			else if (header.colourType == Grey && length >= 2)
+			{
+				hasColourKey = true;
+				colourKey[0] = readU16(chunk);
+			}
+			else if (header.colourType == Rgb && length >= 6)
+			{
+				hasColourKey = true;
+
+				for (int c = 0; c < 3; ++c)
+				{
+					colourKey[c] = readU16(chunk + c * 2);
+				}
+			}
+		}
+		else if (std::memcmp(type, "IDAT", 4) == 0)
+		{
+			compressed.insert(compressed.end(), chunk, chunk + length);
+		}
+		else if (std::memcmp(type, "IEND", 4) == 0)
+		{
+			hasEnd = true;
+		}
+
+		offset += 12 + length;
+	}
+
+	if (header.width == 0)
+	{
+		throw error("header missing");
+	}
+
+	if (header.colourType == Palette && paletteSize == 0)
+	{
+		throw error("palette missing");
+	}
+
+	// The passes of an interlaced image, or the whole image as one pass
+	std::vector<Pass> passes;
+
+	if (header.interlaced)
+	{
+		passes.assign(std::begin(Adam7Passes), std::end(Adam7Passes));
+	}
+	else
+	{
+		passes.push_back(Pass{ 0, 0, 1, 1 });
+	}
+
+	std::size_t rawSize = 0;
+
+	for (const auto& pass : passes)
+	{
+		std::size_t passWidth = header.width > pass.x ? (header.width - pass.x + pass.dx - 1) / pass.dx : 0;
+		std::size_t passHeight = header.height > pass.y ? (header.height - pass.y + pass.dy - 1) / pass.dy : 0;
+
+		if (passWidth > 0)
+		{
+			rawSize += passHeight * (1 + header.getRowBytes(passWidth));
+		}
+	}
+
+	std::vector<unsigned char> raw(rawSize);
+
+	auto decompressed = tinfl_decompress_mem_to_mem(raw.data(), raw.size(), compressed.data(), compressed.size(), TINFL_FLAG_PARSE_ZLIB_HEADER);
+
+	if (decompressed != rawSize)
+	{
+		throw error("corrupt image data");
+	}
+
+	Image image(header.width, header.height);
+
+	int channels = header.getChannels();
+	std::size_t bytesPerPixel = std::max<std::size_t>(1, channels * header.bitDepth / 8);
+	int maxSample = (1 << header.bitDepth) - 1;
+
+	unsigned char* line = raw.data();
+
+	for (const auto& pass : passes)
+	{
+		std::size_t passWidth = header.width > pass.x ? (header.width - pass.x + pass.dx - 1) / pass.dx : 0;
+		std::size_t passHeight = header.height > pass.y ? (header.height - pass.y + pass.dy - 1) / pass.dy : 0;
+
+		if (passWidth == 0) continue;
+
+		std::size_t rowBytes = header.getRowBytes(passWidth);
+		const unsigned char* previous = nullptr;
+
+		for (std::size_t row = 0; row < passHeight; ++row, line += 1 + rowBytes)
+		{
+			unfilter(line[0], line + 1, previous, rowBytes, bytesPerPixel);
+			previous = line + 1;
+
+			const unsigned char* samples = line + 1;
+
+			// The sample of the given channel, in the image's bit depth
+			auto getSample = [&](std::size_t x, int channel) -> int
+			{
+				std::size_t index = x * channels + channel;
+
+				switch (header.bitDepth)
+				{
+				case 16: return readU16(samples + index * 2);
+				case 8: return samples[index];
+				default:
+				{
+					std::size_t bit = index * header.bitDepth;
+					return (samples[bit / 8] >> (8 - header.bitDepth - bit % 8)) & maxSample;
+				}
+				}
+			};
+
+			// Scales a sample to 8 bits
+			auto scale = [&](int sample)
+			{
+				return static_cast<uint8_t>(header.bitDepth == 16 ? sample >> 8 : sample * 255 / maxSample);
+			};
+
+			for (std::size_t x = 0; x < passWidth; ++x)
+			{
+				uint8_t* pixel = image.getPixel(pass.x + x * pass.dx, pass.y + row * pass.dy);
+
+				switch (header.colourType)
+				{
+				case Grey:
+				{
+					int grey = getSample(x, 0);
+					pixel[0] = pixel[1] = pixel[2] = scale(grey);
+					pixel[3] = hasColourKey && grey == colourKey[0] ? 0 : 255;
+					break;
+				}
+				case Palette:
+					std::memcpy(pixel, palette[getSample(x, 0)], 4);
+					break;
+				case GreyAlpha:
+					pixel[0] = pixel[1] = pixel[2] = scale(getSample(x, 0));
+					pixel[3] = scale(getSample(x, 1));
+					break;
+				case Rgb:
+				{
+					int r = getSample(x, 0), g = getSample(x, 1), b = getSample(x, 2);
+
+					pixel[0] = scale(r);
+					pixel[1] = scale(g);
+					pixel[2] = scale(b);
+					pixel[3] = hasColourKey && r == colourKey[0] && g == colourKey[1] && b == colourKey[2] ? 0 : 255;
+					break;
+				}
+				default:
+					for (int c = 0; c < 4; ++c)
+					{
+						pixel[c] = scale(getSample(x, c));
+					}
+					break;
+				}
+			}
+		}
+	}
+
+	return image;
+}
+
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <memory>
 #include "Vector3.h"
@@ -28,11 +30,12 @@ inline std::size_t hashDouble(double value, std::size_t significantDigits)
     return static_cast<std::size_t>(value * detail::RoundingFactor(significantDigits));
 }
 
-inline std::size_t hashVector3(const Vector3& v, std::size_t significantDigits)
+// Hashes the cell of the given scale the vector is in, e.g. a scale of 2 means cells of size 0.5
+inline std::size_t hashVector3InCells(const Vector3& v, double cellScale)
 {
-    auto xHash = math::hashDouble(v.x(), significantDigits);
-    auto yHash = math::hashDouble(v.y(), significantDigits);
-    auto zHash = math::hashDouble(v.z(), significantDigits);
+    auto xHash = static_cast<std::size_t>(v.x() * cellScale);
+    auto yHash = static_cast<std::size_t>(v.y() * cellScale);
+    auto zHash = static_cast<std::size_t>(v.z() * cellScale);
 
     math::combineHash(xHash, yHash);
     math::combineHash(xHash, zHash);
@@ -40,6 +43,11 @@ inline std::size_t hashVector3(const Vector3& v, std::size_t significantDigits)
     return xHash;
 }
 
+inline std::size_t hashVector3(const Vector3& v, std::size_t significantDigits)
+{
+    return hashVector3InCells(v, detail::RoundingFactor(significantDigits));
+}
+
 // Convenience wrapper around the C-style functions in the SHA256.h header
 class Hash
 {
@@ -58,19 +66,21 @@ public:
         sha256_update(_context.get(), reinterpret_cast<const uint8_t*>(&value), sizeof(value));
     }
 
+    // Values are rounded to the given number of decimal digits, into a signed integer
+    // since casting a negative value to an unsigned one is undefined
     void addDouble(double value, std::size_t significantDigits)
     {
-        auto intValue = static_cast<std::size_t>(value * detail::RoundingFactor(significantDigits));
-        addSizet(intValue);
+        int64_t intValue = std::llround(value * detail::RoundingFactor(significantDigits));
+        sha256_update(_context.get(), reinterpret_cast<const uint8_t*>(&intValue), sizeof(intValue));
     }
 
     void addVector3(const Vector3& v, std::size_t significantDigits)
     {
-        std::size_t components[3] =
+        int64_t components[3] =
         {
-            static_cast<std::size_t>(v.x() * detail::RoundingFactor(significantDigits)),
-            static_cast<std::size_t>(v.y() * detail::RoundingFactor(significantDigits)),
-            static_cast<std::size_t>(v.z() * detail::RoundingFactor(significantDigits)),
+            std::llround(v.x() * detail::RoundingFactor(significantDigits)),
+            std::llround(v.y() * detail::RoundingFactor(significantDigits)),
+            std::llround(v.z() * detail::RoundingFactor(significantDigits)),
         };
         
         sha256_update(_context.get(), reinterpret_cast<const uint8_t*>(&components), sizeof(components));
@@ -83,6 +93,13 @@ public:
         sha256_update(_context.get(), reinterpret_cast<const uint8_t*>(str.data()), str.length());
     }
 
+    void addData(const void* data, std::size_t length)
+    {
+        if (length == 0) return;
+
+        sha256_update(_context.get(), static_cast<const uint8_t*>(data), length);
+    }
+
     operator std::string() const
     {
         uint8_t digest[SHA256_BLOCK_SIZE];
@@ -17,6 +17,18 @@
 #include <memory.h>
 #include "SHA256.h"
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define SHA256_X86
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #define SHA256_TARGET_SHANI
+    #else
+        #include <cpuid.h>
+        #define SHA256_TARGET_SHANI __attribute__((target("sha,sse4.1")))
+    #endif
+#endif
+
 namespace math
 {
 
@@ -47,45 +59,158 @@ static const WORD k[64] = {
 };
 
 /*********************** FUNCTION DEFINITIONS ***********************/
-void sha256_transform(SHA256_CTX* ctx, const BYTE data[])
+static inline WORD load_big_endian(const BYTE* p)
+{
+    return (WORD(p[0]) << 24) | (WORD(p[1]) << 16) | (WORD(p[2]) << 8) | WORD(p[3]);
+}
+
+// One round, called with the working variables rotated instead of shifting them around
+#define ROUND(a,b,c,d,e,f,g,h,i) \
+    t1 = h + EP1(e) + CH(e, f, g) + k[i] + m[i]; \
+    d += t1; \
+    h = t1 + EP0(a) + MAJ(a, b, c);
+
+static void sha256_transform_generic(WORD state[8], const BYTE data[], size_t num_blocks)
+{
+    WORD a, b, c, d, e, f, g, h, i, t1, m[64];
+
+    for (; num_blocks > 0; --num_blocks, data += 64) {
+        for (i = 0; i < 16; ++i)
+            m[i] = load_big_endian(data + i * 4);
+        for (; i < 64; ++i)
+            m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
+
+        a = state[0];
+        b = state[1];
+        c = state[2];
+        d = state[3];
+        e = state[4];
+        f = state[5];
+        g = state[6];
+        h = state[7];
+
+        for (i = 0; i < 64; i += 8) {
+            ROUND(a, b, c, d, e, f, g, h, i);
+            ROUND(h, a, b, c, d, e, f, g, i + 1);
+            ROUND(g, h, a, b, c, d, e, f, i + 2);
+            ROUND(f, g, h, a, b, c, d, e, i + 3);
+            ROUND(e, f, g, h, a, b, c, d, i + 4);
+            ROUND(d, e, f, g, h, a, b, c, i + 5);
+            ROUND(c, d, e, f, g, h, a, b, i + 6);
+            ROUND(b, c, d, e, f, g, h, a, i + 7);
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef SHA256_X86
+
+// Four rounds using the message words in current. The message schedule runs ahead of the
+// rounds: next receives its final update, previous its first one.
+#define SHANI_ROUNDS(step, current, next, previous) \
+    if (step < 4) \
+        current = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + step * 16)), byte_swap); \
+    msg = _mm_add_epi32(current, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&k[step * 4]))); \
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+    if (step >= 3 && step < 15) { \
+        next = _mm_add_epi32(next, _mm_alignr_epi8(current, previous, 4)); \
+        next = _mm_sha256msg2_epu32(next, current); \
+    } \
+    msg = _mm_shuffle_epi32(msg, 0x0E); \
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg); \
+    if (step >= 1 && step < 13) \
+        previous = _mm_sha256msg1_epu32(previous, current);
+
+// Uses the SHA extensions of x86 CPUs, two rounds per sha256rnds2 instruction. The state
+// is kept in the ABEF/CDGH register layout these instructions expect.
+SHA256_TARGET_SHANI
+static void sha256_transform_shani(WORD state[8], const BYTE data[], size_t num_blocks)
 {
-    WORD a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
-
-    for (i = 0, j = 0; i < 16; ++i, j += 4)
-        m[i] = (data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
-    for (; i < 64; ++i)
-        m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
-
-    a = ctx->state[0];
-    b = ctx->state[1];
-    c = ctx->state[2];
-    d = ctx->state[3];
-    e = ctx->state[4];
-    f = ctx->state[5];
-    g = ctx->state[6];
-    h = ctx->state[7];
-
-    for (i = 0; i < 64; ++i) {
-        t1 = h + EP1(e) + CH(e, f, g) + k[i] + m[i];
-        t2 = EP0(a) + MAJ(a, b, c);
-        h = g;
-        g = f;
-        f = e;
-        e = d + t1;
-        d = c;
-        c = b;
-        b = a;
-        a = t1 + t2;
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0])), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4])), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; num_blocks > 0; --num_blocks, data += 64) {
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+        __m128i msg, w0, w1, w2, w3;
+
+        SHANI_ROUNDS(0, w0, w1, w3);
+        SHANI_ROUNDS(1, w1, w2, w0);
+        SHANI_ROUNDS(2, w2, w3, w1);
+        SHANI_ROUNDS(3, w3, w0, w2);
+        SHANI_ROUNDS(4, w0, w1, w3);
+        SHANI_ROUNDS(5, w1, w2, w0);
+        SHANI_ROUNDS(6, w2, w3, w1);
+        SHANI_ROUNDS(7, w3, w0, w2);
+        SHANI_ROUNDS(8, w0, w1, w3);
+        SHANI_ROUNDS(9, w1, w2, w0);
+        SHANI_ROUNDS(10, w2, w3, w1);
+        SHANI_ROUNDS(11, w3, w0, w2);
+        SHANI_ROUNDS(12, w0, w1, w3);
+        SHANI_ROUNDS(13, w1, w2, w0);
+        SHANI_ROUNDS(14, w2, w3, w1);
+        SHANI_ROUNDS(15, w3, w0, w2);
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
     }
 
-    ctx->state[0] += a;
-    ctx->state[1] += b;
-    ctx->state[2] += c;
-    ctx->state[3] += d;
-    ctx->state[4] += e;
-    ctx->state[5] += f;
-    ctx->state[6] += g;
-    ctx->state[7] += h;
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), _mm_alignr_epi8(state1, tmp, 8));
+}
+
+static bool cpu_has_sha_extensions()
+{
+    unsigned int regs[4] = { 0 };
+
+    // SSSE3 and SSE4.1 are used for shuffling the state, SHA in leaf 7
+#ifdef _MSC_VER
+    __cpuid(reinterpret_cast<int*>(regs), 1);
+#else
+    __get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+    bool has_sse = (regs[2] & (1u << 9)) && (regs[2] & (1u << 19));
+
+#ifdef _MSC_VER
+    __cpuidex(reinterpret_cast<int*>(regs), 7, 0);
+#else
+    if (!__get_cpuid_count(7, 0, &regs[0], &regs[1], &regs[2], &regs[3])) return false;
+#endif
+    return has_sse && (regs[1] & (1u << 29));
+}
+
+#endif
+
+typedef void (*transform_func)(WORD state[8], const BYTE data[], size_t num_blocks);
+
+// Picks the fastest block function this CPU supports, once
+static transform_func get_transform()
+{
+#ifdef SHA256_X86
+    static const transform_func func = cpu_has_sha_extensions() ? sha256_transform_shani : sha256_transform_generic;
+    return func;
+#else
+    return sha256_transform_generic;
+#endif
+}
+
+void sha256_transform(SHA256_CTX* ctx, const BYTE data[])
+{
+    get_transform()(ctx->state, data, 1);
 }
 
 void sha256_init(SHA256_CTX* ctx)
@@ -104,17 +229,34 @@ void sha256_init(SHA256_CTX* ctx)
 
 void sha256_update(SHA256_CTX* ctx, const BYTE data[], size_t len)
 {
-    WORD i;
+    // Complete a partially filled block first
+    if (ctx->datalen > 0) {
+        size_t count = 64 - ctx->datalen < len ? 64 - ctx->datalen : len;
+        memcpy(ctx->data + ctx->datalen, data, count);
+        ctx->datalen += WORD(count);
+        data += count;
+        len -= count;
 
-    for (i = 0; i < len; ++i) {
-        ctx->data[ctx->datalen] = data[i];
-        ctx->datalen++;
-        if (ctx->datalen == 64) {
-            sha256_transform(ctx, ctx->data);
-            ctx->bitlen += 512;
-            ctx->datalen = 0;
-        }
+        if (ctx->datalen < 64)
+            return;
+
+        sha256_transform(ctx, ctx->data);
+        ctx->bitlen += 512;
+        ctx->datalen = 0;
     }
+
+    // Whole blocks are hashed right from the input
+    size_t num_blocks = len / 64;
+
+    if (num_blocks > 0) {
+        get_transform()(ctx->state, data, num_blocks);
+        ctx->bitlen += uint64_t(num_blocks) * 512;
+        data += num_blocks * 64;
+        len -= num_blocks * 64;
+    }
+
+    memcpy(ctx->data, data, len);
+    ctx->datalen = WORD(len);
 }
 
 void sha256_final(SHA256_CTX* ctx, BYTE hash[])
@@ -10,6 +10,7 @@
 * Source: https://github.com/B-Con/crypto-algorithms/blob/cfbde48414baacf51fc7c74f275190881f037d32/sha256.c
 * Modified by stgatilov: use stdint types, allow inclusion from C++;
 * greebo: Moved to namespace math
+* Block-wise updates, unrolled rounds and a kernel using the x86 SHA extensions
 *********************************************************************/
 
 /*************************** HEADER FILES ***************************/
@@ -0,0 +1,912 @@
+#include "Simd.h"
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define SIMD_X86
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #define SIMD_TARGET(isa)
+    #else
+        #include <cpuid.h>
+        #define SIMD_TARGET(isa) __attribute__((target(isa)))
+    #endif
+#endif
+
+namespace simd
+{
+
+namespace
+{
+    // One implementation per kernel, selected by setActiveIsa
+    struct Kernels
+    {
+        void (*storeBigEndian)(const float* values, std::size_t count, char* dest);
+        void (*transformPoints)(const double* matrix, double* points, std::size_t stride, std::size_t count);
+        void (*getBounds)(const double* points, std::size_t stride, std::size_t count, double* min, double* max);
+        void (*skinVertices)(const double* matrices, const SkinInfluences* influences, double* positions, double* normals,
+            std::size_t stride, std::size_t count);
+        void (*compressBC1)(const unsigned char* rgba, std::size_t pitch, std::size_t numBlocks, unsigned char* dest);
+        void (*compressBC3)(const unsigned char* rgba, std::size_t pitch, std::size_t numBlocks, unsigned char* dest);
+    };
+
+    // --- Block compression, shared by all variants ---
+
+    // The block encoders follow J.M.P. van Waveren's "Real-Time DXT Compression": the endpoints
+    // are the corners of the block's bounding box, moved inwards by a fraction of its size since
+    // the extremes are rarely the best fit, and each pixel gets the closest palette entry. The
+    // kernels only vectorise the bounding box and the index selection, the palettes are built
+    // by the scalar code below, so all variants produce the same blocks.
+
+    uint16_t toRgb565(const int* rgb)
+    {
+        return static_cast<uint16_t>(((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3));
+    }
+
+    // Builds the endpoints and the 4 colour palette from the bounding box of the block's colours
+    void getColourPalette(const uint8_t* min, const uint8_t* max, uint16_t& colour0, uint16_t& colour1, int palette[4][3])
+    {
+        int lower[3], upper[3];
+
+        for (int c = 0; c < 3; ++c)
+        {
+            int inset = (max[c] - min[c]) >> 4;
+
+            lower[c] = min[c] + inset;
+            upper[c] = max[c] - inset;
+        }
+
+        // colour0 > colour1 selects the 4 colour mode, if they are equal all pixels use index 0
+        colour0 = toRgb565(upper);
+        colour1 = toRgb565(lower);
+
+        for (int e = 0; e < 2; ++e)
+        {
+            int value = e == 0 ? colour0 : colour1;
+
+            int r = (value >> 11) & 31, g = (value >> 5) & 63, b = value & 31;
+
+            palette[e][0] = (r << 3) | (r >> 2);
+            palette[e][1] = (g << 2) | (g >> 4);
+            palette[e][2] = (b << 3) | (b >> 2);
+        }
+
+        for (int c = 0; c < 3; ++c)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+    }
+
+    // The closest palette entry given the distances to the entries, using the order of the
+    // entries along the line: 0, 2, 3, 1
+    uint32_t getColourIndex(int d0, int d1, int d2, int d3)
+    {
+        uint32_t b0 = d0 > d3, b1 = d1 > d2, b2 = d0 > d2, b3 = d1 > d3, b4 = d2 > d3;
+
+        return (b0 & b4) | (((b1 & b2) | (b0 & b3)) << 1);
+    }
+
+    // Builds the endpoints and the 8 alpha palette from the alpha range of the block
+    void getAlphaPalette(uint8_t min, uint8_t max, uint8_t& alpha0, uint8_t& alpha1, int palette[8])
+    {
+        int inset = (max - min) >> 5;
+
+        // alpha0 > alpha1 selects the 8 alpha mode, if they are equal all pixels use index 0
+        alpha0 = static_cast<uint8_t>(max - inset);
+        alpha1 = static_cast<uint8_t>(min + inset);
+
+        palette[0] = alpha0;
+        palette[1] = alpha1;
+
+        for (int i = 1; i < 7; ++i)
+        {
+            palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+        }
+    }
+
+    void writeColourBlock(uint16_t colour0, uint16_t colour1, uint32_t indices, unsigned char* dest)
+    {
+        dest[0] = static_cast<unsigned char>(colour0);
+        dest[1] = static_cast<unsigned char>(colour0 >> 8);
+        dest[2] = static_cast<unsigned char>(colour1);
+        dest[3] = static_cast<unsigned char>(colour1 >> 8);
+
+        for (int i = 0; i < 4; ++i)
+        {
+            dest[4 + i] = static_cast<unsigned char>(indices >> (i * 8));
+        }
+    }
+
+    // Writes the alpha endpoints and the 3 bit indices of the 16 pixels
+    void writeAlphaBlock(uint8_t alpha0, uint8_t alpha1, const uint8_t* indices, unsigned char* dest)
+    {
+        uint64_t bits = 0;
+
+        for (int i = 0; i < 16; ++i)
+        {
+            bits |= static_cast<uint64_t>(indices[i]) << (i * 3);
+        }
+
+        dest[0] = alpha0;
+        dest[1] = alpha1;
+
+        for (int i = 0; i < 6; ++i)
+        {
+            dest[2 + i] = static_cast<unsigned char>(bits >> (i * 8));
+        }
+    }
+
+    // --- Scalar ---
+
+    void storeBigEndianScalar(const float* values, std::size_t count, char* dest)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            uint32_t bits;
+            std::memcpy(&bits, &values[i], 4);
+
+            dest[i * 4 + 0] = static_cast<char>(bits >> 24);
+            dest[i * 4 + 1] = static_cast<char>(bits >> 16);
+            dest[i * 4 + 2] = static_cast<char>(bits >> 8);
+            dest[i * 4 + 3] = static_cast<char>(bits);
+        }
+    }
+
+    void transformPointsScalar(const double* m, double* points, std::size_t stride, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i, points += stride)
+        {
+            double x = points[0], y = points[1], z = points[2];
+
+            points[0] = m[0] * x + m[4] * y + m[8] * z + m[12];
+            points[1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+            points[2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+        }
+    }
+
+    void skinVerticesScalar(const double* matrices, const SkinInfluences* influences, double* positions, double* normals,
+        std::size_t stride, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i, positions += stride, normals += stride)
+        {
+            // The weighted bone matrices are summed in slot order, like the vector variants do
+            double m[16];
+            const double* bone = matrices + influences[i].bones[0] * 16;
+            double weight = influences[i].weights[0];
+
+            for (int k = 0; k < 16; ++k)
+            {
+                m[k] = weight * bone[k];
+            }
+
+            for (int b = 1; b < 4; ++b)
+            {
+                bone = matrices + influences[i].bones[b] * 16;
+                weight = influences[i].weights[b];
+
+                for (int k = 0; k < 16; ++k)
+                {
+                    m[k] = m[k] + weight * bone[k];
+                }
+            }
+
+            double x = positions[0], y = positions[1], z = positions[2];
+
+            positions[0] = m[0] * x + m[4] * y + m[8] * z + m[12];
+            positions[1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+            positions[2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+
+            x = normals[0], y = normals[1], z = normals[2];
+
+            normals[0] = m[0] * x + m[4] * y + m[8] * z;
+            normals[1] = m[1] * x + m[5] * y + m[9] * z;
+            normals[2] = m[2] * x + m[6] * y + m[10] * z;
+        }
+    }
+
+    void getBoundsScalar(const double* points, std::size_t stride, std::size_t count, double* min, double* max)
+    {
+        if (count == 0) return;
+
+        double lower[3] = { points[0], points[1], points[2] };
+        double upper[3] = { points[0], points[1], points[2] };
+
+        for (std::size_t i = 1; i < count; ++i)
+        {
+            points += stride;
+
+            // Same operand order as the min/max instructions, which matters for NaN and signed zeros
+            for (int c = 0; c < 3; ++c)
+            {
+                lower[c] = points[c] < lower[c] ? points[c] : lower[c];
+                upper[c] = points[c] > upper[c] ? points[c] : upper[c];
+            }
+        }
+
+        std::memcpy(min, lower, sizeof(lower));
+        std::memcpy(max, upper, sizeof(upper));
+    }
+
+    void compressColourBlockScalar(const unsigned char* block, std::size_t pitch, unsigned char* dest)
+    {
+        uint8_t min[3] = { 255, 255, 255 };
+        uint8_t max[3] = { 0, 0, 0 };
+
+        for (int y = 0; y < 4; ++y)
+        {
+            const unsigned char* row = block + y * pitch;
+
+            for (int x = 0; x < 4; ++x)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    min[c] = std::min(min[c], row[x * 4 + c]);
+                    max[c] = std::max(max[c], row[x * 4 + c]);
+                }
+            }
+        }
+
+        uint16_t colour0, colour1;
+        int palette[4][3];
+        getColourPalette(min, max, colour0, colour1, palette);
+
+        uint32_t indices = 0;
+
+        for (int y = 0; y < 4; ++y)
+        {
+            const unsigned char* row = block + y * pitch;
+
+            for (int x = 0; x < 4; ++x)
+            {
+                int distances[4];
+
+                for (int e = 0; e < 4; ++e)
+                {
+                    distances[e] = std::abs(row[x * 4] - palette[e][0]) + std::abs(row[x * 4 + 1] - palette[e][1]) +
+                        std::abs(row[x * 4 + 2] - palette[e][2]);
+                }
+
+                indices |= getColourIndex(distances[0], distances[1], distances[2], distances[3]) << ((y * 4 + x) * 2);
+            }
+        }
+
+        writeColourBlock(colour0, colour1, indices, dest);
+    }
+
+    void compressAlphaBlockScalar(const unsigned char* block, std::size_t pitch, unsigned char* dest)
+    {
+        uint8_t alphas[16];
+
+        for (int y = 0; y < 4; ++y)
+        {
+            for (int x = 0; x < 4; ++x)
+            {
+                alphas[y * 4 + x] = block[y * pitch + x * 4 + 3];
+            }
+        }
+
+        uint8_t alpha0, alpha1;
+        int palette[8];
+        getAlphaPalette(*std::min_element(alphas, alphas + 16), *std::max_element(alphas, alphas + 16), alpha0, alpha1, palette);
+
+        uint8_t indices[16];
+
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 256;
+
+            // The first of several equally close entries wins
+            for (int e = 0; e < 8; ++e)
+            {
+                int distance = std::abs(alphas[i] - palette[e]);
+
+                if (distance < best)
+                {
+                    best = distance;
+                    indices[i] = static_cast<uint8_t>(e);
+                }
+            }
+        }
+
+        writeAlphaBlock(alpha0, alpha1, indices, dest);
+    }
+
+    void compressBC1Scalar(const unsigned char* rgba, std::size_t pitch, std::size_t numBlocks, unsigned char* dest)
+    {
+        for (std::size_t i = 0; i < numBlocks; ++i)
+        {
+            compressColourBlockScalar(rgba + i * 16, pitch, dest + i * 8);
+        }
+    }
+
+    void compressBC3Scalar(const unsigned char* rgba, std::size_t pitch, std::size_t numBlocks, unsigned char* dest)
+    {
+        for (std::size_t i = 0; i < numBlocks; ++i)
+        {
+            compressAlphaBlockScalar(rgba + i * 16, pitch, dest + i * 16);
+            compressColourBlockScalar(rgba + i * 16, pitch, dest + i * 16 + 8);
+        }
+    }
+
+    const Kernels ScalarKernels = { storeBigEndianScalar, transformPointsScalar, getBoundsScalar, skinVerticesScalar, compressBC1Scalar, compressBC3Scalar };
+
+#ifdef SIMD_X86
+
+    // --- SSE2 ---
+
+    SIMD_TARGET("sse2")
+    void storeBigEndianSSE2(const float* values, std::size_t count, char* dest)
+    {
+        std::size_t i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i v = _mm_castps_si128(_mm_loadu_ps(values + i));
+
+            // Swap the 16 bit halves of each value, then the bytes within the halves
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i * 4), v);
+        }
+
+        storeBigEndianScalar(values + i, count - i, dest + i * 4);
+    }
+
+    SIMD_TARGET("sse2")
+    void transformPointsSSE2(const double* m, double* points, std::size_t stride, std::size_t count)
+    {
+        __m128d c0 = _mm_loadu_pd(m + 0), c0z = _mm_loadu_pd(m + 2);
+        __m128d c1 = _mm_loadu_pd(m + 4), c1z = _mm_loadu_pd(m + 6);
+        __m128d c2 = _mm_loadu_pd(m + 8), c2z = _mm_loadu_pd(m + 10);
+        __m128d c3 = _mm_loadu_pd(m + 12), c3z = _mm_loadu_pd(m + 14);
+
+        for (std::size_t i = 0; i < count; ++i, points += stride)
+        {
+            __m128d x = _mm_set1_pd(points[0]);
+            __m128d y = _mm_set1_pd(points[1]);
+            __m128d z = _mm_set1_pd(points[2]);
+
+            __m128d xy = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(c0, x), _mm_mul_pd(c1, y)), _mm_mul_pd(c2, z)), c3);
+            __m128d zw = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(c0z, x), _mm_mul_pd(c1z, y)), _mm_mul_pd(c2z, z)), c3z);
+
+            _mm_storeu_pd(points, xy);
+            _mm_store_sd(points + 2, zw);
+        }
+    }
+
+    SIMD_TARGET("sse2")
+    void skinVerticesSSE2(const double* matrices, const SkinInfluences* influences, double* positions, double* normals,
+        std::size_t stride, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i, positions += stride, normals += stride)
+        {
+            // The blended matrix, two registers per column
+            __m128d m[8];
+            const double* bone = matrices + influences[i].bones[0] * 16;
+            __m128d weight = _mm_set1_pd(influences[i].weights[0]);
+
+            for (int k = 0; k < 8; ++k)
+            {
+                m[k] = _mm_mul_pd(weight, _mm_loadu_pd(bone + k * 2));
+            }
+
+            for (int b = 1; b < 4; ++b)
+            {
+                bone = matrices + influences[i].bones[b] * 16;
+                weight = _mm_set1_pd(influences[i].weights[b]);
+
+                for (int k = 0; k < 8; ++k)
+                {
+                    m[k] = _mm_add_pd(m[k], _mm_mul_pd(weight, _mm_loadu_pd(bone + k * 2)));
+                }
+            }
+
+            __m128d x = _mm_set1_pd(positions[0]);
+            __m128d y = _mm_set1_pd(positions[1]);
+            __m128d z = _mm_set1_pd(positions[2]);
+
+            _mm_storeu_pd(positions, _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(m[0], x), _mm_mul_pd(m[2], y)), _mm_mul_pd(m[4], z)), m[6]));
+            _mm_store_sd(positions + 2, _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(m[1], x), _mm_mul_pd(m[3], y)), _mm_mul_pd(m[5], z)), m[7]));
+
+            x = _mm_set1_pd(normals[0]);
+            y = _mm_set1_pd(normals[1]);
+            z = _mm_set1_pd(normals[2]);
+
+            _mm_storeu_pd(normals, _mm_add_pd(_mm_add_pd(_mm_mul_pd(m[0], x), _mm_mul_pd(m[2], y)), _mm_mul_pd(m[4], z)));
+            _mm_store_sd(normals + 2, _mm_add_pd(_mm_add_pd(_mm_mul_pd(m[1], x), _mm_mul_pd(m[3], y)), _mm_mul_pd(m[5], z)));
+        }
+    }
+
+    SIMD_TARGET("sse2")
+    void getBoundsSSE2(const double* points, std::size_t stride, std::size_t count, double* min, double* max)
+    {
+        if (count == 0) return;
+
+        __m128d lowerXY = _mm_loadu_pd(points), lowerZ = _mm_load_sd(points + 2);
+        __m128d upperXY = lowerXY, upperZ = lowerZ;
+
+        for (std::size_t i = 1; i < count; ++i)
+        {
+            points += stride;
+
+            __m128d xy = _mm_loadu_pd(points);
+            __m128d z = _mm_load_sd(points + 2);
+
+            lowerXY = _mm_min_pd(xy, lowerXY);
+            upperXY = _mm_max_pd(xy, upperXY);
+            lowerZ = _mm_min_sd(z, lowerZ);
+            upperZ = _mm_max_sd(z, upperZ);
+        }
+
+        _mm_storeu_pd(min, lowerXY);
+        _mm_store_sd(min + 2, lowerZ);
+        _mm_storeu_pd(max, upperXY);
+        _mm_store_sd(max + 2, upperZ);
+    }
+
+    // The distances of the 4 pixels to the palette entry, summed over the colour channels
+    SIMD_TARGET("sse2")
+    __m128i getColourDistancesSSE2(__m128i pixels, __m128i entry)
+    {
+        const __m128i lowByte = _mm_set1_epi32(0xFF);
+
+        __m128i difference = _mm_or_si128(_mm_subs_epu8(pixels, entry), _mm_subs_epu8(entry, pixels));
+
+        return _mm_add_epi32(_mm_add_epi32(_mm_and_si128(difference, lowByte),
+            _mm_and_si128(_mm_srli_epi32(difference, 8), lowByte)), _mm_and_si128(_mm_srli_epi32(difference, 16), lowByte));
+    }
+
+    SIMD_TARGET("sse2")
+    void compressColourBlockSSE2(const unsigned char* block, std::size_t pitch, unsigned char* dest)
+    {
+        // One row of 4 pixels per register, the alpha channel cleared
+        const __m128i colourMask = _mm_set1_epi32(0x00FFFFFF);
+
+        __m128i rows[4];
+
+        for (int y = 0; y < 4; ++y)
+        {
+            rows[y] = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + y * pitch)), colourMask);
+        }
+
+        __m128i lower = _mm_min_epu8(_mm_min_epu8(rows[0], rows[1]), _mm_min_epu8(rows[2], rows[3]));
+        __m128i upper = _mm_max_epu8(_mm_max_epu8(rows[0], rows[1]), _mm_max_epu8(rows[2], rows[3]));
+
+        lower = _mm_min_epu8(lower, _mm_shuffle_epi32(lower, 0x4E));
+        lower = _mm_min_epu8(lower, _mm_shuffle_epi32(lower, 0xB1));
+        upper = _mm_max_epu8(upper, _mm_shuffle_epi32(upper, 0x4E));
+        upper = _mm_max_epu8(upper, _mm_shuffle_epi32(upper, 0xB1));
+
+        uint32_t lowerBits = static_cast<uint32_t>(_mm_cvtsi128_si32(lower));
+        uint32_t upperBits = static_cast<uint32_t>(_mm_cvtsi128_si32(upper));
+
+        uint8_t min[3] = { static_cast<uint8_t>(lowerBits), static_cast<uint8_t>(lowerBits >> 8), static_cast<uint8_t>(lowerBits >> 16) };
+        uint8_t max[3] = { static_cast<uint8_t>(upperBits), static_cast<uint8_t>(upperBits >> 8), static_cast<uint8_t>(upperBits >> 16) };
+
+        uint16_t colour0, colour1;
+        int palette[4][3];
+        getColourPalette(min, max, colour0, colour1, palette);
+
+        __m128i entries[4];
+
+        for (int e = 0; e < 4; ++e)
+        {
+            entries[e] = _mm_set1_epi32(palette[e][0] | (palette[e][1] << 8) | (palette[e][2] << 16));
+        }
+
+        uint32_t indices = 0;
+
+        for (int y = 0; y < 4; ++y)
+        {
+            __m128i d0 = getColourDistancesSSE2(rows[y], entries[0]);
+            __m128i d1 = getColourDistancesSSE2(rows[y], entries[1]);
+            __m128i d2 = getColourDistancesSSE2(rows[y], entries[2]);
+            __m128i d3 = getColourDistancesSSE2(rows[y], entries[3]);
+
+            // Same as getColourIndex, the comparisons yield all bits set for true
+            __m128i b0 = _mm_cmpgt_epi32(d0, d3), b1 = _mm_cmpgt_epi32(d1, d2), b2 = _mm_cmpgt_epi32(d0, d2);
+            __m128i b3 = _mm_cmpgt_epi32(d1, d3), b4 = _mm_cmpgt_epi32(d2, d3);
+
+            const __m128i one = _mm_set1_epi32(1);
+
+            __m128i index = _mm_or_si128(_mm_and_si128(_mm_and_si128(b0, b4), one),
+                _mm_slli_epi32(_mm_and_si128(_mm_or_si128(_mm_and_si128(b1, b2), _mm_and_si128(b0, b3)), one), 1));
+
+            // Gather the 4 indices of the row into the lowest 8 bits
+            index = _mm_or_si128(index, _mm_slli_epi32(_mm_srli_si128(index, 4), 2));
+            index = _mm_or_si128(index, _mm_slli_epi32(_mm_srli_si128(index, 8), 4));
+
+            indices |= (static_cast<uint32_t>(_mm_cvtsi128_si32(index)) & 0xFF) << (y * 8);
+        }
+
+        writeColourBlock(colour0, colour1, indices, dest);
+    }
+
+    SIMD_TARGET("sse2")
+    void compressAlphaBlockSSE2(const unsigned char* block, std::size_t pitch, unsigned char* dest)
+    {
+        __m128i rows[4];
+
+        for (int y = 0; y < 4; ++y)
+        {
+            rows[y] = _mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + y * pitch)), 24);
+        }
+
+        // The 16 alpha values in pixel order
+        __m128i alphas = _mm_packus_epi16(_mm_packs_epi32(rows[0], rows[1]), _mm_packs_epi32(rows[2], rows[3]));
+
+        __m128i lower = _mm_min_epu8(alphas, _mm_srli_si128(alphas, 8));
+        __m128i upper = _mm_max_epu8(alphas, _mm_srli_si128(alphas, 8));
+
+        lower = _mm_min_epu8(lower, _mm_srli_si128(lower, 4));
+        upper = _mm_max_epu8(upper, _mm_srli_si128(upper, 4));
+        lower = _mm_min_epu8(lower, _mm_srli_si128(lower, 2));
+        upper = _mm_max_epu8(upper, _mm_srli_si128(upper, 2));
+        lower = _mm_min_epu8(lower, _mm_srli_si128(lower, 1));
+        upper = _mm_max_epu8(upper, _mm_srli_si128(upper, 1));
+
+        uint8_t alpha0, alpha1;
+        int palette[8];
+        getAlphaPalette(static_cast<uint8_t>(_mm_cvtsi128_si32(lower)), static_cast<uint8_t>(_mm_cvtsi128_si32(upper)),
+            alpha0, alpha1, palette);
+
+        __m128i best = _mm_set1_epi8(-1);
+        __m128i index = _mm_setzero_si128();
+
+        for (int e = 0; e < 8; ++e)
+        {
+            __m128i entry = _mm_set1_epi8(static_cast<char>(palette[e]));
+            __m128i distance = _mm_or_si128(_mm_subs_epu8(alphas, entry), _mm_subs_epu8(entry, alphas));
+
+            // Unsigned distance < best, so the first of several equally close entries wins
+            __m128i closer = _mm_andnot_si128(_mm_cmpeq_epi8(distance, best), _mm_cmpeq_epi8(_mm_min_epu8(distance, best), distance));
+
+            best = _mm_min_epu8(best, distance);
+            index = _mm_or_si128(_mm_andnot_si128(closer, index), _mm_and_si128(closer, _mm_set1_epi8(static_cast<char>(e))));
+        }
+
+        alignas(16) uint8_t indices[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(indices), index);
+
+        writeAlphaBlock(alpha0, alpha1, indices, dest);
+    }
+
+    SIMD_TARGET("sse2")
+    void compressBC1SSE2(const unsigned char* rgba, std::size_t pitch, std::size_t numBlocks, unsigned char* dest)
+    {
+        for (std::size_t i = 0; i < numBlocks; ++i)
+        {
+            compressColourBlockSSE2(rgba + i * 16, pitch, dest + i * 8);
+        }
+    }
+
+    SIMD_TARGET("sse2")
+    void compressBC3SSE2(const unsigned char* rgba, std::size_t pitch, std::size_t numBlocks, unsigned char* dest)
+    {
+        for (std::size_t i = 0; i < numBlocks; ++i)
+        {
+            compressAlphaBlockSSE2(rgba + i * 16, pitch, dest + i * 16);
+            compressColourBlockSSE2(rgba + i * 16, pitch, dest + i * 16 + 8);
+        }
+    }
+
+    const Kernels SSE2Kernels = { storeBigEndianSSE2, transformPointsSSE2, getBoundsSSE2, skinVerticesSSE2, compressBC1SSE2, compressBC3SSE2 };
+
+    // --- AVX2 ---
+
+    SIMD_TARGET("avx2")
+    void storeBigEndianAVX2(const float* values, std::size_t count, char* dest)
+    {
+        const __m256i byteSwap = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+        std::size_t i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i * 4), _mm256_shuffle_epi8(v, byteSwap));
+        }
+
+        storeBigEndianSSE2(values + i, count - i, dest + i * 4);
+    }
+
+    SIMD_TARGET("avx2")
+    void transformPointsAVX2(const double* m, double* points, std::size_t stride, std::size_t count)
+    {
+        __m256d c0 = _mm256_loadu_pd(m + 0);
+        __m256d c1 = _mm256_loadu_pd(m + 4);
+        __m256d c2 = _mm256_loadu_pd(m + 8);
+        __m256d c3 = _mm256_loadu_pd(m + 12);
+
+        for (std::size_t i = 0; i < count; ++i, points += stride)
+        {
+            __m256d x = _mm256_broadcast_sd(points + 0);
+            __m256d y = _mm256_broadcast_sd(points + 1);
+            __m256d z = _mm256_broadcast_sd(points + 2);
+
+            // Separate multiplies and adds, fused ones would round differently
+            __m256d result = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+                _mm256_mul_pd(c0, x), _mm256_mul_pd(c1, y)), _mm256_mul_pd(c2, z)), c3);
+
+            _mm_storeu_pd(points, _mm256_castpd256_pd128(result));
+            _mm_store_sd(points + 2, _mm256_extractf128_pd(result, 1));
+        }
+    }
+
+    SIMD_TARGET("avx2")
+    void skinVerticesAVX2(const double* matrices, const SkinInfluences* influences, double* positions, double* normals,
+        std::size_t stride, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i, positions += stride, normals += stride)
+        {
+            const double* bone = matrices + influences[i].bones[0] * 16;
+            __m256d weight = _mm256_set1_pd(influences[i].weights[0]);
+
+            __m256d c0 = _mm256_mul_pd(weight, _mm256_loadu_pd(bone + 0));
+            __m256d c1 = _mm256_mul_pd(weight, _mm256_loadu_pd(bone + 4));
+            __m256d c2 = _mm256_mul_pd(weight, _mm256_loadu_pd(bone + 8));
+            __m256d c3 = _mm256_mul_pd(weight, _mm256_loadu_pd(bone + 12));
+
+            for (int b = 1; b < 4; ++b)
+            {
+                bone = matrices + influences[i].bones[b] * 16;
+                weight = _mm256_set1_pd(influences[i].weights[b]);
+
+                c0 = _mm256_add_pd(c0, _mm256_mul_pd(weight, _mm256_loadu_pd(bone + 0)));
+                c1 = _mm256_add_pd(c1, _mm256_mul_pd(weight, _mm256_loadu_pd(bone + 4)));
+                c2 = _mm256_add_pd(c2, _mm256_mul_pd(weight, _mm256_loadu_pd(bone + 8)));
+                c3 = _mm256_add_pd(c3, _mm256_mul_pd(weight, _mm256_loadu_pd(bone + 12)));
+            }
+
+            __m256d x = _mm256_broadcast_sd(positions + 0);
+            __m256d y = _mm256_broadcast_sd(positions + 1);
+            __m256d z = _mm256_broadcast_sd(positions + 2);
+
+            __m256d result = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+                _mm256_mul_pd(c0, x), _mm256_mul_pd(c1, y)), _mm256_mul_pd(c2, z)), c3);
+
+            _mm_storeu_pd(positions, _mm256_castpd256_pd128(result));
+            _mm_store_sd(positions + 2, _mm256_extractf128_pd(result, 1));
+
+            x = _mm256_broadcast_sd(normals + 0);
+            y = _mm256_broadcast_sd(normals + 1);
+            z = _mm256_broadcast_sd(normals + 2);
+
+            result = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(c0, x), _mm256_mul_pd(c1, y)), _mm256_mul_pd(c2, z));
+
+            _mm_storeu_pd(normals, _mm256_castpd256_pd128(result));
+            _mm_store_sd(normals + 2, _mm256_extractf128_pd(result, 1));
+        }
+    }
+
+    const Kernels AVX2Kernels = { storeBigEndianAVX2, transformPointsAVX2, getBoundsSSE2, skinVerticesAVX2, compressBC1SSE2, compressBC3SSE2 };
+
+    // --- AVX-512 ---
+
+    SIMD_TARGET("avx512f,avx512bw")
+    void storeBigEndianAVX512(const float* values, std::size_t count, char* dest)
+    {
+        // Loaded from memory, GCC's broadcast intrinsics warn about their uninitialised temporaries
+        alignas(64) static const uint8_t ByteSwap[64] =
+        {
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        };
+
+        const __m512i byteSwap = _mm512_load_si512(ByteSwap);
+
+        std::size_t i = 0;
+
+        for (; i + 16 <= count; i += 16)
+        {
+            __m512i v = _mm512_loadu_si512(values + i);
+            _mm512_storeu_si512(dest + i * 4, _mm512_shuffle_epi8(v, byteSwap));
+        }
+
+        // The remainder is written with a masked store
+        if (i < count)
+        {
+            __mmask16 mask = static_cast<__mmask16>((1u << (count - i)) - 1);
+            __m512i v = _mm512_maskz_loadu_epi32(mask, values + i);
+            _mm512_mask_storeu_epi32(dest + i * 4, mask, _mm512_shuffle_epi8(v, byteSwap));
+        }
+    }
+
+    // The transformation and the skinning use the AVX2 variants, compiled for AVX-512 the
+    // multiplies and adds may be fused, which would change the results
+    const Kernels AVX512Kernels = { storeBigEndianAVX512, transformPointsAVX2, getBoundsSSE2, skinVerticesAVX2, compressBC1SSE2, compressBC3SSE2 };
+
+    void cpuid(unsigned int leaf, unsigned int regs[4])
+    {
+#ifdef _MSC_VER
+        __cpuidex(reinterpret_cast<int*>(regs), leaf, 0);
+#else
+        __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    // The register state the OS saves on context switches
+    uint64_t getEnabledXState()
+    {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        unsigned int low, high;
+        __asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+        return (static_cast<uint64_t>(high) << 32) | low;
+#endif
+    }
+
+    Isa detectIsa()
+    {
+        unsigned int regs[4] = { 0 };
+
+        cpuid(0, regs);
+        auto maxLeaf = regs[0];
+
+        cpuid(1, regs);
+
+        if (!(regs[3] & (1u << 26))) return Isa::Scalar; // SSE2
+
+        // OSXSAVE and AVX, and the OS saving the XMM and YMM registers
+        if (!(regs[2] & (1u << 27)) || !(regs[2] & (1u << 28)) || maxLeaf < 7) return Isa::SSE2;
+
+        auto xstate = getEnabledXState();
+
+        if ((xstate & 0x06) != 0x06) return Isa::SSE2;
+
+        cpuid(7, regs);
+
+        if (!(regs[1] & (1u << 5))) return Isa::SSE2; // AVX2
+
+        // AVX512F and AVX512BW, with the OS saving the opmask and ZMM registers
+        if ((regs[1] & (1u << 16)) && (regs[1] & (1u << 30)) && (xstate & 0xE0) == 0xE0) return Isa::AVX512;
+
+        return Isa::AVX2;
+    }
+
+#endif
+
+    const Kernels& getKernels(Isa isa)
+    {
+        switch (isa)
+        {
+#ifdef SIMD_X86
+        case Isa::SSE2: return SSE2Kernels;
+        case Isa::AVX2: return AVX2Kernels;
+        case Isa::AVX512: return AVX512Kernels;
+#endif
+        default: return ScalarKernels;
+        }
+    }
+
+    struct Dispatch
+    {
+        Isa supported;
+        std::atomic<const Kernels*> kernels;
+        std::atomic<Isa> active;
+
+        Dispatch()
+        {
+#ifdef SIMD_X86
+            supported = detectIsa();
+#else
+            supported = Isa::Scalar;
+#endif
+            active = supported;
+            kernels = &getKernels(supported);
+        }
+    };
+
+    Dispatch& getDispatch()
+    {
+        static Dispatch dispatch;
+        return dispatch;
+    }
+}
+
+const char* getIsaName(Isa isa)
+{
+    switch (isa)
+    {
+    case Isa::SSE2: return "sse2";
+    case Isa::AVX2: return "avx2";
+    case Isa::AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+bool parseIsa(const std::string& name, Isa& isa)
+{
+    std::string lower(name);
+
+    for (auto& c : lower)
+    {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+
+    for (auto candidate : { Isa::Scalar, Isa::SSE2, Isa::AVX2, Isa::AVX512 })
+    {
+        if (lower == getIsaName(candidate))
+        {
+            isa = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+Isa getSupportedIsa()
+{
+    return getDispatch().supported;
+}
+
+Isa getActiveIsa()
+{
+    return getDispatch().active;
+}
+
+bool setActiveIsa(Isa isa)
+{
+    auto& dispatch = getDispatch();
+
+    if (isa > dispatch.supported) return false;
+
+    dispatch.kernels = &getKernels(isa);
+    dispatch.active = isa;
+
+    return true;
+}
+
+void storeBigEndian(const float* values, std::size_t count, char* dest)
+{
+    getDispatch().kernels.load(std::memory_order_relaxed)->storeBigEndian(values, count, dest);
+}
+
+void loadBigEndian(const char* src, std::size_t count, float* values)
+{
+    // Swapping the byte order is its own inverse, the store kernels only use unaligned loads
+    getDispatch().kernels.load(std::memory_order_relaxed)->storeBigEndian(reinterpret_cast<const float*>(src), count,
+        reinterpret_cast<char*>(values));
+}
+
+void transformPoints(const double* matrix, double* points, std::size_t stride, std::size_t count)
+{
+    getDispatch().kernels.load(std::memory_order_relaxed)->transformPoints(matrix, points, stride, count);
+}
+
+void skinVertices(const double* matrices, const SkinInfluences* influences, double* positions, double* normals,
+    std::size_t stride, std::size_t count)
+{
+    getDispatch().kernels.load(std::memory_order_relaxed)->skinVertices(matrices, influences, positions, normals, stride, count);
+}
+
+void getBounds(const double* points, std::size_t stride, std::size_t count, double* min, double* max)
+{
+    getDispatch().kernels.load(std::memory_order_relaxed)->getBounds(points, stride, count, min, max);
+}
+
+void compressBC1(const unsigned char* rgba, std::size_t pitch, std::size_t numBlocks, unsigned char* dest)
+{
+    getDispatch().kernels.load(std::memory_order_relaxed)->compressBC1(rgba, pitch, numBlocks, dest);
+}
+
+void compressBC3(const unsigned char* rgba, std::size_t pitch, std::size_t numBlocks, unsigned char* dest)
+{
+    getDispatch().kernels.load(std::memory_order_relaxed)->compressBC3(rgba, pitch, numBlocks, dest);
+}
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Vectorised kernels for the hot loops of the converter, dispatched at runtime to the
+ * best instruction set the CPU supports. All variants perform the same floating point
+ * operations in the same order (no fused multiply-add), so their results are
+ * bit-identical to the scalar code and to each other.
+ */
+namespace simd
+{
+
+enum class Isa
+{
+    Scalar,
+    SSE2,
+    AVX2,
+    AVX512,     // AVX-512 F and BW
+};
+
+const char* getIsaName(Isa isa);
+
+// Parses the (case-insensitive) name as returned by getIsaName, returns false for unknown names
+bool parseIsa(const std::string& name, Isa& isa);
+
+// The best instruction set supported by both the CPU and the operating system
+Isa getSupportedIsa();
+
+// The instruction set the kernels are currently using
+Isa getActiveIsa();
+
+// Makes the kernels use the given instruction set, e.g. for benchmarking.
+// Returns false and leaves the active set unchanged if the CPU doesn't support it.
+bool setActiveIsa(Isa isa);
+
+// Stores the given floats in big endian byte order, dest needs room for count * 4 bytes
+void storeBigEndian(const float* values, std::size_t count, char* dest);
+
+// Loads count big endian floats from src, which doesn't need to be aligned
+void loadBigEndian(const char* src, std::size_t count, float* values);
+
+// Transforms the points in place like Matrix4::transformPoint does. The matrix is given
+// in Matrix4's memory layout, the points are 3 consecutive doubles, each point starting
+// stride doubles after the previous one.
+void transformPoints(const double* matrix, double* points, std::size_t stride, std::size_t count);
+
+// The (up to) 4 bones moving a skinned vertex, the weights should add up to 1.
+// Unused slots have a weight of 0, their bone index still needs to be valid.
+struct SkinInfluences
+{
+    uint16_t bones[4];
+    float weights[4];
+};
+
+// Linear blend skinning: moves the positions by the weighted sum of their bone matrices, and the
+// normals by the sum's linear part without normalising them. The matrices are given in Matrix4's
+// memory layout, 16 doubles each. Positions and normals are laid out like for transformPoints.
+void skinVertices(const double* matrices, const SkinInfluences* influences, double* positions, double* normals,
+    std::size_t stride, std::size_t count);
+
+// Calculates the component-wise minimum and maximum of the points (laid out like for
+// transformPoints). The results are only written if count is greater than 0.
+void getBounds(const double* points, std::size_t stride, std::size_t count, double* min, double* max);
+
+// Compresses a row of numBlocks 4x4 pixel blocks to BC1 (DXT1), 8 bytes per block. The RGBA
+// pixels of the 4 rows start pitch bytes apart, the alpha channel is ignored.
+void compressBC1(const unsigned char* rgba, std::size_t pitch, std::size_t numBlocks, unsigned char* dest);
+
+// Like compressBC1, but to BC3 (DXT5) with 16 bytes per block: the interpolated alpha block
+// followed by the colour block
+void compressBC3(const unsigned char* rgba, std::size_t pitch, std::size_t numBlocks, unsigned char* dest);
+
+}
@@ -15,6 +15,7 @@
  */
 #include "ofbx.h"
 #include "miniz.h"
+#include <algorithm>
 #include <cassert>
 #include <math.h>
 #include <ctype.h>
@@ -23,6 +24,13 @@
 #include <string>
 #include <unordered_map>
 #include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define OFBX_SSE2
+#endif
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
 
 
 namespace ofbx
@@ -72,9 +80,7 @@ struct Allocator {
 	// store temporary data, can be reused
 	std::vector<float> tmp;
 	std::vector<int> int_tmp;
-	std::vector<Vec3> vec3_tmp;
 	std::vector<double> double_tmp;
-	std::vector<Vec3> vec3_tmp2;
 };
 
 
@@ -95,16 +101,18 @@ struct Video
 };
 
 
+// The message is kept per thread, so concurrent loads don't report each other's errors.
+// Jobs running on other threads hand their message back to the loading thread.
 struct Error
 {
 	Error() {}
 	Error(const char* msg) { s_message = msg; }
 
-	static const char* s_message;
+	static thread_local const char* s_message;
 };
 
 
-const char* Error::s_message = "";
+thread_local const char* Error::s_message = "";
 
 
 template <typename T> struct OptionalError
@@ -159,11 +167,53 @@ struct Header
 #pragma pack()
 
 
+struct TextIndex;
+
+
+// The cancel callback given to load(), checked at the start of each record and object
+struct CancelCheck
+{
+	CancelCallback callback = nullptr;
+	void* user_ptr = nullptr;
+
+	bool isCancelled() const
+	{
+		if (!callback || !callback(user_ptr)) return false;
+		Error::s_message = "Cancelled";
+		return true;
+	}
+};
+
+
+// Reports the begin and end of a stage to the stage callback given to load()
+struct StageScope
+{
+	StageCallback callback;
+	void* user_ptr;
+	LoadStage stage;
+
+	StageScope(StageCallback _callback, void* _user_ptr, LoadStage _stage)
+		: callback(_callback)
+		, user_ptr(_user_ptr)
+		, stage(_stage)
+	{
+		if (callback) callback(user_ptr, stage, true);
+	}
+
+	~StageScope()
+	{
+		if (callback) callback(user_ptr, stage, false);
+	}
+};
+
+
 struct Cursor
 {
 	const u8* current;
 	const u8* begin;
 	const u8* end;
+	const TextIndex* index = nullptr; // only used when tokenizing text files
+	const CancelCheck* cancel = nullptr;
 };
 
 
@@ -667,11 +717,13 @@ static OptionalError<u64> readElementOffset(Cursor* cursor, u16 version)
 }
 
 
-static OptionalError<Element*> readElement(Cursor* cursor, u32 version, Allocator& allocator)
+// Reads the record header and the properties of an element, leaving the cursor at its first child
+static OptionalError<Element*> readElementHeader(Cursor* cursor, u32 version, Allocator& allocator, u64* end_offset)
 {
-	OptionalError<u64> end_offset = readElementOffset(cursor, version);
-	if (end_offset.isError()) return Error();
-	if (end_offset.getValue() == 0) return nullptr;
+	OptionalError<u64> offset = readElementOffset(cursor, version);
+	if (offset.isError()) return Error();
+	*end_offset = offset.getValue();
+	if (*end_offset == 0) return nullptr;
 
 	OptionalError<u64> prop_count = readElementOffset(cursor, version);
 	OptionalError<u64> prop_length = readElementOffset(cursor, version);
@@ -700,17 +752,35 @@ static OptionalError<Element*> readElement(Cursor* cursor, u32 version, Allocato
 		prop_link = &(*prop_link)->next;
 	}
 
-	if (cursor->current - cursor->begin >= (ptrdiff_t)end_offset.getValue()) return element;
+	return element;
+}
+
+
+static int getBlockSentinelLength(u32 version)
+{
+	return version >= 7500 ? 25 : 13;
+}
+
+
+static OptionalError<Element*> readElement(Cursor* cursor, u32 version, Allocator& allocator);
+
 
-	int BLOCK_SENTINEL_LENGTH = version >= 7500 ? 25 : 13;
+// Reads the children of the element and the block sentinel terminating them
+static bool readElementChildren(Cursor* cursor, u32 version, Allocator& allocator, Element* element, u64 end_offset)
+{
+	if (cursor->current - cursor->begin >= (ptrdiff_t)end_offset) return true;
+
+	int BLOCK_SENTINEL_LENGTH = getBlockSentinelLength(version);
 
 	Element** link = &element->child;
-	while (cursor->current - cursor->begin < ((ptrdiff_t)end_offset.getValue() - BLOCK_SENTINEL_LENGTH))
+	while (cursor->current - cursor->begin < ((ptrdiff_t)end_offset - BLOCK_SENTINEL_LENGTH))
 	{
+		if (cursor->cancel && cursor->cancel->isCancelled()) return false;
+
 		OptionalError<Element*> child = readElement(cursor, version, allocator);
 		if (child.isError())
 		{
-			return Error();
+			return false;
 		}
 
 		*link = child.getValue();
@@ -720,14 +790,332 @@ static OptionalError<Element*> readElement(Cursor* cursor, u32 version, Allocato
 
 	if (cursor->current + BLOCK_SENTINEL_LENGTH > cursor->end)
 	{
-		return Error("Reading past the end");
+		Error::s_message = "Reading past the end";
+		return false;
 	}
 
 	cursor->current += BLOCK_SENTINEL_LENGTH;
-	return element;
+	return true;
+}
+
+
+static OptionalError<Element*> readElement(Cursor* cursor, u32 version, Allocator& allocator)
+{
+	u64 end_offset;
+	OptionalError<Element*> element = readElementHeader(cursor, version, allocator, &end_offset);
+	if (element.isError()) return Error();
+	if (!element.getValue()) return nullptr;
+
+	if (!readElementChildren(cursor, version, allocator, element.getValue(), end_offset)) return Error();
+	return element.getValue();
+}
+
+
+// A contiguous range of sibling records, tokenized into an allocator of its own
+struct TokenizeRecordsJob {
+	const u8* data;
+	const u8* data_end;
+	const u8* begin;
+	const u8* end;
+	u32 version;
+	Allocator* allocator;
+	const CancelCheck* cancel;
+	Element* first;
+	Element* last;
+	bool is_error;
+	const char* error;
+};
+
+
+static void tokenizeRecords(TokenizeRecordsJob* job)
+{
+	Cursor cursor;
+	cursor.begin = job->data;
+	cursor.current = job->begin;
+	cursor.end = job->data_end;
+	cursor.cancel = job->cancel;
+
+	// the thread may still hold the message of an earlier load
+	Error::s_message = "";
+
+	Element** link = &job->first;
+	while (cursor.current < job->end)
+	{
+		if (cursor.cancel && cursor.cancel->isCancelled())
+		{
+			job->is_error = true;
+			job->error = Error::s_message;
+			return;
+		}
+
+		OptionalError<Element*> child = readElement(&cursor, job->version, *job->allocator);
+		if (child.isError() || !child.getValue() || cursor.current > job->end)
+		{
+			job->is_error = true;
+			job->error = Error::s_message;
+			return;
+		}
+
+		*link = child.getValue();
+		job->last = child.getValue();
+		link = &(*link)->sibling;
+	}
+}
+
+
+// Reads the children of the element like readElementChildren, but tokenizes them in parallel.
+// The boundaries of the child records are known from their end offsets, so the records are
+// split into ranges of similar size, each tokenized into its own allocator. The sibling lists
+// of the ranges are stitched together in file order afterwards.
+static bool readElementChildrenParallel(Cursor* cursor,
+	u32 version,
+	Allocator& allocator,
+	Element* element,
+	u64 end_offset,
+	std::vector<std::unique_ptr<Allocator>>* job_allocators,
+	JobProcessor job_processor,
+	void* job_user_ptr)
+{
+	// ranges smaller than this aren't worth an allocator of their own
+	const size_t MIN_JOB_SIZE = 256 * 1024;
+	const size_t MAX_JOB_COUNT = 32;
+
+	if (cursor->current - cursor->begin >= (ptrdiff_t)end_offset) return true;
+
+	int BLOCK_SENTINEL_LENGTH = getBlockSentinelLength(version);
+	const u8* children_end = cursor->begin + end_offset - BLOCK_SENTINEL_LENGTH;
+	if (end_offset > (u64)(cursor->end - cursor->begin)) return false;
+
+	// hop over the child records without looking into them
+	std::vector<const u8*> boundaries;
+	boundaries.push_back(cursor->current);
+	Cursor hop = *cursor;
+	while (hop.current < children_end)
+	{
+		OptionalError<u64> child_end_offset = readElementOffset(&hop, version);
+		if (child_end_offset.isError()) return false;
+		if (child_end_offset.getValue() == 0) break;
+
+		const u8* child_end = hop.begin + child_end_offset.getValue();
+		if (child_end <= hop.current || child_end > children_end)
+		{
+			Error::s_message = "Invalid record end offset";
+			return false;
+		}
+
+		hop.current = child_end;
+		boundaries.push_back(child_end);
+	}
+
+	const size_t record_count = boundaries.size() - 1;
+	const size_t total_size = boundaries.back() - boundaries.front();
+	size_t job_count = total_size / MIN_JOB_SIZE;
+	if (job_count > MAX_JOB_COUNT) job_count = MAX_JOB_COUNT;
+	if (job_count > record_count) job_count = record_count;
+
+	if (job_count <= 1)
+	{
+		return readElementChildren(cursor, version, allocator, element, end_offset);
+	}
+
+	// split the records into ranges of about the same byte size
+	std::vector<TokenizeRecordsJob> jobs;
+	size_t record = 0;
+	for (size_t i = 0; i < job_count && record < record_count; ++i)
+	{
+		const u8* target_end = boundaries.front() + total_size * (i + 1) / job_count;
+		size_t first_record = record;
+		while (record < record_count && (record == first_record || boundaries[record] < target_end)) ++record;
+
+		job_allocators->emplace_back(new Allocator());
+
+		TokenizeRecordsJob& job = jobs.emplace_back();
+		job.data = cursor->begin;
+		job.data_end = cursor->end;
+		job.begin = boundaries[first_record];
+		job.end = boundaries[record];
+		job.version = version;
+		job.allocator = job_allocators->back().get();
+		job.cancel = cursor->cancel;
+		job.first = nullptr;
+		job.last = nullptr;
+		job.is_error = false;
+		job.error = "";
+	}
+
+	(*job_processor)([](void* ptr){
+		tokenizeRecords((TokenizeRecordsJob*)ptr);
+	}, job_user_ptr, &jobs[0], (u32)sizeof(jobs[0]), (u32)jobs.size());
+
+	Element** link = &element->child;
+	for (const TokenizeRecordsJob& job : jobs)
+	{
+		if (job.is_error)
+		{
+			Error::s_message = job.error;
+			return false;
+		}
+		*link = job.first;
+		link = &job.last->sibling;
+	}
+
+	// continue after the last record, like the sequential version does
+	cursor->current = hop.current;
+
+	if (cursor->current + BLOCK_SENTINEL_LENGTH > cursor->end)
+	{
+		Error::s_message = "Reading past the end";
+		return false;
+	}
+
+	cursor->current += BLOCK_SENTINEL_LENGTH;
+	return true;
+}
+
+
+// character classes of the text tokenizer, replacing the locale-dependent ctype functions
+enum CharClass : u8
+{
+	CHAR_SPACE = 1 << 0,
+	CHAR_DIGIT = 1 << 1,
+	CHAR_TOKEN = 1 << 2, // alphanumeric, '_' or '-'
+	CHAR_STRUCTURAL = 1 << 3, // '"', '{', '}', ':', ',', ';' and line breaks
+};
+
+
+struct CharClassTable
+{
+	u8 classes[256];
+
+	CharClassTable()
+	{
+		for (int c = 0; c < 256; ++c)
+		{
+			u8 cls = 0;
+			if (c == ' ' || (c >= '\t' && c <= '\r')) cls |= CHAR_SPACE;
+			if (c >= '0' && c <= '9') cls |= CHAR_DIGIT | CHAR_TOKEN;
+			if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '-') cls |= CHAR_TOKEN;
+			if (c == '"' || c == '{' || c == '}' || c == ':' || c == ',' || c == ';' || c == '\n' || c == '\r')
+			{
+				cls |= CHAR_STRUCTURAL;
+			}
+			classes[c] = cls;
+		}
+	}
+};
+
+
+static const CharClassTable s_char_classes;
+
+
+static bool isCharClass(u8 c, u8 cls)
+{
+	return (s_char_classes.classes[c] & cls) != 0;
 }
 
 
+static int countTrailingZeros(u64 value)
+{
+	assert(value != 0);
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return (int)index;
+#else
+	return __builtin_ctzll(value);
+#endif
+}
+
+
+// One bit per input byte marking the structural characters of a text file, and another
+// set of bits marking the '.' characters. The bitmaps are built in a single (vectorized)
+// pass, the tokenizer then jumps from one structural character to the next instead of
+// inspecting every byte. The '.' bits tell floating point arrays from integer ones.
+struct TextIndex
+{
+	const u8* begin = nullptr;
+	const u8* end = nullptr;
+	std::vector<u64> structurals;
+	std::vector<u64> dots;
+
+	void build(const u8* data, size_t size)
+	{
+		begin = data;
+		end = data + size;
+		structurals.assign((size + 63) / 64, 0);
+		dots.assign((size + 63) / 64, 0);
+
+		size_t i = 0;
+#ifdef OFBX_SSE2
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i open = _mm_set1_epi8('{');
+		const __m128i close = _mm_set1_epi8('}');
+		const __m128i colon = _mm_set1_epi8(':');
+		const __m128i comma = _mm_set1_epi8(',');
+		const __m128i semicolon = _mm_set1_epi8(';');
+		const __m128i line_feed = _mm_set1_epi8('\n');
+		const __m128i carriage_return = _mm_set1_epi8('\r');
+		const __m128i period = _mm_set1_epi8('.');
+
+		for (; i + 64 <= size; i += 64)
+		{
+			u64 structural = 0;
+			u64 dot = 0;
+			for (int k = 0; k < 4; ++k)
+			{
+				__m128i v = _mm_loadu_si128((const __m128i*)(data + i + k * 16));
+				__m128i brackets = _mm_or_si128(_mm_cmpeq_epi8(v, open), _mm_cmpeq_epi8(v, close));
+				__m128i separators = _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma));
+				__m128i lines = _mm_or_si128(_mm_cmpeq_epi8(v, line_feed), _mm_cmpeq_epi8(v, carriage_return));
+				__m128i others = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, semicolon));
+				__m128i mask = _mm_or_si128(_mm_or_si128(brackets, separators), _mm_or_si128(lines, others));
+				structural |= (u64)(u32)_mm_movemask_epi8(mask) << (k * 16);
+				dot |= (u64)(u32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, period)) << (k * 16);
+			}
+			structurals[i / 64] = structural;
+			dots[i / 64] = dot;
+		}
+#endif
+		for (; i < size; ++i)
+		{
+			if (isCharClass(data[i], CHAR_STRUCTURAL)) structurals[i / 64] |= (u64)1 << (i % 64);
+			if (data[i] == '.') dots[i / 64] |= (u64)1 << (i % 64);
+		}
+	}
+
+	// position of the first structural character at or after from, end if there's none
+	const u8* nextStructural(const u8* from) const
+	{
+		if (from >= end) return end;
+		size_t pos = from - begin;
+		size_t word = pos / 64;
+		u64 bits = structurals[word] & (~(u64)0 << (pos % 64));
+		while (bits == 0)
+		{
+			if (++word == structurals.size()) return end;
+			bits = structurals[word];
+		}
+		return begin + word * 64 + countTrailingZeros(bits);
+	}
+
+	// whether there is a '.' in the range [from, to)
+	bool hasDot(const u8* from, const u8* to) const
+	{
+		if (from >= to) return false;
+		size_t first = from - begin;
+		size_t last = to - begin - 1;
+		for (size_t word = first / 64; word <= last / 64; ++word)
+		{
+			u64 bits = dots[word];
+			if (word == first / 64) bits &= ~(u64)0 << (first % 64);
+			if (word == last / 64 && last % 64 != 63) bits &= ((u64)1 << (last % 64 + 1)) - 1;
+			if (bits) return true;
+		}
+		return false;
+	}
+};
+
+
 static bool isEndLine(const Cursor& cursor)
 {
 	return *cursor.current == '\n' || *cursor.current == '\r' && cursor.current + 1 < cursor.end && *(cursor.current + 1) != '\n';
@@ -736,7 +1124,7 @@ static bool isEndLine(const Cursor& cursor)
 
 static void skipInsignificantWhitespaces(Cursor* cursor)
 {
-	while (cursor->current < cursor->end && isspace(*cursor->current) && !isEndLine(*cursor))
+	while (cursor->current < cursor->end && isCharClass(*cursor->current, CHAR_SPACE) && !isEndLine(*cursor))
 	{
 		++cursor->current;
 	}
@@ -745,9 +1133,11 @@ static void skipInsignificantWhitespaces(Cursor* cursor)
 
 static void skipLine(Cursor* cursor)
 {
+	// line breaks are structural, jump from one structural character to the next
+	cursor->current = cursor->index->nextStructural(cursor->current);
 	while (cursor->current < cursor->end && !isEndLine(*cursor))
 	{
-		++cursor->current;
+		cursor->current = cursor->index->nextStructural(cursor->current + 1);
 	}
 	if (cursor->current < cursor->end) ++cursor->current;
 	skipInsignificantWhitespaces(cursor);
@@ -756,7 +1146,7 @@ static void skipLine(Cursor* cursor)
 
 static void skipWhitespaces(Cursor* cursor)
 {
-	while (cursor->current < cursor->end && isspace(*cursor->current))
+	while (cursor->current < cursor->end && isCharClass(*cursor->current, CHAR_SPACE))
 	{
 		++cursor->current;
 	}
@@ -766,7 +1156,21 @@ static void skipWhitespaces(Cursor* cursor)
 
 static bool isTextTokenChar(char c)
 {
-	return isalnum(c) || c == '_' || c == '-';
+	return isCharClass((u8)c, CHAR_TOKEN);
+}
+
+
+static bool isTextDigit(u8 c)
+{
+	return isCharClass(c, CHAR_DIGIT);
+}
+
+
+// whether there's anything but whitespace in [from, to)
+static bool hasTextContent(const u8* from, const u8* to)
+{
+	while (from < to && isCharClass(*from, CHAR_SPACE)) ++from;
+	return from < to;
 }
 
 
@@ -785,6 +1189,7 @@ static DataView readTextToken(Cursor* cursor)
 
 static OptionalError<Property*> readTextProperty(Cursor* cursor, Allocator& allocator)
 {
+	const TextIndex& index = *cursor->index;
 	Property* prop = allocator.allocate<Property>();
 	prop->value.is_binary = false;
 	prop->next = nullptr;
@@ -793,21 +1198,22 @@ static OptionalError<Property*> readTextProperty(Cursor* cursor, Allocator& allo
 		prop->type = 'S';
 		++cursor->current;
 		prop->value.begin = cursor->current;
+		cursor->current = index.nextStructural(cursor->current);
 		while (cursor->current < cursor->end && *cursor->current != '"')
 		{
-			++cursor->current;
+			cursor->current = index.nextStructural(cursor->current + 1);
 		}
 		prop->value.end = cursor->current;
 		if (cursor->current < cursor->end) ++cursor->current; // skip '"'
 		return prop;
 	}
 
-	if (isdigit(*cursor->current) || *cursor->current == '-')
+	if (isTextDigit(*cursor->current) || *cursor->current == '-')
 	{
 		prop->type = 'L';
 		prop->value.begin = cursor->current;
 		if (*cursor->current == '-') ++cursor->current;
-		while (cursor->current < cursor->end && isdigit(*cursor->current))
+		while (cursor->current < cursor->end && isTextDigit(*cursor->current))
 		{
 			++cursor->current;
 		}
@@ -817,7 +1223,7 @@ static OptionalError<Property*> readTextProperty(Cursor* cursor, Allocator& allo
 		{
 			prop->type = 'D';
 			++cursor->current;
-			while (cursor->current < cursor->end && isdigit(*cursor->current))
+			while (cursor->current < cursor->end && isTextDigit(*cursor->current))
 			{
 				++cursor->current;
 			}
@@ -826,7 +1232,7 @@ static OptionalError<Property*> readTextProperty(Cursor* cursor, Allocator& allo
 				// 10.5e-013
 				++cursor->current;
 				if (cursor->current < cursor->end && *cursor->current == '-') ++cursor->current;
-				while (cursor->current < cursor->end && isdigit(*cursor->current)) ++cursor->current;
+				while (cursor->current < cursor->end && isTextDigit(*cursor->current)) ++cursor->current;
 			}
 
 
@@ -850,28 +1256,29 @@ static OptionalError<Property*> readTextProperty(Cursor* cursor, Allocator& allo
 		prop->type = 'l';
 		++cursor->current;
 		// Vertices: *10740 { a: 14.2760353088379,... }
+		cursor->current = index.nextStructural(cursor->current);
 		while (cursor->current < cursor->end && *cursor->current != ':')
 		{
-			++cursor->current;
+			cursor->current = index.nextStructural(cursor->current + 1);
 		}
 		if (cursor->current < cursor->end) ++cursor->current; // skip ':'
 		skipInsignificantWhitespaces(cursor);
 		prop->value.begin = cursor->current;
 		prop->count = 0;
-		bool is_any = false;
+		// jump from separator to separator, an element counts if it's not just whitespace
+		const u8* element_begin = cursor->current;
+		cursor->current = index.nextStructural(cursor->current);
 		while (cursor->current < cursor->end && *cursor->current != '}')
 		{
 			if (*cursor->current == ',')
 			{
-				if (is_any) ++prop->count;
-				is_any = false;
+				if (hasTextContent(element_begin, cursor->current)) ++prop->count;
+				element_begin = cursor->current + 1;
 			}
-			else if (!isspace(*cursor->current) && !isEndLine(*cursor))
-				is_any = true;
-			if (*cursor->current == '.') prop->type = 'd';
-			++cursor->current;
+			cursor->current = index.nextStructural(cursor->current + 1);
 		}
-		if (is_any) ++prop->count;
+		if (hasTextContent(element_begin, cursor->current)) ++prop->count;
+		if (index.hasDot(prop->value.begin, cursor->current)) prop->type = 'd';
 		prop->value.end = cursor->current;
 		if (cursor->current < cursor->end) ++cursor->current; // skip '}'
 		return prop;
@@ -921,6 +1328,8 @@ static OptionalError<Element*> readTextElement(Cursor* cursor, Allocator& alloca
 		skipWhitespaces(cursor);
 		while (cursor->current < cursor->end && *cursor->current != '}')
 		{
+			if (cursor->cancel && cursor->cancel->isCancelled()) return Error();
+
 			OptionalError<Element*> child = readTextElement(cursor, allocator);
 			if (child.isError())
 			{
@@ -937,12 +1346,17 @@ static OptionalError<Element*> readTextElement(Cursor* cursor, Allocator& alloca
 }
 
 
-static OptionalError<Element*> tokenizeText(const u8* data, size_t size, Allocator& allocator)
+static OptionalError<Element*> tokenizeText(const u8* data, size_t size, Allocator& allocator, const CancelCheck& cancel)
 {
+	TextIndex index;
+	index.build(data, size);
+
 	Cursor cursor;
 	cursor.begin = data;
 	cursor.current = data;
 	cursor.end = data + size;
+	cursor.index = &index;
+	cursor.cancel = &cancel;
 
 	Element* root = allocator.allocate<Element>();
 	root->first_property = nullptr;
@@ -960,6 +1374,8 @@ static OptionalError<Element*> tokenizeText(const u8* data, size_t size, Allocat
 		}
 		else
 		{
+			if (cancel.isCancelled()) return Error();
+
 			OptionalError<Element*> child = readTextElement(&cursor, allocator);
 			if (child.isError())
 			{
@@ -975,12 +1391,22 @@ static OptionalError<Element*> tokenizeText(const u8* data, size_t size, Allocat
 }
 
 
-static OptionalError<Element*> tokenize(const u8* data, size_t size, u32& version, Allocator& allocator)
+// The children of the Objects record are tokenized in parallel if a job processor is given,
+// the job_allocators receive the allocators used by the jobs
+static OptionalError<Element*> tokenize(const u8* data,
+	size_t size,
+	u32& version,
+	Allocator& allocator,
+	std::vector<std::unique_ptr<Allocator>>* job_allocators,
+	JobProcessor job_processor,
+	void* job_user_ptr,
+	const CancelCheck& cancel)
 {
 	Cursor cursor;
 	cursor.begin = data;
 	cursor.current = data;
 	cursor.end = data + size;
+	cursor.cancel = &cancel;
 
 	const Header* header = (const Header*)cursor.current;
 	cursor.current += sizeof(*header);
@@ -996,12 +1422,23 @@ static OptionalError<Element*> tokenize(const u8* data, size_t size, u32& versio
 	Element** element = &root->child;
 	for (;;)
 	{
-		OptionalError<Element*> child = readElement(&cursor, header->version, allocator);
+		if (cancel.isCancelled()) return Error();
+
+		u64 end_offset;
+		OptionalError<Element*> child = readElementHeader(&cursor, header->version, allocator, &end_offset);
 		if (child.isError()) {
 			return Error();
 		}
 		*element = child.getValue();
 		if (!*element) return root;
+
+		// most of the records of a file are children of Objects
+		bool children_read = job_processor && (*element)->id == "Objects"
+			? readElementChildrenParallel(&cursor, header->version, allocator, *element, end_offset, job_allocators, job_processor, job_user_ptr)
+			: readElementChildren(&cursor, header->version, allocator, *element, end_offset);
+		if (!children_read) {
+			return Error();
+		}
 		element = &(*element)->sibling;
 	}
 }
@@ -1246,8 +1683,9 @@ Shape::Shape(const Scene& _scene, const IElement& _element)
 
 struct ShapeImpl : Shape
 {
-	std::vector<Vec3> vertices;
-	std::vector<Vec3> normals;
+	std::vector<int> indices;
+	std::vector<Vec3> delta_vertices;
+	std::vector<Vec3> delta_normals;
 
 	ShapeImpl(const Scene& _scene, const IElement& _element)
 		: Shape(_scene, _element)
@@ -1255,13 +1693,21 @@ struct ShapeImpl : Shape
 	}
 
 
-	bool postprocess(GeometryImpl* geom, Allocator& allocator);
+	bool postprocess(GeometryImpl* geom);
 
 
 	Type getType() const override { return Type::SHAPE; }
-	int getVertexCount() const override { return (int)vertices.size(); }
-	const Vec3* getVertices() const override { return &vertices[0]; }
-	const Vec3* getNormals() const override { return normals.empty() ? nullptr : &normals[0]; }
+	int getIndexCount() const override { return (int)indices.size(); }
+	const int* getIndices() const override { return indices.empty() ? nullptr : &indices[0]; }
+	const Vec3* getDeltaVertices() const override { return delta_vertices.empty() ? nullptr : &delta_vertices[0]; }
+	const Vec3* getDeltaNormals() const override { return delta_normals.empty() ? nullptr : &delta_normals[0]; }
+};
+
+
+struct PostprocessShapeJob {
+	ShapeImpl* shape;
+	GeometryImpl* geom;
+	bool is_error;
 };
 
 
@@ -1442,7 +1888,8 @@ struct BlendShapeChannelImpl : BlendShapeChannel
 
 	Type getType() const override { return Type::BLEND_SHAPE_CHANNEL; }
 
-	bool postprocess(Allocator& allocator)
+	// The shapes are only queued, they are postprocessed in parallel afterwards
+	bool postprocess(Allocator& allocator, std::vector<PostprocessShapeJob>* shape_jobs)
 	{
 		assert(blendShape);
 
@@ -1463,8 +1910,7 @@ struct BlendShapeChannelImpl : BlendShapeChannel
 
 		for (int i = 0; i < (int)shapes.size(); i++)
 		{
-			auto shape = (ShapeImpl*)shapes[i];
-			if (!shape->postprocess(geom, allocator)) return false;
+			shape_jobs->push_back({(ShapeImpl*)shapes[i], geom, false});
 		}
 
 		return true;
@@ -1670,6 +2116,7 @@ struct Scene : IScene
 	std::vector<TakeInfo> m_take_infos;
 	std::vector<Video> m_videos;
 	Allocator m_allocator;
+	std::vector<std::unique_ptr<Allocator>> m_tokenizer_allocators;
 };
 
 
@@ -1736,28 +2183,54 @@ struct AnimationCurveNodeImpl : AnimationCurveNode
 	Vec3 getNodeLocalTransform(double time) const override
 	{
 		i64 fbx_time = secondsToFbxTime(time);
+		int cursors[3] = {0, 0, 0};
 
-		auto getCoord = [&](const Curve& curve, i64 fbx_time, int idx) {
-			if (!curve.curve) return default_values[idx];
+		return {getCoord(0, fbx_time, cursors[0]), getCoord(1, fbx_time, cursors[1]), getCoord(2, fbx_time, cursors[2])};
+	}
 
-			const i64* times = curve.curve->getKeyTime();
-			const float* values = curve.curve->getKeyValue();
-			int count = curve.curve->getKeyCount();
 
-			if (fbx_time < times[0]) fbx_time = times[0];
-			if (fbx_time > times[count - 1]) fbx_time = times[count - 1];
-			for (int i = 1; i < count; ++i)
-			{
-				if (times[i] >= fbx_time)
-				{
-					float t = float(double(fbx_time - times[i - 1]) / double(times[i] - times[i - 1]));
-					return values[i - 1] * (1 - t) + values[i] * t;
-				}
-			}
-			return values[0];
-		};
+	void getNodeLocalTransforms(const double* times, int count, Vec3* transforms) const override
+	{
+		// Each curve keeps its position, ascending times continue the key search where the last one ended
+		int cursors[3] = {0, 0, 0};
+
+		for (int i = 0; i < count; ++i)
+		{
+			i64 fbx_time = secondsToFbxTime(times[i]);
+			transforms[i] = {getCoord(0, fbx_time, cursors[0]), getCoord(1, fbx_time, cursors[1]), getCoord(2, fbx_time, cursors[2])};
+		}
+	}
+
+
+	// Value of the curve at the given time, interpolated between the keys and clamped to the first and
+	// last one. The cursor is the key index found by the previous call: the search walks forward from
+	// there if the time didn't go backwards, else (and for a cursor of 0) it is a binary search.
+	float getCoord(int idx, i64 fbx_time, int& cursor) const
+	{
+		const AnimationCurve* curve = curves[idx].curve;
+		if (!curve || curve->getKeyCount() == 0) return default_values[idx];
+
+		const i64* times = curve->getKeyTime();
+		const float* values = curve->getKeyValue();
+		int count = curve->getKeyCount();
+
+		if (count == 1) return values[0];
+
+		if (fbx_time < times[0]) fbx_time = times[0];
+		if (fbx_time > times[count - 1]) fbx_time = times[count - 1];
 
-		return {getCoord(curves[0], fbx_time, 0), getCoord(curves[1], fbx_time, 1), getCoord(curves[2], fbx_time, 2)};
+		if (cursor < 1 || cursor >= count || (cursor > 1 && times[cursor - 1] >= fbx_time))
+		{
+			cursor = std::min(int(std::lower_bound(times + 1, times + count, fbx_time) - times), count - 1);
+		}
+		else
+		{
+			// Stops at the last key at the latest, the time has been clamped to it
+			while (times[cursor] < fbx_time) ++cursor;
+		}
+
+		float t = float(double(fbx_time - times[cursor - 1]) / double(times[cursor] - times[cursor - 1]));
+		return values[cursor - 1] * (1 - t) + values[cursor] * t;
 	}
 
 
@@ -1802,15 +2275,38 @@ struct AnimationLayerImpl : AnimationLayer
 
 	const AnimationCurveNode* getCurveNode(const Object& bone, const char* prop) const override
 	{
-		for (const AnimationCurveNodeImpl* node : curve_nodes)
-		{
-			if (node->bone_link_property == prop && node->bone == &bone) return node;
-		}
-		return nullptr;
+		DataView key;
+		key.begin = (const u8*)prop;
+		key.end = key.begin + strlen(prop);
+
+		auto iter = std::lower_bound(curve_node_index.begin(), curve_node_index.end(), &bone,
+			[&](const AnimationCurveNodeImpl* node, const Object* key_bone) { return isLess(node->bone, node->bone_link_property, key_bone, key); });
+
+		if (iter == curve_node_index.end() || (*iter)->bone != &bone || (*iter)->bone_link_property != prop) return nullptr;
+		return *iter;
+	}
+
+
+	// Sorts the curve nodes by bone and property for getCurveNode, called once all connections are resolved.
+	// The sort is stable, the first node connected to a property is found if there are several.
+	void buildCurveNodeIndex()
+	{
+		curve_node_index = curve_nodes;
+		std::stable_sort(curve_node_index.begin(), curve_node_index.end(), [](const AnimationCurveNodeImpl* a, const AnimationCurveNodeImpl* b) {
+			return isLess(a->bone, a->bone_link_property, b->bone, b->bone_link_property);
+		});
+	}
+
+
+	static bool isLess(const Object* bone_a, const DataView& property_a, const Object* bone_b, const DataView& property_b)
+	{
+		if (bone_a != bone_b) return std::less<const Object*>()(bone_a, bone_b);
+		return std::lexicographical_compare(property_a.begin, property_a.end, property_b.begin, property_b.end);
 	}
 
 
 	std::vector<AnimationCurveNodeImpl*> curve_nodes;
+	std::vector<AnimationCurveNodeImpl*> curve_node_index;
 };
 
 void parseVideo(Scene& scene, const Element& element, Allocator& allocator)
@@ -2171,7 +2667,8 @@ template <> const char* fromString<Matrix>(const char* str, const char* end, Mat
 template <typename T> static void parseTextArray(const Property& property, std::vector<T>* out)
 {
 	const u8* iter = property.value.begin;
-	for (int i = 0; i < property.count; ++i)
+	// count is the number of scalars, stop at the end for vector types
+	for (int i = 0; i < property.count && iter < property.value.end; ++i)
 	{
 		T val;
 		iter = (const u8*)fromString<T>((const char*)iter, (const char*)property.value.end, &val);
@@ -2409,9 +2906,11 @@ template <typename T> static void remap(std::vector<T>* out, const std::vector<i
 	std::vector<T> old;
 	old.swap(*out);
 	int old_size = (int)old.size();
+	out->resize(map.size());
+	T* dest = out->data();
 	for (int i = 0, c = (int)map.size(); i < c; ++i)
 	{
-		out->push_back(map[i] < old_size ? old[map[i]] : T());
+		dest[i] = map[i] < old_size ? old[map[i]] : T();
 	}
 }
 
@@ -2716,7 +3215,7 @@ static OptionalError<Object*> parseGeometryNormals(
 }
 
 
-static OptionalError<Object*> parseGeometry(const Element& element, bool triangulate, GeometryImpl* geom)
+static OptionalError<Object*> parseGeometry(const Element& element, bool triangulate, GeometryImpl* geom, const CancelCheck& cancel)
 {
 	assert(element.first_property);
 
@@ -2736,7 +3235,10 @@ static OptionalError<Object*> parseGeometry(const Element& element, bool triangu
 	if (!parseDoubleVecData(*vertices_element->first_property, &vertices, &tmp.f)) return Error("Failed to parse vertices");
 	if (!parseBinaryArray(*polys_element->first_property, &original_indices)) return Error("Failed to parse indices");
 
+	// parsing the arrays and triangulating are the expensive steps of huge meshes
+	if (cancel.isCancelled()) return Error();
 	buildGeometryVertexData(geom, vertices, original_indices, to_old_indices, triangulate);
+	if (cancel.isCancelled()) return Error();
 
 	OptionalError<Object*> materialParsingError = parseGeometryMaterials(geom, element, original_indices);
 	if (materialParsingError.isError()) return materialParsingError;
@@ -2757,7 +3259,7 @@ static OptionalError<Object*> parseGeometry(const Element& element, bool triangu
 }
 
 
-bool ShapeImpl::postprocess(GeometryImpl* geom, Allocator& allocator)
+bool ShapeImpl::postprocess(GeometryImpl* geom)
 {
 	assert(geom);
 
@@ -2770,30 +3272,37 @@ bool ShapeImpl::postprocess(GeometryImpl* geom, Allocator& allocator)
 		return false;
 	}
 
-	allocator.vec3_tmp.clear(); // old vertices
-	allocator.vec3_tmp2.clear(); // old normals
-	allocator.int_tmp.clear(); // old indices
-	if (!parseDoubleVecData(*vertices_element->first_property, &allocator.vec3_tmp, &allocator.tmp)) return true;
-	if (!parseDoubleVecData(*normals_element->first_property, &allocator.vec3_tmp2, &allocator.tmp)) return true;
-	if (!parseBinaryArray(*indexes_element->first_property, &allocator.int_tmp)) return true;
+	// shapes are postprocessed in parallel, so the temporaries can't live in the allocator
+	std::vector<Vec3> old_vertices;
+	std::vector<Vec3> old_normals;
+	std::vector<int> old_indices;
+	std::vector<float> tmp;
+	if (!parseDoubleVecData(*vertices_element->first_property, &old_vertices, &tmp)) return true;
+	if (normals_element && normals_element->first_property)
+	{
+		if (!parseDoubleVecData(*normals_element->first_property, &old_normals, &tmp)) return true;
+	}
+	if (!parseBinaryArray(*indexes_element->first_property, &old_indices)) return true;
 
-	if (allocator.vec3_tmp.size() != allocator.int_tmp.size() || allocator.vec3_tmp2.size() != allocator.int_tmp.size()) return false;
+	if (old_vertices.size() != old_indices.size()) return false;
+	if (!old_normals.empty() && old_normals.size() != old_indices.size()) return false;
 
-	vertices = geom->vertices;
-	normals = geom->normals;
+	// only the moved vertices are stored, no copy of the whole geometry
+	indices.reserve(old_indices.size());
+	delta_vertices.reserve(old_indices.size());
+	if (!old_normals.empty()) delta_normals.reserve(old_indices.size());
 
-	Vec3* vr = &allocator.vec3_tmp[0];
-	Vec3* nr = &allocator.vec3_tmp2[0];
-	int* ir = &allocator.int_tmp[0];
-	for (int i = 0, c = (int)allocator.int_tmp.size(); i < c; ++i)
+	for (int i = 0, c = (int)old_indices.size(); i < c; ++i)
 	{
-		int old_idx = ir[i];
+		int old_idx = old_indices[i];
+		if (old_idx < 0 || old_idx >= (int)geom->to_new_vertices.size()) return false;
 		GeometryImpl::NewVertex* n = &geom->to_new_vertices[old_idx];
 		if (n->index == -1) continue; // skip vertices which aren't indexed.
 		while (n)
 		{
-			vertices[n->index] = vertices[n->index] + vr[i];
-			normals[n->index] = vertices[n->index] + nr[i];
+			indices.push_back(n->index);
+			delta_vertices.push_back(old_vertices[i]);
+			if (!old_normals.empty()) delta_normals.push_back(old_normals[i]);
 			n = n->next;
 		}
 	}
@@ -3012,7 +3521,9 @@ struct ParseGeometryJob {
 	bool triangulate;
 	GeometryImpl* geom;
 	u64 id;
+	const CancelCheck* cancel;
 	bool is_error;
+	const char* error;
 };
 
 void sync_job_processor(JobFunction fn, void*, void* data, u32 size, u32 count) {
@@ -3023,7 +3534,15 @@ void sync_job_processor(JobFunction fn, void*, void* data, u32 size, u32 count)
 	}
 }
 
-static bool parseObjects(const Element& root, Scene* scene, u64 flags, Allocator& allocator, JobProcessor job_processor, void* job_user_ptr)
+static bool parseObjects(const Element& root,
+	Scene* scene,
+	u64 flags,
+	Allocator& allocator,
+	JobProcessor job_processor,
+	void* job_user_ptr,
+	const CancelCheck& cancel,
+	StageCallback stage_callback,
+	void* stage_user_ptr)
 {
 	if (!job_processor) job_processor = &sync_job_processor;
 	const bool triangulate = (flags & (u64)LoadFlags::TRIANGULATE) != 0;
@@ -3039,6 +3558,8 @@ static bool parseObjects(const Element& root, Scene* scene, u64 flags, Allocator
 	const Element* object = objs->child;
 	while (object)
 	{
+		if (cancel.isCancelled()) return false;
+
 		if (!isLong(object->first_property))
 		{
 			Error::s_message = "Invalid";
@@ -3056,6 +3577,7 @@ static bool parseObjects(const Element& root, Scene* scene, u64 flags, Allocator
 		OptionalError<Object*> obj = nullptr;
 
 		if (iter.second.object == scene->m_root) continue;
+		if (cancel.isCancelled()) return false;
 
 		if (iter.second.element->id == "Geometry")
 		{
@@ -3065,7 +3587,7 @@ static bool parseObjects(const Element& root, Scene* scene, u64 flags, Allocator
 			{
 				GeometryImpl* geom = allocator.allocate<GeometryImpl>(*scene, *iter.second.element);
 				scene->m_geometries.push_back(geom);
-				ParseGeometryJob job {iter.second.element, triangulate, geom, iter.first, false};
+				ParseGeometryJob job {iter.second.element, triangulate, geom, iter.first, &cancel, false, ""};
 				parse_geom_jobs.push_back(job);
 				continue;
 			}
@@ -3165,14 +3687,20 @@ static bool parseObjects(const Element& root, Scene* scene, u64 flags, Allocator
 	}
 
 	if (!parse_geom_jobs.empty()) {
+		StageScope stage(stage_callback, stage_user_ptr, LoadStage::PARSE_GEOMETRY);
 		(*job_processor)([](void* ptr){
 			ParseGeometryJob* job = (ParseGeometryJob*)ptr;
-			job->is_error = parseGeometry(*job->element, job->triangulate, job->geom).isError();
+			Error::s_message = "";
+			job->is_error = parseGeometry(*job->element, job->triangulate, job->geom, *job->cancel).isError();
+			if (job->is_error) job->error = Error::s_message;
 		}, job_user_ptr, &parse_geom_jobs[0], (u32)sizeof(parse_geom_jobs[0]), (u32)parse_geom_jobs.size());
 	}
 
 	for (const ParseGeometryJob& job : parse_geom_jobs) {
-		if (job.is_error) return false;
+		if (job.is_error) {
+			Error::s_message = job.error;
+			return false;
+		}
 		scene->m_object_map[job.id].object = job.geom;
 		if (job.geom) {
 			scene->m_all_objects.push_back(job.geom);
@@ -3182,6 +3710,8 @@ static bool parseObjects(const Element& root, Scene* scene, u64 flags, Allocator
 
 	for (const Scene::Connection& con : scene->m_connections)
 	{
+		if (cancel.isCancelled()) return false;
+
 		Object* parent = scene->m_object_map[con.to].object;
 		Object* child = scene->m_object_map[con.from].object;
 		if (!child) continue;
@@ -3359,11 +3889,18 @@ static bool parseObjects(const Element& root, Scene* scene, u64 flags, Allocator
 		}
 	}
 
+	for (Object* obj : scene->m_all_objects)
+	{
+		if (obj->getType() == Object::Type::ANIMATION_LAYER) ((AnimationLayerImpl*)obj)->buildCurveNodeIndex();
+	}
+
 	if (!ignore_geometry) {
+		std::vector<PostprocessShapeJob> shape_jobs;
 		for (auto iter : scene->m_object_map)
 		{
 			Object* obj = iter.second.object;
 			if (!obj) continue;
+			if (cancel.isCancelled()) return false;
 			switch (obj->getType()) {
 				case Object::Type::CLUSTER:
 					if (!((ClusterImpl*)iter.second.object)->postprocess(scene->m_allocator)) {
@@ -3372,7 +3909,7 @@ static bool parseObjects(const Element& root, Scene* scene, u64 flags, Allocator
 					}
 					break;
 				case Object::Type::BLEND_SHAPE_CHANNEL:
-					if (!((BlendShapeChannelImpl*)iter.second.object)->postprocess(scene->m_allocator)) {
+					if (!((BlendShapeChannelImpl*)iter.second.object)->postprocess(scene->m_allocator, &shape_jobs)) {
 						Error::s_message = "Failed to postprocess blend shape channel";
 						return false;
 					}
@@ -3385,6 +3922,20 @@ static bool parseObjects(const Element& root, Scene* scene, u64 flags, Allocator
 					break;
 			}
 		}
+
+		if (!shape_jobs.empty()) {
+			(*job_processor)([](void* ptr){
+				PostprocessShapeJob* job = (PostprocessShapeJob*)ptr;
+				job->is_error = !job->shape->postprocess(job->geom);
+			}, job_user_ptr, &shape_jobs[0], (u32)sizeof(shape_jobs[0]), (u32)shape_jobs.size());
+		}
+
+		for (const PostprocessShapeJob& job : shape_jobs) {
+			if (job.is_error) {
+				Error::s_message = "Failed to postprocess blend shape";
+				return false;
+			}
+		}
 	}
 
 	return true;
@@ -3596,8 +4147,20 @@ Object* Object::getParent() const
 }
 
 
-IScene* load(const u8* data, int size, u64 flags, JobProcessor job_processor, void* job_user_ptr)
+IScene* load(const u8* data,
+	int size,
+	u64 flags,
+	JobProcessor job_processor,
+	void* job_user_ptr,
+	CancelCallback cancel_callback,
+	void* cancel_user_ptr,
+	StageCallback stage_callback,
+	void* stage_user_ptr)
 {
+	CancelCheck cancel;
+	cancel.callback = cancel_callback;
+	cancel.user_ptr = cancel_user_ptr;
+
 	std::unique_ptr<Scene> scene(new Scene());
 	scene->m_data.resize(size);
 	memcpy(&scene->m_data[0], data, size);
@@ -3605,31 +4168,36 @@ IScene* load(const u8* data, int size, u64 flags, JobProcessor job_processor, vo
 
 	const bool is_binary = size >= 18 && strncmp((const char*)data, "Kaydara FBX Binary", 18) == 0;
 	OptionalError<Element*> root(nullptr);
-	if (is_binary) {
-		root = tokenize(&scene->m_data[0], size, version, scene->m_allocator);
-		if (version < 6200)
-		{
-			Error::s_message = "Unsupported FBX file format version. Minimum supported version is 6.2";
-			return nullptr;
+	{
+		StageScope stage(stage_callback, stage_user_ptr, LoadStage::TOKENIZE);
+		if (is_binary) {
+			root = tokenize(&scene->m_data[0], size, version, scene->m_allocator, &scene->m_tokenizer_allocators, job_processor, job_user_ptr, cancel);
+			if (version < 6200)
+			{
+				Error::s_message = "Unsupported FBX file format version. Minimum supported version is 6.2";
+				return nullptr;
+			}
+			if (root.isError())
+			{
+				Error::s_message = "";
+				if (root.isError()) return nullptr;
+			}
 		}
-		if (root.isError())
-		{
-			Error::s_message = "";
+		else {
+			root = tokenizeText(&scene->m_data[0], size, scene->m_allocator, cancel);
 			if (root.isError()) return nullptr;
 		}
 	}
-	else {
-		root = tokenizeText(&scene->m_data[0], size, scene->m_allocator);
-		if (root.isError()) return nullptr;
-	}
 
 	scene->m_root_element = root.getValue();
 	assert(scene->m_root_element);
 
+	StageScope parse_stage(stage_callback, stage_user_ptr, LoadStage::PARSE_OBJECTS);
+
 	// if (parseTemplates(*root.getValue()).isError()) return nullptr;
 	if (!parseConnections(*root.getValue(), scene.get())) return nullptr;
 	if (!parseTakes(scene.get())) return nullptr;
-	if (!parseObjects(*root.getValue(), scene.get(), flags, scene->m_allocator, job_processor, job_user_ptr)) return nullptr;
+	if (!parseObjects(*root.getValue(), scene.get(), flags, scene->m_allocator, job_processor, job_user_ptr, cancel, stage_callback, stage_user_ptr)) return nullptr;
 	parseGlobalSettings(*root.getValue(), scene.get());
 
 	return scene.release();
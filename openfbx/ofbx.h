@@ -39,6 +39,18 @@ static_assert(sizeof(i64) == 8, "i64 is not 8 bytes");
 
 using JobFunction = void (*)(void*);
 using JobProcessor = void (*)(JobFunction, void*, void*, u32, u32);
+// Polled by load() in its long running loops, possibly from the job processor's threads.
+// Once it returns true load() stops and fails with the error "Cancelled".
+using CancelCallback = bool (*)(void* user_ptr);
+
+enum class LoadStage {
+	TOKENIZE,
+	PARSE_OBJECTS,
+	PARSE_GEOMETRY, // triangulation and vertex attributes, nested in PARSE_OBJECTS
+};
+
+// Called by load() on the calling thread when a stage begins (begin = true) and when it ends
+using StageCallback = void (*)(void* user_ptr, LoadStage stage, bool begin);
 
 enum class LoadFlags : u64 {
 	TRIANGULATE = 1 << 0,
@@ -385,10 +397,13 @@ struct Shape : Object
 
 	Shape(const Scene& _scene, const IElement& _element);
 
-	virtual const Vec3* getVertices() const = 0;
-	virtual int getVertexCount() const = 0;
-
-	virtual const Vec3* getNormals() const = 0;
+	// Shapes are sparse, they only store the geometry vertices they move.
+	// Indices refer to the geometry's vertex array, the deltas are offsets
+	// relative to the geometry's vertices and normals.
+	virtual int getIndexCount() const = 0;
+	virtual const int* getIndices() const = 0;
+	virtual const Vec3* getDeltaVertices() const = 0;
+	virtual const Vec3* getDeltaNormals() const = 0;
 };
 
 
@@ -446,6 +461,8 @@ struct AnimationCurveNode : Object
 
 	virtual const AnimationCurve* getCurve(int idx) const = 0; 
 	virtual Vec3 getNodeLocalTransform(double time) const = 0;
+	// Samples the node at all the given times. Ascending times are sampled in a single pass over the keys.
+	virtual void getNodeLocalTransforms(const double* times, int count, Vec3* transforms) const = 0;
 	virtual const Object* getBone() const = 0;
 };
 
@@ -551,7 +568,15 @@ protected:
 };
 
 
-IScene* load(const u8* data, int size, u64 flags, JobProcessor job_processor = nullptr, void* job_user_ptr = nullptr);
+IScene* load(const u8* data,
+	int size,
+	u64 flags,
+	JobProcessor job_processor = nullptr,
+	void* job_user_ptr = nullptr,
+	CancelCallback cancel = nullptr,
+	void* cancel_user_ptr = nullptr,
+	StageCallback stage_callback = nullptr,
+	void* stage_user_ptr = nullptr);
 const char* getError();
 double fbxTimeToSeconds(i64 value);
 i64 secondsToFbxTime(double value);
@@ -0,0 +1,369 @@
+#include "ofbx_stream.h"
+#include "miniz.h"
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#ifdef _WIN32
+	#include <io.h>
+#else
+	#include <unistd.h>
+#endif
+
+
+namespace ofbx
+{
+
+
+static thread_local const char* s_stream_error = "";
+
+
+const char* getStreamError()
+{
+	return s_stream_error;
+}
+
+
+static bool streamError(const char* message)
+{
+	s_stream_error = message;
+	return false;
+}
+
+
+u64 FileDescriptorSource::read(void* buffer, u64 size)
+{
+	for (;;)
+	{
+#ifdef _WIN32
+		int result = ::_read(fd, buffer, size > 0x40000000 ? 0x40000000 : (unsigned int)size);
+#else
+		auto result = ::read(fd, buffer, (size_t)size);
+#endif
+		if (result >= 0) return (u64)result;
+		if (errno != EINTR) return 0;
+	}
+}
+
+
+// Window into the source, refilled on demand. Keeps track of the absolute position
+// in the file, since the records store their end as absolute offsets.
+struct StreamBuffer
+{
+	static const u32 CAPACITY = 256 * 1024;
+
+	explicit StreamBuffer(StreamSource& source)
+		: source(source)
+		, data(CAPACITY)
+	{
+	}
+
+	u64 available() const { return end - begin; }
+	const u8* current() const { return &data[begin]; }
+
+	void consume(u64 size)
+	{
+		begin += size;
+		position += size;
+	}
+
+	// makes sure at least size bytes (<= CAPACITY) are available, returns false if the source ends before
+	bool require(u64 size)
+	{
+		if (available() >= size) return true;
+
+		memmove(&data[0], &data[begin], end - begin);
+		end -= begin;
+		begin = 0;
+
+		while (end < size)
+		{
+			u64 read = source.read(&data[end], CAPACITY - end);
+			if (read == 0) return false;
+			end += read;
+		}
+		return true;
+	}
+
+	bool skip(u64 size)
+	{
+		while (size > 0)
+		{
+			if (available() == 0 && !require(1)) return false;
+			u64 step = available() < size ? available() : size;
+			consume(step);
+			size -= step;
+		}
+		return true;
+	}
+
+	template <typename T> bool read(T* value)
+	{
+		if (!require(sizeof(T))) return false;
+		memcpy(value, current(), sizeof(T));
+		consume(sizeof(T));
+		return true;
+	}
+
+	StreamSource& source;
+	std::vector<u8> data;
+	u64 begin = 0;
+	u64 end = 0;
+	u64 position = 0;
+};
+
+
+struct StreamReader
+{
+	StreamReader(StreamSource& source, StreamVisitor& visitor)
+		: buffer(source)
+		, visitor(visitor)
+	{
+	}
+
+	bool readOffset(u64* value)
+	{
+		if (version >= 7500) return buffer.read(value);
+
+		u32 tmp;
+		if (!buffer.read(&tmp)) return false;
+		*value = tmp;
+		return true;
+	}
+
+	// passes size bytes from the buffer to the visitor, in chunks of whole elements
+	bool streamRaw(u64 size, u32 element_size)
+	{
+		while (size > 0)
+		{
+			if (!buffer.require(element_size)) return streamError("Reading past the end");
+			u64 chunk = buffer.available() < size ? buffer.available() : size;
+			chunk -= chunk % element_size;
+			visitor.arrayData(buffer.current(), u32(chunk / element_size));
+			buffer.consume(chunk);
+			size -= chunk;
+		}
+		return true;
+	}
+
+	// releases the inflate state on every way out, including exceptions thrown by the visitor
+	struct InflateStream
+	{
+		~InflateStream() { mz_inflateEnd(&stream); }
+
+		mz_stream stream = {};
+	};
+
+	// inflates compressed_size bytes from the buffer, the inflated data is passed to the visitor in chunks
+	bool streamCompressed(u64 compressed_size, u64 inflated_size, u32 element_size)
+	{
+		InflateStream inflate_stream;
+		mz_stream& stream = inflate_stream.stream;
+		if (mz_inflateInit(&stream) != MZ_OK) return streamError("Failed to initialize inflate");
+
+		// a multiple of every element size, so full output chunks always contain whole elements
+		inflated.resize(StreamBuffer::CAPACITY);
+		u64 total = 0;
+		u64 pending = 0;
+		bool done = false;
+		while (!done)
+		{
+			if (compressed_size > 0 && !buffer.require(1)) return streamError("Reading past the end");
+
+			u64 input = buffer.available() < compressed_size ? buffer.available() : compressed_size;
+			stream.next_in = buffer.current();
+			stream.avail_in = (unsigned int)input;
+			stream.next_out = &inflated[pending];
+			stream.avail_out = (unsigned int)(inflated.size() - pending);
+
+			int status = mz_inflate(&stream, MZ_NO_FLUSH);
+			u64 consumed = input - stream.avail_in;
+			buffer.consume(consumed);
+			compressed_size -= consumed;
+
+			if (status == MZ_STREAM_END)
+			{
+				done = true;
+			}
+			else if (status != MZ_OK && !(status == MZ_BUF_ERROR && compressed_size > 0))
+			{
+				return streamError("Failed to inflate array");
+			}
+
+			u64 produced = inflated.size() - stream.avail_out;
+			if (stream.avail_out == 0 || done)
+			{
+				u64 whole = produced - produced % element_size;
+				if (whole > 0) visitor.arrayData(&inflated[0], u32(whole / element_size));
+				total += whole;
+				pending = produced - whole;
+				memmove(&inflated[0], &inflated[whole], pending);
+			}
+			else
+			{
+				pending = produced;
+			}
+		}
+		if (total != inflated_size || pending != 0) return streamError("Invalid array size");
+
+		// whatever follows the deflate stream within the property is ignored
+		if (!buffer.skip(compressed_size)) return streamError("Reading past the end");
+		return true;
+	}
+
+	bool readProperty()
+	{
+		u8 type;
+		if (!buffer.read(&type)) return streamError("Reading past the end");
+
+		u32 scalar_size = 0;
+		switch (type)
+		{
+			case 'Y': scalar_size = 2; break;
+			case 'C': scalar_size = 1; break;
+			case 'I': scalar_size = 4; break;
+			case 'F': scalar_size = 4; break;
+			case 'D': scalar_size = 8; break;
+			case 'L': scalar_size = 8; break;
+			case 'S':
+			case 'R':
+			{
+				u32 length;
+				if (!buffer.read(&length)) return streamError("Reading past the end");
+				if (!visitor.beginArray((char)type, length, 1))
+				{
+					return buffer.skip(length) || streamError("Reading past the end");
+				}
+				if (!streamRaw(length, 1)) return false;
+				visitor.endArray();
+				return true;
+			}
+			case 'b':
+			case 'i':
+			case 'l':
+			case 'f':
+			case 'd':
+			{
+				u32 count, encoding, compressed_size;
+				if (!buffer.read(&count) || !buffer.read(&encoding) || !buffer.read(&compressed_size))
+				{
+					return streamError("Reading past the end");
+				}
+
+				u32 element_size = type == 'b' ? 1 : (type == 'i' || type == 'f' ? 4 : 8);
+				if (!visitor.beginArray((char)type, count, element_size))
+				{
+					return buffer.skip(compressed_size) || streamError("Reading past the end");
+				}
+
+				if (encoding == 0)
+				{
+					if (compressed_size != (u64)count * element_size) return streamError("Invalid array size");
+					if (!streamRaw(compressed_size, element_size)) return false;
+				}
+				else if (encoding == 1)
+				{
+					if (!streamCompressed(compressed_size, (u64)count * element_size, element_size)) return false;
+				}
+				else
+				{
+					return streamError("Unknown array encoding");
+				}
+				visitor.endArray();
+				return true;
+			}
+			default: return streamError("Unknown property type");
+		}
+
+		if (!buffer.require(scalar_size)) return streamError("Reading past the end");
+		visitor.property((char)type, buffer.current());
+		buffer.consume(scalar_size);
+		return true;
+	}
+
+	// reads a record, sets is_null if it's the null record terminating a list of records
+	bool readRecord(int depth, bool* is_null)
+	{
+		u64 end_offset, property_count, property_length;
+		u8 id_length;
+		if (!readOffset(&end_offset)) return streamError("Reading past the end");
+		if (end_offset == 0)
+		{
+			*is_null = true;
+			return true;
+		}
+		*is_null = false;
+
+		if (!readOffset(&property_count) || !readOffset(&property_length) || !buffer.read(&id_length))
+		{
+			return streamError("Reading past the end");
+		}
+		if (end_offset <= buffer.position) return streamError("Invalid record end offset");
+
+		char id[256];
+		if (!buffer.require(id_length)) return streamError("Reading past the end");
+		memcpy(id, buffer.current(), id_length);
+		buffer.consume(id_length);
+
+		if (!visitor.beginRecord(id, id_length, depth))
+		{
+			return buffer.skip(end_offset - buffer.position) || streamError("Reading past the end");
+		}
+
+		for (u64 i = 0; i < property_count; ++i)
+		{
+			if (!readProperty()) return false;
+		}
+
+		if (buffer.position < end_offset)
+		{
+			const u64 sentinel_length = version >= 7500 ? 25 : 13;
+			while (buffer.position + sentinel_length < end_offset)
+			{
+				bool child_is_null;
+				if (!readRecord(depth + 1, &child_is_null)) return false;
+				if (child_is_null) break;
+			}
+			if (end_offset < buffer.position) return streamError("Invalid record end offset");
+			if (!buffer.skip(end_offset - buffer.position)) return streamError("Reading past the end");
+		}
+
+		visitor.endRecord(depth);
+		return true;
+	}
+
+	bool read()
+	{
+		const char MAGIC[] = "Kaydara FBX Binary  ";
+		if (!buffer.require(27) || memcmp(buffer.current(), MAGIC, sizeof(MAGIC) - 1) != 0)
+		{
+			return streamError("Not a binary FBX file");
+		}
+		buffer.consume(23);
+		if (!buffer.read(&version)) return streamError("Reading past the end");
+		visitor.header(version);
+
+		for (;;)
+		{
+			if (!buffer.require(version >= 7500 ? 8 : 4)) return true; // no null record at the end, accept that
+			bool is_null;
+			if (!readRecord(0, &is_null)) return false;
+			if (is_null) return true;
+		}
+	}
+
+	StreamBuffer buffer;
+	StreamVisitor& visitor;
+	std::vector<u8> inflated;
+	u32 version = 0;
+};
+
+
+bool readStream(StreamSource& source, StreamVisitor& visitor)
+{
+	s_stream_error = "";
+	StreamReader reader(source, visitor);
+	return reader.read();
+}
+
+
+} // namespace ofbx
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "ofbx.h"
+
+
+namespace ofbx
+{
+
+
+// Provides the bytes of a binary FBX to the stream reader, in order
+struct StreamSource
+{
+	virtual ~StreamSource() {}
+
+	// Reads up to size bytes into buffer, returns the number of bytes read, 0 at the end of the stream
+	virtual u64 read(void* buffer, u64 size) = 0;
+};
+
+
+// Reads from a file descriptor, works with pipes since the stream reader never seeks
+struct FileDescriptorSource : StreamSource
+{
+	explicit FileDescriptorSource(int fd) : fd(fd) {}
+
+	u64 read(void* buffer, u64 size) override;
+
+	int fd;
+};
+
+
+// Receives the events of readStream. Records start with beginRecord, followed by the
+// events of their properties and child records, and end with endRecord.
+//
+// Scalar properties (types Y, C, I, F, D, L) are passed to property() as raw little-endian
+// values. Array properties (types b, i, l, f, d) as well as strings (S) and raw data (R)
+// arrive in chunks: beginArray, any number of arrayData calls, endArray. Compressed arrays
+// are inflated on the fly. Chunks always contain whole elements and are only valid during
+// the call, so a consumer can process arrays of any size with bounded memory. Exceptions
+// thrown by the visitor are passed through readStream.
+struct StreamVisitor
+{
+	virtual ~StreamVisitor() {}
+
+	// Called once before the first record with the version of the file
+	virtual void header(u32 /*version*/) {}
+
+	// Return false to skip the record, including its properties and children; endRecord is not called then
+	virtual bool beginRecord(const char* /*id*/, int /*id_length*/, int /*depth*/) { return true; }
+	virtual void endRecord(int /*depth*/) {}
+
+	virtual void property(char /*type*/, const u8* /*value*/) {}
+
+	// count is the number of elements, element_size is 1 for strings and raw data.
+	// Return false to skip the array without decoding it, arrayData and endArray are not called then.
+	virtual bool beginArray(char /*type*/, u32 /*count*/, u32 /*element_size*/) { return true; }
+	virtual void arrayData(const u8* /*data*/, u32 /*count*/) {}
+	virtual void endArray() {}
+};
+
+
+// Reads the binary FBX provided by the source and reports its contents to the visitor. Only a
+// fixed-size buffer is held in memory. Returns false on errors, see getStreamError() for details.
+// Text FBX files are not supported.
+bool readStream(StreamSource& source, StreamVisitor& visitor);
+
+// The error message of the last failed readStream call on this thread
+const char* getStreamError();
+
+
+} // namespace ofbx